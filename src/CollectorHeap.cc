@@ -0,0 +1,179 @@
+#include "CollectorHeap.hh"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace collector_heap {
+
+namespace {
+
+// a is ranked before b: larger first measure (smaller key on ties,
+// so that the result doesn't depend on the traversal order)
+inline bool better(const std::vector<int> &key_a, const Value &a, const std::vector<int> &key_b, const Value &b)
+{
+    if (a.first != b.first) {
+        return a.first > b.first;
+    }
+    return key_a < key_b;
+}
+
+inline bool better(const Cell &a, const Cell &b)
+{
+    return better(a.key, a.value, b.key, b.value);
+}
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+// Cell Impl.
+//-----------------------------------------------------------------------------
+
+Cell::Cell(const std::vector<int> &key, const Value &value):
+    key(key),
+    value(value)
+{}
+
+std::vector<Label> Cell::path() const
+{
+    std::vector<Label> result;
+    std::size_t i = 0;
+    while (i < key.size()) {
+        std::size_t n = (std::size_t) key[i++];
+        result.push_back(Label(key.begin() + i, key.begin() + i + n));
+        i += n;
+    }
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+// Collector Impl.
+//-----------------------------------------------------------------------------
+
+std::size_t Collector::KeyHash::operator()(const std::vector<int> &key) const
+{
+    std::size_t hash_value = 0;
+    for (auto v: key) {
+        std::size_t vv = (std::size_t) v;
+        hash_value ^= vv + 0x9e3779b9 + (hash_value << 6) + (hash_value >> 2);
+    }
+    return hash_value;
+}
+
+Collector::Collector(Mode mode, int k, bool stream_cells):
+    mode(mode),
+    k(k),
+    stream_cells(stream_cells)
+{}
+
+void Collector::push(const Label &label)
+{
+    key_sizes.push_back((int) key.size());
+    key.push_back((int) label.size());
+    key.insert(key.end(), label.begin(), label.end());
+}
+
+void Collector::pop()
+{
+    key.resize(key_sizes.back());
+    key_sizes.pop_back();
+    if (stream_cells && key_sizes.empty()) {
+        drain();
+    }
+}
+
+void Collector::store(const Value &value, ::tree_store::StoreOp op, ::tree_store::StoreMode store_mode)
+{
+    auto it = cells.find(key);
+    if (it == cells.end()) {
+        cells.emplace(key, evalOp(Value(::nanocube::SimpleConfig::default_value), value, op, store_mode));
+    }
+    else {
+        it->second = evalOp(it->second, value, op, store_mode);
+    }
+}
+
+Collector Collector::part() const
+{
+    return Collector(mode, k, false);
+}
+
+void Collector::merge(const Collector &other)
+{
+    if (other.stream_cells) {
+        throw std::runtime_error("Collector: merge of a streaming collector");
+    }
+    for (auto &it: other.cells) {
+        auto cell = cells.find(it.first);
+        if (cell == cells.end()) {
+            cells.emplace(it.first, evalOp(Value(::nanocube::SimpleConfig::default_value), it.second, ::tree_store::ADD, ::tree_store::NORMAL));
+        }
+        else {
+            cell->second = evalOp(cell->second, it.second, ::tree_store::ADD, ::tree_store::NORMAL);
+        }
+    }
+}
+
+void Collector::offer(const std::vector<int> &key, const Value &value)
+{
+    if (k <= 0) {
+        return;
+    }
+    else if (heap.size() < (std::size_t) k) {
+        heap.push_back(Cell(key, value));
+        std::push_heap(heap.begin(), heap.end(), [](const Cell &a, const Cell &b) { return better(a, b); });
+    }
+    else if (better(key, value, heap.front().key, heap.front().value)) {
+        std::pop_heap(heap.begin(), heap.end(), [](const Cell &a, const Cell &b) { return better(a, b); });
+        heap.back().key   = key;
+        heap.back().value = value;
+        std::push_heap(heap.begin(), heap.end(), [](const Cell &a, const Cell &b) { return better(a, b); });
+    }
+}
+
+void Collector::drain()
+{
+    if (mode == TOPK) {
+        for (auto &it: cells) {
+            offer(it.first, it.second);
+        }
+    }
+    else {
+        unique_count += cells.size();
+    }
+    cells.clear();
+}
+
+std::vector<Cell> Collector::topK()
+{
+    drain();
+    std::vector<Cell> result(heap);
+    std::sort(result.begin(), result.end(), [](const Cell &a, const Cell &b) { return better(a, b); });
+    return result;
+}
+
+uint64_t Collector::uniqueCount()
+{
+    drain();
+    return unique_count;
+}
+
+bool Collector::streamsCells(const ::query::QueryDescription &query_description)
+{
+    for (std::size_t i=0;i<query_description.targets.size();++i) {
+        auto target = query_description.targets[i];
+        if (query_description.anchors[i]) {
+            // a sequence may list the same address twice
+            return target->type != ::query::Target::SEQUENCE;
+        }
+        else if (target->type == ::query::Target::ROOT) {
+            continue;
+        }
+        else if (target->type == ::query::Target::FIND_AND_DIVE && target->asFindAndDiveTarget()->offset == 0) {
+            continue;
+        }
+        return false;
+    }
+    return true; // no anchors: a single cell
+}
+
+} // collector_heap namespace
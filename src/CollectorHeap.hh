@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "Query.hh"
+#include "tree_store_nanocube.hh"
+
+//
+// Query results that are reduced while the cube is traversed instead
+// of being built as a whole TreeValue: the k anchored cells with the
+// largest value (topk) or the number of anchored cells (unique).
+//
+// A Collector has the same push/pop/store interface as a
+// ::query::result::Result, so it can be passed to NanoCube::query.
+// Values of a cell are summed on a hash map keyed by its path. When
+// every label of the outermost anchored dimension is visited only once
+// (see streamsCells), a cell is complete as soon as that label is
+// popped: the map is then drained into a bounded min-heap (or just
+// counted) on every such pop and only holds the cells under one label.
+//
+
+namespace collector_heap {
+
+enum Mode { NO_COLLECTOR, TOPK, UNIQUE_COUNT };
+
+using Label = ::nanocube::DimAddress;
+using Value = ::nanocube::Measures;
+
+//-----------------------------------------------------------------------------
+// Cell
+//-----------------------------------------------------------------------------
+
+struct Cell {
+    Cell() = default;
+    Cell(const std::vector<int> &key, const Value &value);
+
+    std::vector<Label> path() const;
+
+    std::vector<int> key; // size of every label followed by its items
+    Value            value;
+};
+
+//-----------------------------------------------------------------------------
+// Collector
+//-----------------------------------------------------------------------------
+
+struct Collector {
+public:
+
+    Collector(Mode mode, int k, bool stream_cells);
+
+    // same interface as ::query::result::Result
+    void push(const Label &label);
+    void pop();
+    void store(const Value &value, ::tree_store::StoreOp op=::tree_store::SET, ::tree_store::StoreMode store_mode=::tree_store::NORMAL);
+
+    // empty collector of the same kind, for a part of the query
+    // evaluated on another thread; parts don't stream cells, since
+    // another part may visit them too
+    Collector part() const;
+
+    // adds up the cells of a part into this collector
+    void merge(const Collector &other);
+
+    // cells with the largest first measure (largest first)
+    std::vector<Cell> topK();
+
+    uint64_t uniqueCount();
+
+    // true if the cells under a label of the first anchored dimension
+    // are complete once it is popped (i.e. no dimension before it
+    // visits more than one node and its own labels don't repeat)
+    static bool streamsCells(const ::query::QueryDescription &query_description);
+
+private:
+
+    void drain();
+
+    void offer(const std::vector<int> &key, const Value &value);
+
+private:
+
+    struct KeyHash {
+        std::size_t operator()(const std::vector<int> &key) const;
+    };
+
+    Mode                  mode;
+    int                   k;
+    bool                  stream_cells;
+
+    std::vector<int>      key;          // path of the current cell
+    std::vector<int>      key_sizes;    // key size before every push
+
+    std::unordered_map<std::vector<int>, Value, KeyHash> cells;
+
+    std::vector<Cell>     heap;         // worst of the best k on front
+    uint64_t              unique_count { 0 };
+};
+
+} // collector_heap namespace
@@ -0,0 +1,228 @@
+#include "ColumnarResult.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace columnar_result {
+
+namespace {
+
+enum Encoding { FRAME_OF_REFERENCE = 0, DELTA = 1 };
+
+using Label = ::nanocube::DimAddress;
+
+int numColumns(LayerKind kind)
+{
+    switch (kind) {
+    case QUADTREE: return 3;
+    case CATEGORY: return 2;
+    case TIME_BIN: return 1;
+    case IMAGE:    return 2;
+    }
+    return 0;
+}
+
+// key columns of a label appended to row
+void split(LayerKind kind, const Label &label, std::vector<int64_t> &row)
+{
+    switch (kind) {
+    case QUADTREE: {
+        int64_t x = 0, y = 0;
+        for (auto d: label) {
+            x = (x << 1) | (d & 1);
+            y = (y << 1) | ((d >> 1) & 1);
+        }
+        row.push_back((int64_t) label.size());
+        row.push_back(x);
+        row.push_back(y);
+        break;
+    }
+    case CATEGORY:
+        if (label.size() > 1)
+            throw std::runtime_error("bin2: categorical label with more than one item");
+        row.push_back((int64_t) label.size());
+        row.push_back(label.size() ? label[0] : 0);
+        break;
+    case TIME_BIN:
+        row.push_back(label.at(0));
+        break;
+    case IMAGE:
+        row.push_back(label.at(0));
+        row.push_back(label.at(1));
+        break;
+    }
+}
+
+template <typename T>
+void append(std::string &out, T value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void pad(std::string &out)
+{
+    out.append((8 - out.size() % 8) % 8, '\0');
+}
+
+int bitWidth(uint64_t v)
+{
+    int bits = 0;
+    while (v) {
+        ++bits;
+        v >>= 1;
+    }
+    return bits;
+}
+
+inline uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+// column header, then the n offsets from base packed with the given
+// bit width on little-endian 64-bit words
+void writeColumn(std::string &out, Encoding encoding, uint64_t base, const std::vector<uint64_t> &offsets, int bits)
+{
+    std::vector<uint64_t> words(((std::size_t) bits * offsets.size() + 63) / 64, 0);
+    std::size_t position = 0;
+    for (std::size_t i=0;bits>0 && i<offsets.size();++i) {
+        std::size_t w = position / 64;
+        int         b = (int) (position % 64);
+        words[w] |= offsets[i] << b;
+        if (b + bits > 64)
+            words[w + 1] |= offsets[i] >> (64 - b);
+        position += (std::size_t) bits;
+    }
+    append<uint8_t>(out, (uint8_t) encoding);
+    append<uint8_t>(out, (uint8_t) bits);
+    append<uint16_t>(out, 0);
+    append<uint32_t>(out, (uint32_t) (words.size() * sizeof(uint64_t)));
+    append<uint64_t>(out, base);
+    if (words.size())
+        out.append(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(uint64_t));
+}
+
+void encodeColumn(std::string &out, const std::vector<int64_t> &column)
+{
+    std::size_t n = column.size();
+
+    // frame of reference: column[i] = base + offset[i]
+    int64_t min_value = n ? *std::min_element(column.begin(), column.end()) : 0;
+    int64_t max_value = n ? *std::max_element(column.begin(), column.end()) : 0;
+    int for_bits = bitWidth((uint64_t) max_value - (uint64_t) min_value);
+
+    // delta: column[i] = column[i-1] + unzigzag(base + offset[i])
+    std::vector<uint64_t> deltas(n);
+    int64_t previous = 0;
+    for (std::size_t i=0;i<n;++i) {
+        deltas[i] = zigzag(column[i] - previous);
+        previous  = column[i];
+    }
+    uint64_t min_delta = n ? *std::min_element(deltas.begin(), deltas.end()) : 0;
+    uint64_t max_delta = n ? *std::max_element(deltas.begin(), deltas.end()) : 0;
+    int delta_bits = bitWidth(max_delta - min_delta);
+
+    if (delta_bits < for_bits) {
+        for (auto &d: deltas)
+            d -= min_delta;
+        writeColumn(out, DELTA, min_delta, deltas, delta_bits);
+    }
+    else {
+        for (std::size_t i=0;i<n;++i)
+            deltas[i] = (uint64_t) column[i] - (uint64_t) min_value;
+        writeColumn(out, FRAME_OF_REFERENCE, (uint64_t) min_value, deltas, for_bits);
+    }
+}
+
+} // anonymous namespace
+
+Encoder::Encoder(const std::vector<LayerKind> &kinds, const std::vector<std::string> &level_names):
+    kinds(kinds),
+    level_names(level_names)
+{
+    if (kinds.size() != level_names.size())
+        throw std::runtime_error("bin2: one layer kind per level is needed");
+    for (auto kind: kinds)
+        num_columns += (std::size_t) numColumns(kind);
+}
+
+void Encoder::push(const Label &label)
+{
+    if (sizes.size() >= kinds.size())
+        throw std::runtime_error("bin2: result is deeper than its layers");
+    sizes.push_back(path.size());
+    split(kinds[sizes.size() - 1], label, path);
+}
+
+void Encoder::store(const ::nanocube::Measures &value)
+{
+    keys.insert(keys.end(), path.begin(), path.end());
+    values.push_back(value);
+    num_measures = std::max(num_measures, value.size());
+}
+
+void Encoder::pop()
+{
+    path.resize(sizes.back());
+    sizes.pop_back();
+}
+
+std::string Encoder::finish()
+{
+    const std::size_t n = values.size();
+    const std::size_t c = num_columns;
+
+    std::vector<uint32_t> order(n);
+    for (uint32_t i=0;i<(uint32_t) n;++i)
+        order[i] = i;
+    const int64_t *k = keys.data();
+    std::sort(order.begin(), order.end(), [k, c](uint32_t a, uint32_t b) {
+        return std::lexicographical_compare(k + a * c, k + (a + 1) * c, k + b * c, k + (b + 1) * c);
+    });
+
+    std::string out;
+    out.append("NCB2", 4);
+    append<uint16_t>(out, FORMAT_VERSION);
+    append<uint16_t>(out, (uint16_t) kinds.size());
+    append<uint32_t>(out, (uint32_t) num_measures);
+    append<uint32_t>(out, 0);
+    append<uint64_t>(out, (uint64_t) n);
+
+    for (std::size_t i=0;i<kinds.size();++i) {
+        const std::string &name = level_names[i];
+        append<uint8_t>(out, (uint8_t) kinds[i]);
+        append<uint8_t>(out, (uint8_t) numColumns(kinds[i]));
+        append<uint16_t>(out, (uint16_t) name.size());
+        out.append(name);
+    }
+    pad(out);
+
+    std::vector<int64_t> column(n);
+    for (std::size_t j=0;j<c;++j) {
+        for (std::size_t i=0;i<n;++i)
+            column[i] = k[order[i] * c + j];
+        encodeColumn(out, column);
+    }
+
+    std::vector<double> measure(n);
+    for (std::size_t m=0;m<num_measures;++m) {
+        for (std::size_t i=0;i<n;++i) {
+            auto &value = values[order[i]];
+            measure[i] = m < value.size() ? value[m].asDouble() : 0.0;
+        }
+        if (n)
+            out.append(reinterpret_cast<const char*>(measure.data()), n * sizeof(double));
+    }
+
+    return out;
+}
+
+std::string encode(const ::nanocube::TreeValue &tree_value, const std::vector<LayerKind> &kinds)
+{
+    Encoder encoder(kinds, tree_value.level_names);
+    ::tree_store::replay(tree_value, encoder);
+    return encoder.finish();
+}
+
+} // columnar_result namespace
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "tree_store_nanocube.hh"
+
+//
+// Columnar binary encoding of a query result (the .bin2() output; see
+// API.md for the layout).
+//
+// Every cell of the result is a row: the label of each layer is split
+// into integer key columns (e.g. level, x and y of a quadtree address)
+// and the value into one float64 column per measure. Rows are sorted
+// by their key columns, so that a key column is either delta or frame
+// of reference bit-packed (whichever is smaller) and two results can
+// be merged with a single pass over both.
+//
+
+namespace columnar_result {
+
+static const uint16_t FORMAT_VERSION = 1;
+
+// how the labels of a layer are split into key columns
+enum LayerKind {
+    QUADTREE = 0, // level, x, y
+    CATEGORY = 1, // level, id
+    TIME_BIN = 2, // bin
+    IMAGE    = 3  // x, y (relative to the base of an "img" dive)
+};
+
+// rows of what it is pushed, stored and popped in depth first order,
+// e.g. the cells of a query::result::FlatResult without building the
+// tree (one kind and one name per layer)
+struct Encoder {
+public:
+    Encoder(const std::vector<LayerKind> &kinds, const std::vector<std::string> &level_names);
+
+    void push(const ::nanocube::DimAddress &label);
+    void store(const ::nanocube::Measures &value);
+    void pop();
+
+    // the encoded rows
+    std::string finish();
+
+private:
+    std::vector<LayerKind>            kinds;
+    std::vector<std::string>          level_names;
+    std::size_t                       num_columns  { 0 };
+    std::size_t                       num_measures { 1 };
+    std::vector<int64_t>              keys;   // num_columns per row
+    std::vector<::nanocube::Measures> values;
+    std::vector<int64_t>              path;   // key columns of the current node
+    std::vector<std::size_t>          sizes;  // of path before every push
+};
+
+// one entry per level of tree_value
+std::string encode(const ::nanocube::TreeValue &tree_value, const std::vector<LayerKind> &kinds);
+
+} // columnar_result namespace
@@ -0,0 +1,815 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <ostream>
+
+#include <boost/mpl/at.hpp>
+
+#include "TaggedPointer.hh"
+#include "SlabAllocator.hh"
+#include "TimeSeries.hh"
+
+//
+// Compressed time series: same interface as TimeSeries, selected by
+// defining TIMESERIES_COMPRESSED on a build target.
+//
+// A time series with at most TIMESERIES_COMPRESSION_THRESHOLD entries is
+// stored as a plain array (like the small_vector of TimeSeries). Larger
+// ones are stored in blocks of BLOCK_SIZE entries: the first entry of a
+// block is a full width checkpoint and the others are the differences
+// to the previous entry (time bin and the cumulative variables) encoded
+// as varints. Time bins are increasing and the variables cumulative, so
+// the differences are small.
+//
+// getWindowTotal is a binary search on the checkpoints plus the decoding
+// of at most BLOCK_SIZE-1 differences. Appending and accumulating on the
+// last entry only touch the tail of the buffer; out of order insertions
+// decode and re-encode the whole series.
+//
+// Buffer layout in compressed mode:
+//
+//     [Header][checkpoint 0]...[checkpoint cp_capacity-1][deltas]
+//
+// where a checkpoint is an entry followed by the uint32 offset of the
+// deltas of its block (relative to the beginning of the deltas).
+//
+
+#ifndef TIMESERIES_COMPRESSION_THRESHOLD
+#define TIMESERIES_COMPRESSION_THRESHOLD 16
+#endif
+
+namespace timeseries {
+
+namespace compressed {
+
+//-----------------------------------------------------------------------------
+// varints
+//-----------------------------------------------------------------------------
+
+inline int putVarint(unsigned char *out, uint64_t value)
+{
+    int n = 0;
+    while (value >= 0x80) {
+        out[n++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char) value;
+    return n;
+}
+
+inline uint64_t getVarint(const unsigned char* &in)
+{
+    uint64_t result = 0;
+    int      shift  = 0;
+    while (*in & 0x80) {
+        result |= (uint64_t) (*in++ & 0x7F) << shift;
+        shift += 7;
+    }
+    result |= (uint64_t) (*in++) << shift;
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+// EntryDelta
+//-----------------------------------------------------------------------------
+
+//
+// Field by field difference of two entries. Differences are taken
+// modulo the field width, so wrapped around counters still decode to
+// the same value.
+//
+template <typename Entry, int n>
+struct EntryDelta {
+
+    static const int      index     = Entry::dimension - n;
+    static const int      num_bytes = boost::mpl::at_c<typename Entry::sizes, index>::type::value;
+    static const uint64_t mask      = num_bytes >= 8 ? ~0ULL : ((1ULL << (8 * (num_bytes % 8))) - 1);
+
+    // write cur - prev and return the number of bytes written
+    static int encode(const Entry &cur, const Entry &prev, unsigned char *out) {
+        uint64_t d = (cur.template get<index>() - prev.template get<index>()) & mask;
+        int k = putVarint(out, d);
+        return k + EntryDelta<Entry, n-1>::encode(cur, prev, out + k);
+    }
+
+    // e += delta
+    static void decode(const unsigned char* &in, Entry &e) {
+        uint64_t d = getVarint(in);
+        e.template set<index>(e.template get<index>() + d);
+        EntryDelta<Entry, n-1>::decode(in, e);
+    }
+
+    // e -= delta
+    static void undo(const unsigned char* &in, Entry &e) {
+        uint64_t d = getVarint(in);
+        e.template set<index>(e.template get<index>() - d);
+        EntryDelta<Entry, n-1>::undo(in, e);
+    }
+};
+
+template <typename Entry>
+struct EntryDelta<Entry, 0> {
+    static int  encode(const Entry &cur, const Entry &prev, unsigned char *out) { return 0; }
+    static void decode(const unsigned char* &in, Entry &e) {}
+    static void undo(const unsigned char* &in, Entry &e) {}
+};
+
+} // compressed namespace
+
+//-----------------------------------------------------------------------------
+// CompressedTimeSeries
+//-----------------------------------------------------------------------------
+
+template<typename Entry>
+struct CompressedTimeSeries
+{
+
+    using EntryType = Entry;
+
+    static const uint32_t THRESHOLD       = TIMESERIES_COMPRESSION_THRESHOLD;
+    static const uint32_t BLOCK_SIZE      = 16;
+    static const uint32_t MAX_NUM_ENTRIES = 0xFFFF; // size is kept on the pointer tag
+    static const uint32_t CHECKPOINT_SIZE = sizeof(Entry) + sizeof(uint32_t);
+    static const uint32_t MAX_DELTA_SIZE  = 10 * Entry::dimension;
+
+    struct Header {
+        uint32_t capacity;    // bytes of the buffer
+        uint32_t cp_capacity; // number of checkpoint slots
+        uint32_t used;        // bytes of deltas
+        uint32_t last_offset; // deltas of the last entry
+        Entry    last;
+    };
+
+    static const uint32_t HEADER_SIZE = (sizeof(Header) + 7) / 8 * 8;
+
+    static_assert(THRESHOLD >= 1 && THRESHOLD < MAX_NUM_ENTRIES, "invalid TIMESERIES_COMPRESSION_THRESHOLD");
+
+public:
+
+    inline Count add(Entry entry);
+
+    CompressedTimeSeries* makeLazyCopy() const;
+
+    Count getMemoryUsage() const;
+
+    CompressedTimeSeries* getRoot();
+
+    template <int VariableIndex>
+    uint64_t getWindowTotal(Timestamp a, Timestamp b) const;
+
+    template <int VariableIndex, typename Function>
+    void visitWindowTotals(Timestamp base, Timestamp width, NumBins count, Function f) const;
+
+    template <typename Function>
+    void visitWindowBins(Timestamp base, Timestamp width, NumBins count, Function f) const;
+
+    void dump(std::ostream &os) const;
+
+    inline uint32_t size() const;
+
+    inline const Entry& front() const;
+
+    inline const Entry& back() const;
+
+    template <typename Function>
+    void forEachEntry(Function f) const;
+
+    void assign(const std::vector<Entry> &entries); // cumulative entries; picks plain or compressed
+
+public:
+
+    CompressedTimeSeries();
+
+    ~CompressedTimeSeries();
+
+    CompressedTimeSeries(const CompressedTimeSeries&) = delete;
+    CompressedTimeSeries& operator=(const CompressedTimeSeries&) = delete;
+
+    static void* operator new(size_t size);
+    static void  operator delete(void *p);
+
+    static std::atomic<uint64_t> count_new;
+    static std::atomic<uint64_t> count_delete;
+    static std::atomic<uint64_t> count_used_bins;
+    static std::atomic<uint64_t> count_num_adds;
+
+private:
+
+    inline bool isCompressed() const { return size() > THRESHOLD; }
+
+    static uint32_t plainCapacityFor(uint32_t n);
+
+    inline Entry* plainEntries() const { return reinterpret_cast<Entry*>(data.getPointer()); }
+
+    inline Header& header() const { return *reinterpret_cast<Header*>(data.getPointer()); }
+
+    inline unsigned char* checkpoint(uint32_t block) const {
+        return data.getPointer() + HEADER_SIZE + block * CHECKPOINT_SIZE;
+    }
+
+    inline const Entry& checkpointEntry(uint32_t block) const {
+        return *reinterpret_cast<const Entry*>(checkpoint(block));
+    }
+
+    inline uint32_t checkpointOffset(uint32_t block) const {
+        uint32_t offset;
+        std::memcpy(&offset, checkpoint(block) + sizeof(Entry), sizeof(uint32_t));
+        return offset;
+    }
+
+    inline unsigned char* deltas() const {
+        return checkpoint(header().cp_capacity);
+    }
+
+    inline uint32_t numBlocks() const { return (size() + BLOCK_SIZE - 1) / BLOCK_SIZE; }
+
+    void release();
+
+    void decodeAll(std::vector<Entry> &result) const;
+
+    void reserve(uint32_t cp_capacity, uint32_t delta_capacity);
+
+    void append(const Entry &cumulative_entry);
+
+    void accumLast(const Entry &entry);
+
+    template <int VariableIndex>
+    uint64_t valueBefore(Timestamp t) const; // cumulative value of last entry with time < t
+
+    uint32_t blocksBefore(Timestamp t) const; // number of blocks starting before t
+
+private:
+
+    // buffer: plain array of entries or compressed blocks;
+    // tag is the number of entries
+    tagged_pointer::TaggedPointer<unsigned char> data;
+
+};
+
+//-----------------------------------------------------------------------------
+// CompressedTimeSeries Impl.
+//-----------------------------------------------------------------------------
+
+template<typename Entry>
+std::atomic<uint64_t> CompressedTimeSeries<Entry>::count_new { 0 };
+
+template<typename Entry>
+std::atomic<uint64_t> CompressedTimeSeries<Entry>::count_delete { 0 };
+
+template<typename Entry>
+std::atomic<uint64_t> CompressedTimeSeries<Entry>::count_used_bins { 0 };
+
+template<typename Entry>
+std::atomic<uint64_t> CompressedTimeSeries<Entry>::count_num_adds { 0 };
+
+template<typename Entry>
+void* CompressedTimeSeries<Entry>::operator new(size_t size) {
+    count_new++;
+    return slab::allocate(size);
+}
+
+template<typename Entry>
+void CompressedTimeSeries<Entry>::operator delete(void *p) {
+    count_delete++;
+    slab::deallocate(p, sizeof(CompressedTimeSeries<Entry>));
+}
+
+template<typename Entry>
+CompressedTimeSeries<Entry>::CompressedTimeSeries():
+    data(nullptr, 0)
+{}
+
+template<typename Entry>
+CompressedTimeSeries<Entry>::~CompressedTimeSeries()
+{
+    release();
+}
+
+template<typename Entry>
+uint32_t CompressedTimeSeries<Entry>::plainCapacityFor(uint32_t n)
+{
+    // same growth as small_vector
+    if (n <= 2) {
+        return n;
+    }
+    uint32_t c = 4;
+    while (c < n) {
+        c <<= 1;
+    }
+    return c;
+}
+
+template<typename Entry>
+void CompressedTimeSeries<Entry>::release()
+{
+    unsigned char *buffer = data.getPointer();
+    if (!buffer) {
+        return;
+    }
+    if (isCompressed()) {
+        slab::deallocate(buffer, header().capacity);
+    }
+    else {
+        slab::deallocate(buffer, plainCapacityFor(size()) * sizeof(Entry));
+    }
+    data = tagged_pointer::TaggedPointer<unsigned char>(nullptr, 0);
+}
+
+template<typename Entry>
+inline uint32_t CompressedTimeSeries<Entry>::size() const
+{
+    return data.getTag();
+}
+
+template<typename Entry>
+inline const Entry& CompressedTimeSeries<Entry>::front() const
+{
+    return isCompressed() ? checkpointEntry(0) : plainEntries()[0];
+}
+
+template<typename Entry>
+inline const Entry& CompressedTimeSeries<Entry>::back() const
+{
+    return isCompressed() ? header().last : plainEntries()[size() - 1];
+}
+
+template<typename Entry>
+template <typename Function>
+void CompressedTimeSeries<Entry>::forEachEntry(Function f) const
+{
+    if (!isCompressed()) {
+        for (uint32_t i=0;i<size();++i) {
+            f(plainEntries()[i]);
+        }
+        return;
+    }
+    uint32_t n = size();
+    for (uint32_t block=0;block<numBlocks();++block) {
+        Entry e = checkpointEntry(block);
+        f(e);
+        const unsigned char *in = deltas() + checkpointOffset(block);
+        uint32_t block_end = std::min(n, (block + 1) * BLOCK_SIZE);
+        for (uint32_t i=block * BLOCK_SIZE + 1;i<block_end;++i) {
+            compressed::EntryDelta<Entry, Entry::dimension>::decode(in, e);
+            f(e);
+        }
+    }
+}
+
+template<typename Entry>
+void CompressedTimeSeries<Entry>::decodeAll(std::vector<Entry> &result) const
+{
+    result.clear();
+    result.reserve(size());
+    forEachEntry([&result](const Entry &e) { result.push_back(e); });
+}
+
+template<typename Entry>
+void CompressedTimeSeries<Entry>::assign(const std::vector<Entry> &entries)
+{
+    // refuse before releasing, so that the series is left as it was
+    if (entries.size() > MAX_NUM_ENTRIES) {
+        throw std::runtime_error("too many entries on a time series");
+    }
+
+    release();
+
+    uint32_t n = (uint32_t) entries.size();
+    if (n == 0) {
+        return;
+    }
+    else if (n <= THRESHOLD) {
+        uint32_t c = plainCapacityFor(n);
+        Entry *buffer = static_cast<Entry*>(slab::allocate(c * sizeof(Entry)));
+        std::copy(entries.begin(), entries.end(), buffer);
+        data = tagged_pointer::TaggedPointer<unsigned char>(reinterpret_cast<unsigned char*>(buffer), n);
+        return;
+    }
+
+    // encode the deltas first to get the exact size
+    std::vector<unsigned char> encoded;
+    std::vector<uint32_t>      offsets;
+    encoded.resize(n * MAX_DELTA_SIZE);
+    uint32_t used = 0;
+    uint32_t last_offset = 0;
+    for (uint32_t i=0;i<n;++i) {
+        if (i % BLOCK_SIZE == 0) {
+            offsets.push_back(used);
+            last_offset = used;
+        }
+        else {
+            last_offset = used;
+            used += compressed::EntryDelta<Entry, Entry::dimension>::encode(entries[i], entries[i-1], &encoded[used]);
+        }
+    }
+
+    uint32_t num_blocks  = (uint32_t) offsets.size();
+    uint32_t cp_capacity = num_blocks + 1;
+    uint32_t capacity    = HEADER_SIZE + cp_capacity * CHECKPOINT_SIZE + used + used / 4 + MAX_DELTA_SIZE;
+
+    unsigned char *buffer = static_cast<unsigned char*>(slab::allocate(capacity));
+    data = tagged_pointer::TaggedPointer<unsigned char>(buffer, n);
+
+    Header &h     = header();
+    h.capacity    = capacity;
+    h.cp_capacity = cp_capacity;
+    h.used        = used;
+    h.last_offset = last_offset;
+    h.last        = entries.back();
+    for (uint32_t block=0;block<num_blocks;++block) {
+        std::memcpy(checkpoint(block), &entries[block * BLOCK_SIZE], sizeof(Entry));
+        std::memcpy(checkpoint(block) + sizeof(Entry), &offsets[block], sizeof(uint32_t));
+    }
+    std::copy(encoded.begin(), encoded.begin() + used, deltas());
+}
+
+template<typename Entry>
+void CompressedTimeSeries<Entry>::reserve(uint32_t cp_capacity, uint32_t delta_capacity)
+{
+    Header &h = header();
+    uint32_t capacity = HEADER_SIZE + cp_capacity * CHECKPOINT_SIZE + delta_capacity;
+
+    unsigned char *buffer = static_cast<unsigned char*>(slab::allocate(capacity));
+    std::memcpy(buffer, data.getPointer(), HEADER_SIZE + numBlocks() * CHECKPOINT_SIZE);
+    std::memcpy(buffer + HEADER_SIZE + cp_capacity * CHECKPOINT_SIZE, deltas(), h.used);
+
+    slab::deallocate(data.getPointer(), h.capacity);
+    data.setPointer(buffer);
+
+    header().capacity    = capacity;
+    header().cp_capacity = cp_capacity;
+}
+
+template<typename Entry>
+void CompressedTimeSeries<Entry>::append(const Entry &cumulative_entry)
+{
+    uint32_t n = size();
+    if (n == MAX_NUM_ENTRIES) {
+        throw std::runtime_error("too many entries on a time series");
+    }
+
+    if (n < THRESHOLD) {
+        uint32_t c = plainCapacityFor(n);
+        if (n + 1 > c) {
+            uint32_t new_c = plainCapacityFor(n + 1);
+            Entry *buffer = static_cast<Entry*>(slab::allocate(new_c * sizeof(Entry)));
+            std::copy(plainEntries(), plainEntries() + n, buffer);
+            if (c) {
+                slab::deallocate(data.getPointer(), c * sizeof(Entry));
+            }
+            data.setPointer(reinterpret_cast<unsigned char*>(buffer));
+        }
+        plainEntries()[n] = cumulative_entry;
+        data.setTag(n + 1);
+        return;
+    }
+    else if (n == THRESHOLD) {
+        std::vector<Entry> entries;
+        decodeAll(entries);
+        entries.push_back(cumulative_entry);
+        assign(entries);
+        return;
+    }
+
+    Header  *h          = &header();
+    uint32_t delta_room = h->capacity - HEADER_SIZE - h->cp_capacity * CHECKPOINT_SIZE;
+    if (n % BLOCK_SIZE == 0) {
+        // new block
+        if (numBlocks() == h->cp_capacity) {
+            reserve(h->cp_capacity * 2, delta_room);
+            h = &header();
+        }
+        uint32_t block = n / BLOCK_SIZE;
+        std::memcpy(checkpoint(block), &cumulative_entry, sizeof(Entry));
+        std::memcpy(checkpoint(block) + sizeof(Entry), &h->used, sizeof(uint32_t));
+        h->last_offset = h->used;
+    }
+    else {
+        if (h->used + MAX_DELTA_SIZE > delta_room) {
+            reserve(h->cp_capacity, delta_room + delta_room / 4 + MAX_DELTA_SIZE);
+            h = &header();
+        }
+        h->last_offset = h->used;
+        h->used += compressed::EntryDelta<Entry, Entry::dimension>::encode(cumulative_entry, h->last, deltas() + h->used);
+    }
+    h->last = cumulative_entry;
+    data.setTag(n + 1);
+}
+
+template<typename Entry>
+void CompressedTimeSeries<Entry>::accumLast(const Entry &entry)
+{
+    uint32_t n = size();
+    if (!isCompressed()) {
+        plainEntries()[n - 1].accum(entry);
+        return;
+    }
+
+    Header &h = header();
+    Entry new_last = h.last;
+    new_last.accum(entry);
+
+    if ((n - 1) % BLOCK_SIZE == 0) {
+        // last entry is a checkpoint
+        std::memcpy(checkpoint((n - 1) / BLOCK_SIZE), &new_last, sizeof(Entry));
+    }
+    else {
+        // re-encode the last delta (might change its size, but there is
+        // always room for MAX_DELTA_SIZE bytes after last_offset)
+        Entry prev = h.last;
+        const unsigned char *in = deltas() + h.last_offset;
+        compressed::EntryDelta<Entry, Entry::dimension>::undo(in, prev);
+        h.used = h.last_offset + compressed::EntryDelta<Entry, Entry::dimension>::encode(new_last, prev, deltas() + h.last_offset);
+    }
+    h.last = new_last;
+}
+
+template<typename Entry>
+inline Count // return increase on the actual used memory
+CompressedTimeSeries<Entry>::add(Entry entry)
+{
+#ifdef COLLECT_MEMUSAGE
+    count_num_adds++;
+#endif
+
+    if (size() == 0) {
+#ifdef COLLECT_MEMUSAGE
+        count_used_bins++;
+#endif
+        append(entry);
+        return sizeof(Entry);
+    }
+
+    uint64_t entry_time = entry.template get<0>();
+    uint64_t current_entry_time = back().template get<0>();
+
+    if (current_entry_time < entry_time) {
+#ifdef COLLECT_MEMUSAGE
+        count_used_bins++;
+#endif
+        entry.accum(back());
+        append(entry);
+        return sizeof(Entry);
+    }
+    else if (current_entry_time == entry_time) {
+        accumLast(entry);
+        return 0;
+    }
+
+    // out of order case: SLOW (decode, insert and encode)
+    std::vector<Entry> entries;
+    decodeAll(entries);
+
+    auto comp = [](const Entry &e, uint64_t time) -> bool {
+        uint64_t e_time = e.template get<0>();
+        return e_time < time;
+    };
+
+    auto it = std::lower_bound(entries.begin(), entries.end(), entry_time, comp);
+
+    Count used_size_inc = 0;
+    if ((*it).template get<0>() != entry_time) {
+        it = entries.insert(it, entry);
+        used_size_inc += sizeof(Entry);
+#ifdef COLLECT_MEMUSAGE
+        count_used_bins++;
+#endif
+        if (it != entries.begin()) {
+            (*it).accum(*(it-1)); // accumulate last
+        }
+    }
+    else {
+        (*it).accum(entry);
+    }
+
+    // accumulate on suffix of (cumulative) time series
+    for (auto it2=it+1;it2!=entries.end();++it2) {
+        (*it2).accum(entry);
+    }
+
+    assign(entries);
+
+    return used_size_inc;
+}
+
+template<typename Entry>
+CompressedTimeSeries<Entry>*
+CompressedTimeSeries<Entry>::makeLazyCopy() const
+{
+    CompressedTimeSeries<Entry> *copy = new CompressedTimeSeries<Entry>();
+
+    count_used_bins += size();
+
+    uint32_t n = size();
+    if (n == 0) {
+        return copy;
+    }
+    else if (!isCompressed()) {
+        uint32_t c = plainCapacityFor(n);
+        Entry *buffer = static_cast<Entry*>(slab::allocate(c * sizeof(Entry)));
+        std::copy(plainEntries(), plainEntries() + n, buffer);
+        copy->data = tagged_pointer::TaggedPointer<unsigned char>(reinterpret_cast<unsigned char*>(buffer), n);
+        return copy;
+    }
+
+    // keep some room on the copy: it is about to receive a new record
+    const Header &h          = header();
+    uint32_t      blocks     = numBlocks();
+    uint32_t      cp_capacity = blocks + 1;
+    uint32_t      capacity   = HEADER_SIZE + cp_capacity * CHECKPOINT_SIZE + h.used + MAX_DELTA_SIZE;
+
+    unsigned char *buffer = static_cast<unsigned char*>(slab::allocate(capacity));
+    std::memcpy(buffer, data.getPointer(), HEADER_SIZE + blocks * CHECKPOINT_SIZE);
+    std::memcpy(buffer + HEADER_SIZE + cp_capacity * CHECKPOINT_SIZE, deltas(), h.used);
+    copy->data = tagged_pointer::TaggedPointer<unsigned char>(buffer, n);
+    copy->header().capacity    = capacity;
+    copy->header().cp_capacity = cp_capacity;
+
+    return copy;
+}
+
+template<typename Entry>
+Count
+CompressedTimeSeries<Entry>::getMemoryUsage() const
+{
+    if (isCompressed()) {
+        return sizeof(CompressedTimeSeries<Entry>) + header().capacity;
+    }
+    return sizeof(CompressedTimeSeries<Entry>) + sizeof(Entry) * size();
+}
+
+template<typename Entry>
+CompressedTimeSeries<Entry> *CompressedTimeSeries<Entry>::getRoot()
+{
+    return this;
+}
+
+template<typename Entry>
+uint32_t CompressedTimeSeries<Entry>::blocksBefore(Timestamp t) const
+{
+    uint32_t lo = 0;
+    uint32_t hi = numBlocks();
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (checkpointEntry(mid).template get<0>() < t) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+template<typename Entry>
+template <int VariableIndex>
+uint64_t CompressedTimeSeries<Entry>::valueBefore(Timestamp t) const
+{
+    if (!isCompressed()) {
+        auto cmp = [](const Entry& e, Timestamp tb) -> bool {
+            return e.template get<0>() < tb;
+        };
+        const Entry *begin = plainEntries();
+        const Entry *it    = std::lower_bound(begin, begin + size(), t, cmp);
+        return it == begin ? 0 : (it-1)->template get<VariableIndex>();
+    }
+
+    uint32_t blocks = blocksBefore(t);
+    if (blocks == 0) {
+        return 0;
+    }
+
+    uint32_t block     = blocks - 1;
+    uint32_t block_end = std::min(size(), (block + 1) * BLOCK_SIZE);
+    Entry    e         = checkpointEntry(block);
+    const unsigned char *in = deltas() + checkpointOffset(block);
+    for (uint32_t i=block * BLOCK_SIZE + 1;i<block_end;++i) {
+        Entry next = e;
+        compressed::EntryDelta<Entry, Entry::dimension>::decode(in, next);
+        if (next.template get<0>() >= t) {
+            break;
+        }
+        e = next;
+    }
+    return e.template get<VariableIndex>();
+}
+
+//
+// Interval is [a, b)
+//    closed on a and open on b.
+//
+
+template<typename Entry>
+template<int VariableIndex>
+uint64_t CompressedTimeSeries<Entry>::getWindowTotal(Timestamp a, Timestamp b) const
+{
+    if (size() == 0 || back().template get<0>() < a) {
+        return 0;
+    }
+    return valueBefore<VariableIndex>(b) - valueBefore<VariableIndex>(a);
+}
+
+template<typename Entry>
+template<int VariableIndex, typename Function>
+void CompressedTimeSeries<Entry>::visitWindowTotals(Timestamp base, Timestamp width, NumBins count, Function f) const
+{
+    visitWindowBins(base, width, count, [&f](NumBins i, const Entry &before, const Entry &last) {
+        uint64_t value    = last.template get<VariableIndex>();
+        uint64_t previous = before.template get<VariableIndex>();
+        if (value != previous) {
+            f(i, value - previous);
+        }
+    });
+}
+
+//
+// Same merge as timeseries::visitWindowBins, but the entries are
+// decoded sequentially from the block where base falls.
+//
+
+template<typename Entry>
+template<typename Function>
+void CompressedTimeSeries<Entry>::visitWindowBins(Timestamp base, Timestamp width, NumBins count, Function f) const
+{
+    if (!isCompressed()) {
+        timeseries::visitWindowBins(plainEntries(), plainEntries() + size(), base, width, count, f);
+        return;
+    }
+    else if (width == 0 || count == 0) {
+        return;
+    }
+
+    const Timestamp end = base + width * count;
+
+    uint32_t blocks = blocksBefore(base);
+    uint32_t block  = blocks ? blocks - 1 : 0;
+
+    Entry    before   = Entry(); // entry before the current bin
+    Entry    bin_last = Entry(); // last entry seen on the current bin
+    int64_t  bin      = -1;      // current bin
+
+    uint32_t n = size();
+    Entry    e = checkpointEntry(block);
+    const unsigned char *in = deltas() + checkpointOffset(block);
+    for (uint32_t i=block * BLOCK_SIZE;i<n;++i) {
+        if (i > block * BLOCK_SIZE) {
+            if (i % BLOCK_SIZE == 0) {
+                ++block;
+                e  = checkpointEntry(block);
+                in = deltas() + checkpointOffset(block);
+            }
+            else {
+                compressed::EntryDelta<Entry, Entry::dimension>::decode(in, e);
+            }
+        }
+
+        Timestamp t = e.template get<0>();
+        if (t < base) {
+            before = e;
+            continue;
+        }
+        else if (t >= end) {
+            break;
+        }
+
+        int64_t entry_bin = (int64_t) ((t - base) / width);
+        if (entry_bin != bin) {
+            if (bin >= 0) {
+                f((NumBins) bin, before, bin_last);
+                before = bin_last;
+            }
+            bin = entry_bin;
+        }
+        bin_last = e;
+    }
+    if (bin >= 0) {
+        f((NumBins) bin, before, bin_last);
+    }
+}
+
+template<typename Entry>
+void CompressedTimeSeries<Entry>::dump(std::ostream &os) const
+{
+    os << "Compressed Time Series with " << size() << "  entries." << std::endl;
+    os << "[";
+    forEachEntry([&os](const Entry &e) {
+        os << "(" << e.template get<0>() << "," << e.template get<1>() << "), ";
+    });
+    os << "]";
+    os << std::endl;
+}
+
+template<typename Entry>
+std::ostream& operator<<(std::ostream &o,
+                         const CompressedTimeSeries<Entry>& ts)
+{
+    o << "[compressed timeseries: " << ts.getMemoryUsage() << "] ";
+    return o;
+}
+
+} // end namespace timeseries
@@ -0,0 +1,118 @@
+#include "Compression.hh"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace compression {
+
+namespace {
+
+// q value of a coding on an Accept-Encoding header (-1 if not listed)
+double quality(const std::string &header, const std::string &coding)
+{
+    double result = -1;
+    std::size_t i = 0;
+    while (i < header.size()) {
+        std::size_t end = header.find(',', i);
+        if (end == std::string::npos)
+            end = header.size();
+
+        std::string item = header.substr(i, end - i);
+        std::size_t semicolon = item.find(';');
+        std::string token = item.substr(0, semicolon);
+        token.erase(0, token.find_first_not_of(" \t"));
+        token.erase(token.find_last_not_of(" \t") + 1);
+        for (auto &c: token)
+            c = (char) std::tolower(c);
+
+        if (token == coding || (token == "*" && result < 0)) {
+            double q = 1.0;
+            if (semicolon != std::string::npos) {
+                auto p = item.find("q=", semicolon);
+                if (p != std::string::npos)
+                    q = std::atof(item.c_str() + p + 2);
+            }
+            result = q;
+            if (token == coding)
+                return result;
+        }
+        i = end + 1;
+    }
+    return result;
+}
+
+} // anonymous namespace
+
+Encoding negotiate(const char *accept_encoding)
+{
+    if (!accept_encoding)
+        return IDENTITY;
+    std::string header(accept_encoding);
+    if (quality(header, "gzip") > 0)
+        return GZIP;
+    else if (quality(header, "deflate") > 0)
+        return DEFLATE;
+    return IDENTITY;
+}
+
+const char* name(Encoding encoding)
+{
+    switch (encoding) {
+    case GZIP:    return "gzip";
+    case DEFLATE: return "deflate";
+    default:      return "identity";
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Deflater Impl.
+//-----------------------------------------------------------------------------
+
+Deflater::Deflater(Encoding encoding, int level):
+    output(new char[OUTPUT_SIZE])
+{
+    std::memset(&stream, 0, sizeof(stream));
+    // HTTP "deflate" is the zlib format; window bits + 16 is gzip
+    int window_bits = encoding == GZIP ? 15 + 16 : 15;
+    if (deflateInit2(&stream, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw std::runtime_error("zlib error while initializing compression");
+}
+
+Deflater::~Deflater()
+{
+    deflateEnd(&stream);
+}
+
+void Deflater::write(const char *data, std::size_t size, bool last, const sink_func &sink)
+{
+    stream.next_in  = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = (uInt) size;
+    int flush = last ? Z_FINISH : Z_NO_FLUSH;
+    while (true) {
+        stream.next_out  = reinterpret_cast<Bytef*>(output.get());
+        stream.avail_out = (uInt) OUTPUT_SIZE;
+        int status = deflate(&stream, flush);
+        if (status == Z_STREAM_ERROR)
+            throw std::runtime_error("zlib error while compressing");
+        std::size_t n = OUTPUT_SIZE - stream.avail_out;
+        if (n)
+            sink(output.get(), n);
+        if (last ? status == Z_STREAM_END : (stream.avail_in == 0 && stream.avail_out > 0))
+            break;
+    }
+}
+
+std::string compress(Encoding encoding, int level, const char *data, std::size_t size)
+{
+    std::string result;
+    Deflater deflater(encoding, level);
+    deflater.write(data, size, true, [&result](const char *p, std::size_t n) {
+        result.append(p, n);
+    });
+    return result;
+}
+
+} // compression namespace
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <zlib.h>
+
+//
+// HTTP content encoding of responses (Accept-Encoding/Content-Encoding)
+// with a streaming zlib deflate context: the body is compressed as it
+// is written, so chunked responses are compressed chunk by chunk.
+//
+
+namespace compression {
+
+enum Encoding { IDENTITY, GZIP, DEFLATE };
+
+// encoding for a request with the given Accept-Encoding header (may be
+// nullptr): gzip is preferred and codings with q=0 are refused
+Encoding negotiate(const char *accept_encoding);
+
+// Content-Encoding name
+const char* name(Encoding encoding);
+
+//-----------------------------------------------------------------------------
+// Deflater
+//-----------------------------------------------------------------------------
+
+struct Deflater {
+public:
+
+    using sink_func = std::function<void(const char *data, std::size_t size)>;
+
+    Deflater(Encoding encoding, int level);
+    ~Deflater();
+
+    Deflater(const Deflater& other) = delete;
+    Deflater& operator=(const Deflater& other) = delete;
+
+    // compressed bytes go to sink as the output buffer fills up; the
+    // last write also flushes the end of the stream
+    void write(const char *data, std::size_t size, bool last, const sink_func &sink);
+
+private:
+
+    static const std::size_t OUTPUT_SIZE = 1 << 16;
+
+    z_stream                stream;
+    std::unique_ptr<char[]> output;
+};
+
+// whole body compressed in one go
+std::string compress(Encoding encoding, int level, const char *data, std::size_t size);
+
+} // compression namespace
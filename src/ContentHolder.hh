@@ -4,7 +4,6 @@
 
 namespace contentholder {
 
-using tagged_pointer::TaggedPointer;
 
 typedef uint16_t UserData; // the first seven bits of CustomData
 typedef uint16_t Flag; // the first seven bits of CustomData
@@ -32,7 +31,13 @@ struct UserDataAndFlag
 // ContentHolder
 //-----------------------------------------------------------------------------
 
-template <typename Content>
+//
+// Policy is one of the link policies of TaggedPointer.hh: it decides
+// if the content is referred to by a 64-bit pointer or a 32-bit slab
+// handle (the content then needs to come from the slab allocator).
+//
+
+template <typename Content, typename Policy=tagged_pointer::DefaultPolicy>
 struct ContentHolder
 {
     ContentHolder();
@@ -64,7 +69,7 @@ public: // reuse the 7 bits of the flag byte indicating that
 
 public:
 
-    TaggedPointer<Content> data;
+    typename Policy::template Tagged<Content> data;
 
 //    Content*         content;
 //    Flag             proper_content: 1;
@@ -85,24 +90,24 @@ public:
 //    return UserDataAndFlag(data.getTag());
 //}
 
-template <typename Content>
-ContentHolder<Content>::ContentHolder()
+template <typename Content, typename Policy>
+ContentHolder<Content, Policy>::ContentHolder()
 {}
 
-template <typename Content>
-bool ContentHolder<Content>::contentIsProper() const
+template <typename Content, typename Policy>
+bool ContentHolder<Content, Policy>::contentIsProper() const
 {
     return UserDataAndFlag(data.getTag()).proper_content == 1;
 }
 
-template <typename Content>
-bool ContentHolder<Content>::contentIsShared() const
+template <typename Content, typename Policy>
+bool ContentHolder<Content, Policy>::contentIsShared() const
 {
     return UserDataAndFlag(data.getTag()).proper_content == 0;
 }
 
-template <typename Content>
-void ContentHolder<Content>::copyContentAndProperFlag(const ContentHolder &c)
+template <typename Content, typename Policy>
+void ContentHolder<Content, Policy>::copyContentAndProperFlag(const ContentHolder &c)
 {
     data.setPointer(c.data.getPointer());
     UserDataAndFlag udf(data.getTag());
@@ -114,14 +119,14 @@ void ContentHolder<Content>::copyContentAndProperFlag(const ContentHolder &c)
 //    this->proper_content = c.proper_content;
 }
 
-template <typename Content>
-Content* ContentHolder<Content>::getContent() const
+template <typename Content, typename Policy>
+Content* ContentHolder<Content, Policy>::getContent() const
 {
     return data.getPointer();
 }
 
-template <typename Content>
-void ContentHolder<Content>::setProperContent(Content *content)
+template <typename Content, typename Policy>
+void ContentHolder<Content, Policy>::setProperContent(Content *content)
 {
     data.setPointer(content);
     UserDataAndFlag udf(data.getTag());
@@ -132,8 +137,8 @@ void ContentHolder<Content>::setProperContent(Content *content)
     //this->proper_content = 1;
 }
 
-template <typename Content>
-void ContentHolder<Content>::setSharedContent(Content *content)
+template <typename Content, typename Policy>
+void ContentHolder<Content, Policy>::setSharedContent(Content *content)
 {
     data.setPointer(content);
     UserDataAndFlag udf(data.getTag());
@@ -144,8 +149,8 @@ void ContentHolder<Content>::setSharedContent(Content *content)
     // this->proper_content = 0;
 }
 
-template <typename Content>
-Content* ContentHolder<Content>::getProperContentCreateIfNeeded()
+template <typename Content, typename Policy>
+Content* ContentHolder<Content, Policy>::getProperContentCreateIfNeeded()
 {
     if (!data.getPointer())
     {
@@ -174,8 +179,8 @@ Content* ContentHolder<Content>::getProperContentCreateIfNeeded()
     return data.getPointer();
 }
 
-template <typename Content>
-void ContentHolder<Content>::setUserData(UserData d)
+template <typename Content, typename Policy>
+void ContentHolder<Content, Policy>::setUserData(UserData d)
 {
     UserDataAndFlag udf(data.getTag());
     udf.user_data = d;
@@ -184,8 +189,8 @@ void ContentHolder<Content>::setUserData(UserData d)
     // user_data = d;
 }
 
-template <typename Content>
-inline UserData ContentHolder<Content>::getUserData() const
+template <typename Content, typename Policy>
+inline UserData ContentHolder<Content, Policy>::getUserData() const
 {
     // apparently this constructor wasn't getting optimized away...
     // at least I see a 3% difference in overall runtime when replacing
@@ -0,0 +1,249 @@
+#include "ExternalSort.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+
+#include <unistd.h>
+
+namespace external_sort {
+
+//------------------------------------------------------------------------------
+// ExternalSortException Impl.
+//------------------------------------------------------------------------------
+
+ExternalSortException::ExternalSortException(const std::string &message):
+    std::runtime_error(message)
+{}
+
+//------------------------------------------------------------------------------
+// KeyField Impl.
+//------------------------------------------------------------------------------
+
+KeyField::KeyField(int offset, int size):
+    offset(offset),
+    size(size)
+{
+    if (size < 1 || size > 8) {
+        throw ExternalSortException("key fields need to have between 1 and 8 bytes");
+    }
+}
+
+//------------------------------------------------------------------------------
+// ExternalSorter Impl.
+//------------------------------------------------------------------------------
+
+ExternalSorter::ExternalSorter(int                          record_size,
+                               const std::vector<KeyField> &key,
+                               std::size_t                  memory_budget,
+                               const std::string           &tmp_dir):
+    record_size(record_size),
+    key(key),
+    memory_budget(memory_budget),
+    tmp_dir(tmp_dir)
+{
+    if (record_size <= 0) {
+        throw ExternalSortException("record size needs to be positive");
+    }
+    for (auto &k: key) {
+        if (k.offset < 0 || k.offset + k.size > record_size) {
+            throw ExternalSortException("key field is outside of the record");
+        }
+    }
+}
+
+ExternalSorter::~ExternalSorter()
+{
+    for (auto &run: runs) {
+        run->is.close();
+        std::remove(run->filename.c_str());
+    }
+}
+
+std::size_t ExternalSorter::numRuns() const
+{
+    return runs.size();
+}
+
+bool ExternalSorter::less(const char *a, const char *b) const
+{
+    for (auto &k: key) {
+        std::uint64_t va = 0;
+        std::uint64_t vb = 0;
+        std::memcpy(&va, a + k.offset, k.size);
+        std::memcpy(&vb, b + k.offset, k.size);
+        if (va != vb) {
+            return va < vb;
+        }
+    }
+    return false;
+}
+
+void ExternalSorter::sortChunk(std::size_t num_records)
+{
+    order.resize(num_records);
+    std::iota(order.begin(), order.end(), 0);
+    const char *base = &chunk[0];
+    std::stable_sort(order.begin(), order.end(), [this, base](std::uint32_t i, std::uint32_t j) {
+        return less(base + (std::size_t) i * record_size, base + (std::size_t) j * record_size);
+    });
+    chunk_pos = 0;
+}
+
+void ExternalSorter::spillChunk()
+{
+    std::unique_ptr<Run> run(new Run());
+
+    std::string name_template = tmp_dir + "/nanocube-sort-XXXXXX";
+    std::vector<char> name(name_template.begin(), name_template.end());
+    name.push_back(0);
+    int fd = mkstemp(&name[0]);
+    if (fd == -1) {
+        throw ExternalSortException("could not create a spill file in " + tmp_dir);
+    }
+    close(fd);
+    run->filename = &name[0];
+
+    {
+        std::ofstream os(run->filename, std::ofstream::binary);
+        for (auto i: order) {
+            os.write(&chunk[(std::size_t) i * record_size], record_size);
+        }
+        if (!os) {
+            std::remove(run->filename.c_str());
+            throw ExternalSortException("could not write spill file " + run->filename);
+        }
+    }
+
+    runs.push_back(std::move(run));
+
+    order.clear();
+    chunk.clear();
+    chunk.shrink_to_fit();
+}
+
+std::uint64_t ExternalSorter::sort(std::istream &is, std::uint64_t max_records)
+{
+    const std::size_t chunk_records = std::max<std::size_t>(1, std::min<std::size_t>(memory_budget / record_size, 0xFFFFFFFFUL));
+
+    std::uint64_t num_records = 0;
+    bool done = false;
+    while (!done) {
+        std::size_t n = chunk_records;
+        if (max_records && max_records - num_records < n) {
+            n = max_records - num_records;
+        }
+
+        // grow the chunk as records arrive: small inputs don't
+        // need to touch the whole memory budget
+        chunk.clear();
+        while (chunk.size() < n * record_size) {
+            auto offset = chunk.size();
+            auto block  = std::min<std::size_t>(n * record_size - offset, std::max(1 << 20, record_size));
+            chunk.resize(offset + block);
+            is.read(&chunk[offset], block);
+            chunk.resize(offset + is.gcount());
+            if ((std::size_t) is.gcount() < block) {
+                break;
+            }
+        }
+        std::size_t read_records = chunk.size() / record_size; // drop incomplete record
+
+        done = read_records < n || (max_records && num_records + read_records == max_records);
+
+        chunk.resize(read_records * record_size);
+        num_records += read_records;
+
+        if (read_records == 0) {
+            break;
+        }
+
+        sortChunk(read_records);
+
+        // the last chunk stays in memory if it is the only one
+        if (!done || runs.size()) {
+            spillChunk();
+        }
+    }
+
+    // prepare merge
+    if (runs.size()) {
+        std::size_t run_records = std::max<std::size_t>(1, memory_budget / (runs.size() * record_size));
+        heap.clear();
+        for (std::size_t i=0;i<runs.size();++i) {
+            auto &run = *runs[i];
+            run.is.open(run.filename, std::ifstream::binary);
+            if (!run.is) {
+                throw ExternalSortException("could not read spill file " + run.filename);
+            }
+            run.buffer.resize(run_records * record_size);
+            if (fillRun(run)) {
+                heap.push_back(i);
+            }
+        }
+        std::make_heap(heap.begin(), heap.end(), [this](std::size_t a, std::size_t b) { return runAfter(a, b); });
+    }
+
+    return num_records;
+}
+
+bool ExternalSorter::fillRun(Run &run)
+{
+    run.is.read(&run.buffer[0], run.buffer.size());
+    run.size = run.is.gcount() / record_size;
+    run.pos  = 0;
+    return run.size > 0;
+}
+
+const char* ExternalSorter::current(std::size_t run) const
+{
+    auto &r = *runs[run];
+    return &r.buffer[r.pos * record_size];
+}
+
+bool ExternalSorter::runAfter(std::size_t run_a, std::size_t run_b) const
+{
+    // std heaps keep the "largest" element on top: make that the
+    // smallest record (earliest run on ties)
+    auto a = current(run_a);
+    auto b = current(run_b);
+    if (less(b, a)) {
+        return true;
+    }
+    else if (less(a, b)) {
+        return false;
+    }
+    return run_a > run_b;
+}
+
+std::size_t ExternalSorter::read(char *buffer, std::size_t num_records)
+{
+    std::size_t count = 0;
+
+    if (runs.empty()) {
+        for (;count<num_records && chunk_pos<order.size();++count,++chunk_pos) {
+            std::memcpy(buffer + count * record_size, &chunk[(std::size_t) order[chunk_pos] * record_size], record_size);
+        }
+        return count;
+    }
+
+    auto heap_order = [this](std::size_t a, std::size_t b) { return runAfter(a, b); };
+    for (;count<num_records && heap.size();++count) {
+        std::pop_heap(heap.begin(), heap.end(), heap_order);
+        auto i = heap.back();
+        auto &run = *runs[i];
+        std::memcpy(buffer + count * record_size, current(i), record_size);
+        ++run.pos;
+        if (run.pos < run.size || fillRun(run)) {
+            std::push_heap(heap.begin(), heap.end(), heap_order);
+        }
+        else {
+            heap.pop_back();
+        }
+    }
+    return count;
+}
+
+} // external_sort namespace
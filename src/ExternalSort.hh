@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace external_sort {
+
+//------------------------------------------------------------------------------
+// ExternalSortException
+//------------------------------------------------------------------------------
+
+struct ExternalSortException: public std::runtime_error {
+public:
+    ExternalSortException(const std::string &message);
+};
+
+//------------------------------------------------------------------------------
+// KeyField
+//------------------------------------------------------------------------------
+
+//
+// A byte range of a record that is part of the sort key. The bytes are
+// interpreted as an unsigned little-endian integer (at most 8 bytes),
+// the same way records of a .dmp file are laid out.
+//
+struct KeyField {
+    KeyField() = default;
+    KeyField(int offset, int size);
+    int offset { 0 };
+    int size   { 0 };
+};
+
+//------------------------------------------------------------------------------
+// ExternalSorter
+//------------------------------------------------------------------------------
+
+//
+// Sorts fixed size records read from a stream by a list of key fields
+// (the first one is the most significant; ties keep the input order).
+// At most "memory_budget" bytes of records are kept in memory: larger
+// inputs are sorted in runs that are spilled to temporary files in
+// "tmp_dir" and merged while the sorted records are read back.
+//
+struct ExternalSorter {
+public:
+
+    ExternalSorter(int                          record_size,
+                   const std::vector<KeyField> &key,
+                   std::size_t                  memory_budget,
+                   const std::string           &tmp_dir);
+
+    ~ExternalSorter(); // removes the spill files
+
+    ExternalSorter(const ExternalSorter&) = delete;
+    ExternalSorter& operator=(const ExternalSorter&) = delete;
+
+    // consume all the records of the stream (or only the first
+    // max_records if it is not zero) and return how many there were
+    std::uint64_t sort(std::istream &is, std::uint64_t max_records=0);
+
+    // copy the next (at most) num_records sorted records into buffer
+    // and return how many were copied: zero means no more records
+    std::size_t read(char *buffer, std::size_t num_records);
+
+    std::size_t numRuns() const;
+
+private:
+
+    struct Run {
+        std::string       filename;
+        std::ifstream     is;
+        std::vector<char> buffer;
+        std::size_t       size { 0 }; // records in buffer
+        std::size_t       pos  { 0 }; // current record in buffer
+    };
+
+    bool less(const char *a, const char *b) const;
+
+    void sortChunk(std::size_t num_records);
+
+    void spillChunk();
+
+    bool fillRun(Run &run);
+
+    bool runAfter(std::size_t run_a, std::size_t run_b) const; // heap order
+
+    const char* current(std::size_t run) const;
+
+private:
+
+    int                               record_size;
+    std::vector<KeyField>             key;
+    std::size_t                       memory_budget;
+    std::string                       tmp_dir;
+
+    std::vector<char>                 chunk;         // records of the current chunk
+    std::vector<std::uint32_t>        order;         // sorted order of the chunk
+    std::size_t                       chunk_pos { 0 };
+
+    std::vector<std::unique_ptr<Run>> runs;
+    std::vector<std::size_t>          heap;          // runs with records left
+};
+
+} // external_sort namespace
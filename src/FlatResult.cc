@@ -0,0 +1,287 @@
+#include "FlatResult.hh"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace query {
+
+namespace result {
+
+namespace {
+
+inline uint64_t mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+inline uint64_t hashKey(const uint64_t *key, int n)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    for (int i=0;i<n;++i) {
+        h = mix(h ^ key[i]);
+    }
+    return h;
+}
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+// FlatResult Impl.
+//-----------------------------------------------------------------------------
+
+void FlatResult::reset(int num_layers)
+{
+    if (num_layers > MAX_LAYERS) {
+        throw std::runtime_error("FlatResult: too many layers");
+    }
+    this->num_layers = num_layers;
+    this->depth      = 0;
+    std::fill(&decoders[0], &decoders[MAX_LAYERS], nullptr);
+    if (values.capacity() > MAX_RETAINED_CELLS) {
+        std::vector<uint64_t>().swap(keys);
+        std::vector<Value>().swap(values);
+        std::vector<uint32_t>().swap(slots);
+        std::vector<uint32_t>().swap(order);
+    }
+    else {
+        keys.clear();
+        values.clear();
+        std::fill(slots.begin(), slots.end(), 0);
+    }
+}
+
+void FlatResult::pushKey(uint64_t key, decode_func decode)
+{
+    if (depth == num_layers) {
+        throw std::runtime_error("FlatResult: push beyond the last layer");
+    }
+    this->key[depth]      = key;
+    this->decoders[depth] = decode;
+    ++depth;
+}
+
+void FlatResult::push(const Label &label)
+{
+    if (label.size() == 0) {
+        pushKey(0, &FlatResult::decodeLabel0);
+    }
+    else if (label.size() == 1) {
+        pushKey((uint32_t) label[0], &FlatResult::decodeLabel1);
+    }
+    else if (label.size() == 2) {
+        pushKey((uint64_t) (uint32_t) label[0] | ((uint64_t) (uint32_t) label[1] << 32), &FlatResult::decodeLabel2);
+    }
+    else {
+        throw std::runtime_error("FlatResult: labels have at most two items");
+    }
+}
+
+void FlatResult::pushBin(uint32_t bin)
+{
+    pushKey(bin, &FlatResult::decodeLabel1);
+}
+
+void FlatResult::pop()
+{
+    --depth;
+}
+
+void FlatResult::store(const Value &value, ::tree_store::StoreOp op, ::tree_store::StoreMode store_mode)
+{
+    if (depth != num_layers) {
+        throw std::runtime_error("FlatResult: values are only stored on the last layer");
+    }
+    auto index = findOrInsert();
+    values[index] = evalOp(values[index], value, op, store_mode);
+}
+
+std::size_t FlatResult::size() const
+{
+    return values.size();
+}
+
+FlatResult FlatResult::part() const
+{
+    FlatResult result;
+    result.reset(num_layers);
+    return result;
+}
+
+void FlatResult::merge(const FlatResult &other)
+{
+    if (other.num_layers != num_layers || depth != 0 || other.depth != 0) {
+        throw std::runtime_error("FlatResult: merge of a different or incomplete result");
+    }
+    for (int i=0;i<num_layers;++i) {
+        if (!decoders[i])
+            decoders[i] = other.decoders[i];
+    }
+    for (std::size_t i=0;i<other.values.size();++i) {
+        std::copy(other.keys.begin() + i * num_layers, other.keys.begin() + (i + 1) * num_layers, &key[0]);
+        auto index = findOrInsert();
+        values[index] = evalOp(values[index], other.values[i], ::tree_store::ADD, ::tree_store::NORMAL);
+    }
+}
+
+uint32_t FlatResult::findOrInsert()
+{
+    if ((values.size() + 1) * 2 > slots.size()) {
+        grow();
+    }
+    std::size_t mask = slots.size() - 1;
+    std::size_t slot = hashKey(key, num_layers) & mask;
+    while (slots[slot]) {
+        uint32_t index = slots[slot] - 1;
+        if (std::equal(&key[0], &key[num_layers], keys.begin() + (std::size_t) index * num_layers)) {
+            return index;
+        }
+        slot = (slot + 1) & mask;
+    }
+    uint32_t index = (uint32_t) values.size();
+    keys.insert(keys.end(), &key[0], &key[num_layers]);
+    values.push_back(Value(::nanocube::SimpleConfig::default_value));
+    slots[slot] = index + 1;
+    return index;
+}
+
+void FlatResult::grow()
+{
+    std::size_t new_size = std::max((std::size_t) 16, slots.size() * 2);
+    slots.assign(new_size, 0);
+    std::size_t mask = new_size - 1;
+    for (uint32_t index=0;index<(uint32_t) values.size();++index) {
+        std::size_t slot = hashKey(&keys[(std::size_t) index * num_layers], num_layers) & mask;
+        while (slots[slot]) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = index + 1;
+    }
+}
+
+void FlatResult::sort()
+{
+    order.resize(values.size());
+    for (uint32_t i=0;i<(uint32_t) order.size();++i) {
+        order[i] = i;
+    }
+    const int n = num_layers;
+    const uint64_t *k = keys.data();
+    std::sort(order.begin(), order.end(), [k, n](uint32_t a, uint32_t b) {
+        return std::lexicographical_compare(k + (std::size_t) a * n, k + (std::size_t) (a + 1) * n,
+                                            k + (std::size_t) b * n, k + (std::size_t) (b + 1) * n);
+    });
+}
+
+void FlatResult::fill(::nanocube::TreeValue &tree_value)
+{
+    ::nanocube::TreeValueBuilder builder(tree_value);
+    emit(builder);
+}
+
+FlatResult::Label FlatResult::decodeLabel0(uint64_t key)
+{
+    return Label();
+}
+
+FlatResult::Label FlatResult::decodeLabel1(uint64_t key)
+{
+    return Label { (int) (uint32_t) key };
+}
+
+FlatResult::Label FlatResult::decodeLabel2(uint64_t key)
+{
+    return Label { (int) (uint32_t) key, (int) (uint32_t) (key >> 32) };
+}
+
+//-----------------------------------------------------------------------------
+// FanOutResult Impl.
+//-----------------------------------------------------------------------------
+
+FanOutResult::FanOutResult(int dimension, const std::vector<::query::Target*> &targets, int num_layers):
+    dimension(dimension),
+    targets(targets),
+    members(targets.size())
+{
+    for (auto &member: members) {
+        member.reset(num_layers);
+    }
+}
+
+void FanOutResult::select(int member)
+{
+    selected = member;
+}
+
+void FanOutResult::push(const Label &label)
+{
+    if (selected >= 0) {
+        members[selected].push(label);
+        return;
+    }
+    for (auto &member: members) {
+        member.push(label);
+    }
+}
+
+void FanOutResult::pop()
+{
+    if (selected >= 0) {
+        members[selected].pop();
+        return;
+    }
+    for (auto &member: members) {
+        member.pop();
+    }
+}
+
+void FanOutResult::store(const Value &value, ::tree_store::StoreOp op, ::tree_store::StoreMode store_mode)
+{
+    if (selected >= 0) {
+        members[selected].store(value, op, store_mode);
+        return;
+    }
+    for (auto &member: members) {
+        member.store(value, op, store_mode);
+    }
+}
+
+void FanOutResult::pushBin(uint32_t bin)
+{
+    if (selected >= 0) {
+        members[selected].pushBin(bin);
+        return;
+    }
+    for (auto &member: members) {
+        member.pushBin(bin);
+    }
+}
+
+FanOutResult FanOutResult::part() const
+{
+    FanOutResult result;
+    result.dimension = dimension;
+    result.targets   = targets;
+    for (auto &member: members) {
+        result.members.push_back(member.part());
+    }
+    return result;
+}
+
+void FanOutResult::merge(const FanOutResult &other)
+{
+    if (other.members.size() != members.size()) {
+        throw std::runtime_error("FanOutResult: merge of a different result");
+    }
+    for (std::size_t i=0;i<members.size();++i) {
+        members[i].merge(other.members[i]);
+    }
+}
+
+} // namespace result
+
+} // namespace query
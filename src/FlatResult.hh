@@ -0,0 +1,228 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "Query.hh"
+#include "tree_store_nanocube.hh"
+
+//
+// Query result accumulated on flat arrays instead of a TreeValue.
+//
+// Every anchored dimension is a layer and the label of a cell on a
+// layer is packed into one uint64_t: the raw() of a quadtree or
+// flattree address (pushed with pushAddress) or up to two label items
+// (a time bin or the x,y of an img label). A cell is the composite key
+// of its layers and cells are found on an open addressing table with
+// linear probing. Keys and values are appended to vectors that are
+// only cleared by reset, so a FlatResult reused across queries (e.g.
+// one per thread) doesn't allocate once it has grown to the size of
+// the queries it sees.
+//
+// Labels are only converted to a DimAddress on emit(), once per
+// distinct node of the result tree, instead of on every visit.
+//
+
+namespace query {
+
+namespace result {
+
+struct FlatResult {
+public:
+
+    using Label = ::nanocube::DimAddress;
+    using Value = ::nanocube::Measures;
+
+    // packed key of a layer to its label
+    using decode_func = Label (*)(uint64_t);
+
+    static const int MAX_LAYERS = ::query::QueryDescription::MAX_DIMENSIONS;
+
+    // larger arrays are released on reset
+    static const std::size_t MAX_RETAINED_CELLS = 1 << 20;
+
+public:
+
+    FlatResult() = default;
+
+    void reset(int num_layers);
+
+    // same interface as ::query::result::Result (labels of at most two
+    // items; all labels of a layer must have the same size)
+    void push(const Label &label);
+    void pop();
+    void store(const Value &value, ::tree_store::StoreOp op=::tree_store::SET, ::tree_store::StoreMode store_mode=::tree_store::NORMAL);
+
+    template <typename Address>
+    void pushAddress(const Address &address);
+
+    void pushBin(uint32_t bin);
+
+    std::size_t size() const;
+
+    // empty result with the same layers, for a part of the query
+    // evaluated on another thread
+    FlatResult part() const;
+
+    // adds up the cells of a part into this result
+    void merge(const FlatResult &other);
+
+    // pushes, stores and pops every cell on a builder in depth first
+    // order (e.g. an encoder of the result): cells are sorted by key and
+    // share the pushes of their common prefix with the previous cell
+    template <typename Builder>
+    void emit(Builder &builder);
+
+    // stores every cell on a TreeValue with num_layers levels
+    void fill(::nanocube::TreeValue &tree_value);
+
+private:
+
+    // cell indices on order, sorted by key
+    void sort();
+
+    void pushKey(uint64_t key, decode_func decode);
+
+    uint32_t findOrInsert();
+
+    void grow();
+
+    template <typename Address>
+    static Label decodeAddress(uint64_t key);
+
+    static Label decodeLabel0(uint64_t key);
+    static Label decodeLabel1(uint64_t key);
+    static Label decodeLabel2(uint64_t key);
+
+private:
+
+    int                   num_layers { 0 };
+    int                   depth      { 0 };
+
+    uint64_t              key[MAX_LAYERS];         // current cell
+    decode_func           decoders[MAX_LAYERS] {}; // set on the first push of a layer
+
+    std::vector<uint64_t> keys;   // num_layers words per cell
+    std::vector<Value>    values; // one per cell
+    std::vector<uint32_t> slots;  // cell index + 1 (0 is an empty slot)
+    std::vector<uint32_t> order;  // cells sorted by key on fill
+};
+
+//-----------------------------------------------------------------------------
+// FanOutResult
+//-----------------------------------------------------------------------------
+
+//
+// Flat results of queries that only differ on the target of one
+// dimension (e.g. dive(tile2d(...)) tiles under the same filters),
+// evaluated on a single traversal: the query on dimension `dimension`
+// visits the target of each member in turn (see NanoCubeQuery.hh) and
+// what is pushed, stored and popped meanwhile only goes to that
+// member. The rest, e.g. the labels of the dimensions before, goes to
+// every member.
+//
+struct FanOutResult {
+public:
+
+    using Label = FlatResult::Label;
+    using Value = FlatResult::Value;
+
+public:
+
+    FanOutResult() = default;
+
+    // one member per target; members are reset to num_layers
+    FanOutResult(int dimension, const std::vector<::query::Target*> &targets, int num_layers);
+
+    // member that receives the calls (-1: all of them)
+    void select(int member);
+
+    void push(const Label &label);
+    void pop();
+    void store(const Value &value, ::tree_store::StoreOp op=::tree_store::SET, ::tree_store::StoreMode store_mode=::tree_store::NORMAL);
+
+    template <typename Address>
+    void pushAddress(const Address &address);
+
+    void pushBin(uint32_t bin);
+
+    // same targets and empty members (see FlatResult::part)
+    FanOutResult part() const;
+
+    void merge(const FanOutResult &other);
+
+public:
+
+    int                           dimension { -1 };
+    std::vector<::query::Target*> targets;
+    std::vector<FlatResult>       members;
+
+private:
+
+    int                           selected  { -1 };
+};
+
+//-----------------------------------------------------------------------------
+// FlatResult Impl.
+//-----------------------------------------------------------------------------
+
+template <typename Address>
+void FlatResult::pushAddress(const Address &address)
+{
+    pushKey(address.raw(), &FlatResult::decodeAddress<Address>);
+}
+
+template <typename Builder>
+void FlatResult::emit(Builder &builder)
+{
+    sort();
+    const int n = num_layers;
+    const uint64_t *previous = nullptr;
+    for (auto index: order) {
+        const uint64_t *current = keys.data() + (std::size_t) index * n;
+        int common = 0;
+        if (previous) {
+            common = (int) (std::mismatch(previous, previous + n, current).first - previous);
+            for (int i=common;i<n;++i) {
+                builder.pop();
+            }
+        }
+        for (int i=common;i<n;++i) {
+            builder.push(decoders[i](current[i]));
+        }
+        builder.store(values[index]);
+        previous = current;
+    }
+    if (previous) {
+        for (int i=0;i<n;++i) {
+            builder.pop();
+        }
+    }
+}
+
+template <typename Address>
+FlatResult::Label FlatResult::decodeAddress(uint64_t key)
+{
+    return Address(key).getDimensionPath();
+}
+
+//-----------------------------------------------------------------------------
+// FanOutResult Impl.
+//-----------------------------------------------------------------------------
+
+template <typename Address>
+void FanOutResult::pushAddress(const Address &address)
+{
+    if (selected >= 0) {
+        members[selected].pushAddress(address);
+        return;
+    }
+    for (auto &member: members) {
+        member.pushAddress(address);
+    }
+}
+
+} // namespace result
+
+} // namespace query
@@ -10,12 +10,15 @@
 
 #ifndef FLATTREE_VECTOR
 #include "small_vector.hh"
+#include "SlabAllocator.hh"
 #endif
 
 #include "ContentHolder.hh"
 
 #include "cache.hh"
 #include "polycover/labeled_tree.hh"
+#include "polycover/packed_tree.hh"
+#include "polycover/interval_mask.hh"
 
 //
 // Needed Mechanisms
@@ -33,6 +36,8 @@ namespace flattree
     using DimensionPath = std::vector<int>; // matching tree_store_nanocube.hh
     
     using Mask = polycover::labeled_tree::Node;
+    using PackedMaskCursor = polycover::labeled_tree::PackedCursor;
+    using MaskIntervals = polycover::labeled_tree::IntervalMask;
     
         using Cache = nanocube::Cache;
 
@@ -53,13 +58,13 @@ using contentholder::ContentHolder;
 // Forward Declarations
 //-----------------------------------------------------------------------------
 
-template <typename Content>
+template <typename Content, typename Policy=tagged_pointer::DefaultPolicy>
 struct Node;
 
-template <typename Content>
+template <typename Content, typename Policy=tagged_pointer::DefaultPolicy>
 struct Iterator;
 
-template <typename Content>
+template <typename Content, typename Policy=tagged_pointer::DefaultPolicy>
 struct FlatTree;
 
 //-----------------------------------------------------------------------------
@@ -120,8 +125,8 @@ std::ostream& operator<<(std::ostream &os, const Address<Structure>& addr);
 
 typedef uint8_t NodeType;
 
-template <typename Content>
-struct Node: public ContentHolder<Content>
+template <typename Content, typename Policy>
+struct Node: public ContentHolder<Content, Policy>
 {
     static const NodeType LINK     = 1;
     static const NodeType FLATTREE = 2;
@@ -137,13 +142,13 @@ protected:
 // Link
 //-----------------------------------------------------------------------------
 
-template <typename Content>
-struct Link: public Node<Content>
+template <typename Content, typename Policy>
+struct Link: public Node<Content, Policy>
 {
     Link();
     Link(PathElement label);
 
-    Node<Content> &asNode();
+    Node<Content, Policy> &asNode();
 
     PathElement    label;
 };
@@ -153,16 +158,17 @@ struct Link: public Node<Content>
 // FlatTree
 //-----------------------------------------------------------------------------
 
-template <typename Content>
-struct FlatTree: public Node<Content>
+template <typename Content, typename Policy>
+struct FlatTree: public Node<Content, Policy>
 {
 public:
-    typedef FlatTree<Content>              Type;
-    typedef Node<Content>                  NodeType;
+    typedef FlatTree<Content, Policy>      Type;
+    typedef Node<Content, Policy>          NodeType;
     typedef Address<Type>                  AddressType;
     typedef Content                        ContentType;
+    typedef Policy                         PolicyType;
     typedef std::vector<NodeType*>         NodeStackType;
-    typedef Iterator<Content>              IteratorType;
+    typedef Iterator<Content, Policy>      IteratorType;
 
 #if 0
 public: // static services for allocation and memory usage count
@@ -182,9 +188,9 @@ public:
     static void* operator new(size_t size);
     static void  operator delete(void *p);
 
-    static uint64_t count_new;
-    static uint64_t count_delete;
-    static uint64_t count_entries; // number of total level 1 nodes across all flattrees
+    static std::atomic<uint64_t> count_new;
+    static std::atomic<uint64_t> count_delete;
+    static std::atomic<uint64_t> count_entries; // number of total level 1 nodes across all flattrees
 
 public:
 
@@ -203,7 +209,7 @@ public:
                                         std::vector<void*>&   parallel_replaced_nodes,
                                         NodeStackType&        stack);
 
-    Node<Content>* find(AddressType &addr);
+    Node<Content, Policy>* find(AddressType &addr);
 
     void dump(std::ostream& os);
 
@@ -222,7 +228,10 @@ public:
     void visitSequence(const std::vector<RawAddress> &seq, Visitor &visitor, Cache& cache);
 
     template <typename Visitor>
-    void visitExistingTreeLeaves(const Mask* mask, Visitor &visitor);
+    void visitExistingTreeLeaves(const PackedMaskCursor &mask, Visitor &visitor);
+
+    template <typename Visitor>
+    void visitExistingTreeLeaves(const MaskIntervals &mask, Visitor &visitor);
 
     FlatTree();
     ~FlatTree();
@@ -230,7 +239,7 @@ public:
 private:
 
 
-    Link<Content>* getLink(PathElement e, bool create_if_not_found=false);
+    Link<Content, Policy>* getLink(PathElement e, bool create_if_not_found=false);
 
 //    Node<Content>* addChild(PathElement label);
 //    Node<Content>* getProperChildCreateIfNeed(PathElement e); //
@@ -239,9 +248,9 @@ private:
 public:
 
 #ifndef FLATTREE_VECTOR
-    small_vector::small_vector<Link<Content> > links;
+    small_vector::small_vector<Link<Content, Policy> > links;
 #else
-    std::vector<Link<Content> > links;
+    std::vector<Link<Content, Policy>, slab::Allocator<Link<Content, Policy>> > links;
 #endif
 
 };
@@ -251,7 +260,7 @@ public:
 //-----------------------------------------------------------------------------
 
 // Iterate through all parent-child relations
-template <typename Content>
+template <typename Content, typename Policy>
 struct Iterator {
 
 public: // constants
@@ -259,8 +268,8 @@ public: // constants
     static const bool PROPER = false;
 
 public: // subtypes
-    typedef FlatTree<Content>                    tree_type;
-    typedef typename FlatTree<Content>::NodeType node_type;
+    typedef FlatTree<Content, Policy>                    tree_type;
+    typedef typename FlatTree<Content, Policy>::NodeType node_type;
 
 public: // constructor
     Iterator(const tree_type &tree);
@@ -313,13 +322,13 @@ public:
 // checkout default values on declaration they are
 // important for sync purposes.
 //
-template <typename Content>
-Iterator<Content>::Iterator(const tree_type& tree):
+template <typename Content, typename Policy>
+Iterator<Content, Policy>::Iterator(const tree_type& tree):
     tree(tree)
 {}
 
-template <typename Content>
-bool Iterator<Content>::next() {
+template <typename Content, typename Policy>
+bool Iterator<Content, Policy>::next() {
     current_index++;
     if (current_level == 0) {
         if  (current_index==0) {
@@ -352,11 +361,11 @@ bool Iterator<Content>::next() {
 // Output
 //-----------------------------------------------------------------------------
 
-template <typename Content>
-std::ostream& operator<<(std::ostream &o, const FlatTree<Content>& ft);
+template <typename Content, typename Policy>
+std::ostream& operator<<(std::ostream &o, const FlatTree<Content, Policy>& ft);
 
-template<typename Content>
-std::ostream& operator<<(std::ostream &o, const Link<Content>& ts);
+template<typename Content, typename Policy>
+std::ostream& operator<<(std::ostream &o, const Link<Content, Policy>& ts);
 
 //-----------------------------------------------------------------------------
 // Impl. Address Template Members
@@ -450,27 +459,27 @@ PathElement Address<Structure>::operator[](PathIndex index) const
 // Node Impl.
 //----------------------------------------------------------------------------
 
-template <typename Content>
-Node<Content>::Node(NodeType type):
-    ContentHolder<Content>()
+template <typename Content, typename Policy>
+Node<Content, Policy>::Node(NodeType type):
+    ContentHolder<Content, Policy>()
 {
     this->setUserData(type);
 }
 
-template <typename Content>
+template <typename Content, typename Policy>
 NumChildren
-Node<Content>::getNumChildren() const
+Node<Content, Policy>::getNumChildren() const
 {
-    using FlatTree = FlatTree<Content>;
-    if (getNodeType() == Node<Content>::LINK)
+    using FlatTree = FlatTree<Content, Policy>;
+    if (getNodeType() == Node<Content, Policy>::LINK)
         return 0;
     else // flattree
         return (reinterpret_cast<const FlatTree*>(this))->links.size();
 }
 
-template <typename Content>
+template <typename Content, typename Policy>
 NodeType
-Node<Content>::getNodeType() const
+Node<Content, Policy>::getNodeType() const
 {
     return this->getUserData();
 }
@@ -479,47 +488,47 @@ Node<Content>::getNodeType() const
 // Impl. Link Template Memebers
 //-----------------------------------------------------------------------------
 
-template <typename Content>
-Link<Content>::Link():
-    Node<Content>(Node<Content>::LINK),
+template <typename Content, typename Policy>
+Link<Content, Policy>::Link():
+    Node<Content, Policy>(Node<Content, Policy>::LINK),
     label(0)
 {}
 
-template <typename Content>
-Link<Content>::Link(PathElement label):
-    Node<Content>(Node<Content>::LINK),
+template <typename Content, typename Policy>
+Link<Content, Policy>::Link(PathElement label):
+    Node<Content, Policy>(Node<Content, Policy>::LINK),
     label(label)
 {}
 
-template <typename Content>
-Node<Content> &Link<Content>::asNode()
+template <typename Content, typename Policy>
+Node<Content, Policy> &Link<Content, Policy>::asNode()
 {
-    return static_cast<Node<Content>&>(*this);
+    return static_cast<Node<Content, Policy>&>(*this);
 }
 
 //-----------------------------------------------------------------------------
 // Impl. FlatTree Template Members
 //-----------------------------------------------------------------------------
 
-template <typename Content>
-uint64_t FlatTree<Content>::count_new = 0;
+template <typename Content, typename Policy>
+std::atomic<uint64_t> FlatTree<Content, Policy>::count_new { 0 };
 
-template <typename Content>
-uint64_t FlatTree<Content>::count_delete = 0;
+template <typename Content, typename Policy>
+std::atomic<uint64_t> FlatTree<Content, Policy>::count_delete { 0 };
 
-template <typename Content>
-uint64_t FlatTree<Content>::count_entries = 0;
+template <typename Content, typename Policy>
+std::atomic<uint64_t> FlatTree<Content, Policy>::count_entries { 0 };
 
-template <typename Content>
-void* FlatTree<Content>::operator new(size_t size) {
+template <typename Content, typename Policy>
+void* FlatTree<Content, Policy>::operator new(size_t size) {
     count_new++;
-    return ::operator new(size);
+    return slab::allocate(size);
 }
 
-template <typename Content>
-void FlatTree<Content>::operator delete(void *p) {
+template <typename Content, typename Policy>
+void FlatTree<Content, Policy>::operator delete(void *p) {
     count_delete++;
-    ::operator delete(p);
+    slab::deallocate(p, sizeof(FlatTree<Content, Policy>));
 }
 
 //
@@ -529,9 +538,9 @@ void FlatTree<Content>::operator delete(void *p) {
 // is going to be sent to all the contents of the
 // given path.
 //
-template <typename Content>
-Node<Content>*
-FlatTree<Content>::trailProperPath(AddressType addr, FlatTree::NodeStackType &stack)
+template <typename Content, typename Policy>
+Node<Content, Policy>*
+FlatTree<Content, Policy>::trailProperPath(AddressType addr, FlatTree::NodeStackType &stack)
 {
     assert(addr.getPathSize()<=1);
 
@@ -540,7 +549,7 @@ FlatTree<Content>::trailProperPath(AddressType addr, FlatTree::NodeStackType &st
 
     if (addr.getPathSize() == 1)
     {
-        Node<Content> *child = this->getLink(addr.singleton_path_element, true);
+        Node<Content, Policy> *child = this->getLink(addr.singleton_path_element, true);
         stack.push_back(child); // add root
         return child;
     }
@@ -550,14 +559,14 @@ FlatTree<Content>::trailProperPath(AddressType addr, FlatTree::NodeStackType &st
 }
 
 
-template <typename Content>
+template <typename Content, typename Policy>
 void
-FlatTree<Content>::prepareProperOutdatedPath(FlatTree*                  parallel_structure,
+FlatTree<Content, Policy>::prepareProperOutdatedPath(FlatTree*                  parallel_structure,
                                              FlatTree::AddressType      address,
                                              std::vector<void*>&        parallel_replaced_nodes,
                                              FlatTree::NodeStackType&   stack)
 {
-    //std::cout << "FlatTree<Content>::prepareProperOutdatedPath(...): address == " << address << std::endl;
+    //std::cout << "FlatTree<Content, Policy>::prepareProperOutdatedPath(...): address == " << address << std::endl;
     
     // same implementation as trailProperPath
     // there is no gain on a flattree to share
@@ -582,7 +591,7 @@ FlatTree<Content>::prepareProperOutdatedPath(FlatTree*                  parallel
         bool needs_to_update_child = true;
 
         // get child. maybe doesn't need to be updated...
-        Node<Content> *child = this->getLink(address.singleton_path_element, false);
+        Node<Content, Policy> *child = this->getLink(address.singleton_path_element, false);
         if (child == nullptr) {
             child = this->getLink(address.singleton_path_element, true);
             child->setSharedContent(parallel_child->getContent());
@@ -616,7 +625,7 @@ FlatTree<Content>::prepareProperOutdatedPath(FlatTree*                  parallel
     }
 
     else {
-        Node<Content> *child = this->getLink(address.singleton_path_element, true);
+        Node<Content, Policy> *child = this->getLink(address.singleton_path_element, true);
         stack.push_back(child);
         stack.push_back(nullptr);
         // return child;
@@ -629,9 +638,9 @@ FlatTree<Content>::prepareProperOutdatedPath(FlatTree*                  parallel
 // The idea is that a message is going to be
 // sent to all the contents of the given path.
 //
-template <typename Content>
-Node<Content>*
-FlatTree<Content>::find(AddressType &addr)
+template <typename Content, typename Policy>
+Node<Content, Policy>*
+FlatTree<Content, Policy>::find(AddressType &addr)
 {
     assert(addr.getPathSize()<=1);
 
@@ -642,14 +651,14 @@ FlatTree<Content>::find(AddressType &addr)
     }
     else // if (addr.getPathSize() == 1)
     {
-        Node<Content> *child = this->getLink(addr.singleton_path_element, false);
+        Node<Content, Policy> *child = this->getLink(addr.singleton_path_element, false);
         return child;
     }
 }
 
-template <typename Content>
+template <typename Content, typename Policy>
 template <typename Visitor>
-void FlatTree<Content>::visitSubnodes(AddressType address, Level targetLevelOffset, Visitor &visitor)
+void FlatTree<Content, Policy>::visitSubnodes(AddressType address, Level targetLevelOffset, Visitor &visitor)
 {
 //    Level targetLevel = (address.isEmpty() ? 0 : 1) + targetLevelOffset;
 //    assert(targetLevel <= 1);
@@ -664,7 +673,7 @@ void FlatTree<Content>::visitSubnodes(AddressType address, Level targetLevelOffs
     }
     else if (address.isEmpty() && targetLevelOffset == 1) {
         // loop
-        for (Link<Content> &link: this->links) {
+        for (Link<Content, Policy> &link: this->links) {
             AddressType addr(link.label);
             visitor.visit(static_cast<NodeType*>(&link), addr);
         }
@@ -675,9 +684,9 @@ void FlatTree<Content>::visitSubnodes(AddressType address, Level targetLevelOffs
 //
 // Report each link once
 //
-template <typename Content>
+template <typename Content, typename Policy>
 template <typename Visitor>
-void FlatTree<Content>::visitAllNodes(Visitor &visitor)
+void FlatTree<Content, Policy>::visitAllNodes(Visitor &visitor)
 {
 //    Level targetLevel = (address.isEmpty() ? 0 : 1) + targetLevelOffset;
 //    assert(targetLevel <= 1);
@@ -691,7 +700,7 @@ void FlatTree<Content>::visitAllNodes(Visitor &visitor)
     }
     else if (address.isEmpty() && targetLevelOffset == 1) {
         // loop
-        for (Link<Content> &link: this->links) {
+        for (Link<Content, Policy> &link: this->links) {
             AddressType addr(link.label);
             visitor.visit(static_cast<NodeType*>(&link), addr);
         }
@@ -700,9 +709,9 @@ void FlatTree<Content>::visitAllNodes(Visitor &visitor)
 #endif
 
 
-template <typename Content>
+template <typename Content, typename Policy>
 template <typename Visitor>
-void FlatTree<Content>::visitRange(AddressType min_address, AddressType max_address, Visitor &visitor)
+void FlatTree<Content, Policy>::visitRange(AddressType min_address, AddressType max_address, Visitor &visitor)
 {
     for (PathElement e=min_address.singleton_path_element;e<=max_address.singleton_path_element;e++)
     {
@@ -715,17 +724,23 @@ void FlatTree<Content>::visitRange(AddressType min_address, AddressType max_addr
 
 
 // polygon visit (cache first preprocessing)
-template <typename Content>
+template <typename Content, typename Policy>
 template <typename Visitor>
-void FlatTree<Content>::visitSequence(const std::vector<RawAddress> &seq, Visitor &visitor, Cache& cache) {
+void FlatTree<Content, Policy>::visitSequence(const std::vector<RawAddress> &seq, Visitor &visitor, Cache& cache) {
     for (auto raw_address: seq) {
         this->visitSubnodes(AddressType(raw_address),0,visitor);
     }
 }
 
-    template<typename Content>
+    template<typename Content, typename Policy>
+    template <typename Visitor>
+    void FlatTree<Content, Policy>::visitExistingTreeLeaves(const PackedMaskCursor &mask, Visitor &visitor) {
+        throw std::runtime_error("not available");
+    }
+
+    template<typename Content, typename Policy>
     template <typename Visitor>
-    void FlatTree<Content>::visitExistingTreeLeaves(const Mask* mask, Visitor &visitor) {
+    void FlatTree<Content, Policy>::visitExistingTreeLeaves(const MaskIntervals &mask, Visitor &visitor) {
         throw std::runtime_error("not available");
     }
 
@@ -733,15 +748,15 @@ void FlatTree<Content>::visitSequence(const std::vector<RawAddress> &seq, Visito
 // Node Implementation
 //
 
-template <typename Content>
-FlatTree<Content>::FlatTree(): Node<Content>(Node<Content>::FLATTREE)
+template <typename Content, typename Policy>
+FlatTree<Content, Policy>::FlatTree(): Node<Content, Policy>(Node<Content, Policy>::FLATTREE)
 {}
 
-template <typename Content>
-FlatTree<Content>::~FlatTree()
+template <typename Content, typename Policy>
+FlatTree<Content, Policy>::~FlatTree()
 {
     // delete content of children nodes
-    for (Link<Content> &link: this->links) {
+    for (Link<Content, Policy> &link: this->links) {
         if (link.contentIsProper()) {
             delete link.getContent();
         }
@@ -755,8 +770,8 @@ FlatTree<Content>::~FlatTree()
 //    std::cerr << "~FlatTree " << this << std::endl;
 }
 
-template <typename Content>
-void FlatTree<Content>::dump(std::ostream& os)
+template <typename Content, typename Policy>
+void FlatTree<Content, Policy>::dump(std::ostream& os)
 {
     os << "FlatTree, tag: "
        << (int) this->data.getTag()
@@ -775,11 +790,11 @@ void FlatTree<Content>::dump(std::ostream& os)
 }
 
 
-template <typename Content>
-FlatTree<Content>*
-FlatTree<Content>::makeLazyCopy() const
+template <typename Content, typename Policy>
+FlatTree<Content, Policy>*
+FlatTree<Content, Policy>::makeLazyCopy() const
 {
-    FlatTree<Content> *copy = new FlatTree<Content>();
+    FlatTree<Content, Policy> *copy = new FlatTree<Content, Policy>();
 
     copy->setSharedContent(this->getContent()); // TODO: check the semantics of the lazy copy
                                                 // in regards to the content
@@ -793,21 +808,21 @@ FlatTree<Content>::makeLazyCopy() const
     return copy;
 }
 
-template <typename Content>
-inline bool compare_links(const Link<Content> &a, const Link<Content> &b)
+template <typename Content, typename Policy>
+inline bool compare_links(const Link<Content, Policy> &a, const Link<Content, Policy> &b)
 {
     return (a.label < b.label);
 }
 
-template <typename Content>
-Link<Content> *
-FlatTree<Content>::getLink(PathElement e, bool create_if_not_found)
+template <typename Content, typename Policy>
+Link<Content, Policy> *
+FlatTree<Content, Policy>::getLink(PathElement e, bool create_if_not_found)
 {
-    Link<Content> link(e);
-    auto it = std::lower_bound(links.begin(),links.end(),link,compare_links<Content>);
+    Link<Content, Policy> link(e);
+    auto it = std::lower_bound(links.begin(),links.end(),link,compare_links<Content, Policy>);
     if (it != links.end() && it->label == e)
     {
-        return const_cast<Link<Content>*>(&*it);
+        return const_cast<Link<Content, Policy>*>(&*it);
     }
     else
     {
@@ -817,27 +832,27 @@ FlatTree<Content>::getLink(PathElement e, bool create_if_not_found)
         {
             count_entries++; // global count of nodes of level 1
 
-            Link<Content> aux(e);
+            Link<Content, Policy> aux(e);
             auto it2 = links.insert(it, aux);
-            return const_cast<Link<Content>*>(&*it2);
+            return const_cast<Link<Content, Policy>*>(&*it2);
 
         }
     }
 }
 
-template <typename Content>
-Count FlatTree<Content>::getMemoryUsage() const
+template <typename Content, typename Policy>
+Count FlatTree<Content, Policy>::getMemoryUsage() const
 {
-    Count result = sizeof(FlatTree<Content>);
-    result += links.size() * sizeof(Link<Content>);
+    Count result = sizeof(FlatTree<Content, Policy>);
+    result += links.size() * sizeof(Link<Content, Policy>);
 //    for (auto &link: links)
 //        if (link.proper)
 //            result += link.node->getMemoryUsage();
     return result;
 }
 
-template <typename Content>
-Node<Content> *FlatTree<Content>::getRoot()
+template <typename Content, typename Policy>
+Node<Content, Policy> *FlatTree<Content, Policy>::getRoot()
 {
     return this;
 }
@@ -846,16 +861,16 @@ Node<Content> *FlatTree<Content>::getRoot()
 // Output
 //-----------------------------------------------------------------------------
 
-template <typename Content>
-std::ostream& operator<<(std::ostream &o, const FlatTree<Content>& ft)
+template <typename Content, typename Policy>
+std::ostream& operator<<(std::ostream &o, const FlatTree<Content, Policy>& ft)
 {
     o << "[flattree: " << ft.getNumChildren() << "] ";
     return o;
 }
 
-template<typename Content>
+template<typename Content, typename Policy>
 std::ostream& operator<<(std::ostream &o,
-                         const Link<Content>& ts)
+                         const Link<Content, Policy>& ts)
 {
     o << "[Link: " << static_cast<int>(ts.label) << "] ";
     return o;
@@ -9,6 +9,8 @@
 #include "cache.hh"
 
 #include "polycover/labeled_tree.hh"
+#include "polycover/packed_tree.hh"
+#include "polycover/interval_mask.hh"
 
 //-----------------------------------------------------------------------------
 // DECLARATIONS
@@ -19,6 +21,8 @@ namespace flattree_n {
     using DimensionPath = std::vector<int>; // matching tree_store_nanocube.hh
     
     using Mask = polycover::labeled_tree::Node;
+    using PackedMaskCursor = polycover::labeled_tree::PackedCursor;
+    using MaskIntervals = polycover::labeled_tree::IntervalMask;
     
     using Cache = nanocube::Cache;
 
@@ -125,8 +129,8 @@ using NumChildren = uint32_t;
 
 enum NodeType { LINK=1, FLATTREE=2 };
 
-template <NumBytes N, typename Content>
-struct Node: public contentholder::ContentHolder<Content> {
+template <NumBytes N, typename Content, typename Policy=tagged_pointer::DefaultPolicy>
+struct Node: public contentholder::ContentHolder<Content, Policy> {
     NumChildren getNumChildren() const;
     NodeType    getNodeType() const;
 protected:
@@ -138,9 +142,9 @@ protected:
 //--------------------------------------------------------------------
 
 template <typename Structure>
-struct Link: public Node<Structure::Size, typename Structure::ContentType>
+struct Link: public Node<Structure::Size, typename Structure::ContentType, typename Structure::PolicyType>
 {
-    using NodeType = Node<Structure::Size, typename Structure::ContentType>;
+    using NodeType = Node<Structure::Size, typename Structure::ContentType, typename Structure::PolicyType>;
 
     Link();
     Link(RawAddress addr);
@@ -162,8 +166,8 @@ struct Link: public Node<Structure::Size, typename Structure::ContentType>
 // FlatTree
 //--------------------------------------------------------------------
 
-template <NumBytes N, typename Content>
-struct FlatTree: public Node<N, Content> {
+template <NumBytes N, typename Content, typename Policy=tagged_pointer::DefaultPolicy>
+struct FlatTree: public Node<N, Content, Policy> {
 
 public: // constants
 
@@ -173,7 +177,8 @@ public: // constants
 public: // subtypes
 
     using ContentType   = Content;
-    using NodeType      = Node<Size, ContentType>;
+    using PolicyType    = Policy;
+    using NodeType      = Node<Size, ContentType, PolicyType>;
     using LinkType      = Link<FlatTree>;
     using AddressType   = Address<FlatTree>;
     using NodeStackType = std::vector<NodeType*>;
@@ -185,6 +190,9 @@ public: // methods
 
     ~FlatTree();
 
+    static void* operator new(size_t size);
+    static void  operator delete(void *p);
+
     auto getRoot() -> NodeType*;
 
     auto getLink(RawAddress raw_address, bool create_if_not_found) -> LinkType*;
@@ -215,7 +223,10 @@ public: // methods
     void visitSequence(const std::vector<RawAddress> &seq, Visitor &visitor, Cache& cache);
     
     template <typename Visitor>
-    void visitExistingTreeLeaves(const Mask* mask, Visitor &visitor);
+    void visitExistingTreeLeaves(const PackedMaskCursor &mask, Visitor &visitor);
+
+    template <typename Visitor>
+    void visitExistingTreeLeaves(const MaskIntervals &mask, Visitor &visitor);
 
 
     std::vector<LinkType> links; // TODO: replace with something more space efficient (3 pointers in here)
@@ -301,17 +312,17 @@ bool Address<Structure>::read(std::istream &is)
 // Node Impl.
 //-----------------------------------------------------------------------------
 
-template<NumBytes N, typename Content>
-Node<N, Content>::Node(NodeType type):
-    contentholder::ContentHolder<Content>()
+template<NumBytes N, typename Content, typename Policy>
+Node<N, Content, Policy>::Node(NodeType type):
+    contentholder::ContentHolder<Content, Policy>()
 {
     this->setUserData(type);
 }
 
-template <NumBytes N, typename Content>
-auto Node<N,Content>::getNumChildren() const -> NumChildren
+template <NumBytes N, typename Content, typename Policy>
+auto Node<N, Content, Policy>::getNumChildren() const -> NumChildren
 {
-    using FlatTree = FlatTree<N,Content>;
+    using FlatTree = FlatTree<N, Content, Policy>;
 
     if (getNodeType() == LINK)
         return 0;
@@ -319,8 +330,8 @@ auto Node<N,Content>::getNumChildren() const -> NumChildren
         return (reinterpret_cast<const FlatTree*>(this))->links.size();
 }
 
-template <NumBytes N, typename Content>
-auto Node<N, Content>::getNodeType() const -> NodeType
+template <NumBytes N, typename Content, typename Policy>
+auto Node<N, Content, Policy>::getNodeType() const -> NodeType
 {
     return (NodeType) this->getUserData();
 }
@@ -355,13 +366,13 @@ RawAddress Link<Structure>::getRawAddress() const
 // FlatTree Impl.
 //-----------------------------------------------------------------------------
 
-template<NumBytes N, typename Content>
-FlatTree<N, Content>::FlatTree():
+template<NumBytes N, typename Content, typename Policy>
+FlatTree<N, Content, Policy>::FlatTree():
     NodeType(FLATTREE)
 {}
 
-template<NumBytes N, typename Content>
-auto FlatTree<N, Content>::find(const FlatTree::AddressType &addr) -> NodeType*
+template<NumBytes N, typename Content, typename Policy>
+auto FlatTree<N, Content, Policy>::find(const FlatTree::AddressType &addr) -> NodeType*
 {
     if (addr.isEmpty()) {
         return this;
@@ -371,8 +382,8 @@ auto FlatTree<N, Content>::find(const FlatTree::AddressType &addr) -> NodeType*
     }
 }
 
-template<NumBytes N, typename Content>
-void FlatTree<N, Content>::prepareProperOutdatedPath(FlatTree*                parallel_structure,
+template<NumBytes N, typename Content, typename Policy>
+void FlatTree<N, Content, Policy>::prepareProperOutdatedPath(FlatTree*                parallel_structure,
                                                      FlatTree::AddressType    address,
                                                      std::vector<void *>&     parallel_replaced_nodes,
                                                      FlatTree::NodeStackType& stack)
@@ -448,9 +459,9 @@ void FlatTree<N, Content>::prepareProperOutdatedPath(FlatTree*                pa
 
 
 
-template <NumBytes N, typename Content>
+template <NumBytes N, typename Content, typename Policy>
 template <typename Visitor>
-void FlatTree<N, Content>::visitSubnodes(AddressType address, Level targetLevelOffset, Visitor &visitor)
+void FlatTree<N, Content, Policy>::visitSubnodes(AddressType address, Level targetLevelOffset, Visitor &visitor)
 {
 //    Level targetLevel = (address.isEmpty() ? 0 : 1) + targetLevelOffset;
 //    assert(targetLevel <= 1);
@@ -471,9 +482,9 @@ void FlatTree<N, Content>::visitSubnodes(AddressType address, Level targetLevelO
     }
 }
 
-template <NumBytes N, typename Content>
+template <NumBytes N, typename Content, typename Policy>
 template <typename Visitor>
-void FlatTree<N, Content>::visitRange(AddressType min_address, AddressType max_address, Visitor &visitor)
+void FlatTree<N, Content, Policy>::visitRange(AddressType min_address, AddressType max_address, Visitor &visitor)
 {
     for (RawAddress e=min_address.raw();e<=max_address.raw();e++)
     {
@@ -486,9 +497,9 @@ void FlatTree<N, Content>::visitRange(AddressType min_address, AddressType max_a
     }
 }
 
-template <NumBytes N, typename Content>
+template <NumBytes N, typename Content, typename Policy>
 template <typename Visitor>
-void FlatTree<N, Content>::visitSequence(const std::vector<RawAddress> &seq, Visitor &visitor, Cache& cache)
+void FlatTree<N, Content, Policy>::visitSequence(const std::vector<RawAddress> &seq, Visitor &visitor, Cache& cache)
 {
     for (auto raw_address: seq) {
         this->visitSubnodes(AddressType(raw_address),0,visitor);
@@ -497,15 +508,21 @@ void FlatTree<N, Content>::visitSequence(const std::vector<RawAddress> &seq, Vis
 }
     
     
-    template<NumBytes N, typename Content>
+    template<NumBytes N, typename Content, typename Policy>
+    template <typename Visitor>
+    void FlatTree<N, Content, Policy>::visitExistingTreeLeaves(const PackedMaskCursor &mask, Visitor &visitor) {
+        throw std::runtime_error("not available");
+    }
+
+    template<NumBytes N, typename Content, typename Policy>
     template <typename Visitor>
-    void FlatTree<N,Content>::visitExistingTreeLeaves(const Mask* mask, Visitor &visitor) {
+    void FlatTree<N, Content, Policy>::visitExistingTreeLeaves(const MaskIntervals &mask, Visitor &visitor) {
         throw std::runtime_error("not available");
     }
 
 
-template<NumBytes N, typename Content>
-auto FlatTree<N, Content>::getLink(RawAddress raw_address, bool create_if_not_found) -> LinkType*
+template<NumBytes N, typename Content, typename Policy>
+auto FlatTree<N, Content, Policy>::getLink(RawAddress raw_address, bool create_if_not_found) -> LinkType*
 {
     auto compare = [](const Link<FlatTree>& link, RawAddress raw_address) {
         return (link.getRawAddress() < raw_address);
@@ -529,8 +546,8 @@ auto FlatTree<N, Content>::getLink(RawAddress raw_address, bool create_if_not_fo
     }
 }
 
-template <NumBytes N, typename Content>
-auto FlatTree<N, Content>::makeLazyCopy() const -> FlatTree*
+template <NumBytes N, typename Content, typename Policy>
+auto FlatTree<N, Content, Policy>::makeLazyCopy() const -> FlatTree*
 {
     FlatTree *copy = new FlatTree();
 
@@ -545,8 +562,20 @@ auto FlatTree<N, Content>::makeLazyCopy() const -> FlatTree*
 }
 
 
-template <NumBytes N, typename Content>
-FlatTree<N, Content>::~FlatTree()
+template <NumBytes N, typename Content, typename Policy>
+void* FlatTree<N, Content, Policy>::operator new(size_t size)
+{
+    return slab::allocate(size);
+}
+
+template <NumBytes N, typename Content, typename Policy>
+void FlatTree<N, Content, Policy>::operator delete(void *p)
+{
+    slab::deallocate(p, sizeof(FlatTree<N, Content, Policy>));
+}
+
+template <NumBytes N, typename Content, typename Policy>
+FlatTree<N, Content, Policy>::~FlatTree()
 {
     // delete content of children nodes
     for (LinkType &link: this->links) {
@@ -563,14 +592,14 @@ FlatTree<N, Content>::~FlatTree()
     //    std::cerr << "~FlatTree " << this << std::endl;
 }
 
-template <NumBytes N, typename Content>
-auto FlatTree<N, Content>::getRoot() -> NodeType*
+template <NumBytes N, typename Content, typename Policy>
+auto FlatTree<N, Content, Policy>::getRoot() -> NodeType*
 {
     return this;
 }
 
-template <NumBytes N, typename Content>
-void FlatTree<N, Content>::dump(std::ostream& os)
+template <NumBytes N, typename Content, typename Policy>
+void FlatTree<N, Content, Policy>::dump(std::ostream& os)
 {
     os << "FlatTree, tag: "
        << (int) this->data.getTag()
@@ -0,0 +1,929 @@
+#include "HttpServer.hh"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace http {
+
+//-----------------------------------------------------------------------------
+// Connection
+//-----------------------------------------------------------------------------
+
+struct Connection {
+
+    enum State { READING, SERVING, WRITING, CLOSED };
+
+    Connection(int fd);
+
+    // only touched by the I/O thread
+    State             state           { READING };
+    std::string       input;
+    Message           message;
+    bool              keep_alive      { true };
+    bool              input_closed    { false }; // client shut down its side
+    bool              request_started { false }; // bytes of the next request arrived
+    bool              sent_continue   { false };
+    bool              readable        { true };  // an edge not read up to EAGAIN yet
+    Clock::time_point deadline;                  // to receive the next request
+
+    // shared with the worker serving the current request
+    std::mutex              mutex;
+    std::condition_variable drained;
+    int                     fd;
+    std::string             output;               // not yet taken by the socket
+    std::size_t             output_offset { 0 };
+    Clock::time_point       last_progress;        // of the socket taking output
+    bool                    done          { false };  // handler returned
+    std::size_t             response_size { 0 };
+    bool                    aborted       { false };  // socket is gone
+
+    std::atomic<bool>       cancelled     { false };  // client went away while served
+
+    std::size_t pending() const { return output.size() - output_offset; }
+
+    // sends as much output as the socket takes (mutex held); false on a
+    // socket error
+    bool send();
+};
+
+Connection::Connection(int fd):
+    fd(fd)
+{}
+
+bool Connection::send()
+{
+    while (output_offset < output.size()) {
+        auto n = ::send(fd, output.data() + output_offset, output.size() - output_offset, MSG_NOSIGNAL);
+        if (n > 0) {
+            output_offset += (std::size_t) n;
+            last_progress = Clock::now();
+        }
+        else if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        else {
+            return false;
+        }
+    }
+    if (output_offset == output.size()) {
+        output.clear();
+        output_offset = 0;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Message Impl.
+//-----------------------------------------------------------------------------
+
+static bool equalsIgnoreCase(const std::string &a, const char *b)
+{
+    std::size_t n = std::strlen(b);
+    if (a.size() != n)
+        return false;
+    for (std::size_t i=0;i<n;++i) {
+        if (std::tolower((unsigned char) a[i]) != std::tolower((unsigned char) b[i]))
+            return false;
+    }
+    return true;
+}
+
+// comma separated token list of a header value contains token
+static bool hasToken(const char *value, const char *token)
+{
+    if (!value)
+        return false;
+    std::string s(value);
+    std::size_t begin = 0;
+    while (begin <= s.size()) {
+        std::size_t end = s.find(',', begin);
+        if (end == std::string::npos)
+            end = s.size();
+        auto b = s.find_first_not_of(" \t", begin);
+        auto e = s.find_last_not_of(" \t", end == 0 ? 0 : end - 1);
+        if (b != std::string::npos && b < end && e != std::string::npos && e >= b) {
+            if (equalsIgnoreCase(s.substr(b, e - b + 1), token))
+                return true;
+        }
+        begin = end + 1;
+    }
+    return false;
+}
+
+const char* Message::header(const char *name) const
+{
+    for (auto &h: headers) {
+        if (equalsIgnoreCase(h.first, name))
+            return h.second.c_str();
+    }
+    return nullptr;
+}
+
+//-----------------------------------------------------------------------------
+// Parsing
+//-----------------------------------------------------------------------------
+
+static int hexValue(char c)
+{
+    return std::isdigit((unsigned char) c) ? c - '0' : std::tolower((unsigned char) c) - 'a' + 10;
+}
+
+// %XX escapes of a path (same rules mongoose applied to the uri)
+static std::string decodeUri(const std::string &s)
+{
+    std::string result;
+    result.reserve(s.size());
+    for (std::size_t i=0;i<s.size();++i) {
+        if (s[i] == '%' && i + 2 < s.size() &&
+            std::isxdigit((unsigned char) s[i+1]) && std::isxdigit((unsigned char) s[i+2])) {
+            result.push_back((char) ((hexValue(s[i+1]) << 4) | hexValue(s[i+2])));
+            i += 2;
+        }
+        else {
+            result.push_back(s[i]);
+        }
+    }
+    if (!result.empty() && (result[0] == '/' || result[0] == '.')) {
+        // no directory disclosure: drop '..' and repeated slashes after a slash
+        std::string clean;
+        clean.reserve(result.size());
+        for (std::size_t i=0;i<result.size();) {
+            char c = result[i++];
+            clean.push_back(c);
+            if (c == '/' || c == '\\') {
+                while (i < result.size()) {
+                    if (result[i] == '/' || result[i] == '\\') { ++i; }
+                    else if (result[i] == '.' && i + 1 < result.size() && result[i+1] == '.') { i += 2; }
+                    else { break; }
+                }
+            }
+        }
+        result.swap(clean);
+    }
+    return result;
+}
+
+static std::string trim(const std::string &s)
+{
+    auto b = s.find_first_not_of(" \t");
+    if (b == std::string::npos)
+        return std::string();
+    auto e = s.find_last_not_of(" \t\r");
+    return s.substr(b, e - b + 1);
+}
+
+// request line and headers of input[0,size); false if malformed
+static bool parseHead(const std::string &input, std::size_t size, Message &message)
+{
+    message = Message();
+
+    std::size_t pos = 0;
+    bool first = true;
+    while (pos < size) {
+        std::size_t end = input.find('\n', pos);
+        if (end == std::string::npos || end > size)
+            end = size;
+        std::string line = input.substr(pos, end - pos);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        pos = end + 1;
+
+        if (first) {
+            if (line.empty())
+                continue; // empty lines before the request line are ignored
+            first = false;
+            auto m = line.find(' ');
+            auto u = m == std::string::npos ? m : line.find_first_not_of(' ', m);
+            auto v = u == std::string::npos ? u : line.find(' ', u);
+            if (m == 0 || v == std::string::npos)
+                return false;
+            std::string uri = line.substr(u, v - u);
+            std::string version = trim(line.substr(v));
+            if (version.compare(0, 5, "HTTP/") != 0)
+                return false;
+            message.method  = line.substr(0, m);
+            message.version = version.substr(5);
+            message.uri = decodeUri(uri.substr(0, uri.find('?')));
+        }
+        else if (!line.empty()) {
+            auto colon = line.find(':');
+            if (colon == std::string::npos || colon == 0)
+                return false;
+            message.headers.push_back({ trim(line.substr(0, colon)), trim(line.substr(colon + 1)) });
+        }
+    }
+    return !first;
+}
+
+static const char* statusReason(int status)
+{
+    switch (status) {
+    case 100: return "Continue";
+    case 400: return "Bad Request";
+    case 413: return "Payload Too Large";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    default:  return "Error";
+    }
+}
+
+static std::string statusResponse(int status)
+{
+    std::stringstream ss;
+    ss << "HTTP/1.1 " << status << " " << statusReason(status) << "\r\n";
+    if (status >= 400) {
+        ss << "Content-Length: 0\r\n"
+           << "Connection: close\r\n";
+    }
+    ss << "\r\n";
+    return ss.str();
+}
+
+//-----------------------------------------------------------------------------
+// Exchange Impl.
+//-----------------------------------------------------------------------------
+
+// smaller writes are coalesced: the headers of a response usually go out
+// with its body in one segment
+static const std::size_t EXCHANGE_BUFFER_SIZE = 64 * 1024;
+
+Exchange::Exchange(const ConnectionPtr &connection, const Options &options):
+    connection(connection),
+    options(options)
+{}
+
+Exchange::~Exchange()
+{
+    flush();
+}
+
+const Message& Exchange::message() const
+{
+    return connection->message;
+}
+
+bool Exchange::keepAlive() const
+{
+    return connection->keep_alive;
+}
+
+const std::atomic<bool>& Exchange::cancelled() const
+{
+    return connection->cancelled;
+}
+
+void Exchange::write(const char *data, std::size_t size)
+{
+    buffer.append(data, size);
+    written += size;
+    if (buffer.size() >= EXCHANGE_BUFFER_SIZE)
+        flush();
+}
+
+std::size_t Exchange::size() const
+{
+    return written;
+}
+
+void Exchange::flush()
+{
+    if (buffer.empty())
+        return;
+
+    auto &c = *connection;
+    std::unique_lock<std::mutex> lock(c.mutex);
+    if (c.aborted) {
+        buffer.clear();
+        return;
+    }
+
+    if (c.pending() == 0) {
+        // write through: the I/O thread is only involved when the socket
+        // does not take everything
+        c.output.swap(buffer);
+        c.output_offset = 0;
+        c.last_progress = Clock::now();
+        if (!c.send()) {
+            c.aborted = true;
+        }
+    }
+    else {
+        c.output.append(buffer);
+    }
+    buffer.clear();
+
+    if (c.pending() > options.max_output_buffer) {
+        // backpressure: the I/O thread flushes the output as the client
+        // reads it and wakes us up below half of the limit
+        auto ok = c.drained.wait_for(lock, options.write_timeout, [&c, this]() {
+                return c.aborted || c.pending() <= options.max_output_buffer / 2;
+            });
+        if (!ok) {
+            c.aborted = true; // closed on the next sweep
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Server Impl.
+//-----------------------------------------------------------------------------
+
+// how often timeouts are checked
+static const std::chrono::milliseconds SWEEP_PERIOD { 250 };
+
+Server::Server(const Options &options, const Handler &handler):
+    options(options),
+    handler(handler)
+{}
+
+Server::~Server()
+{
+    if (listen_fd >= 0)
+        ::close(listen_fd);
+    if (wake_fd >= 0)
+        ::close(wake_fd);
+    if (epoll_fd >= 0)
+        ::close(epoll_fd);
+}
+
+void Server::listen(int port)
+{
+    auto fail = [this](const std::string &what) {
+        std::string message = what + ": " + std::strerror(errno);
+        if (listen_fd >= 0) { ::close(listen_fd); listen_fd = -1; }
+        throw std::runtime_error(message);
+    };
+
+    listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0)
+        fail("socket");
+
+    int on = 1;
+    ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port        = htons((uint16_t) port);
+    if (::bind(listen_fd, (sockaddr*) &addr, sizeof(addr)) != 0)
+        fail("bind port " + std::to_string(port));
+    if (::listen(listen_fd, SOMAXCONN) != 0)
+        fail("listen");
+
+    epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+        fail("epoll_create1");
+
+    wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0)
+        fail("eventfd");
+
+    epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events  = EPOLLIN;
+    ev.data.fd = wake_fd;
+    if (::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) != 0)
+        fail("epoll_ctl");
+
+    ev.data.fd = listen_fd;
+    if (::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) != 0)
+        fail("epoll_ctl");
+    accepting = true;
+}
+
+void Server::stop()
+{
+    stopping = true;
+    if (wake_fd >= 0) {
+        std::uint64_t one = 1;
+        auto n = ::write(wake_fd, &one, sizeof(one));
+        (void) n;
+    }
+}
+
+void Server::notify(const ConnectionPtr &connection)
+{
+    {
+        std::lock_guard<std::mutex> lock(notify_mutex);
+        notified.push_back(connection);
+        if (notified.size() > 1)
+            return; // the I/O thread was already woken up for the batch
+    }
+    std::uint64_t one = 1;
+    auto n = ::write(wake_fd, &one, sizeof(one));
+    (void) n;
+}
+
+void Server::run()
+{
+    if (epoll_fd < 0)
+        throw std::runtime_error("http::Server::run() before listen()");
+
+    for (int i=0;i<std::max(1,options.workers);++i) {
+        workers.push_back(std::thread(&Server::work, this));
+    }
+
+    const int MAX_EVENTS = 256;
+    epoll_event events[MAX_EVENTS];
+
+    bool draining = false;
+    Clock::time_point drain_deadline;
+    Clock::time_point next_sweep = Clock::now() + SWEEP_PERIOD;
+
+    std::vector<ConnectionPtr> ready;
+
+    while (true) {
+
+        int n = ::epoll_wait(epoll_fd, events, MAX_EVENTS, (int) SWEEP_PERIOD.count());
+        if (n < 0 && errno != EINTR)
+            break;
+
+        for (int i=0;i<n;++i) {
+            int fd = events[i].data.fd;
+            auto e = events[i].events;
+            if (fd == listen_fd) {
+                accept();
+            }
+            else if (fd == wake_fd) {
+                std::uint64_t count;
+                auto r = ::read(wake_fd, &count, sizeof(count));
+                (void) r;
+                {
+                    std::lock_guard<std::mutex> lock(notify_mutex);
+                    ready.swap(notified);
+                }
+                for (auto &c: ready) {
+                    if (c->state != Connection::CLOSED)
+                        flushOutput(c);
+                }
+                ready.clear();
+            }
+            else {
+                auto it = connections.find(fd);
+                if (it == connections.end())
+                    continue;
+                auto c = it->second; // keep it alive while it is handled
+                if (e & (EPOLLERR | EPOLLHUP)) {
+                    close(c);
+                    continue;
+                }
+                if (e & EPOLLOUT) {
+                    flushOutput(c);
+                }
+                if (c->state == Connection::SERVING && (e & EPOLLRDHUP)) {
+                    hangup(c);
+                }
+                if (c->state != Connection::CLOSED && (e & (EPOLLIN | EPOLLRDHUP))) {
+                    c->readable = true;
+                    read(c);
+                }
+            }
+        }
+
+        auto now = Clock::now();
+
+        if (stopping && !draining) {
+            draining = true;
+            drain_deadline = now + options.drain_timeout;
+            if (listen_fd >= 0) {
+                ::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, listen_fd, nullptr);
+                ::close(listen_fd);
+                listen_fd = -1;
+                accepting = false;
+            }
+            next_sweep = now; // closes the idle connections right away
+        }
+
+        if (now >= next_sweep) {
+            sweep(now);
+            next_sweep = now + SWEEP_PERIOD;
+        }
+
+        if (draining && (connections.empty() || now >= drain_deadline))
+            break;
+    }
+
+    // whatever is left is dropped; a worker waiting for its client to read
+    // is released by the close
+    std::vector<ConnectionPtr> remaining;
+    for (auto &it: connections)
+        remaining.push_back(it.second);
+    for (auto &c: remaining)
+        close(c);
+
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        workers_done = true;
+        jobs.clear();
+    }
+    jobs_cv.notify_all();
+    for (auto &w: workers)
+        w.join();
+    workers.clear();
+}
+
+void Server::work()
+{
+    while (true) {
+        ConnectionPtr c;
+        {
+            std::unique_lock<std::mutex> lock(jobs_mutex);
+            ++idle_workers;
+            jobs_cv.wait(lock, [this]() { return workers_done || !jobs.empty(); });
+            --idle_workers;
+            if (workers_done)
+                return;
+            c = jobs.front();
+            jobs.pop_front();
+        }
+
+        std::size_t response_size = 0;
+        {
+            Exchange exchange(c, options);
+            try {
+                handler(exchange);
+            }
+            catch (...) {
+                if (exchange.size() == 0) {
+                    auto response = statusResponse(500);
+                    exchange.write(response.data(), response.size());
+                }
+            }
+            exchange.flush();
+            response_size = exchange.size();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(c->mutex);
+            c->done = true;
+            c->response_size = response_size;
+        }
+        notify(c);
+    }
+}
+
+void Server::setAccepting(bool b)
+{
+    if (listen_fd < 0 || accepting == b)
+        return;
+    epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events  = b ? (std::uint32_t) EPOLLIN : 0u;
+    ev.data.fd = listen_fd;
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_MOD, listen_fd, &ev);
+    accepting = b;
+}
+
+void Server::accept()
+{
+    while (accepting) {
+        if ((int) connections.size() >= options.max_connections) {
+            // the backlog holds the others until some connection closes
+            setAccepting(false);
+            return;
+        }
+
+        int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                setAccepting(false); // retried on the next sweep
+            }
+            return;
+        }
+
+        int on = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        auto c = std::make_shared<Connection>(fd);
+        c->deadline = Clock::now() + options.idle_timeout;
+
+        // edge triggered: a connection is read until EAGAIN and only when
+        // it is not serving a request
+        epoll_event ev;
+        std::memset(&ev, 0, sizeof(ev));
+        ev.events  = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fd;
+        if (::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            ::close(fd);
+            continue;
+        }
+        connections[fd] = c;
+    }
+}
+
+void Server::read(const ConnectionPtr &c)
+{
+    if (c->state != Connection::READING) {
+        // picked up again by resume() once the current response is sent
+        return;
+    }
+
+    char buf[64 * 1024];
+    c->readable = false;
+    while (true) {
+        auto n = ::recv(c->fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            c->input.append(buf, (std::size_t) n);
+            if (c->input.size() > options.max_header_size + options.max_body_size) {
+                reject(c, 413);
+                return;
+            }
+            if ((std::size_t) n < sizeof(buf))
+                break; // drained: more data is another edge
+        }
+        else if (n == 0) {
+            c->input_closed = true;
+            break;
+        }
+        else if (errno == EINTR) {
+            continue;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        }
+        else {
+            close(c);
+            return;
+        }
+    }
+
+    dispatch(c);
+}
+
+void Server::hangup(const ConnectionPtr &c)
+{
+    // the connection is not read while serving: peek for the end of
+    // the stream. Bytes ahead of it (a pipelined request) hide it until
+    // the response is sent and read() finds it.
+    char byte;
+    ssize_t n;
+    do {
+        n = ::recv(c->fd, &byte, 1, MSG_PEEK);
+    } while (n < 0 && errno == EINTR);
+    if (n != 0)
+        return;
+    c->input_closed = true;
+    if (options.half_close)
+        return; // the client may still read the response
+    c->keep_alive = false;
+    c->cancelled  = true;
+}
+
+void Server::dispatch(const ConnectionPtr &c)
+{
+    if (c->state != Connection::READING)
+        return;
+
+    // line breaks a client sends after a request body
+    auto skip = c->input.find_first_not_of("\r\n");
+    c->input.erase(0, skip == std::string::npos ? c->input.size() : skip);
+
+    if (c->input.empty()) {
+        if (c->input_closed)
+            close(c);
+        return;
+    }
+
+    if (!c->request_started) {
+        c->request_started = true;
+        c->deadline = Clock::now() + options.read_timeout;
+    }
+
+    // end of the headers
+    std::size_t head_size = std::string::npos;
+    for (std::size_t pos = c->input.find('\n'); pos != std::string::npos; pos = c->input.find('\n', pos + 1)) {
+        if (pos + 1 < c->input.size() && c->input[pos + 1] == '\n') {
+            head_size = pos + 2;
+            break;
+        }
+        if (pos + 2 < c->input.size() && c->input[pos + 1] == '\r' && c->input[pos + 2] == '\n') {
+            head_size = pos + 3;
+            break;
+        }
+        if (pos > options.max_header_size)
+            break;
+    }
+
+    if (head_size == std::string::npos) {
+        if (c->input.size() > options.max_header_size)
+            reject(c, 431);
+        else if (c->input_closed)
+            close(c);
+        return;
+    }
+    if (head_size > options.max_header_size) {
+        reject(c, 431);
+        return;
+    }
+
+    auto &message = c->message;
+    if (!parseHead(c->input, head_size, message)) {
+        reject(c, 400);
+        return;
+    }
+
+    auto transfer_encoding = message.header("Transfer-Encoding");
+    if (transfer_encoding && !equalsIgnoreCase(transfer_encoding, "identity")) {
+        reject(c, 501); // chunked request bodies are not supported
+        return;
+    }
+
+    std::size_t content_length = 0;
+    if (auto value = message.header("Content-Length")) {
+        char *end = nullptr;
+        auto n = std::strtoull(value, &end, 10);
+        if (end == value || *end != '\0') {
+            reject(c, 400);
+            return;
+        }
+        if (n > options.max_body_size) {
+            reject(c, 413);
+            return;
+        }
+        content_length = (std::size_t) n;
+    }
+
+    if (c->input.size() < head_size + content_length) {
+        if (c->input_closed) {
+            close(c);
+        }
+        else if (!c->sent_continue && hasToken(message.header("Expect"), "100-continue")) {
+            c->sent_continue = true;
+            auto response = statusResponse(100);
+            {
+                std::lock_guard<std::mutex> lock(c->mutex);
+                c->output.append(response);
+            }
+            flushOutput(c);
+        }
+        return;
+    }
+
+    message.body = c->input.substr(head_size, content_length);
+    c->input.erase(0, head_size + content_length);
+
+    auto connection_header = message.header("Connection");
+    if (message.version == "1.0")
+        c->keep_alive = hasToken(connection_header, "keep-alive");
+    else
+        c->keep_alive = !hasToken(connection_header, "close");
+    if (stopping)
+        c->keep_alive = false;
+
+    c->state           = Connection::SERVING;
+    c->request_started = false;
+    c->sent_continue   = false;
+    c->cancelled       = false;
+    {
+        std::lock_guard<std::mutex> lock(c->mutex);
+        c->done          = false;
+        c->response_size = 0;
+    }
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        jobs.push_back(c);
+        wake = idle_workers >= jobs.size();
+    }
+    if (wake)
+        jobs_cv.notify_one(); // busy workers pick the job up when they are done
+}
+
+void Server::flushOutput(const ConnectionPtr &c)
+{
+    bool aborted;
+    bool empty;
+    bool done;
+    std::size_t response_size;
+    {
+        std::lock_guard<std::mutex> lock(c->mutex);
+        if (c->fd < 0)
+            return;
+        if (!c->aborted && !c->send())
+            c->aborted = true;
+        aborted       = c->aborted;
+        empty         = c->pending() == 0;
+        done          = c->done;
+        response_size = c->response_size;
+        if (aborted || c->pending() <= options.max_output_buffer / 2)
+            c->drained.notify_all();
+    }
+
+    if (aborted) {
+        close(c);
+        return;
+    }
+
+    if (c->state == Connection::SERVING && done) {
+        c->state = Connection::WRITING;
+        if (response_size == 0) {
+            // the handler did not answer: there is no way to tell the
+            // client where a response ends but closing the connection
+            c->keep_alive = false;
+        }
+    }
+
+    if (c->state == Connection::WRITING && empty)
+        resume(c);
+}
+
+void Server::resume(const ConnectionPtr &c)
+{
+    if (!c->keep_alive || stopping) {
+        close(c);
+        return;
+    }
+
+    c->state    = Connection::READING;
+    c->deadline = Clock::now() + options.idle_timeout;
+
+    // pipelined requests first, then whatever arrived meanwhile (the
+    // socket is edge triggered and was left unread)
+    dispatch(c);
+    if (c->state == Connection::READING && c->readable)
+        read(c);
+}
+
+void Server::reject(const ConnectionPtr &c, int status)
+{
+    auto response = statusResponse(status);
+    c->keep_alive = false;
+    c->state      = Connection::WRITING;
+    {
+        std::lock_guard<std::mutex> lock(c->mutex);
+        c->done = true;
+        c->response_size = response.size();
+        c->output.append(response);
+    }
+    flushOutput(c);
+}
+
+void Server::close(const ConnectionPtr &c)
+{
+    int fd;
+    {
+        std::lock_guard<std::mutex> lock(c->mutex);
+        fd = c->fd;
+        if (fd < 0)
+            return;
+        ::close(fd); // also leaves the epoll set
+        c->fd        = -1;
+        c->aborted   = true;
+        c->cancelled = true;
+        c->drained.notify_all();
+    }
+    c->state = Connection::CLOSED;
+    connections.erase(fd);
+
+    if (!accepting && !stopping && (int) connections.size() < options.max_connections)
+        setAccepting(true);
+}
+
+void Server::sweep(Clock::time_point now)
+{
+    std::vector<ConnectionPtr> expired;
+    for (auto &it: connections) {
+        auto &c = it.second;
+        bool aborted;
+        bool stalled;
+        {
+            std::lock_guard<std::mutex> lock(c->mutex);
+            aborted = c->aborted;
+            stalled = c->pending() > 0 && now - c->last_progress > options.write_timeout;
+        }
+        bool idle = c->state == Connection::READING && !c->request_started && c->input.empty();
+        if (aborted || stalled ||
+            (c->state == Connection::READING && now >= c->deadline) ||
+            (stopping && idle)) {
+            expired.push_back(c);
+        }
+    }
+    for (auto &c: expired)
+        close(c);
+
+    if (!accepting && !stopping && (int) connections.size() < options.max_connections)
+        setAccepting(true);
+}
+
+} // http namespace
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+//
+// Event driven HTTP/1.x front end.
+//
+// A single I/O thread multiplexes the listening socket and every client
+// connection with epoll; a pool of workers runs the request handlers.
+// Handlers never block on a socket: what they write is sent right away
+// when the socket takes it and is otherwise queued on the connection and
+// flushed by the I/O thread once the client reads. Only a response that
+// piles up more than "max_output_buffer" unsent bytes makes its worker
+// wait, and at most "write_timeout" before the connection is dropped.
+//
+// Connections are kept alive (HTTP/1.1, or HTTP/1.0 with "Connection:
+// keep-alive") and pipelined requests are answered in order: a connection
+// is not read while its current request is being served, so a client
+// that sends faster than it is served is throttled by TCP. A client that
+// closes its connection while served cancels the request (see
+// Exchange::cancelled()), unless "half_close" is set.
+//
+// stop() drains the server: the listening socket is closed, idle
+// connections are closed and requests already received are served for
+// at most "drain_timeout" before run() returns.
+//
+
+namespace http {
+
+using Clock = std::chrono::steady_clock;
+
+//-----------------------------------------------------------------------------
+// Options
+//-----------------------------------------------------------------------------
+
+struct Options {
+    int         workers           { 10 };
+    int         max_connections   { 10000 };       // stop accepting beyond this
+    std::size_t max_header_size   { 16384 };       // request line and headers
+    std::size_t max_body_size     { 16 << 20 };    // Content-Length of a request
+    std::size_t max_output_buffer { 8 << 20 };     // unsent bytes before a worker waits
+    std::chrono::milliseconds read_timeout  { 30000 };  // to receive a whole request
+    std::chrono::milliseconds idle_timeout  { 60000 };  // between keep-alive requests
+    std::chrono::milliseconds write_timeout { 60000 };  // without the client reading
+    std::chrono::milliseconds drain_timeout { 10000 };  // on stop()
+    bool half_close { false }; // a client that shuts down its side while served still gets the response
+};
+
+//-----------------------------------------------------------------------------
+// Message
+//-----------------------------------------------------------------------------
+
+struct Message {
+
+    // case insensitive; nullptr if the header is not present
+    const char* header(const char *name) const;
+
+    std::string method;
+    std::string uri;     // decoded path without the query string
+    std::string version; // "1.0", "1.1"
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+};
+
+struct Connection;
+
+using ConnectionPtr = std::shared_ptr<Connection>;
+
+//-----------------------------------------------------------------------------
+// Exchange: a request being served and the way back to its client
+//-----------------------------------------------------------------------------
+
+struct Exchange {
+public:
+
+    Exchange(const ConnectionPtr &connection, const Options &options);
+
+    ~Exchange();
+
+    Exchange(const Exchange& other) = delete;
+    Exchange& operator=(const Exchange& other) = delete;
+
+    const Message& message() const;
+
+    // the connection is kept open after this response
+    bool keepAlive() const;
+
+    // set once the client closes its connection or the connection is
+    // dropped (socket error or a failed send) while the request is
+    // served: a handler may stop working on a response nobody will read.
+    // A close and a shutdown of the sending side look the same from
+    // here: with Options::half_close both still get the response.
+    const std::atomic<bool>& cancelled() const;
+
+    // raw bytes of the response (status line, headers and body); small
+    // writes are coalesced until flush() or the end of the handler
+    void write(const char *data, std::size_t size);
+
+    void flush();
+
+    // bytes written so far
+    std::size_t size() const;
+
+private:
+
+    ConnectionPtr  connection;
+    const Options &options;
+    std::string    buffer;
+    std::size_t    written { 0 };
+};
+
+using Handler = std::function<void(Exchange&)>;
+
+//-----------------------------------------------------------------------------
+// Server
+//-----------------------------------------------------------------------------
+
+struct Server {
+public:
+
+    Server(const Options &options, const Handler &handler);
+
+    ~Server();
+
+    Server(const Server& other) = delete;
+    Server& operator=(const Server& other) = delete;
+
+    // binds the port (throws std::runtime_error)
+    void listen(int port);
+
+    // serves until stop() and the drain are done
+    void run();
+
+    // safe from any thread
+    void stop();
+
+private:
+
+    void work();
+
+    // a worker is done with a request (runs on the worker)
+    void notify(const ConnectionPtr &connection);
+
+    void accept();
+
+    void read(const ConnectionPtr &connection);
+
+    // the client of a request being served shut down its side
+    void hangup(const ConnectionPtr &connection);
+
+    void dispatch(const ConnectionPtr &connection);
+
+    void flushOutput(const ConnectionPtr &connection);
+
+    void resume(const ConnectionPtr &connection);
+
+    void reject(const ConnectionPtr &connection, int status);
+
+    void close(const ConnectionPtr &connection);
+
+    void sweep(Clock::time_point now);
+
+    void setAccepting(bool accepting);
+
+private:
+
+    Options options;
+    Handler handler;
+
+    int listen_fd { -1 };
+    int epoll_fd  { -1 };
+    int wake_fd   { -1 }; // eventfd: workers and stop() wake the I/O thread
+
+    bool accepting { false };
+
+    std::atomic<bool> stopping { false };
+
+    // owned by the I/O thread
+    std::unordered_map<int, ConnectionPtr> connections;
+
+    // served requests reported back to the I/O thread
+    std::mutex                 notify_mutex;
+    std::vector<ConnectionPtr> notified;
+
+    // requests waiting for a worker
+    std::mutex                 jobs_mutex;
+    std::condition_variable    jobs_cv;
+    std::deque<ConnectionPtr>  jobs;
+    std::size_t                idle_workers { 0 };
+    bool                       workers_done { false };
+
+    std::vector<std::thread>   workers;
+};
+
+} // http namespace
@@ -0,0 +1,154 @@
+#include "MaskCache.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+namespace mask_cache {
+
+//-----------------------------------------------------------------------------
+// CachedMask Impl.
+//-----------------------------------------------------------------------------
+
+CachedMask::CachedMask(Mask *mask):
+    mask(mask),
+    intervals(polycover::labeled_tree::NodeCursor(mask))
+{}
+
+//-----------------------------------------------------------------------------
+// MaskCache Impl.
+//-----------------------------------------------------------------------------
+
+MaskCache::MaskCache(std::size_t budget)
+{
+    setBudget(budget);
+}
+
+void MaskCache::setBudget(std::size_t budget)
+{
+    for (auto &s: shards) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.counters.budget = budget / NUM_SHARDS;
+        enforceBudget(s);
+    }
+}
+
+MaskPtr MaskCache::get(const std::string &key, const Compute &compute)
+{
+    auto &s = shard(key);
+
+    std::promise<MaskPtr> promise;
+    {
+        std::unique_lock<std::mutex> lock(s.mutex);
+        auto it = s.items.find(key);
+        if (it != s.items.end()) {
+            ++s.counters.hits;
+            auto &entry = it->second;
+            s.queue.erase(entry.position);
+            entry.position = s.queue.insert(Queue::value_type(s.clock + entry.worth, &it->first));
+            return entry.mask;
+        }
+        auto in_flight = s.in_flight.find(key);
+        if (in_flight != s.in_flight.end()) {
+            ++s.counters.shared;
+            auto computation = in_flight->second;
+            lock.unlock();
+            return computation.get(); // rethrows the error of the computation
+        }
+        ++s.counters.misses;
+        s.in_flight[key] = promise.get_future().share();
+    }
+
+    MaskPtr mask;
+    auto start = std::chrono::steady_clock::now();
+    try {
+        std::unique_ptr<Mask> computed(compute());
+        if (!computed)
+            throw std::runtime_error("no mask for " + key);
+        mask = std::make_shared<const CachedMask>(computed.release());
+    }
+    catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.in_flight.erase(key);
+        }
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+    auto microseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    auto mask_bytes   = bytes(key, *mask);
+
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.in_flight.erase(key);
+        insert(s, key, mask, mask_bytes, microseconds);
+    }
+    promise.set_value(mask);
+    return mask;
+}
+
+Stats MaskCache::stats() const
+{
+    Stats result;
+    for (auto &s: shards) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        result.hits      += s.counters.hits;
+        result.misses    += s.counters.misses;
+        result.shared    += s.counters.shared;
+        result.evictions += s.counters.evictions;
+        result.entries   += s.counters.entries;
+        result.bytes     += s.counters.bytes;
+        result.budget    += s.counters.budget;
+    }
+    return result;
+}
+
+std::size_t MaskCache::bytes(const std::string &key, const CachedMask &mask)
+{
+    polycover::labeled_tree::Summary summary(*mask.mask);
+    return summary.num_nodes * sizeof(Mask)
+        + mask.intervals.size() * 2 * sizeof(std::uint64_t)
+        + key.size() + sizeof(CachedMask) + sizeof(Entry) + sizeof(Queue::value_type);
+}
+
+auto MaskCache::shard(const std::string &key) -> Shard&
+{
+    return shards[std::hash<std::string>()(key) % NUM_SHARDS];
+}
+
+void MaskCache::insert(Shard &s, const std::string &key, MaskPtr mask, std::size_t mask_bytes, double microseconds)
+{
+    // a mask larger than the shard would evict everything else
+    if (mask_bytes > s.counters.budget)
+        return;
+
+    auto  it    = s.items.insert(std::make_pair(key, Entry())).first;
+    auto &entry = it->second;
+    entry.mask     = mask;
+    entry.bytes    = mask_bytes;
+    entry.worth    = std::max(1.0, microseconds) / mask_bytes;
+    entry.position = s.queue.insert(Queue::value_type(s.clock + entry.worth, &it->first));
+    ++s.counters.entries;
+    s.counters.bytes += mask_bytes;
+    enforceBudget(s);
+}
+
+void MaskCache::erase(Shard &s, std::unordered_map<std::string, Entry>::iterator it)
+{
+    s.counters.bytes -= it->second.bytes;
+    --s.counters.entries;
+    s.queue.erase(it->second.position);
+    s.items.erase(it);
+}
+
+void MaskCache::enforceBudget(Shard &s)
+{
+    while (s.counters.bytes > s.counters.budget && !s.queue.empty()) {
+        auto first = s.queue.begin();
+        s.clock = first->first;
+        erase(s, s.items.find(*first->second));
+        ++s.counters.evictions;
+    }
+}
+
+} // mask_cache namespace
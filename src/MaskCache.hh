@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "polycover/labeled_tree.hh"
+#include "polycover/packed_tree.hh"
+#include "polycover/interval_mask.hh"
+
+//
+// Masks of mask, degrees_mask, mercator_mask and region queries kept in
+// memory by their query text.
+//
+// The cache is split in shards by key hash, each with its own lock and
+// an equal part of the budget, so concurrent queries only contend on
+// the same shard. An entry costs the bytes of its mask nodes and key.
+//
+// Eviction is GreedyDual-Size: an entry is worth the time it took to
+// compute per byte it holds, and its priority is the shard's clock plus
+// that worth, renewed on every hit. The entry with the least priority
+// goes first and its priority becomes the clock, so entries that are not
+// hit age relative to the ones that are. A polygon cover that took
+// seconds outlives a cheap mask() of the same size.
+//
+// Concurrent misses of the same key wait for a single computation, which
+// also lays out the Morton intervals of the mask leaves once: queries
+// walk the intervals of the cached mask and never rebuild them.
+//
+
+namespace mask_cache {
+
+using Mask          = polycover::labeled_tree::Node;
+using MaskIntervals = polycover::labeled_tree::IntervalMask;
+
+//-----------------------------------------------------------------------------
+// CachedMask: a mask and the intervals of its leaves
+//-----------------------------------------------------------------------------
+
+struct CachedMask {
+public:
+    CachedMask(Mask *mask); // takes ownership
+public:
+    std::unique_ptr<const Mask> mask;
+    MaskIntervals               intervals;
+};
+
+using MaskPtr = std::shared_ptr<const CachedMask>;
+
+//-----------------------------------------------------------------------------
+// Stats
+//-----------------------------------------------------------------------------
+
+struct Stats {
+    std::uint64_t hits      { 0 };
+    std::uint64_t misses    { 0 }; // masks computed
+    std::uint64_t shared    { 0 }; // misses that waited for another one
+    std::uint64_t evictions { 0 };
+    std::size_t   entries   { 0 };
+    std::size_t   bytes     { 0 };
+    std::size_t   budget    { 0 };
+};
+
+//-----------------------------------------------------------------------------
+// MaskCache
+//-----------------------------------------------------------------------------
+
+struct MaskCache {
+public:
+
+    static const int NUM_SHARDS = 16;
+
+    using Compute = std::function<Mask*()>;
+
+    MaskCache(std::size_t budget=0);
+
+    MaskCache(const MaskCache& other) = delete;
+    MaskCache& operator=(const MaskCache& other) = delete;
+
+    // bytes; 0 keeps no masks (misses still share computations)
+    void setBudget(std::size_t budget);
+
+    // mask of key from the cache or from compute(); an exception of
+    // compute() is rethrown to every query waiting for it (as is a mask
+    // that compute() could not produce)
+    MaskPtr get(const std::string &key, const Compute &compute);
+
+    Stats stats() const;
+
+    static std::size_t bytes(const std::string &key, const CachedMask &mask);
+
+private:
+
+    using Queue = std::multimap<double, const std::string*>; // priority -> key
+
+    struct Entry {
+        MaskPtr         mask;
+        std::size_t     bytes;
+        double          worth; // microseconds to compute per byte
+        Queue::iterator position;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        double     clock { 0 };
+        Queue      queue;
+        std::unordered_map<std::string, Entry> items;
+        std::unordered_map<std::string, std::shared_future<MaskPtr>> in_flight;
+        Stats      counters;
+    };
+
+    Shard& shard(const std::string &key);
+
+    void insert(Shard &shard, const std::string &key, MaskPtr mask, std::size_t mask_bytes, double microseconds);
+
+    void erase(Shard &shard, std::unordered_map<std::string, Entry>::iterator it);
+
+    void enforceBudget(Shard &shard);
+
+private:
+
+    Shard shards[NUM_SHARDS];
+};
+
+} // mask_cache namespace
@@ -0,0 +1,161 @@
+#include "MaskStore.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace mask_store {
+
+static const char          MAGIC[8] = { 'N','C','M','A','S','K','S','1' };
+static const std::uint64_t HEADER   = sizeof(MAGIC) + sizeof(std::uint64_t);
+
+static std::uint64_t align8(std::uint64_t offset) {
+    return (offset + 7) & ~7ULL;
+}
+
+//-----------------------------------------------------------------------------
+// MaskStore Impl.
+//-----------------------------------------------------------------------------
+
+MaskStore::~MaskStore()
+{
+    if (data)
+        munmap(const_cast<char*>(data), data_size);
+}
+
+void MaskStore::open(const std::string &path)
+{
+    if (data)
+        throw std::runtime_error("mask store already open");
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("could not open mask store " + path + ": " + std::strerror(errno));
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (std::uint64_t) st.st_size < HEADER) {
+        ::close(fd);
+        throw std::runtime_error("invalid mask store " + path);
+    }
+
+    auto size = (std::size_t) st.st_size;
+    void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+        throw std::runtime_error("could not map mask store " + path + ": " + std::strerror(errno));
+
+    auto bytes   = (const char*) p;
+    auto invalid = [&]() {
+        munmap(p, size);
+        trees.clear();
+        return std::runtime_error("invalid mask store " + path);
+    };
+
+    // index only: the masks are read when queried
+    std::uint64_t count;
+    std::memcpy(&count, bytes + sizeof(MAGIC), sizeof(count));
+    if (std::memcmp(bytes, MAGIC, sizeof(MAGIC)) != 0 || count > (size - HEADER) / sizeof(Entry))
+        throw invalid();
+
+    auto index = (const Entry*) (bytes + HEADER);
+    trees.reserve(count);
+    for (std::uint64_t i=0;i<count;++i) {
+        auto &e = index[i];
+        if (e.name_offset > size || e.name_size > size - e.name_offset ||
+            e.tree_offset % 8 != 0 || e.tree_offset > size || e.num_nodes == 0 || e.num_nodes > size ||
+            PackedTree::bytes(e.num_nodes) > size - e.tree_offset)
+            throw invalid();
+        trees.push_back(PackedTree(e.num_nodes, bytes + e.tree_offset));
+    }
+
+    data      = bytes;
+    data_size = size;
+    entries   = index;
+}
+
+bool MaskStore::isOpen() const
+{
+    return data != nullptr;
+}
+
+std::size_t MaskStore::size() const
+{
+    return trees.size();
+}
+
+const PackedTree* MaskStore::find(const std::string &name) const
+{
+    auto compare = [this](const Entry &e, const std::string &name) {
+        auto n = std::min<std::uint64_t>(e.name_size, name.size());
+        auto c = std::memcmp(data + e.name_offset, name.data(), n);
+        return c < 0 || (c == 0 && e.name_size < name.size());
+    };
+    auto end = entries + trees.size();
+    auto it  = std::lower_bound(entries, end, name, compare);
+    if (it == end || it->name_size != name.size() ||
+        std::memcmp(data + it->name_offset, name.data(), name.size()) != 0)
+        return nullptr;
+    return &trees[it - entries];
+}
+
+void MaskStore::write(const std::string &path, std::vector<Mask> masks)
+{
+    std::sort(masks.begin(), masks.end(), [](const Mask &a, const Mask &b) { return a.name < b.name; });
+    for (std::size_t i=1;i<masks.size();++i) {
+        if (masks[i-1].name == masks[i].name)
+            throw std::runtime_error("duplicate mask " + masks[i].name);
+    }
+
+    std::vector<Entry> index(masks.size());
+    std::uint64_t offset = HEADER + masks.size() * sizeof(Entry);
+    for (std::size_t i=0;i<masks.size();++i) {
+        index[i].name_offset = offset;
+        index[i].name_size   = masks[i].name.size();
+        offset += masks[i].name.size();
+    }
+    for (std::size_t i=0;i<masks.size();++i) {
+        offset = align8(offset);
+        index[i].tree_offset = offset;
+        index[i].num_nodes   = masks[i].num_nodes;
+        offset += masks[i].packed.size();
+    }
+
+    auto tmp_path = path + ".tmp";
+    {
+        std::ofstream os(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!os)
+            throw std::runtime_error("could not write " + tmp_path);
+
+        std::uint64_t count = masks.size();
+        os.write(MAGIC, sizeof(MAGIC));
+        os.write((const char*) &count, sizeof(count));
+        os.write((const char*) index.data(), index.size() * sizeof(Entry));
+        for (auto &m: masks)
+            os.write(m.name.data(), m.name.size());
+
+        std::uint64_t position = HEADER + masks.size() * sizeof(Entry);
+        for (auto &m: masks)
+            position += m.name.size();
+        const char zeros[8] = { 0 };
+        for (std::size_t i=0;i<masks.size();++i) {
+            os.write(zeros, index[i].tree_offset - position);
+            os.write(masks[i].packed.data(), masks[i].packed.size());
+            position = index[i].tree_offset + masks[i].packed.size();
+        }
+
+        if (!os.flush())
+            throw std::runtime_error("could not write " + tmp_path);
+    }
+
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+        throw std::runtime_error("could not replace " + path + ": " + std::strerror(errno));
+}
+
+} // mask_store namespace
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "polycover/packed_tree.hh"
+
+//
+// Precompiled region masks (see nanocube-mask-store).
+//
+// A store is a single file with the packed form (see packed_tree.hh) of
+// every region mask and an index of their names. It is memory mapped
+// once and masks are traversed right where they lie: a region query
+// neither reads nor parses a .ttt file and only the pages of the masks
+// that are actually queried are ever loaded. The mapping lives as long
+// as the store, so views handed out by find() need no pinning.
+//
+// Layout (little-endian):
+//
+//     char     magic[8]                      "NCMASKS1"
+//     uint64_t count
+//     Entry    entries[count]                sorted by name
+//     names and packed trees (each one 8-byte aligned)
+//
+
+namespace mask_store {
+
+using PackedTree = polycover::labeled_tree::PackedTree;
+
+//-----------------------------------------------------------------------------
+// Entry: index of the store
+//-----------------------------------------------------------------------------
+
+struct Entry {
+    std::uint64_t name_offset;
+    std::uint64_t name_size;
+    std::uint64_t tree_offset;
+    std::uint64_t num_nodes;
+};
+
+//-----------------------------------------------------------------------------
+// Mask: input of MaskStore::write
+//-----------------------------------------------------------------------------
+
+struct Mask {
+    std::string   name;
+    std::uint64_t num_nodes;
+    std::string   packed; // PackedTree::pack
+};
+
+//-----------------------------------------------------------------------------
+// MaskStore
+//-----------------------------------------------------------------------------
+
+struct MaskStore {
+public:
+
+    MaskStore() = default;
+
+    ~MaskStore();
+
+    MaskStore(const MaskStore& other) = delete;
+    MaskStore& operator=(const MaskStore& other) = delete;
+
+    // maps a store file (throws std::runtime_error)
+    void open(const std::string &path);
+
+    bool isOpen() const;
+
+    std::size_t size() const;
+
+    // nullptr if there is no such region on the store
+    const PackedTree* find(const std::string &name) const;
+
+    // writes a store with the given masks; the file is replaced at once,
+    // so a server can keep the previous one mapped
+    static void write(const std::string &path, std::vector<Mask> masks);
+
+private:
+
+    const char*  data        { nullptr };
+    std::size_t  data_size   { 0 };
+    const Entry* entries     { nullptr };
+
+    std::vector<PackedTree> trees; // one view per entry
+};
+
+} // mask_store namespace
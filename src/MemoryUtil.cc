@@ -1,4 +1,5 @@
 #include "MemoryUtil.hh"
+#include "SlabAllocator.hh"
 #include "Stopwatch.hh"
 
 #include <iostream>
@@ -76,6 +77,23 @@ static size_t memory_used (bool resident=false)
 #endif
 }
 
+/// The peak resident set size of this process so far, in bytes.
+static size_t peak_memory_used()
+{
+#if defined(_WINDOWS)
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+# if defined(__APPLE__)
+    return (size_t) usage.ru_maxrss;        // bytes on OS X
+# else
+    return (size_t) usage.ru_maxrss * 1024; // kilobytes on linux
+# endif
+#endif
+}
+
 //-----------------------------------------------------------------------------
 // MemInfo Impl.
 //-----------------------------------------------------------------------------
@@ -85,6 +103,10 @@ MemInfo MemInfo::get()
     MemInfo result;
     result.res = memory_used(true);
     result.virt = memory_used(false);
+    result.peak_res = peak_memory_used();
+    auto slab_stats = slab::stats();
+    result.slab_reserved = slab_stats.reservedBytes();
+    result.slab_used     = slab_stats.usedBytes();
     return result;
 }
 
@@ -106,8 +128,23 @@ size_t MemInfo::virt_KB() const
 size_t MemInfo::virt_B() const
 { return virt; }
 
+size_t MemInfo::peak_res_MB() const
+{ return peak_res/(1<<20); }
+
+size_t MemInfo::peak_res_B() const
+{ return peak_res; }
+
+size_t MemInfo::slab_reserved_MB() const
+{ return slab_reserved/(1<<20); }
+
+size_t MemInfo::slab_used_MB() const
+{ return slab_used/(1<<20); }
+
+size_t MemInfo::slab_overhead_MB() const
+{ return (slab_reserved - slab_used)/(1<<20); }
+
 MemInfo::MemInfo():
-    res(0), virt(0)
+    res(0), virt(0), peak_res(0), slab_reserved(0), slab_used(0)
 {}
 
 
@@ -117,7 +154,8 @@ MemInfo::MemInfo():
 
 std::ostream& operator<<(std::ostream &os, const MemInfo &memInfo)
 {
-    os << "MemInfo (MB.): resident: " << memInfo.res_MB() << "   virtual: " << memInfo.virt_MB() << std::endl;
+    os << "MemInfo (MB.): resident: " << memInfo.res_MB() << "   virtual: " << memInfo.virt_MB()
+       << "   slabs: " << memInfo.slab_reserved_MB() << "   slab overhead: " << memInfo.slab_overhead_MB() << std::endl;
     return os;
 }
 
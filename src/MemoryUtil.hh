@@ -33,6 +33,18 @@ struct MemInfo
 
     size_t virt_B() const;
 
+    size_t peak_res_MB() const;
+
+    size_t peak_res_B() const;
+
+    // slab allocator (see SlabAllocator.hh): bytes reserved on
+    // slabs, bytes used by live objects and the difference
+    size_t slab_reserved_MB() const;
+
+    size_t slab_used_MB() const;
+
+    size_t slab_overhead_MB() const;
+
 private:
     MemInfo();
 
@@ -40,6 +52,9 @@ private:
 private:
     size_t res;
     size_t virt;
+    size_t peak_res;
+    size_t slab_reserved;
+    size_t slab_used;
 
 };
 
@@ -28,6 +28,8 @@
 #include <boost/type_traits/is_same.hpp>
 
 #include <vector>
+#include <atomic>
+#include <utility>
 
 #include "Util.hh"
 #include "Tuple.hh"
@@ -35,12 +37,14 @@
 #include "FlatTree.hh"
 #include "FlatTreeN.hh"
 #include "TimeSeries.hh"
+#include "CompressedTimeSeries.hh"
 
 #define xDEBUG_STREE
 
 #include "TimeSeriesEntryType.hh"
 #include "NanoCubeReportBuilder.hh"
 #include "NanoCubeInsert.hh"
+#include "NanoCubeBulkInsert.hh"
 #include "NanoCubeQuery.hh"
 #include "NanoCubeTimeQuery.hh"
 #include "NanoCubeSchema.hh"
@@ -268,7 +272,11 @@ public: // subtypes
 
     typedef TimeSeriesEntryType<variable_types> entry_type;
 
+#ifdef TIMESERIES_COMPRESSED
+    typedef timeseries::CompressedTimeSeries<entry_type> time_series_type;
+#else
     typedef timeseries::TimeSeries<entry_type> time_series_type;
+#endif
 
     typedef dim_names dimension_names;
 
@@ -278,13 +286,15 @@ public: // subtypes
 
     typedef typename mpl::front<dimension_types>::type first_dimension_type;
 
+    typedef std::pair<address_type, entry_type> record_type;
+
     static const int DIMENSION = mpl::size<dimension_types>::type::value;
 
 public: // STATIC a single object of this type per process is expected
 
-    static uint64_t keys;
+    static std::atomic<uint64_t> keys;
 
-    static int flags; // used when inserting a new entry
+    static thread_local int flags; // used when inserting a new entry
 
 public: // methods
 
@@ -294,12 +304,30 @@ public: // methods
 
     bool add(std::istream &is);
 
+    // build this (empty) nanocube from a batch of records
+    // using num_threads threads (see NanoCubeBulkInsert.hh)
+    void bulkAdd(const std::vector<record_type> &records, int num_threads);
+
+    // forgets the nodes without deleting them (see QuadTree::abandon)
+    void abandon() { root.abandon(); }
+
     bool mountAddressFromStream(address_type &a, std::istream &is);
 
+    static bool mountRecordFromStream(record_type &r, std::istream &is);
+
     void mountReport(report::Report &report);
 
+    // Result: ::query::result::Result or anything with the same
+    // push/pop/store interface (e.g. ::collector_heap::Collector)
+    template <typename Result>
     void query(const ::query::QueryDescription  &query_description,
-               ::query::result::Result    &result);
+               Result                           &result);
+
+    // throws query::QueryAborted once the budget is exhausted
+    template <typename Result>
+    void query(const ::query::QueryDescription  &query_description,
+               Result                           &result,
+               query::Budget                    &budget);
 
     void timeQuery(::query::QueryDescription &query_description,
                    ::query::result::Result &result);
@@ -313,10 +341,10 @@ public:
 };
 
 template <typename A, typename B>
-uint64_t NanoCubeTemplate<A, B>::keys = 0;
+std::atomic<uint64_t> NanoCubeTemplate<A, B>::keys { 0 };
 
 template <typename A, typename B>
-int NanoCubeTemplate<A, B>::flags = 0;
+thread_local int NanoCubeTemplate<A, B>::flags = 0;
 
 
 
@@ -378,8 +406,9 @@ void NanoCubeTemplate<dim_names, var_types>::add(address_type address, entry_typ
     typedef NanoCubeTemplate<dim_names, var_types> nanocube_type;
     typedef typename mpl::begin<dimension_types>::type iterator;
 
-    static std::vector<void*> updated_content(1024);
-    static std::vector<void*> replaced_nodes(1024);
+    // scratch space is per thread
+    static thread_local std::vector<void*> updated_content(1024);
+    static thread_local std::vector<void*> replaced_nodes(1024);
 
     updated_content.clear();
     replaced_nodes.clear();
@@ -391,31 +420,46 @@ void NanoCubeTemplate<dim_names, var_types>::add(address_type address, entry_typ
 }
 
 template <typename dim_names, typename var_types>
-bool NanoCubeTemplate<dim_names, var_types>::add(std::istream &is) {
+bool NanoCubeTemplate<dim_names, var_types>::mountRecordFromStream(record_type &r, std::istream &is) {
 
     // loop through Address types reading
     // address raw data and building corresponding
     // adddress of the right kind
-    address_type a;
-
-    bool valid_address = mountAddressFromStream(a, is);
+    static const bool empty = mpl::empty<dimension_types>::type::value;
+    bool valid_address = Aux<dimension_types, empty>::process(r.first, is);
 
     if (!valid_address) {
         return false;
     }
 
-    entry_type e;
-
-    is.read(e.data, entry_type::total_size);
+    is.read(r.second.data, entry_type::total_size);
     if (!is) {
         return false;
     }
 
-    this->add(a, e);
+    return true;
+}
+
+template <typename dim_names, typename var_types>
+bool NanoCubeTemplate<dim_names, var_types>::add(std::istream &is) {
+
+    record_type r;
+
+    if (!mountRecordFromStream(r, is)) {
+        return false;
+    }
+
+    this->add(r.first, r.second);
 
     return true;
 }
 
+template <typename dim_names, typename var_types>
+void NanoCubeTemplate<dim_names, var_types>::bulkAdd(const std::vector<record_type> &records, int num_threads) {
+    static const bool first_dimension_is_quadtree = mpl::front<dim_names>::type::Kind == QUADTREE;
+    insert::BulkInsert<nanocube_type, first_dimension_is_quadtree> bulk_insert(*this, records, num_threads);
+}
+
 template <typename dim_names, typename var_types>
 void NanoCubeTemplate<dim_names, var_types>::mountReport(report::Report &report)
 {
@@ -441,12 +485,24 @@ void NanoCubeTemplate<dim_names, var_types>::mountReport(report::Report &report)
 }
 
 template <typename dim_names, typename var_types>
+template <typename Result>
 void NanoCubeTemplate<dim_names, var_types>::query(
         const ::query::QueryDescription  &query_description,
-        ::query::result::Result    &result)
+        Result                           &result)
+{
+    query::Budget budget; // no limits
+    this->query(query_description, result, budget);
+}
+
+template <typename dim_names, typename var_types>
+template <typename Result>
+void NanoCubeTemplate<dim_names, var_types>::query(
+        const ::query::QueryDescription  &query_description,
+        Result                           &result,
+        query::Budget                    &budget)
 {
     Cache cache; // caches only within a single query
-    query::Query<nanocube_type> query(root, query_description, result, cache);
+    query::Query<nanocube_type, 0, Result> query(root, query_description, result, cache, budget);
 }
 
 template <typename dim_names, typename var_types>
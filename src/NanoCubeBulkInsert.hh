@@ -0,0 +1,611 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include <boost/mpl/begin_end.hpp>
+
+namespace mpl = boost::mpl;
+
+namespace nanocube {
+
+namespace insert {
+
+//-----------------------------------------------------------------------------
+// Merge
+//-----------------------------------------------------------------------------
+
+//
+// Merge<Content>::exec(inputs) builds a new content with the records of
+// two or more contents of the same type. A part found in a single input
+// is shared with that input instead of copied, so the new content only
+// owns what had to be combined.
+//
+
+template <typename Content>
+struct Merge {};
+
+template <quadtree::BitSize N, typename Content, typename Policy>
+struct Merge<quadtree::QuadTree<N, Content, Policy>>
+{
+    typedef quadtree::QuadTree<N, Content, Policy>  tree_type;
+    typedef typename tree_type::NodeType            node_type;
+
+    static tree_type* exec(const std::vector<tree_type*> &inputs) {
+        std::vector<node_type*> roots;
+        for (auto tree: inputs) {
+            roots.push_back(tree->root);
+        }
+        tree_type *result = new tree_type();
+        result->root = node(roots);
+        return result;
+    }
+
+    // inputs are two or more nodes on the same address
+    static node_type* node(const std::vector<node_type*> &inputs) {
+        node_type *result = new quadtree::ScopedNode<Content, quadtree::NodeType0000, Policy>();
+        node_type *child  = nullptr;
+        std::vector<node_type*> children;
+        for (quadtree::ChildName name=0;name<4;++name) {
+            children.clear();
+            for (auto input: inputs) {
+                node_type *input_child = input->getChild(name);
+                if (input_child) {
+                    children.push_back(input_child);
+                }
+            }
+            if (children.empty()) {
+                continue;
+            }
+
+            bool shared = children.size() == 1;
+            child = shared ? children[0] : node(children);
+
+            node_type *result_updated = result->copyWithAddedChild(child, name, shared ? quadtree::SHARED_FLAG : quadtree::PROPER_FLAG);
+            result->setContentAndChildrenToNull();
+            delete result;
+            result = result_updated;
+        }
+
+        if (result->getNumChildren() == 1) {
+            result->setSharedContent(child->getContent());
+        }
+        else {
+            std::vector<Content*> contents;
+            for (auto input: inputs) {
+                contents.push_back(input->getContent());
+            }
+            result->setProperContent(Merge<Content>::exec(contents));
+        }
+        return result;
+    }
+};
+
+template <typename Content, typename Policy>
+struct Merge<flattree::FlatTree<Content, Policy>>
+{
+    typedef flattree::FlatTree<Content, Policy> tree_type;
+
+    static tree_type* exec(const std::vector<tree_type*> &inputs) {
+        tree_type *result = new tree_type();
+
+        // links are sorted by label on every input
+        std::vector<std::size_t> next(inputs.size(), 0);
+        std::vector<Content*>    contents;
+        while (true) {
+            bool found = false;
+            flattree::PathElement label = 0;
+            for (std::size_t i=0;i<inputs.size();++i) {
+                if (next[i] < inputs[i]->links.size() && (!found || inputs[i]->links[next[i]].label < label)) {
+                    label = inputs[i]->links[next[i]].label;
+                    found = true;
+                }
+            }
+            if (!found) {
+                break;
+            }
+
+            contents.clear();
+            for (std::size_t i=0;i<inputs.size();++i) {
+                if (next[i] < inputs[i]->links.size() && inputs[i]->links[next[i]].label == label) {
+                    contents.push_back(inputs[i]->links[next[i]].getContent());
+                    ++next[i];
+                }
+            }
+
+            result->links.push_back(flattree::Link<Content, Policy>(label));
+            if (contents.size() == 1) {
+                result->links.back().setSharedContent(contents[0]);
+            }
+            else {
+                result->links.back().setProperContent(Merge<Content>::exec(contents));
+            }
+            ++tree_type::count_entries;
+        }
+
+        if (result->links.size() == 1) {
+            result->setSharedContent(result->links[0].getContent());
+        }
+        else {
+            contents.clear();
+            for (auto input: inputs) {
+                contents.push_back(input->getContent());
+            }
+            result->setProperContent(Merge<Content>::exec(contents));
+        }
+        return result;
+    }
+};
+
+template <flattree_n::NumBytes N, typename Content, typename Policy>
+struct Merge<flattree_n::FlatTree<N, Content, Policy>>
+{
+    typedef flattree_n::FlatTree<N, Content, Policy>   tree_type;
+    typedef typename tree_type::LinkType               link_type;
+
+    static tree_type* exec(const std::vector<tree_type*> &inputs) {
+        tree_type *result = new tree_type();
+
+        // links are sorted by raw address on every input
+        std::vector<std::size_t> next(inputs.size(), 0);
+        std::vector<Content*>    contents;
+        while (true) {
+            bool found = false;
+            flattree_n::RawAddress raw_address = 0;
+            for (std::size_t i=0;i<inputs.size();++i) {
+                if (next[i] < inputs[i]->links.size() && (!found || inputs[i]->links[next[i]].getRawAddress() < raw_address)) {
+                    raw_address = inputs[i]->links[next[i]].getRawAddress();
+                    found = true;
+                }
+            }
+            if (!found) {
+                break;
+            }
+
+            contents.clear();
+            for (std::size_t i=0;i<inputs.size();++i) {
+                if (next[i] < inputs[i]->links.size() && inputs[i]->links[next[i]].getRawAddress() == raw_address) {
+                    contents.push_back(inputs[i]->links[next[i]].getContent());
+                    ++next[i];
+                }
+            }
+
+            result->links.push_back(link_type(raw_address));
+            if (contents.size() == 1) {
+                result->links.back().setSharedContent(contents[0]);
+            }
+            else {
+                result->links.back().setProperContent(Merge<Content>::exec(contents));
+            }
+        }
+
+        if (result->links.size() == 1) {
+            result->setSharedContent(result->links[0].getContent());
+        }
+        else {
+            contents.clear();
+            for (auto input: inputs) {
+                contents.push_back(input->getContent());
+            }
+            result->setProperContent(Merge<Content>::exec(contents));
+        }
+        return result;
+    }
+};
+
+// cumulative entries of the union of the inputs: the entry on time t
+// adds up the last entry up to t of every input
+template <typename TimeSeries>
+std::vector<typename TimeSeries::EntryType> mergeEntries(const std::vector<TimeSeries*> &inputs)
+{
+    typedef typename TimeSeries::EntryType entry_type;
+
+    std::vector<std::vector<entry_type>> series(inputs.size());
+    for (std::size_t i=0;i<inputs.size();++i) {
+        series[i].reserve(inputs[i]->size());
+        inputs[i]->forEachEntry([&series, i](const entry_type &e) { series[i].push_back(e); });
+    }
+
+    std::vector<entry_type>  result;
+    std::vector<std::size_t> next(inputs.size(), 0);
+    while (true) {
+        bool found = false;
+        uint64_t time = 0;
+        for (std::size_t i=0;i<series.size();++i) {
+            if (next[i] < series[i].size() && (!found || series[i][next[i]].template get<0>() < time)) {
+                time  = series[i][next[i]].template get<0>();
+                found = true;
+            }
+        }
+        if (!found) {
+            break;
+        }
+
+        bool first = true;
+        for (std::size_t i=0;i<series.size();++i) {
+            if (next[i] < series[i].size() && series[i][next[i]].template get<0>() == time) {
+                ++next[i];
+            }
+            if (next[i] == 0) {
+                continue;
+            }
+            if (first) {
+                result.push_back(series[i][next[i] - 1]);
+                first = false;
+            }
+            else {
+                result.back().accum(series[i][next[i] - 1]);
+            }
+        }
+        result.back().template set<0>(time);
+    }
+    return result;
+}
+
+template <typename Entry>
+struct Merge<timeseries::TimeSeries<Entry>>
+{
+    typedef timeseries::TimeSeries<Entry> series_type;
+
+    static series_type* exec(const std::vector<series_type*> &inputs) {
+        auto entries = mergeEntries(inputs);
+        series_type *result = new series_type();
+        result->entries.resize(entries.size());
+        std::copy(entries.begin(), entries.end(), result->entries.begin());
+        return result;
+    }
+};
+
+template <typename Entry>
+struct Merge<timeseries::CompressedTimeSeries<Entry>>
+{
+    typedef timeseries::CompressedTimeSeries<Entry> series_type;
+
+    static series_type* exec(const std::vector<series_type*> &inputs) {
+        series_type *result = new series_type();
+        try {
+            result->assign(mergeEntries(inputs));
+        }
+        catch (...) {
+            delete result;
+            throw;
+        }
+        return result;
+    }
+};
+
+//-----------------------------------------------------------------------------
+// BulkInsert
+//-----------------------------------------------------------------------------
+
+//
+// Builds an *empty* nanocube from a batch of records using several
+// threads.
+//
+// When the first dimension is a quadtree the records are partitioned by
+// their cell at "split_level". The subtree of a cell only sees the records
+// that fall into that cell and its contents only share with its own
+// descendants, so every cell is built sequentially (original record order)
+// on a private nanocube by some worker thread and then grafted into the
+// final root.
+//
+// The few nodes above split_level are stitched afterwards, one level at
+// a time from the cells up: a node with a single child shares the content
+// of that child, while a node with more children gets a proper content
+// merged from the contents of its children (see Merge). The merges of a
+// level run on the workers and only walk the children contents, never
+// the records again. Whatever comes from a single child is shared with
+// it, as a sequential insertion shares it with the parallel structure,
+// so the result answers queries and takes later insertions the same way.
+//
+// Any other first dimension falls back to sequential insertion.
+//
+
+template <typename nanocube, bool FirstDimensionIsQuadTree>
+struct BulkInsert
+{
+    typedef typename nanocube::record_type record_type;
+
+    BulkInsert(nanocube                       &nc,
+               const std::vector<record_type> &records,
+               int                             num_threads)
+    {
+        for (auto &record: records) {
+            nc.add(record.first, record.second);
+        }
+    }
+};
+
+template <typename nanocube>
+struct BulkInsert<nanocube, true>
+{
+
+public: // subtypes & class constants
+
+    typedef nanocube                                                 nanocube_type;
+    typedef typename nanocube::record_type                           record_type;
+    typedef typename nanocube::first_dimension_type                  dimension_type;
+    typedef typename dimension_type::NodeType                        node_type;
+    typedef typename dimension_type::ContentType                     content_type;
+    typedef typename dimension_type::AddressType                     dimension_address_type;
+    typedef typename mpl::begin<typename nanocube::dimension_types>::type iterator;
+    typedef Insert<nanocube, iterator>                               insert_type;
+
+    static const int N               = dimension_type::AddressSize;
+    static const int MAX_SPLIT_LEVEL = 6; // at most 4096 cells
+
+    struct Task {
+        Task() = default;
+        Task(std::size_t size, std::function<void()> run):
+            size(size), run(run)
+        {}
+        std::size_t           size { 0 }; // number of records (bigger tasks go first)
+        std::function<void()> run;
+    };
+
+public: // constructor
+
+    BulkInsert(nanocube_type                  &nc,
+               const std::vector<record_type> &records,
+               int                             num_threads);
+
+private:
+
+    inline std::size_t index(int level, uint32_t x, uint32_t y) const {
+        return ((std::size_t) y << level) | x;
+    }
+
+    void buildCell(uint32_t x, uint32_t y, const std::vector<std::size_t> &cell_records);
+
+    void mergeContent(int level, uint32_t x, uint32_t y);
+
+    node_type* stitch(int level, uint32_t x, uint32_t y);
+
+    // runs the tasks that build the given level
+    void runTasks(std::vector<Task> &tasks, int level);
+
+public: // members
+
+    nanocube_type                           &nc;
+    const std::vector<record_type>          &records;
+    int                                      num_threads;
+    int                                      split_level { 0 };
+
+    std::vector<uint32_t>                    record_x;  // cell coords of each record
+    std::vector<uint32_t>                    record_y;  // on split_level
+
+    std::vector<std::vector<bool>>           occupied;  // [level][index]
+    std::vector<std::vector<content_type*>>  contents;  // [level][index] for levels < split_level
+    std::vector<std::vector<node_type*>>     nodes;     // [level][index] (the cells on split_level)
+
+};
+
+//-----------------------------------------------------------------------------
+// BulkInsert Impl.
+//-----------------------------------------------------------------------------
+
+template <typename nanocube>
+BulkInsert<nanocube, true>::BulkInsert(nanocube_type                  &nc,
+                                       const std::vector<record_type> &records,
+                                       int                             num_threads):
+    nc(nc),
+    records(records),
+    num_threads(num_threads)
+{
+    // bulk insertion assumes nothing is there yet
+    if (num_threads <= 1 || N == 0 || !nc.root.isEmpty() || records.empty()) {
+        BulkInsert<nanocube, false> sequential(nc, records, num_threads);
+        return;
+    }
+
+    // a few cells per thread so that the workers stay balanced
+    split_level = 1;
+    while (split_level < MAX_SPLIT_LEVEL && split_level < N &&
+           (1UL << (2 * split_level)) < 8UL * num_threads) {
+        ++split_level;
+    }
+
+    const uint32_t coord_mask = (1U << split_level) - 1;
+
+    // partition records by cell
+    std::vector<std::vector<std::size_t>> cell_records(1UL << (2 * split_level));
+    record_x.resize(records.size());
+    record_y.resize(records.size());
+    for (std::size_t i=0;i<records.size();++i) {
+        auto address = records[i].first; // Tuple::get is not const
+        auto &dimension_address = address.template get<dimension_address_type>();
+        record_x[i] = (dimension_address.x >> (N - split_level)) & coord_mask;
+        record_y[i] = (dimension_address.y >> (N - split_level)) & coord_mask;
+        cell_records[index(split_level, record_x[i], record_y[i])].push_back(i);
+    }
+
+    // occupied cells and number of records below them
+    // on every level above (and including) split_level
+    occupied.resize(split_level + 1);
+    contents.resize(split_level);
+    nodes.resize(split_level + 1);
+    std::vector<std::vector<std::size_t>> counts(split_level + 1);
+    for (int level=0;level<=split_level;++level) {
+        occupied[level].resize(1UL << (2 * level), false);
+        nodes[level].resize(1UL << (2 * level), nullptr);
+        counts[level].resize(1UL << (2 * level), 0);
+        if (level < split_level) {
+            contents[level].resize(1UL << (2 * level), nullptr);
+        }
+    }
+    for (std::size_t i=0;i<records.size();++i) {
+        for (int level=0;level<=split_level;++level) {
+            int shift = split_level - level;
+            occupied[level][index(level, record_x[i] >> shift, record_y[i] >> shift)] = true;
+            ++counts[level][index(level, record_x[i] >> shift, record_y[i] >> shift)];
+        }
+    }
+
+    std::vector<Task> tasks;
+
+    // one task per occupied cell
+    for (uint32_t y=0;y<=coord_mask;++y) {
+        for (uint32_t x=0;x<=coord_mask;++x) {
+            auto &cr = cell_records[index(split_level, x, y)];
+            if (cr.size()) {
+                tasks.push_back(Task(cr.size(), [this, x, y, &cr]() { buildCell(x, y, cr); }));
+            }
+        }
+    }
+
+    auto by_size = [](const Task &a, const Task &b) { return a.size > b.size; };
+
+    std::stable_sort(tasks.begin(), tasks.end(), by_size);
+
+    runTasks(tasks, split_level);
+
+    // one task per node with more than one child, a level at a
+    // time: its content is merged from the level below
+    for (int level=split_level-1;level>=0;--level) {
+        tasks.clear();
+        for (uint32_t y=0;y<(1U << level);++y) {
+            for (uint32_t x=0;x<(1U << level);++x) {
+                int num_children = 0;
+                for (int name=0;name<4;++name) {
+                    num_children += occupied[level+1][index(level+1, 2*x + (name & 1), 2*y + (name >> 1))] ? 1 : 0;
+                }
+                if (num_children > 1) {
+                    tasks.push_back(Task(counts[level][index(level, x, y)], [this, level, x, y]() { mergeContent(level, x, y); }));
+                }
+            }
+        }
+
+        std::stable_sort(tasks.begin(), tasks.end(), by_size);
+
+        runTasks(tasks, level);
+
+        for (uint32_t y=0;y<(1U << level);++y) {
+            for (uint32_t x=0;x<(1U << level);++x) {
+                nodes[level][index(level, x, y)] = stitch(level, x, y);
+            }
+        }
+    }
+
+    nc.root.root = nodes[0][0];
+}
+
+template <typename nanocube>
+void BulkInsert<nanocube, true>::buildCell(uint32_t x, uint32_t y, const std::vector<std::size_t> &cell_records)
+{
+    // all nodes above the cell have a single child
+    // and simply share the content of the cell
+    nanocube_type cube(nc.schema);
+    for (auto i: cell_records) {
+        cube.add(records[i].first, records[i].second);
+    }
+
+    dimension_address_type cell_address(x, y, split_level, quadtree::FLAG_HIGH_LEVEL_COORDS);
+    dimension_address_type parent_address(x >> 1, y >> 1, split_level - 1, quadtree::FLAG_HIGH_LEVEL_COORDS);
+
+    node_type *cell   = cube.root.find(cell_address);
+    node_type *parent = cube.root.find(parent_address);
+
+    // detach the cell subtree from the private cube: once the
+    // link is shared the private cube won't delete the subtree
+    parent->setChild(cell, cell_address.nameOnParent(), quadtree::SHARED_FLAG);
+
+    nodes[split_level][index(split_level, x, y)] = cell;
+}
+
+template <typename nanocube>
+void BulkInsert<nanocube, true>::mergeContent(int level, uint32_t x, uint32_t y)
+{
+    std::vector<content_type*> inputs;
+    for (quadtree::ChildName name=0;name<4;++name) {
+        node_type *child = nodes[level + 1][index(level + 1, 2*x + (name & 1), 2*y + (name >> 1))];
+        if (child) {
+            inputs.push_back(child->getContent());
+        }
+    }
+    contents[level][index(level, x, y)] = Merge<content_type>::exec(inputs);
+}
+
+template <typename nanocube>
+typename BulkInsert<nanocube, true>::node_type*
+BulkInsert<nanocube, true>::stitch(int level, uint32_t x, uint32_t y)
+{
+    if (!occupied[level][index(level, x, y)]) {
+        return nullptr;
+    }
+
+    node_type *node = new quadtree::ScopedNode<content_type, quadtree::NodeType0000, typename dimension_type::PolicyType>();
+    node_type *child = nullptr;
+    for (quadtree::ChildName name=0;name<4;++name) {
+        node_type *next_child = nodes[level + 1][index(level + 1, 2*x + (name & 1), 2*y + (name >> 1))];
+        if (!next_child) {
+            continue;
+        }
+
+        node_type *node_updated = node->copyWithAddedChild(next_child, name, quadtree::PROPER_FLAG);
+        node->setContentAndChildrenToNull();
+        delete node;
+
+        node  = node_updated;
+        child = next_child;
+    }
+
+    if (node->getNumChildren() == 1) {
+        node->setSharedContent(child->getContent());
+    }
+    else {
+        node->setProperContent(contents[level][index(level, x, y)]);
+    }
+
+    return node;
+}
+
+template <typename nanocube>
+void BulkInsert<nanocube, true>::runTasks(std::vector<Task> &tasks, int level)
+{
+    std::atomic<std::size_t>        next_task { 0 };
+    std::vector<std::exception_ptr> errors(num_threads);
+
+    auto worker = [&](int worker_index) {
+        try {
+            for (std::size_t t=next_task++;t<tasks.size();t=next_task++) {
+                tasks[t].run();
+            }
+        }
+        catch (...) {
+            errors[worker_index] = std::current_exception();
+            next_task = tasks.size(); // stop the other workers
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i=0;i<num_threads;++i) {
+        workers.push_back(std::thread(worker, i));
+    }
+    for (auto &w: workers) {
+        w.join();
+    }
+
+    for (auto &e: errors) {
+        if (e) {
+            // the contents of this level only own what they merged; the
+            // nodes of the level below own everything under them
+            if (level < split_level) {
+                for (auto content: contents[level]) {
+                    delete content;
+                }
+            }
+            for (auto node: nodes[std::min(level + 1, split_level)]) {
+                delete node;
+            }
+            std::rethrow_exception(e);
+        }
+    }
+}
+
+} // insert namespace
+
+} // nanocube namespace
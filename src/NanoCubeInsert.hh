@@ -190,7 +190,7 @@ Insert<nanocube, iterator>::Insert(address_type               &address,
     dimension_address_type &dimension_address =
             address.template get<dimension_address_type>();
 
-    static typename dimension_type::NodeStackType stack;
+    static thread_local typename dimension_type::NodeStackType stack;
     stack.clear();
 
     // trail proper path
@@ -15,8 +15,10 @@
 
 #include "Query.hh"
 #include "QueryResult.hh"
+#include "FlatResult.hh"
 
 #include "NanoCubeQueryException.hh"
+#include "QueryBudget.hh"
 
 #include "cache.hh"
 
@@ -37,21 +39,34 @@ namespace query {
 // Query
 //-----------------------------------------------------------------------------
 
-template <typename NanoCube, int Index=0>
+//
+// Result receives push(label), pop() and store(value, op) calls while
+// the cube is traversed (a ::query::result::Result builds the whole
+// result tree; see FlatResult.hh and CollectorHeap.hh for ones that
+// don't).
+//
+// Every visited node is charged to the Budget of the query, which
+// aborts the traversal (throws QueryAborted) once it is exhausted.
+//
+// A ::query::result::FanOutResult evaluates several queries on one
+// traversal: on its dimension the target of each of its members is
+// visited in turn, instead of the target of the description.
+//
+template <typename NanoCube, int Index=0, typename Result=::query::result::Result>
 struct Query
 {
 
 public: // subtypes & class constants
 
     typedef ::query::QueryDescription                                query_description_type;
-    typedef ::query::result::Result                                  query_result_type;
+    typedef Result                                                   query_result_type;
 
     typedef NanoCube                                                 nanocube_type;
 
     typedef typename nanocube_type::dimension_types                  dimension_types;
     typedef typename nanocube_type::entry_type                       entry_type;
 
-    typedef Query<nanocube_type, Index>                              query_type;
+    typedef Query<nanocube_type, Index, Result>                      query_type;
 
     typedef typename boost::mpl::at_c<dimension_types, Index>::type         dimension_type;
     typedef typename boost::mpl::at_c<dimension_types, Index+1>::type       next_dimension_type;
@@ -71,18 +86,30 @@ public: // constructor
     Query(dimension_type            &tree,
           const query_description_type    &query_description,
           query_result_type         &result,
-          Cache                     &cache);
+          Cache                     &cache,
+          Budget                    &budget);
 
 public: // methods
 
     void visit(dimension_node_type *node, const dimension_address_type &addr);
 
+    // a node walked through on the way to the visited ones
+    inline void charge() { budget.charge(); }
+
+private:
+
+    // visit the nodes of target on tree
+    void traverse(dimension_type &tree);
+
 public: // methods
 
     const ::query::QueryDescription &query_description;
 
     query_result_type &result;
     Cache             &cache;
+    Budget            &budget;
+
+    ::query::Target   *target; // being visited on this dimension
 
     bool    anchored;
     bool    pushed;
@@ -100,6 +127,57 @@ public: // methods
 
 namespace aux {
 
+// labels are pushed through these, so that a result that packs them
+// (see FlatResult.hh) is not given a DimAddress on every visit
+
+template <typename Result, typename Address>
+inline void pushAddress(Result &result, const Address &address) {
+    result.push(address.getDimensionPath());
+}
+
+template <typename Address>
+inline void pushAddress(::query::result::FlatResult &result, const Address &address) {
+    result.pushAddress(address);
+}
+
+template <typename Result>
+inline void pushBin(Result &result, uint32_t bin) {
+    result.push(std::vector<int> { (int) bin });
+}
+
+inline void pushBin(::query::result::FlatResult &result, uint32_t bin) {
+    result.pushBin(bin);
+}
+
+template <typename Address>
+inline void pushAddress(::query::result::FanOutResult &result, const Address &address) {
+    result.pushAddress(address);
+}
+
+inline void pushBin(::query::result::FanOutResult &result, uint32_t bin) {
+    result.pushBin(bin);
+}
+
+// targets visited in turn on a dimension (see FanOutResult): none
+// for the other results
+
+template <typename Result>
+inline const std::vector<::query::Target*> *fanOutTargets(Result &, int) {
+    return nullptr;
+}
+
+inline const std::vector<::query::Target*> *fanOutTargets(::query::result::FanOutResult &result, int dimension) {
+    return result.dimension == dimension ? &result.targets : nullptr;
+}
+
+template <typename Result>
+inline void selectMember(Result &, int) {
+}
+
+inline void selectMember(::query::result::FanOutResult &result, int member) {
+    result.select(member);
+}
+
 template <typename query_type, bool Flag=false>
 struct Eval {
 
@@ -108,9 +186,9 @@ struct Eval {
     typedef typename query_type::query_result_type         query_result_type;
     typedef typename query_type::dimension_content_type    dimension_content_type;
 
-    static void eval(dimension_content_type &content, const query_description_type &qd, query_result_type &result, Cache &cache) {
+    static void eval(dimension_content_type &content, const query_description_type &qd, query_result_type &result, Cache &cache, Budget &budget) {
 
-        Query<nanocube_type, query_type::DIMENSION_INDEX + 1> q(content, qd, result, cache);
+        Query<nanocube_type, query_type::DIMENSION_INDEX + 1, query_result_type> q(content, qd, result, cache, budget);
 
         // query::Query<QueryDescriptionType> query(root, query_description, result);
 
@@ -124,16 +202,27 @@ struct Eval<query_type, true> {
     typedef typename query_type::nanocube_type              nanocube_type;
     typedef typename query_type::query_result_type          query_result_type;
     typedef typename query_type::dimension_content_type     dimension_content_type;
+    typedef typename query_type::entry_type                 entry_type;
 
     static void eval(dimension_content_type &content,
                      const query_description_type &qd,
                      query_result_type      &result,
-                     Cache &cache) {
+                     Cache &cache,
+                     Budget &budget) {
 
-        // content will be a time series and there will be a variable
-        // index in which we are interested.
+        // content is a time series: every variable on qd.variables is
+        // aggregated on the same pass (one measure per variable)
 
-        // get the first variable for now (query_type::VARIABLE_INDEX)
+        const std::vector<int> &variables = qd.variables;
+
+        auto measures = [&variables](const entry_type &before, const entry_type &last) -> ::nanocube::Measures {
+            ::nanocube::Measures m;
+            m.resize(variables.size());
+            for (std::size_t j=0;j<variables.size();++j) {
+                m[j] = ::nanocube::Measure((uint64_t) (last.get(variables[j]) - before.get(variables[j])));
+            }
+            return m;
+        };
 
         // context is stored in the result object???
         ::query::Target* target = qd.targets[query_type::DIMENSION_INDEX + 1];
@@ -146,9 +235,7 @@ struct Eval<query_type, true> {
                 throw QueryException("Anchors on time dimension should use: base:width:count notation");
             }
 
-            uint64_t last_value = content.entries.back().template get<1>();
-            result.store(last_value, ::tree_store::ADD);
-
+            result.store(measures(entry_type(), content.back()), ::tree_store::ADD);
 
         }
         else if (target->type == ::query::Target::BASE_WIDTH_COUNT) {
@@ -165,22 +252,29 @@ struct Eval<query_type, true> {
             uint32_t base  = (uint32_t) bwc_target.base;
             uint32_t width = (uint32_t) bwc_target.width;
             uint32_t count = (uint32_t) bwc_target.count;
-            uint32_t a = base;
-            for (uint32_t i=0;i<count;i++) {
-                uint32_t b = a + width;
-                uint64_t value = content.template getWindowTotal<1>(a,b);
-                if (value != 0) {
-                    if (anchored) {
-                        // ::query::RawAddress addr = ((uint64_t) a << 32) + b;
-                        std::vector<int> path { (int) i };
-                        result.push(path);
-                    }
-                    result.store(value, ::tree_store::ADD);
-                    if (anchored) {
-                        result.pop();
-                    }
+
+            // all bins in one merge pass over the time series
+            // (only the non-zero ones are visited)
+            auto store_bin = [&](uint32_t i, const ::nanocube::Measures &value) {
+                budget.charge(); // long series are as costly as many nodes
+                if (anchored) {
+                    pushBin(result, i);
                 }
-                a = b;
+                result.store(value, ::tree_store::ADD);
+                if (anchored) {
+                    result.pop();
+                }
+            };
+
+            if (variables.size() == 1 && variables[0] == 1) {
+                content.template visitWindowTotals<1>(base, width, count, [&](uint32_t i, uint64_t value) {
+                    store_bin(i, ::nanocube::Measures(value));
+                });
+            }
+            else {
+                content.visitWindowBins(base, width, count, [&](uint32_t i, const entry_type &before, const entry_type &last) {
+                    store_bin(i, measures(before, last));
+                });
             }
         }
     }
@@ -192,20 +286,46 @@ struct Eval<query_type, true> {
 // Query Impl.
 //-----------------------------------------------------------------------------
 
-template <typename NanoCube, int Index>
-Query<NanoCube, Index>::Query(dimension_type             &tree,
-                              const query_description_type     &query_description,
-                              query_result_type          &result,
-                              Cache                      &cache):
+template <typename NanoCube, int Index, typename Result>
+Query<NanoCube, Index, Result>::Query(dimension_type             &tree,
+                                      const query_description_type     &query_description,
+                                      query_result_type          &result,
+                                      Cache                      &cache,
+                                      Budget                     &budget):
     query_description(query_description),
     result(result),
     cache(cache),
+    budget(budget),
+    target(query_description.targets[Index]),
     anchored(false),
     pushed(false)
 {
-    // context is stored in the result object???
-    ::query::Target *target = query_description.targets[Index];
+    auto fan_out = aux::fanOutTargets(result, Index);
+    if (!fan_out) {
+        traverse(tree);
+        if (pushed) {
+            result.pop();
+        }
+        return;
+    }
 
+    // the traversal so far is shared by the members: each one visits
+    // its own target from here
+    for (std::size_t i=0;i<fan_out->size();++i) {
+        aux::selectMember(result, (int) i);
+        target = (*fan_out)[i];
+        traverse(tree);
+        if (pushed) {
+            result.pop();
+            pushed = false;
+        }
+    }
+    aux::selectMember(result, -1);
+}
+
+template <typename NanoCube, int Index, typename Result>
+void Query<NanoCube, Index, Result>::traverse(dimension_type &tree)
+{
     Query &query = *this;
 
     if (target->type == ::query::Target::ROOT) { // simplest case
@@ -292,7 +412,10 @@ Query<NanoCube, Index>::Query(dimension_type             &tree,
 //        //        std::cout << "max_address: " << max_address << std::endl;
 //        
 //        // use the visitSubnodes interface
-        tree.visitExistingTreeLeaves(mask_target.root, query);
+        if (mask_target.root)
+            tree.visitExistingTreeLeaves(*mask_target.intervals, query);
+        else
+            tree.visitExistingTreeLeaves(mask_target.packed_root, query);
 //        
 //        //        ::query::RangeTarget &range_target = *target->asRangeTarget();
 //        
@@ -307,14 +430,12 @@ Query<NanoCube, Index>::Query(dimension_type             &tree,
     else {
         throw std::exception();
     }
-
-    if (pushed) {
-        result.pop();
-    }
 }
 
-template <typename NanoCube, int Index>
-void Query<NanoCube, Index>::visit(dimension_node_type *node, const dimension_address_type &address) {
+template <typename NanoCube, int Index, typename Result>
+void Query<NanoCube, Index, Result>::visit(dimension_node_type *node, const dimension_address_type &address) {
+
+    budget.charge();
 
     // state
     if (query_description.anchors[Index]) {
@@ -326,7 +447,6 @@ void Query<NanoCube, Index>::visit(dimension_node_type *node, const dimension_ad
         // address conversion
         if (query_description.img_hint[Index]) {
             // assume it is a dive target
-            auto target = query_description.targets[Index];
             auto dive_target = target->asFindAndDiveTarget();
             if (dive_target) {
                 auto raw_base  = dive_target->base;
@@ -343,14 +463,14 @@ void Query<NanoCube, Index>::visit(dimension_node_type *node, const dimension_ad
             }
         }
         else {
-            result.push(address.getDimensionPath());
+            aux::pushAddress(result, address);
         }
         pushed = true;
     }
 
     dimension_content_type &content = *node->getContent();
 
-    aux::Eval<query_type, (DIMENSION_INDEX == DIMENSION-1)>::eval(content, query_description, result, cache);
+    aux::Eval<query_type, (DIMENSION_INDEX == DIMENSION-1)>::eval(content, query_description, result, cache, budget);
 
 }
 
@@ -7,3 +7,12 @@
 nanocube::query::QueryException::QueryException(const std::string &message):
     std::runtime_error(message)
 {}
+
+//------------------------------------------------------------------------------
+// QueryAborted Impl.
+//------------------------------------------------------------------------------
+
+nanocube::query::QueryAborted::QueryAborted(Reason reason, const std::string &message):
+    QueryException(message),
+    reason(reason)
+{}
@@ -16,6 +16,19 @@ public:
     QueryException(const std::string &message);
 };
 
+//------------------------------------------------------------------------------
+// QueryAborted
+//------------------------------------------------------------------------------
+
+// a query stopped before it was done (see QueryBudget.hh)
+struct QueryAborted: public QueryException {
+public:
+    enum Reason { TIMEOUT, NODE_BUDGET, CANCELLED };
+    QueryAborted(Reason reason, const std::string &message);
+public:
+    Reason reason;
+};
+
 } // query
 
 } // nanocube
@@ -175,14 +175,14 @@ void AuxReportBuilder<ReportBuilder, true>::process_content(const node_type *nod
 
     std::stringstream ss;
     bool first = true;
-    for (entry_type &e: content->entries) {
+    content->forEachEntry([&ss, &first](const entry_type &e) {
         if (!first) {
             ss << " ";
         }
         uint64_t time = e.template get<0>();
         ss << "t" << time;
         first = false;
-    }
+    });
     content_report_node->setInfo(ss.str());
 
     // report node
@@ -128,12 +128,12 @@ struct Eval<query_type, true> {
 
         // context is stored in the result object???
 
-        if (content.entries.size() == 0)
+        if (content.size() == 0)
             throw ::nanocube::query::QueryException("No entries when a timeseries was expected");
 
-        uint64_t a     = content.entries.front().template get<0>();
-        uint64_t b     = content.entries.back().template get<0>();
-        uint64_t count = content.entries.back().template get<1>();
+        uint64_t a     = content.front().template get<0>();
+        uint64_t b     = content.back().template get<0>();
+        uint64_t count = content.back().template get<1>();
 
         // it is an open interval [a,b)
         ::query::RawAddress addr = ((uint64_t) a << 32) + (b+1);
@@ -21,6 +21,8 @@
 #include "geom2d/polygon.hh"
 
 #include "polycover/labeled_tree.hh"
+#include "polycover/packed_tree.hh"
+#include "polycover/interval_mask.hh"
 
 namespace quadtree
 {
@@ -29,6 +31,10 @@ namespace quadtree
     
     using Mask = polycover::labeled_tree::Node;
 
+    using PackedMaskCursor = polycover::labeled_tree::PackedCursor;
+
+    using MaskIntervals = polycover::labeled_tree::IntervalMask;
+
     using Cache = nanocube::Cache;
 
 //-----------------------------------------------------------------------------
@@ -52,10 +58,10 @@ typedef uint8_t  BitIndex; // this goes up 25 (17 zooms + 8 resolution)
 template<BitSize N, typename Structure>
 class Address;
 
-template<BitSize N, typename Content>
+template<BitSize N, typename Content, typename Policy=tagged_pointer::DefaultPolicy>
 class QuadTree;
 
-template<BitSize N, typename Content>
+template<BitSize N, typename Content, typename Policy=tagged_pointer::DefaultPolicy>
 struct Iterator;
 
 //-----------------------------------------------------------------------------
@@ -65,11 +71,11 @@ struct Iterator;
 struct MemUsage
 {
 
-    template <typename Content>
-    void add(Node<Content> *node);
+    template <typename Content, typename Policy>
+    void add(Node<Content, Policy> *node);
 
-    template <typename Content>
-    void remove(Node<Content> *node);
+    template <typename Content, typename Policy>
+    void remove(Node<Content, Policy> *node);
 
     Count getMemUsage()  const;
     Count getMemUsage(NumChildren n)  const;
@@ -86,6 +92,21 @@ struct MemUsage
 };
 
 
+//-----------------------------------------------------------------------------
+// chargeNode
+//-----------------------------------------------------------------------------
+
+// the visit loops charge every node they walk through to visitors that
+// keep a budget (a charge() method, see NanoCubeQuery.hh); other
+// visitors are not charged
+template <typename Visitor>
+inline auto chargeNode(Visitor &visitor, int) -> decltype(visitor.charge(), void()) {
+    visitor.charge();
+}
+
+template <typename Visitor>
+inline void chargeNode(Visitor &, long) {}
+
 //-----------------------------------------------------------------------------
 // StackItem
 //-----------------------------------------------------------------------------
@@ -94,10 +115,10 @@ template <BitSize N, typename Content, typename Structure>
 struct StackItemTemplate
 {
     StackItemTemplate();
-    StackItemTemplate(Node<Content>* node, Address<N, Structure> address);
+    StackItemTemplate(typename Structure::NodeType* node, Address<N, Structure> address);
 
-    Node<Content>             *node;
-    Address<N, Structure>      address;
+    typename Structure::NodeType *node;
+    Address<N, Structure>         address;
 };
 
 //-----------------------------------------------------------------------------
@@ -108,17 +129,18 @@ struct StackItemTemplate
 // one exrea pointer per quadtree. Bad in the case
 // of nested quadtrees!
 
-template<BitSize N, typename Content>
+template<BitSize N, typename Content, typename Policy>
 class QuadTree
 {
 public:
 
 
-    typedef QuadTree<N,Content>              Type;
-    typedef Node<Content>                    NodeType;
+    typedef QuadTree<N, Content, Policy>     Type;
+    typedef Node<Content, Policy>            NodeType;
     typedef Address<N, Type>                 AddressType;
-    typedef Iterator<N, Content>             IteratorType;
+    typedef Iterator<N, Content, Policy>     IteratorType;
     typedef Content                          ContentType;
+    typedef Policy                           PolicyType;
 
     typedef std::vector<NodeType*>           NodeStackType;
 
@@ -134,6 +156,14 @@ public:
     QuadTree(); // up to 32 levels right now
     ~QuadTree();
 
+    // forgets the nodes without deleting them (e.g. after their
+    // slab::Arena was released)
+    void abandon() { root = nullptr; }
+
+    // quadtrees can be the content of a previous dimension
+    static void* operator new(size_t size);
+    static void  operator delete(void *p);
+
 #if 0
     template<typename QuadTreeAddPolicy, typename Point>
     void add(AddressType address, Point &point, QuadTreeAddPolicy &addPolicy);
@@ -174,9 +204,15 @@ public:
     template <typename Visitor>
     void visitSequence(const std::vector<RawAddress> &seq, Visitor &visitor, Cache& cache);
 
-    // polygon visit (cache first preprocessing)
+    // visit guided by a packed mask (e.g. from a mask store): the
+    // mask is walked in place, in sync with the tree
+    template <typename Visitor>
+    void visitExistingTreeLeaves(const PackedMaskCursor &mask, Visitor &visitor);
+
+    // same visit with the mask leaves as Morton intervals: cells that
+    // overlap no leaf are skipped without walking the mask
     template <typename Visitor>
-    void visitExistingTreeLeaves(const Mask* mask, Visitor &visitor);
+    void visitExistingTreeLeaves(const MaskIntervals &mask, Visitor &visitor);
 
 //    // mask querying
 //    // template <typename Visitor>
@@ -188,7 +224,7 @@ public:
 
 private:
 
-    Node<Content> *_createPath(AddressType current_address, AddressType target_address, bool include_current_address);
+    Node<Content, Policy> *_createPath(AddressType current_address, AddressType target_address, bool include_current_address);
 
 public:
 
@@ -210,7 +246,7 @@ public:
 //-----------------------------------------------------------------------------
 
 // Iterate through all parent-child relations
-template <BitSize N, typename Content>
+template <BitSize N, typename Content, typename Policy>
 struct Iterator {
 
 public: // constants
@@ -218,10 +254,10 @@ public: // constants
     static const bool PROPER = true;
 
 public: // subtypes
-    typedef QuadTree<N, Content>                       tree_type;
-    typedef typename QuadTree<N,Content>::NodeType     node_type;
-    typedef typename QuadTree<N,Content>::AddressType  address_type;
-    typedef NodePointer<Content>                       node_pointer_type;
+    typedef QuadTree<N, Content, Policy>                        tree_type;
+    typedef typename QuadTree<N, Content, Policy>::NodeType     node_type;
+    typedef typename QuadTree<N, Content, Policy>::AddressType  address_type;
+    typedef NodePointer<Content, Policy>                        node_pointer_type;
 
 public: // constructor
     Iterator(const tree_type &tree);
@@ -302,8 +338,8 @@ public:
 
 };
 
-template <BitSize N, typename Content>
-Iterator<N,Content>::Iterator(const tree_type& tree):
+template <BitSize N, typename Content, typename Policy>
+Iterator<N, Content, Policy>::Iterator(const tree_type& tree):
     tree(tree)
 {
     stack.push(Item(tree.root,
@@ -313,8 +349,8 @@ Iterator<N,Content>::Iterator(const tree_type& tree):
                     false));
 }
 
-template <BitSize N, typename Content>
-bool Iterator<N,Content>::next() {
+template <BitSize N, typename Content, typename Policy>
+bool Iterator<N, Content, Policy>::next() {
 
     if (stack.empty()) {
         return false;
@@ -473,8 +509,8 @@ std::ostream& operator<<(std::ostream &os, const Address<N, Structure>& addr)
 // Implmentation of QuadTree Template members
 //-----------------------------------------------------------------------------
 
-template<BitSize N, typename Content>
-QuadTree<N, Content>::QuadTree():
+template<BitSize N, typename Content, typename Policy>
+QuadTree<N, Content, Policy>::QuadTree():
     root(nullptr)
 {
     // std::cout << "constructing quadtree " << (unsigned long) this << std::endl;
@@ -482,8 +518,8 @@ QuadTree<N, Content>::QuadTree():
 }
 
 
-template<BitSize N, typename Content>
-QuadTree<N, Content>::~QuadTree()
+template<BitSize N, typename Content, typename Policy>
+QuadTree<N, Content, Policy>::~QuadTree()
 {
     // std::cout << "deleting quadtree " << (unsigned long) this << std::endl;
     if (root)
@@ -494,68 +530,84 @@ QuadTree<N, Content>::~QuadTree()
 //    std::cout << "~QuadTree " << this << std::endl;
 }
 
-template<BitSize N, typename Content>
+template<BitSize N, typename Content, typename Policy>
+void* QuadTree<N, Content, Policy>::operator new(size_t size)
+{
+    return slab::allocate(size);
+}
+
+template<BitSize N, typename Content, typename Policy>
+void QuadTree<N, Content, Policy>::operator delete(void *p)
+{
+    slab::deallocate(p, sizeof(QuadTree<N, Content, Policy>));
+}
+
+template<BitSize N, typename Content, typename Policy>
 inline bool
-QuadTree<N, Content>::isEmpty() const
+QuadTree<N, Content, Policy>::isEmpty() const
 {
     return root == nullptr;
 }
 
-template<BitSize N, typename Content>
-Node<Content>* QuadTree<N,Content>::getRoot()
+template<BitSize N, typename Content, typename Policy>
+Node<Content, Policy>* QuadTree<N, Content, Policy>::getRoot()
 {
     return root;
 }
     
     
-    template<BitSize N, typename Content>
+    template<BitSize N, typename Content, typename Policy>
     template <typename Visitor>
-    void QuadTree<N,Content>::visitExistingTreeLeaves(const Mask* mask, Visitor &visitor)
+    void QuadTree<N, Content, Policy>::visitExistingTreeLeaves(const PackedMaskCursor &mask, Visitor &visitor)
     {
-        using StackItem = StackItemTemplate<N, Content, QuadTree<N, Content>>;
-        
+        using StackItem = StackItemTemplate<N, Content, QuadTree<N, Content, Policy>>;
+
+        if (this->isEmpty()) // empty
+            return;
+
         std::stack< StackItem > stack;
         stack.push( StackItem(this->root, AddressType()) );
         
         // stack and mask go in sync
-        std::vector<const Mask*> mask_stack;
+        std::vector<PackedMaskCursor> mask_stack;
         mask_stack.push_back(mask);
         
         while (!stack.empty())
         {
-            StackItemTemplate<N, Content, QuadTree<N, Content>> &topItem = stack.top();
+            StackItemTemplate<N, Content, QuadTree<N, Content, Policy>> &topItem = stack.top();
             NodeType*   node = topItem.node;
             AddressType addr = topItem.address;
             stack.pop();
+            chargeNode(visitor, 0);
             
             //
             auto mask_node = mask_stack.back();
             mask_stack.pop_back();
             
-            if (mask_node->getNumChildren() == 0) {
+            if (mask_node.isLeaf()) {
                 visitor.visit(node, addr);
             }
             else { // schedule next visit
                 
                 NumChildren num_children = node->getNumChildren();
                 const ChildName *actual_indices = childEntryIndexToName[node->key()];
-                NodePointer<Content>*  children = node->getChildrenArray();
+                NodePointer<Content, Policy>*  children = node->getChildrenArray();
                 
                 for (int i=0;i<num_children;i++)
                 {
-                    const NodePointer<Content>& ci        = children[i];
+                    const NodePointer<Content, Policy>& ci        = children[i];
                     NodeType*                   childNode = ci.getNode();
                     // NodeType*   childNode = const_cast<NodeType*>(children[i]);
                     
                     auto actual_child_index = actual_indices[i];
                     
-                    auto mask_child_node = mask_node->children[actual_child_index].get();
+                    auto mask_child_node = mask_node.child(actual_child_index);
                     
-                    if (mask_child_node != nullptr) {
+                    if (mask_child_node.valid()) {
                         
                         AddressType childAddr = addr.childAddress(actual_indices[i]);
                         
-                        stack.push(StackItemTemplate<N, Content, QuadTree<N, Content>>(childNode, childAddr));
+                        stack.push(StackItemTemplate<N, Content, QuadTree<N, Content, Policy>>(childNode, childAddr));
                         mask_stack.push_back(mask_child_node);
                         
                     }
@@ -563,11 +615,68 @@ Node<Content>* QuadTree<N,Content>::getRoot()
             }
         }
     } // visitExistingTreeLeaves
+
+    template<BitSize N, typename Content, typename Policy>
+    template <typename Visitor>
+    void QuadTree<N, Content, Policy>::visitExistingTreeLeaves(const MaskIntervals &mask, Visitor &visitor)
+    {
+        static_assert(N <= MaskIntervals::MAX_LEVEL, "quadtree deeper than a mask interval");
+
+        if (this->isEmpty() || mask.empty())
+            return;
+
+        // a cell and its Morton code
+        struct Item {
+            NodeType*   node;
+            AddressType address;
+            uint64_t    code;
+            int         level;
+        };
+
+        std::vector<Item> stack;
+        stack.push_back({ this->root, AddressType(), 0, 0 });
+
+        // children are pushed in increasing order, so cells are visited
+        // in decreasing Morton order and the intervals that start before
+        // the current cell ends only get fewer
+        std::size_t count = mask.size();
+
+        while (!stack.empty())
+        {
+            Item item = stack.back();
+            stack.pop_back();
+
+            auto begin = MaskIntervals::cellBegin(item.code, item.level);
+            auto end   = MaskIntervals::cellEnd(item.code, item.level);
+
+            count = mask.startingBefore(end, count);
+            if (count == 0 || mask.ends[count - 1] <= begin)
+                continue; // no leaf of the mask here
+
+            chargeNode(visitor, 0);
+
+            if (mask.begins[count - 1] == begin && mask.ends[count - 1] == end) {
+                // the cell is a leaf of the mask
+                visitor.visit(item.node, item.address);
+                continue;
+            }
+
+            NumChildren num_children = item.node->getNumChildren();
+            const ChildName *actual_indices = childEntryIndexToName[item.node->key()];
+            NodePointer<Content, Policy>*  children = item.node->getChildrenArray();
+
+            for (int i=0;i<num_children;i++)
+            {
+                stack.push_back({ children[i].getNode(), item.address.childAddress(actual_indices[i]),
+                                  item.code * 4 + actual_indices[i], item.level + 1 });
+            }
+        }
+    } // visitExistingTreeLeaves
     
 
-template<BitSize N, typename Content>
-Node<Content>*
-QuadTree<N, Content>::_createPath(AddressType current_address, AddressType target_address, bool include_current_address)
+template<BitSize N, typename Content, typename Policy>
+Node<Content, Policy>*
+QuadTree<N, Content, Policy>::_createPath(AddressType current_address, AddressType target_address, bool include_current_address)
 {
 
 //    // create nodes bottom up of the right kind;
@@ -580,11 +689,11 @@ QuadTree<N, Content>::_createPath(AddressType current_address, AddressType targe
     int n = max_level - min_level + 1;
 
     if (! (n > 0)) {
-        throw std::string("n <= 0 on QuadTree<N, Content>::_createPath(...)");
+        throw std::string("n <= 0 on QuadTree<N, Content, Policy>::_createPath(...)");
     }
 
     // leaf
-    Node<Content> *current = new ScopedNode<Content, NodeType0000>();
+    Node<Content, Policy> *current = new ScopedNode<Content, NodeType0000, Policy>();
 
     for (int i=max_level;i>min_level;i--) {
 
@@ -592,21 +701,21 @@ QuadTree<N, Content>::_createPath(AddressType current_address, AddressType targe
         ChildName yoff = target_address.ybit(i) ? 1 : 0 ;
         ChildName index = (yoff << 1) | xoff;
 
-        Node<Content> *next_node = nullptr;
+        Node<Content, Policy> *next_node = nullptr;
         if (index == 0) {
-            ScopedNode<Content, NodeType1000> *aux = new ScopedNode<Content, NodeType1000>();
+            ScopedNode<Content, NodeType1000, Policy> *aux = new ScopedNode<Content, NodeType1000, Policy>();
             aux->children[0].setNode(current,PROPER_FLAG);
             next_node = aux;
         } else if (index == 1) {
-            ScopedNode<Content, NodeType0100> *aux = new ScopedNode<Content, NodeType0100>();
+            ScopedNode<Content, NodeType0100, Policy> *aux = new ScopedNode<Content, NodeType0100, Policy>();
             aux->children[0].setNode(current,PROPER_FLAG);
             next_node = aux;
         } else if (index == 2) {
-            ScopedNode<Content, NodeType0010> *aux = new ScopedNode<Content, NodeType0010>();
+            ScopedNode<Content, NodeType0010, Policy> *aux = new ScopedNode<Content, NodeType0010, Policy>();
             aux->children[0].setNode(current,PROPER_FLAG);
             next_node = aux;
         } else if (index == 3) {
-            ScopedNode<Content, NodeType0001> *aux = new ScopedNode<Content, NodeType0001>();
+            ScopedNode<Content, NodeType0001, Policy> *aux = new ScopedNode<Content, NodeType0001, Policy>();
             aux->children[0].setNode(current,PROPER_FLAG);
             next_node = aux;
         }
@@ -619,10 +728,10 @@ QuadTree<N, Content>::_createPath(AddressType current_address, AddressType targe
 }
 
 #if 0
-template<BitSize N, typename Content>
+template<BitSize N, typename Content, typename Policy>
 template<typename QuadTreeAddPolicy, typename Point>
 void
-QuadTree<N, Content>::add(AddressType address, Point &point, QuadTreeAddPolicy &addPolicy)
+QuadTree<N, Content, Policy>::add(AddressType address, Point &point, QuadTreeAddPolicy &addPolicy)
 {
     AddressType    current_address(0,0,0);
     NodeType* current_node  = root;
@@ -631,7 +740,7 @@ QuadTree<N, Content>::add(AddressType address, Point &point, QuadTreeAddPolicy &
     if (isEmpty())
     {
         // new leaf nodes
-        current_node = new ScopedNode<Content,NodeType0000>(); // _newNode with nullptr: new root
+        current_node = new ScopedNode<Content, NodeType0000, Policy>(); // _newNode with nullptr: new root
 
         root = current_node;
         // leaf node
@@ -726,9 +835,9 @@ QuadTree<N, Content>::add(AddressType address, Point &point, QuadTreeAddPolicy &
  * child structure is "contained" in this quadtree except, maybe for a (suffix) path
  * containing the new data point just added in child_strucutre.
  */
-template<BitSize N, typename Content>
+template<BitSize N, typename Content, typename Policy>
 void
-QuadTree<N, Content>::prepareProperOutdatedPath(QuadTree<N, Content> *parallel_structure,
+QuadTree<N, Content, Policy>::prepareProperOutdatedPath(QuadTree<N, Content, Policy> *parallel_structure,
                                                 AddressType           address,
                                                 std::vector<void*>   &parallel_replaced_nodes,
                                                 NodeStackType        &stack)
@@ -954,9 +1063,9 @@ QuadTree<N, Content>::prepareProperOutdatedPath(QuadTree<N, Content> *parallel_s
 
 }
 
-template<BitSize N, typename Content>
-Node<Content>*
-QuadTree<N, Content>::trailProperPath(AddressType address, NodeStackType &stack)
+template<BitSize N, typename Content, typename Policy>
+Node<Content, Policy>*
+QuadTree<N, Content, Policy>::trailProperPath(AddressType address, NodeStackType &stack)
 {
     AddressType  current_address(0,0,0);
     NodeType*    current_node  = root;
@@ -965,7 +1074,7 @@ QuadTree<N, Content>::trailProperPath(AddressType address, NodeStackType &stack)
     if (isEmpty())
     {
         // new leaf nodes
-        current_node = new ScopedNode<Content,NodeType0000>(); // _newNode with nullptr: new root
+        current_node = new ScopedNode<Content, NodeType0000, Policy>(); // _newNode with nullptr: new root
 
         root = current_node;
         // leaf node
@@ -1048,9 +1157,9 @@ QuadTree<N, Content>::trailProperPath(AddressType address, NodeStackType &stack)
 
 }
 
-template<BitSize N, typename Content>
-Node<Content>*
-QuadTree<N, Content>::find(AddressType address)  const
+template<BitSize N, typename Content, typename Policy>
+Node<Content, Policy>*
+QuadTree<N, Content, Policy>::find(AddressType address)  const
 {
     if (isEmpty())
         return nullptr;
@@ -1081,20 +1190,20 @@ QuadTree<N, Content>::find(AddressType address)  const
     return nullptr;
 }
 
-template<BitSize N, typename Content>
-QuadTree<N,Content> *QuadTree<N, Content>::makeLazyCopy() const
+template<BitSize N, typename Content, typename Policy>
+QuadTree<N, Content, Policy> *QuadTree<N, Content, Policy>::makeLazyCopy() const
 {
-    QuadTree<N,Content> *lazy_copy = new QuadTree<N,Content>();
+    QuadTree<N, Content, Policy> *lazy_copy = new QuadTree<N, Content, Policy>();
     if (root) {
         lazy_copy->root = root->makeLazyCopy();
     }
     return lazy_copy;
 }
 
-template<BitSize N, typename Content>
+template<BitSize N, typename Content, typename Policy>
 template <typename Visitor>
 void
-QuadTree<N, Content>::visitSubnodes(AddressType address, Level targetLevelOffset, Visitor &visitor)
+QuadTree<N, Content, Policy>::visitSubnodes(AddressType address, Level targetLevelOffset, Visitor &visitor)
 {
     Level targetLevel = address.level + targetLevelOffset;
 
@@ -1103,15 +1212,16 @@ QuadTree<N, Content>::visitSubnodes(AddressType address, Level targetLevelOffset
     if (!baseNode)
         return; // there is no node
 
-    std::stack<StackItemTemplate<N, Content, QuadTree<N, Content>>> stack;
-    stack.push(StackItemTemplate<N, Content, QuadTree<N, Content>>(baseNode, address));
+    std::stack<StackItemTemplate<N, Content, QuadTree<N, Content, Policy>>> stack;
+    stack.push(StackItemTemplate<N, Content, QuadTree<N, Content, Policy>>(baseNode, address));
 
     while (!stack.empty())
     {
-        StackItemTemplate<N, Content, QuadTree<N, Content>> &topItem = stack.top();
+        StackItemTemplate<N, Content, QuadTree<N, Content, Policy>> &topItem = stack.top();
         NodeType*   node = topItem.node;
         AddressType addr = topItem.address;
         stack.pop();
+        chargeNode(visitor, 0);
 
         if (targetLevel < 0 || addr.level == targetLevel)
             visitor.visit(node, addr);
@@ -1120,15 +1230,15 @@ QuadTree<N, Content>::visitSubnodes(AddressType address, Level targetLevelOffset
         {
             NumChildren num_children = node->getNumChildren();
             const ChildName *actual_indices = childEntryIndexToName[node->key()];
-            NodePointer<Content>*  children = node->getChildrenArray();
+            NodePointer<Content, Policy>*  children = node->getChildrenArray();
 
             for (int i=0;i<num_children;i++)
             {
-                const NodePointer<Content> &ci = children[i];
+                const NodePointer<Content, Policy> &ci = children[i];
                 NodeType*   childNode = ci.getNode();
                 // NodeType*   childNode = const_cast<NodeType*>(children[i]);
                 AddressType childAddr = addr.childAddress(actual_indices[i]);
-                stack.push(StackItemTemplate<N, Content, QuadTree<N, Content>>(childNode, childAddr));
+                stack.push(StackItemTemplate<N, Content, QuadTree<N, Content, Policy>>(childNode, childAddr));
             }
         }
     }
@@ -1136,9 +1246,9 @@ QuadTree<N, Content>::visitSubnodes(AddressType address, Level targetLevelOffset
 
 // visit all subnodes of a certain node in the
 // requested target level.
-template<BitSize N, typename Content>
+template<BitSize N, typename Content, typename Policy>
 template <typename Visitor>
-void QuadTree<N,Content>::visitRange(AddressType min_address, AddressType max_address, Visitor &visitor)
+void QuadTree<N, Content, Policy>::visitRange(AddressType min_address, AddressType max_address, Visitor &visitor)
 {
     if (this->isEmpty()) // empty
         return;
@@ -1149,15 +1259,16 @@ void QuadTree<N,Content>::visitRange(AddressType min_address, AddressType max_ad
         throw std::string("Invalid range addresses");
     }
         
-    std::stack<StackItemTemplate<N, Content, QuadTree<N, Content>>> stack;
-    stack.push(StackItemTemplate<N, Content, QuadTree<N, Content>>(root, AddressType()));
+    std::stack<StackItemTemplate<N, Content, QuadTree<N, Content, Policy>>> stack;
+    stack.push(StackItemTemplate<N, Content, QuadTree<N, Content, Policy>>(root, AddressType()));
 
     while (!stack.empty())
     {
-        StackItemTemplate<N, Content, QuadTree<N, Content>> &topItem = stack.top();
+        StackItemTemplate<N, Content, QuadTree<N, Content, Policy>> &topItem = stack.top();
         NodeType*   node = topItem.node;
         AddressType addr = topItem.address;
         stack.pop();
+        chargeNode(visitor, 0);
 
         // std::cout << "Testing address: " << addr  << std::endl;
 
@@ -1177,14 +1288,14 @@ void QuadTree<N,Content>::visitRange(AddressType min_address, AddressType max_ad
             NumChildren num_children = node->getNumChildren();
             const ChildName *actual_indices = childEntryIndexToName[node->key()];
 
-            NodePointer<Content>  *children = node->getChildrenArray();
+            NodePointer<Content, Policy>  *children = node->getChildrenArray();
 
             for (int i=0;i<num_children;i++)
             {
-                const NodePointer<Content> &ci = children[i];
+                const NodePointer<Content, Policy> &ci = children[i];
                 NodeType*   childNode = ci.getNode();
                 AddressType childAddr = addr.childAddress(actual_indices[i]);
-                stack.push(StackItemTemplate<N, Content, QuadTree<N, Content>>(childNode, childAddr));
+                stack.push(StackItemTemplate<N, Content, QuadTree<N, Content, Policy>>(childNode, childAddr));
             }
         }
         else {
@@ -1198,9 +1309,9 @@ void QuadTree<N,Content>::visitRange(AddressType min_address, AddressType max_ad
 
 // static std::unordered_map<void*, qtfilter::Node*> cache;
 
-template<BitSize N, typename Content>
+template<BitSize N, typename Content, typename Policy>
 template <typename Visitor>
-void QuadTree<N,Content>::visitSequence(const std::vector<RawAddress> &seq,
+void QuadTree<N, Content, Policy>::visitSequence(const std::vector<RawAddress> &seq,
                                         Visitor &visitor, Cache& cache)
 {
     // preprocess and cache sequence (assuming the vector won't change)
@@ -1274,7 +1385,7 @@ void QuadTree<N,Content>::visitSequence(const std::vector<RawAddress> &seq,
     // if (!baseNode)
     //    return; // there is no node
 
-    using StackItem = StackItemTemplate<N, Content, QuadTree<N, Content>>;
+    using StackItem = StackItemTemplate<N, Content, QuadTree<N, Content, Policy>>;
 
 
     std::stack< StackItem > stack;
@@ -1286,10 +1397,11 @@ void QuadTree<N,Content>::visitSequence(const std::vector<RawAddress> &seq,
 
     while (!stack.empty())
     {
-        StackItemTemplate<N, Content, QuadTree<N, Content>> &topItem = stack.top();
+        StackItemTemplate<N, Content, QuadTree<N, Content, Policy>> &topItem = stack.top();
         NodeType*   node = topItem.node;
         AddressType addr = topItem.address;
         stack.pop();
+        chargeNode(visitor, 0);
 
         //
         qtfilter::Node* mask_node = mask_stack.back();
@@ -1302,11 +1414,11 @@ void QuadTree<N,Content>::visitSequence(const std::vector<RawAddress> &seq,
 
             NumChildren num_children = node->getNumChildren();
             const ChildName *actual_indices = childEntryIndexToName[node->key()];
-            NodePointer<Content>*  children = node->getChildrenArray();
+            NodePointer<Content, Policy>*  children = node->getChildrenArray();
 
             for (int i=0;i<num_children;i++)
             {
-                const NodePointer<Content>& ci        = children[i];
+                const NodePointer<Content, Policy>& ci        = children[i];
                 NodeType*                   childNode = ci.getNode();
                 // NodeType*   childNode = const_cast<NodeType*>(children[i]);
 
@@ -1318,7 +1430,7 @@ void QuadTree<N,Content>::visitSequence(const std::vector<RawAddress> &seq,
 
                     AddressType childAddr = addr.childAddress(actual_indices[i]);
 
-                    stack.push(StackItemTemplate<N, Content, QuadTree<N, Content>>(childNode, childAddr));
+                    stack.push(StackItemTemplate<N, Content, QuadTree<N, Content, Policy>>(childNode, childAddr));
                     mask_stack.push_back(mask_child_node);
 
                 }
@@ -1337,9 +1449,9 @@ void QuadTree<N,Content>::visitSequence(const std::vector<RawAddress> &seq,
     
 // visit all subnodes of a certain node in the
 // requested target level.
-template<BitSize N, typename Content>
+template<BitSize N, typename Content, typename Policy>
 template <typename Visitor>
-void QuadTree<N,Content>::scan(Visitor &visitor)
+void QuadTree<N, Content, Policy>::scan(Visitor &visitor)
 {
     if (this->isEmpty()) // empty
         return;
@@ -1358,11 +1470,11 @@ void QuadTree<N,Content>::scan(Visitor &visitor)
 
         NumChildren num_children = node->getNumChildren();
         const ChildName           *actual_indices = childEntryIndexToName[node->key()];
-        const NodePointer<Content> *children_pointers = node->getChildrenArray();
+        const NodePointer<Content, Policy> *children_pointers = node->getChildrenArray();
 
         for (int i=0;i<num_children;i++)
         {
-            const NodePointer<Content> &child_pointer = children_pointers[i];
+            const NodePointer<Content, Policy> &child_pointer = children_pointers[i];
             if (child_pointer.isShared()) {
                 continue; // do not push shared nodes (only proper ones)
             }
@@ -1721,8 +1833,8 @@ PathSize    Address<N, Structure>::getPathSize() const
 
 #ifdef COLLECT_MEMUSAGE
 
-template <typename Content>
-void MemUsage::add(Node<Content> *node)
+template <typename Content, typename Policy>
+void MemUsage::add(Node<Content, Policy> *node)
 {
     Count mu = node->getMemoryUsage();
     NumChildren n = node->getNumChildren();
@@ -1733,8 +1845,8 @@ void MemUsage::add(Node<Content> *node)
     totalCount            += 1;
 }
 
-template <typename Content>
-void MemUsage::remove(Node<Content> *node)
+template <typename Content, typename Policy>
+void MemUsage::remove(Node<Content, Policy> *node)
 {
     Count mu = node->getMemoryUsage();
     NumChildren n = node->getNumChildren();
@@ -1752,8 +1864,8 @@ void MemUsage::remove(Node<Content> *node)
 
 #else
 
-template <typename Content> void MemUsage::add(Node<Content> *node) {}
-template <typename Content> void MemUsage::remove(Node<Content> *node) {}
+template <typename Content, typename Policy> void MemUsage::add(Node<Content, Policy> *node) {}
+template <typename Content, typename Policy> void MemUsage::remove(Node<Content, Policy> *node) {}
 
 #endif
 
@@ -1767,7 +1879,7 @@ StackItemTemplate<N,Content,Structure>::StackItemTemplate()
 {}
 
 template <BitSize N, typename Content, typename Structure>
-StackItemTemplate<N,Content,Structure>::StackItemTemplate(Node<Content>* node, Address<N, Structure> address):
+StackItemTemplate<N,Content,Structure>::StackItemTemplate(typename Structure::NodeType* node, Address<N, Structure> address):
     node(node), address(address)
 {}
 
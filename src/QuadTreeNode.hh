@@ -10,6 +10,7 @@
 
 #include "ContentHolder.hh"
 #include "TaggedPointer.hh"
+#include "SlabAllocator.hh"
 
 namespace quadtree
 {
@@ -68,13 +69,13 @@ using contentholder::ContentHolder;
 // Forward declarations
 //-----------------------------------------------------------------------------
 
-template <typename Content>
+template <typename Content, typename Policy=tagged_pointer::DefaultPolicy>
 struct Node;
 
-template <typename Content, typename K>
+template <typename Content, typename K, typename Policy=tagged_pointer::DefaultPolicy>
 struct ScopedNode;
 
-template <typename Content>
+template <typename Content, typename Policy=tagged_pointer::DefaultPolicy>
 struct NodePointer;
 
 //-----------------------------------------------------------------------------
@@ -102,8 +103,8 @@ extern ChildName childNameToEntryIndex[16][4];
 // Node
 //-----------------------------------------------------------------------------
 
-template <typename Content>
-struct Node: public ContentHolder<Content>
+template <typename Content, typename Policy>
+struct Node: public ContentHolder<Content, Policy>
 {
     Node(NodeKey key);
 
@@ -112,22 +113,22 @@ struct Node: public ContentHolder<Content>
     void setContentAndChildrenToNull();
 
     inline Node *getChild(ChildName index) const;
-    inline Node<Content>* getChildAndShareFlag(ChildName index, bool &shared) const;
+    inline Node<Content, Policy>* getChildAndShareFlag(ChildName index, bool &shared) const;
 
     inline bool isSharedPointer(ChildName index) const;
     inline bool isProperPointer(ChildName index) const;
 
     // inline NodePointer<Content> getChildPointer(ChildIndex index) const;
 
-    inline NodePointer<Content> const* getChildrenArray() const {
-        const ScopedNode<Content, NodeType1111> &node =
-            reinterpret_cast<const ScopedNode<Content, NodeType1111>&>(*this);
+    inline NodePointer<Content, Policy> const* getChildrenArray() const {
+        const ScopedNode<Content, NodeType1111, Policy> &node =
+            reinterpret_cast<const ScopedNode<Content, NodeType1111, Policy>&>(*this);
         return node.children;
     }
 
-    inline NodePointer<Content>* getChildrenArray() {
-        ScopedNode<Content, NodeType1111> &node =
-            reinterpret_cast<ScopedNode<Content, NodeType1111>&>(*this);
+    inline NodePointer<Content, Policy>* getChildrenArray() {
+        ScopedNode<Content, NodeType1111, Policy> &node =
+            reinterpret_cast<ScopedNode<Content, NodeType1111, Policy>&>(*this);
         return node.children;
     }
 
@@ -151,6 +152,12 @@ struct Node: public ContentHolder<Content>
 
     CountRecord count();
 
+    // all 16 node shapes come from the slab allocator. A node is
+    // usually deleted through a Node pointer, so the size class is
+    // found from the address (see SlabAllocator.hh)
+    static void* operator new(size_t size);
+    static void  operator delete(void *p);
+
 private:
 
     template <NodeKey key>
@@ -173,11 +180,11 @@ private:
 // TaggedNodePointer
 //-----------------------------------------------------------------------------
 
-template <typename Content>
+template <typename Content, typename Policy>
 struct NodePointer
 {
     NodePointer();
-    NodePointer(Node<Content> *ptr, bool shared);
+    NodePointer(Node<Content, Policy> *ptr, bool shared);
 
     inline bool isShared() const {
         return tag_ptr.getTag() == SHARED;
@@ -187,27 +194,27 @@ struct NodePointer
         return tag_ptr.getTag() == PROPER;
     }
 
-    inline Node<Content>* getNode() const {
+    inline Node<Content, Policy>* getNode() const {
         return tag_ptr.getPointer();
     }
 
-    inline void setNode(Node<Content>* ptr, bool shared) {
+    inline void setNode(Node<Content, Policy>* ptr, bool shared) {
         tag_ptr.setPointer(ptr);
         tag_ptr.setTag(shared ? SHARED : PROPER);
     }
 
     // space efficiently but not necessarely cpu efficient
-    tagged_pointer::TaggedPointer<Node<Content>> tag_ptr;
+    typename Policy::template Flagged<Node<Content, Policy>> tag_ptr;
 };
 
 
-template <typename Content>
-NodePointer<Content>::NodePointer():
+template <typename Content, typename Policy>
+NodePointer<Content, Policy>::NodePointer():
     tag_ptr(nullptr, SHARED)
 {}
 
-template <typename Content>
-NodePointer<Content>::NodePointer(Node<Content> *ptr, bool shared):
+template <typename Content, typename Policy>
+NodePointer<Content, Policy>::NodePointer(Node<Content, Policy> *ptr, bool shared):
     tag_ptr(ptr, shared ? SHARED : PROPER)
 {}
 
@@ -216,12 +223,12 @@ NodePointer<Content>::NodePointer(Node<Content> *ptr, bool shared):
 // ScopedNode
 //-----------------------------------------------------------------------------
 
-template <typename Content, typename NodeType>
-struct ScopedNode: public Node<Content>
+template <typename Content, typename NodeType, typename Policy>
+struct ScopedNode: public Node<Content, Policy>
 {
     ScopedNode();
 
-    NodePointer<Content> children[NodeType::numChildren];
+    NodePointer<Content, Policy> children[NodeType::numChildren];
        // <-- get value N computed at compile time from key
        //     the interpretation is also stored on key
 };
@@ -235,9 +242,9 @@ struct ScopedNode: public Node<Content>
 // Node Implementation
 //-----------------------------------------------------------------------------
 
-template <typename Content>
-Node<Content>::Node(NodeKey key):
-    ContentHolder<Content>()
+template <typename Content, typename Policy>
+Node<Content, Policy>::Node(NodeKey key):
+    ContentHolder<Content, Policy>()
 {
     // TODO: check if we can move this to the parent class constructor (more efficient)
     this->setUserData(key);
@@ -247,15 +254,15 @@ Node<Content>::Node(NodeKey key):
 }
 
 
-template <typename Content>
-Node<Content>::~Node()
+template <typename Content, typename Policy>
+Node<Content, Policy>::~Node()
 {
     // delete children
     NumChildren       num_children = getNumChildren();
-    const NodePointer<Content> *children_pointers = getChildrenArray();
+    const NodePointer<Content, Policy> *children_pointers = getChildrenArray();
     for (int i=0;i<num_children;i++)
     {
-        const NodePointer<Content> &child_pointer = children_pointers[i];
+        const NodePointer<Content, Policy> &child_pointer = children_pointers[i];
         if (child_pointer.isProper()) {
             delete child_pointer.getNode();
         }
@@ -268,12 +275,24 @@ Node<Content>::~Node()
     }
 }
 
-template <typename Content>
-void Node<Content>::setContentAndChildrenToNull()
+template <typename Content, typename Policy>
+void* Node<Content, Policy>::operator new(size_t size)
+{
+    return slab::allocate(size);
+}
+
+template <typename Content, typename Policy>
+void Node<Content, Policy>::operator delete(void *p)
+{
+    slab::deallocate(p, sizeof(Node<Content, Policy>));
+}
+
+template <typename Content, typename Policy>
+void Node<Content, Policy>::setContentAndChildrenToNull()
 {
     // delete children
     NumChildren           num_children = getNumChildren();
-    NodePointer<Content> *children = getChildrenArray();
+    NodePointer<Content, Policy> *children = getChildrenArray();
 
     for (int i=0;i<num_children;i++) {
         children[i].setNode(nullptr, true);
@@ -285,35 +304,35 @@ void Node<Content>::setContentAndChildrenToNull()
     }
 }
 
-template <typename Content>
+template <typename Content, typename Policy>
 template <NodeKey K>
 inline Count
-Node<Content>::_getNumChildren() const
+Node<Content, Policy>::_getNumChildren() const
 {
     return NodeKeyToNodeType<K>::type::numChildren;
 }
 
 
 
-template <typename Content>
+template <typename Content, typename Policy>
 template <NodeKey K>
 inline Count
-Node<Content>::_getMemoryUsage() const
+Node<Content, Policy>::_getMemoryUsage() const
 {
-    return sizeof(ScopedNode<Content, typename NodeKeyToNodeType<K>::type>);
+    return sizeof(ScopedNode<Content, typename NodeKeyToNodeType<K>::type, Policy>);
 }
 
-template <typename Content>
+template <typename Content, typename Policy>
 inline bool
-Node<Content>::isLeaf() const
+Node<Content, Policy>::isLeaf() const
 {
     return this->key() == 0;
 }
 
-template <typename Content>
+template <typename Content, typename Policy>
 template <NodeKey K>
 inline void
-Node<Content>::_setChild(Node<Content>* child, ChildName child_name, bool shared)
+Node<Content, Policy>::_setChild(Node<Content, Policy>* child, ChildName child_name, bool shared)
 {
     typedef typename NodeKeyToNodeType<K>::type CurrentNodeType;
 
@@ -322,64 +341,64 @@ Node<Content>::_setChild(Node<Content>* child, ChildName child_name, bool shared
     if (child_index == -1)
         throw std::string("incompatible type");
 
-    NodePointer<Content> &node_pointer = this->getChildrenArray()[child_index];
+    NodePointer<Content, Policy> &node_pointer = this->getChildrenArray()[child_index];
 
     node_pointer.setNode(child, shared);
 }
 
 
-template <typename Content>
-Node<Content>*
-Node<Content>::_newNode(NodeKey key)
+template <typename Content, typename Policy>
+Node<Content, Policy>*
+Node<Content, Policy>::_newNode(NodeKey key)
 {
     if (key == 7)
     {
-        return new ScopedNode<Content, typename NodeKeyToNodeType<7>::type>();
+        return new ScopedNode<Content, typename NodeKeyToNodeType<7>::type, Policy>();
     }
     else if (key < 7)
     {
         if (key == 3)
-            return new ScopedNode<Content, typename NodeKeyToNodeType<3>::type>();
+            return new ScopedNode<Content, typename NodeKeyToNodeType<3>::type, Policy>();
         else if (key < 3)
         {
             if (key == 1)
-                return new ScopedNode<Content, typename NodeKeyToNodeType<1>::type>();
+                return new ScopedNode<Content, typename NodeKeyToNodeType<1>::type, Policy>();
             else if (key == 0)
-                return new ScopedNode<Content, typename NodeKeyToNodeType<0>::type>();
+                return new ScopedNode<Content, typename NodeKeyToNodeType<0>::type, Policy>();
             else if (key == 2)
-                return new ScopedNode<Content, typename NodeKeyToNodeType<2>::type>();
+                return new ScopedNode<Content, typename NodeKeyToNodeType<2>::type, Policy>();
         }
         else {
             if (key == 5)
-                return new ScopedNode<Content, typename NodeKeyToNodeType<5>::type>();
+                return new ScopedNode<Content, typename NodeKeyToNodeType<5>::type, Policy>();
             else if (key == 4)
-                return new ScopedNode<Content, typename NodeKeyToNodeType<4>::type>();
+                return new ScopedNode<Content, typename NodeKeyToNodeType<4>::type, Policy>();
             else if (key == 6)
-                return new ScopedNode<Content, typename NodeKeyToNodeType<6>::type>();
+                return new ScopedNode<Content, typename NodeKeyToNodeType<6>::type, Policy>();
         }
     }
     else { // key > 7
         if (key == 11)
-            return new ScopedNode<Content, typename NodeKeyToNodeType<11>::type>();
+            return new ScopedNode<Content, typename NodeKeyToNodeType<11>::type, Policy>();
         else if (key < 11)
         {
             if (key == 9)
-                return new ScopedNode<Content, typename NodeKeyToNodeType<9>::type>();
+                return new ScopedNode<Content, typename NodeKeyToNodeType<9>::type, Policy>();
             else if (key == 8)
-                return new ScopedNode<Content, typename NodeKeyToNodeType<8>::type>();
+                return new ScopedNode<Content, typename NodeKeyToNodeType<8>::type, Policy>();
             else if (key == 10)
-                return new ScopedNode<Content, typename NodeKeyToNodeType<10>::type>();
+                return new ScopedNode<Content, typename NodeKeyToNodeType<10>::type, Policy>();
         }
         else // key > 13
         {
             if (key == 13)
-                return new ScopedNode<Content, typename NodeKeyToNodeType<13>::type>();
+                return new ScopedNode<Content, typename NodeKeyToNodeType<13>::type, Policy>();
             else if (key == 12)
-                return new ScopedNode<Content, typename NodeKeyToNodeType<12>::type>();
+                return new ScopedNode<Content, typename NodeKeyToNodeType<12>::type, Policy>();
            else if (key == 15)
-                return new ScopedNode<Content, typename NodeKeyToNodeType<15>::type>();
+                return new ScopedNode<Content, typename NodeKeyToNodeType<15>::type, Policy>();
             else if (key == 14)
-                return new ScopedNode<Content, typename NodeKeyToNodeType<14>::type>();
+                return new ScopedNode<Content, typename NodeKeyToNodeType<14>::type, Policy>();
         }
     }
 
@@ -388,38 +407,38 @@ Node<Content>::_newNode(NodeKey key)
 
 }
 
-template <typename Content>
+template <typename Content, typename Policy>
 inline bool
-Node<Content>::hasChildSlot(ChildName index) const
+Node<Content, Policy>::hasChildSlot(ChildName index) const
 {
     return ((this->key & (1 << index)) != 0);
 }
 
 
-template <typename Content>
+template <typename Content, typename Policy>
 NodeKey
-inline Node<Content>::key() const
+inline Node<Content, Policy>::key() const
 {
     return this->getUserData();
 }
 
-template <typename Content>
+template <typename Content, typename Policy>
 ChildName
-Node<Content>::getChildActualIndex(int index) const
+Node<Content, Policy>::getChildActualIndex(int index) const
 {
     return childEntryIndexToName[this->key()][index];
 }
 
-template <typename Content>
-CountRecord Node<Content>::count()
+template <typename Content, typename Policy>
+CountRecord Node<Content, Policy>::count()
 {
     CountRecord mine;
     return mine;
 }
 
-template <typename Content>
-Node<Content>*
-Node<Content>::copyWithAddedChild(Node<Content>* child, ChildName new_child_name, bool shared)
+template <typename Content, typename Policy>
+Node<Content, Policy>*
+Node<Content, Policy>::copyWithAddedChild(Node<Content, Policy>* child, ChildName new_child_name, bool shared)
 {
     NodeKey key = this->key();
     NodeKey new_key = key | (1 << new_child_name);
@@ -427,7 +446,7 @@ Node<Content>::copyWithAddedChild(Node<Content>* child, ChildName new_child_name
     if (new_key == key)
         throw std::string("Should be a different key");
 
-    Node<Content> *copy = Node<Content>::_newNode(new_key);
+    Node<Content, Policy> *copy = Node<Content, Policy>::_newNode(new_key);
     copy->copyContentAndProperFlag(*this);
 
     // set child
@@ -435,38 +454,38 @@ Node<Content>::copyWithAddedChild(Node<Content>* child, ChildName new_child_name
 
     NumChildren            num_children   = getNumChildren();
     ChildName             *children_names = childEntryIndexToName[key];
-    NodePointer<Content>  *children       = getChildrenArray();
+    NodePointer<Content, Policy>  *children       = getChildrenArray();
 
     for (int i=0;i<num_children;i++)
     {
-        const NodePointer<Content> &ci = children[i];
+        const NodePointer<Content, Policy> &ci = children[i];
         copy->setChild(ci.getNode(), children_names[i], ci.isShared());
     }
 
     return copy;
 }
 
-template <typename Content>
-Node<Content>*
-Node<Content>::makeLazyCopy() const
+template <typename Content, typename Policy>
+Node<Content, Policy>*
+Node<Content, Policy>::makeLazyCopy() const
 {
-    Node<Content> *copy = Node<Content>::_newNode(this->key());
+    Node<Content, Policy> *copy = Node<Content, Policy>::_newNode(this->key());
     NumChildren            num_children = getNumChildren();
-    NodePointer<Content>  const *source_children_pointers = getChildrenArray();
-    NodePointer<Content>  *target_children_pointers = copy->getChildrenArray();
+    NodePointer<Content, Policy>  const *source_children_pointers = getChildrenArray();
+    NodePointer<Content, Policy>  *target_children_pointers = copy->getChildrenArray();
     for (int i=0;i<num_children;i++)
     {
-        const NodePointer<Content> &source_pointer = source_children_pointers[i];
-        NodePointer<Content> &target_pointer = target_children_pointers[i];
+        const NodePointer<Content, Policy> &source_pointer = source_children_pointers[i];
+        NodePointer<Content, Policy> &target_pointer = target_children_pointers[i];
         target_pointer.setNode(source_pointer.getNode(), SHARED_FLAG); // make everything shared
     }
     copy->setSharedContent(this->getContent());
     return copy;
 }
 
-template <typename Content>
+template <typename Content, typename Policy>
 void
-Node<Content>::setChild(Node<Content>* child, ChildName child_name, bool shared)
+Node<Content, Policy>::setChild(Node<Content, Policy>* child, ChildName child_name, bool shared)
 {
     // NodeKey K = this->key;
     NodeKey key = this->key();
@@ -531,33 +550,33 @@ Node<Content>::setChild(Node<Content>* child, ChildName child_name, bool shared)
 }
 
 //template <typename Content>
-//inline NodePointer<Content>
-//Node<Content>::getChildPointer(ChildIndex index) const
+//inline NodePointer<Content, Policy>
+//Node<Content, Policy>::getChildPointer(ChildIndex index) const
 //{
 //    NodeKey key = this->key();
-//    const NodePointer<Content> *children_begin = getChildrenArray();
+//    const NodePointer<Content, Policy> *children_begin = getChildrenArray();
 //    int i = nodeChildrenIndices[key][index];
 //    if (i == -1) return nullptr;
 //    return children_begin[i]; //
 //}
 
-template <typename Content>
-inline Node<Content>*
-Node<Content>::getChild(ChildName child_name) const
+template <typename Content, typename Policy>
+inline Node<Content, Policy>*
+Node<Content, Policy>::getChild(ChildName child_name) const
 {
     NodeKey key = this->key();
-    const NodePointer<Content> *children_begin = getChildrenArray();
+    const NodePointer<Content, Policy> *children_begin = getChildrenArray();
     int i = childNameToEntryIndex[key][child_name];
     if (i == -1) return nullptr;
     return children_begin[i].getNode();
 }
 
-template <typename Content>
-inline Node<Content>*
-Node<Content>::getChildAndShareFlag(ChildName child_name, bool &shared) const
+template <typename Content, typename Policy>
+inline Node<Content, Policy>*
+Node<Content, Policy>::getChildAndShareFlag(ChildName child_name, bool &shared) const
 {
     NodeKey key = this->key();
-    const NodePointer<Content> *children_begin = getChildrenArray();
+    const NodePointer<Content, Policy> *children_begin = getChildrenArray();
     int i = childNameToEntryIndex[key][child_name];
     if (i == -1) {
 
@@ -575,31 +594,31 @@ Node<Content>::getChildAndShareFlag(ChildName child_name, bool &shared) const
 }
 
 
-template <typename Content>
+template <typename Content, typename Policy>
 bool
-Node<Content>::isSharedPointer(ChildName child_name) const
+Node<Content, Policy>::isSharedPointer(ChildName child_name) const
 {
     NodeKey key = this->key();
-    const NodePointer<Content> *children_begin = getChildrenArray();
+    const NodePointer<Content, Policy> *children_begin = getChildrenArray();
     int i = childNameToEntryIndex[key][child_name];
     if (i == -1) throw std::exception();
     return children_begin[i].isShared();
 }
 
-template <typename Content>
+template <typename Content, typename Policy>
 bool
-Node<Content>::isProperPointer(ChildName child_name) const
+Node<Content, Policy>::isProperPointer(ChildName child_name) const
 {
     NodeKey key = this->key();
-    const NodePointer<Content> *children_begin = getChildrenArray();
+    const NodePointer<Content, Policy> *children_begin = getChildrenArray();
     int i = childNameToEntryIndex[key][child_name];
     if (i == -1) throw std::exception();
     return children_begin[i].isProper();
 }
 
-template <typename Content>
+template <typename Content, typename Policy>
 Count
-Node<Content>::getMemoryUsage() const
+Node<Content, Policy>::getMemoryUsage() const
 {
     // NodeKey K = this->key;
     NodeKey key = this->key();
@@ -660,9 +679,9 @@ Node<Content>::getMemoryUsage() const
 
 }
 
-template <typename Content>
+template <typename Content, typename Policy>
 inline Count
-Node<Content>::getNumChildren() const
+Node<Content, Policy>::getNumChildren() const
 {
     NodeKey key = this->key();
     static const int v[16] = {0, 1, 1, 2,
@@ -677,8 +696,11 @@ Node<Content>::getNumChildren() const
 // ScopedNode Implementation
 //
 
-template <typename Content, typename NodeType>
-ScopedNode<Content, NodeType>::ScopedNode(): Node<Content>(NodeType::key)
-{}
+template <typename Content, typename NodeType, typename Policy>
+ScopedNode<Content, NodeType, Policy>::ScopedNode(): Node<Content, Policy>(NodeType::key)
+{
+    // every shape has to come from a slab (a link may be a slab handle)
+    static_assert(sizeof(ScopedNode) <= slab::MAX_OBJECT_SIZE, "quadtree node is too large for a slab");
+}
 
 } // end namespace quadtree
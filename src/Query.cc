@@ -1,4 +1,6 @@
 #include<cstddef>
+#include <algorithm>
+#include <cmath>
 #include <stdexcept>
 
 #include"Query.hh"
@@ -180,9 +182,19 @@ void BaseWidthCountTarget::replace(RawAddress addr_old, RawAddress addr_new)
     // MaskTarget
     //-----------------------------------------------------------------------------
     
-    MaskTarget::MaskTarget(const Mask* root):
+    MaskTarget::MaskTarget(const Mask* root, const MaskIntervals *intervals, const std::string &name):
     Target(MASK),
-    root(root)
+    root(root),
+    intervals(intervals),
+    name(name)
+    {}
+    
+    MaskTarget::MaskTarget(const PackedMaskCursor &packed_root, const std::string &name):
+    Target(MASK),
+    root(nullptr),
+    packed_root(packed_root),
+    intervals(nullptr),
+    name(name)
     {}
     
     MaskTarget* MaskTarget::asMaskTarget() {
@@ -200,9 +212,22 @@ void BaseWidthCountTarget::replace(RawAddress addr_old, RawAddress addr_new)
 QueryDescription::QueryDescription():
     anchors(MAX_DIMENSIONS, false),
     targets(MAX_DIMENSIONS, Target::root),
-    img_hint(MAX_DIMENSIONS, false)
+    img_hint(MAX_DIMENSIONS, false),
+    variables { 1 }
 {}
 
+QueryDescription::~QueryDescription() {
+    for (auto target: targets) {
+        if (target->type != Target::ROOT) {
+            delete target;
+        }
+    }
+}
+
+void QueryDescription::setVariables(const std::vector<int> &variables) {
+    this->variables = variables;
+}
+
 void QueryDescription::setAnchor(int dimension, bool flag) {
     anchors[dimension] = flag;
 }
@@ -233,12 +258,20 @@ void QueryDescription::setSequenceTarget(int dimension, const std::vector<RawAdd
     targets[dimension] = new SequenceTarget(addresses);
 }
 
-void QueryDescription::setMaskTarget(int dimension, const Mask *mask)
+void QueryDescription::setMaskTarget(int dimension, const Mask *mask, const MaskIntervals *intervals, const std::string &name)
+{
+    if (targets[dimension]->type != Target::ROOT) {
+        delete targets[dimension];
+    }
+    targets[dimension] = new MaskTarget(mask, intervals, name);
+}
+
+void QueryDescription::setMaskTarget(int dimension, const PackedMaskCursor &mask, const std::string &name)
 {
     if (targets[dimension]->type != Target::ROOT) {
         delete targets[dimension];
     }
-    targets[dimension] = new MaskTarget(mask);
+    targets[dimension] = new MaskTarget(mask, name);
 }
     
 void QueryDescription::setBaseWidthCountTarget(int dimension, RawAddress base_address, int width, int count)
@@ -266,4 +299,91 @@ Target *QueryDescription::getFirstAnchoredTarget()
     else return nullptr;
 }
 
+double QueryDescription::estimatedCost() const
+{
+    double cost = 1.0;
+    for (auto target: targets) {
+        switch (target->type) {
+        case Target::LIST:
+            cost *= std::max<std::size_t>(1, static_cast<const ListTarget*>(target)->list.size());
+            break;
+        case Target::FIND_AND_DIVE:
+            cost *= std::pow(4.0, std::min(static_cast<const FindAndDiveTarget*>(target)->offset, 32));
+            break;
+        case Target::SEQUENCE:
+            cost *= std::max<std::size_t>(1, static_cast<const SequenceTarget*>(target)->addresses.size());
+            break;
+        case Target::BASE_WIDTH_COUNT:
+            cost *= std::max(1, static_cast<const BaseWidthCountTarget*>(target)->count);
+            break;
+        case Target::MASK:
+        {
+            auto mask_target = static_cast<const MaskTarget*>(target);
+            cost *= std::max<std::size_t>(1, mask_target->root
+                                          ? mask_target->intervals->size()
+                                          : mask_target->packed_root.tree->numNodes());
+            break;
+        }
+        default: // ROOT, RANGE: a single aggregate
+            break;
+        }
+    }
+    return cost;
+}
+
+void QueryDescription::writeKey(std::ostream &os, int free_dimension) const
+{
+    // e.g. "v1;0a:d12,8;2:b480,24,10;" for the variable 1, dimension 0
+    // anchored on dive(...,8) and dimension 2 on a base:width:count
+    os << 'v';
+    for (auto v: variables)
+        os << v << ',';
+    os << ';';
+    for (std::size_t i=0;i<targets.size();++i) {
+        auto target = targets[i];
+        if (target->type == Target::ROOT && !anchors[i])
+            continue;
+        os << i << (anchors[i] ? "a" : "") << (img_hint[i] ? "i" : "") << ':';
+        switch (target->type) {
+        case Target::LIST:
+            os << 'l';
+            for (auto a: static_cast<const ListTarget*>(target)->list)
+                os << a << ',';
+            break;
+        case Target::FIND_AND_DIVE: {
+            auto t = static_cast<const FindAndDiveTarget*>(target);
+            if ((int) i == free_dimension)
+                os << "d*," << t->offset;
+            else
+                os << 'd' << t->base << ',' << t->offset;
+            break;
+        }
+        case Target::RANGE: {
+            auto t = static_cast<const RangeTarget*>(target);
+            os << 'r' << t->min_address << ',' << t->max_address;
+            break;
+        }
+        case Target::SEQUENCE:
+            os << 's';
+            for (auto a: static_cast<const SequenceTarget*>(target)->addresses)
+                os << a << ',';
+            break;
+        case Target::BASE_WIDTH_COUNT: {
+            auto t = static_cast<const BaseWidthCountTarget*>(target);
+            os << 'b' << t->base << ',' << t->width << ',' << t->count;
+            break;
+        }
+        case Target::MASK:
+        {
+            auto &name = static_cast<const MaskTarget*>(target)->name;
+            os << 'm' << name.size() << ':' << name;
+            break;
+        }
+        default: // ROOT
+            break;
+        }
+        os << ';';
+    }
+}
+
 } // query namespace
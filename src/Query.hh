@@ -1,10 +1,14 @@
 #pragma once
 
+#include <ostream>
+#include <string>
 #include <vector>
 #include <stack>
 #include <stdint.h>
 
 #include "polycover/labeled_tree.hh"
+#include "polycover/packed_tree.hh"
+#include "polycover/interval_mask.hh"
 
 namespace query {
 
@@ -12,6 +16,10 @@ using RawAddress = uint64_t;
     
 using Mask = polycover::labeled_tree::Node;
 
+using PackedMaskCursor = polycover::labeled_tree::PackedCursor;
+
+using MaskIntervals = polycover::labeled_tree::IntervalMask;
+
 struct ListTarget;
 struct RangeTarget;
 struct MaskTarget;
@@ -182,7 +190,12 @@ public: // data memebers
         
     public: // constructors
         
-        MaskTarget(const Mask* root);
+        // a parsed mask and the intervals of its leaves (built once
+        // by the mask cache; both outlive the target)
+        MaskTarget(const Mask* root, const MaskIntervals *intervals, const std::string &name);
+        
+        // a packed mask (root is then nullptr)
+        MaskTarget(const PackedMaskCursor &packed_root, const std::string &name);
         
     public: // methods
         
@@ -192,7 +205,16 @@ public: // data memebers
         
     public: // data memebers
         
-        const Mask* root;
+        const Mask*      root;
+        PackedMaskCursor packed_root;
+        
+        // leaves of a parsed mask: what its traversal uses (a packed
+        // mask is walked in place and has no intervals)
+        const MaskIntervals *intervals;
+        
+        // where the mask comes from (e.g. its mask cache key): what
+        // tells two masks apart in the key of a query
+        std::string      name;
         
     };
     
@@ -237,6 +259,11 @@ public: // subtypes
 public: // Constructor
 
     QueryDescription();
+    ~QueryDescription();
+
+    // targets are owned by the description
+    QueryDescription(const QueryDescription& other) = delete;
+    QueryDescription& operator=(const QueryDescription& other) = delete;
 
 public: // Methods
 
@@ -245,18 +272,35 @@ public: // Methods
     void setFindAndDiveTarget(int dimension, RawAddress base_address, int dive_depth);
     void setRangeTarget(int dimension, RawAddress min_address, RawAddress max_address);
     void setSequenceTarget(int dimension, const std::vector<RawAddress> addresses);
-    void setMaskTarget(int dimension, const Mask *mask);
+    void setMaskTarget(int dimension, const Mask *mask, const MaskIntervals *intervals, const std::string &name);
+    void setMaskTarget(int dimension, const PackedMaskCursor &mask, const std::string &name);
 
     // this is used for the time dimension which is special
     void setBaseWidthCountTarget(int dimension, RawAddress base_address, int width, int count);
 
+    // indices of the time series entry variables to aggregate (the
+    // first one is 1: 0 is time); one measure per index on the result
+    void setVariables(const std::vector<int> &variables);
+
     Target* getFirstAnchoredTarget();
 
+    // rough size of the query: the product over the dimensions of the
+    // number of addresses (or bins) its target asks for; dive(d) counts
+    // as a quadtree dive (4^d) and a mask as its number of nodes
+    double estimatedCost() const;
+
+    // the same text for two descriptions that select the same cells
+    // (however their query was written); the base of a dive target on
+    // free_dimension is left out, so that descriptions that only differ
+    // on it have the same key
+    void writeKey(std::ostream &os, int free_dimension=-1) const;
+
 public: // Data Members
     // time range description first/size/count
     std::vector<bool>    anchors;
     std::vector<Target*> targets;
     std::vector<bool>    img_hint;
+    std::vector<int>     variables;
 };
 
 } // query namespace
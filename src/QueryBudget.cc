@@ -0,0 +1,65 @@
+#include "QueryBudget.hh"
+
+#include <algorithm>
+#include <string>
+
+#include "NanoCubeQueryException.hh"
+
+namespace nanocube {
+
+namespace query {
+
+//------------------------------------------------------------------------------
+// Budget Impl.
+//------------------------------------------------------------------------------
+
+const std::uint64_t Budget::CHECK_PERIOD;
+
+Budget::Budget(std::chrono::milliseconds timeout, std::uint64_t max_nodes, const std::atomic<bool> *cancelled):
+    has_deadline(timeout.count() > 0),
+    start(Clock::now()),
+    deadline(start + timeout),
+    max_nodes(max_nodes),
+    cancelled(cancelled)
+{
+    if (max_nodes)
+        next_check = std::min(next_check, max_nodes);
+}
+
+Budget Budget::fork(std::atomic<std::uint64_t> *shared_nodes) const
+{
+    Budget result(*this);
+    result.nodes        = 0;
+    result.next_check   = max_nodes ? std::min(CHECK_PERIOD, max_nodes) : CHECK_PERIOD;
+    result.shared_nodes = shared_nodes;
+    result.reported     = 0;
+    return result;
+}
+
+void Budget::check()
+{
+    auto total = nodes;
+    if (shared_nodes) {
+        total = shared_nodes->fetch_add(nodes - reported) + (nodes - reported);
+        reported = nodes;
+    }
+    next_check = nodes + CHECK_PERIOD;
+    if (max_nodes) {
+        if (total >= max_nodes)
+            throw QueryAborted(QueryAborted::NODE_BUDGET, "query visited more than " + std::to_string(max_nodes) + " nodes");
+        next_check = std::min(next_check, nodes + (max_nodes - total));
+    }
+    if (cancelled && cancelled->load(std::memory_order_relaxed))
+        throw QueryAborted(QueryAborted::CANCELLED, "query cancelled");
+    if (has_deadline) {
+        auto now = Clock::now();
+        if (now >= deadline) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count();
+            throw QueryAborted(QueryAborted::TIMEOUT, "query timeout after " + std::to_string(elapsed) + "ms");
+        }
+    }
+}
+
+} // query
+
+} // nanocube
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace nanocube {
+
+namespace query {
+
+//------------------------------------------------------------------------------
+// Budget
+//------------------------------------------------------------------------------
+
+//
+// How much a single query evaluation may cost. The traversal charges
+// one unit per node it walks through (see QuadTree.hh and
+// NanoCubeQuery.hh) and every CHECK_PERIOD units the budget checks the
+// deadline and the cancellation flag: a query over its budget throws a
+// QueryAborted, which unwinds the traversal and releases the locks of
+// the caller.
+//
+struct Budget {
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    static const std::uint64_t CHECK_PERIOD = 1024;
+
+    Budget() = default; // no limits
+
+    // timeout: 0 for none; max_nodes: 0 for no limit; cancelled: set
+    // by another thread to abort (e.g. the client went away)
+    Budget(std::chrono::milliseconds timeout,
+           std::uint64_t max_nodes=0,
+           const std::atomic<bool> *cancelled=nullptr);
+
+    inline void charge() {
+        if (++nodes >= next_check)
+            check();
+    }
+
+    // throws QueryAborted if the query is over budget
+    void check();
+
+    std::uint64_t nodesCharged() const { return nodes; }
+
+    // budget of one of the threads a query is split across: same
+    // deadline and cancellation flag, while the nodes of all the forks
+    // are added up on shared_nodes (on every check) for max_nodes
+    Budget fork(std::atomic<std::uint64_t> *shared_nodes) const;
+
+public:
+
+    bool                     has_deadline { false };
+    Clock::time_point        start;
+    Clock::time_point        deadline;
+    std::uint64_t            max_nodes    { 0 };
+    const std::atomic<bool> *cancelled    { nullptr };
+
+private:
+
+    std::uint64_t            nodes        { 0 };
+    std::uint64_t            next_check   { CHECK_PERIOD };
+
+    std::atomic<std::uint64_t> *shared_nodes { nullptr };
+    std::uint64_t               reported     { 0 }; // nodes already on shared_nodes
+};
+
+} // query
+
+} // nanocube
@@ -0,0 +1,116 @@
+#include "ResultCache.hh"
+
+#include <iterator>
+
+namespace result_cache {
+
+//-----------------------------------------------------------------------------
+// Entry Impl.
+//-----------------------------------------------------------------------------
+
+Entry::Entry(ContentType content_type, std::uint64_t version, std::string &&body):
+    content_type(content_type),
+    version(version),
+    body(std::move(body))
+{}
+
+//-----------------------------------------------------------------------------
+// ResultCache Impl.
+//-----------------------------------------------------------------------------
+
+ResultCache::ResultCache(std::size_t budget)
+{
+    counters.budget = budget;
+}
+
+void ResultCache::setBudget(std::size_t budget)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    counters.budget = budget;
+    enforceBudget();
+}
+
+bool ResultCache::enabled() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters.budget > 0;
+}
+
+std::size_t ResultCache::maxEntrySize() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters.budget / 4;
+}
+
+EntryPtr ResultCache::get(const std::string &key, std::uint64_t version)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = items.find(key);
+    if (it == items.end()) {
+        ++counters.misses;
+        return EntryPtr();
+    }
+    auto item_it = it->second;
+    if (item_it->second->version != version) {
+        ++counters.stale;
+        ++counters.misses;
+        erase(item_it);
+        return EntryPtr();
+    }
+    ++counters.hits;
+    mru_list.splice(mru_list.begin(), mru_list, item_it);
+    return item_it->second;
+}
+
+void ResultCache::put(const std::string &key, ContentType content_type, std::uint64_t version, std::string &&body)
+{
+    EntryPtr entry(new Entry(content_type, version, std::move(body)));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (cost(Item(key, entry)) > counters.budget / 4) {
+        return;
+    }
+    auto it = items.find(key);
+    if (it != items.end()) {
+        // a concurrent request computed the same query: keep the newest
+        if (it->second->second->version >= version) {
+            return;
+        }
+        erase(it->second);
+    }
+    mru_list.push_front(Item(key, entry));
+    items[key] = mru_list.begin();
+    ++counters.entries;
+    counters.bytes += cost(mru_list.front());
+    enforceBudget();
+}
+
+Stats ResultCache::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+}
+
+std::size_t ResultCache::cost(const Item &item)
+{
+    // the key is stored twice: on the list and on the map
+    return 2 * item.first.size() + item.second->body.size() + sizeof(Item) + sizeof(Entry);
+}
+
+void ResultCache::erase(List::iterator it)
+{
+    counters.bytes -= cost(*it);
+    --counters.entries;
+    items.erase(it->first);
+    mru_list.erase(it);
+}
+
+void ResultCache::enforceBudget()
+{
+    while (counters.bytes > counters.budget && !mru_list.empty()) {
+        erase(std::prev(mru_list.end()));
+        ++counters.evictions;
+    }
+}
+
+} // result_cache namespace
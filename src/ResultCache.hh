@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+//
+// Encoded responses of whole queries kept in memory and served again
+// while the cube is unchanged.
+//
+// An entry is keyed by its compiled query (the server writes the
+// targets, anchors, variables and encoding of the plan, so different
+// spellings of a query share an entry) and tagged with the version of
+// the cube it was computed on: the server bumps the version after every
+// inserted batch, so an entry of an older version is stale and is
+// dropped the next time it is looked up (or when it becomes the least
+// recently used one). The cache holds at most "budget" bytes of keys
+// and bodies.
+//
+
+namespace result_cache {
+
+enum ContentType { JSON, TEXT, OCTET_STREAM };
+
+//-----------------------------------------------------------------------------
+// Entry
+//-----------------------------------------------------------------------------
+
+struct Entry {
+    Entry(ContentType content_type, std::uint64_t version, std::string &&body);
+
+    ContentType   content_type;
+    std::uint64_t version;
+    std::string   body;
+};
+
+using EntryPtr = std::shared_ptr<const Entry>;
+
+//-----------------------------------------------------------------------------
+// Stats
+//-----------------------------------------------------------------------------
+
+struct Stats {
+    std::uint64_t hits      { 0 };
+    std::uint64_t misses    { 0 };
+    std::uint64_t stale     { 0 }; // misses on an entry of an older version
+    std::uint64_t evictions { 0 };
+    std::size_t   entries   { 0 };
+    std::size_t   bytes     { 0 };
+    std::size_t   budget    { 0 };
+};
+
+//-----------------------------------------------------------------------------
+// ResultCache
+//-----------------------------------------------------------------------------
+
+struct ResultCache {
+public:
+
+    ResultCache(std::size_t budget=0);
+
+    ResultCache(const ResultCache& other) = delete;
+    ResultCache& operator=(const ResultCache& other) = delete;
+
+    // 0 disables the cache
+    void setBudget(std::size_t budget);
+
+    bool enabled() const;
+
+    // larger responses are not kept (a quarter of the budget)
+    std::size_t maxEntrySize() const;
+
+    // entry of key computed on the given version of the cube (null on a
+    // miss); entries are shared so that a hit is served after the cache
+    // lock is released
+    EntryPtr get(const std::string &key, std::uint64_t version);
+
+    void put(const std::string &key, ContentType content_type, std::uint64_t version, std::string &&body);
+
+    Stats stats() const;
+
+private:
+
+    using Item = std::pair<std::string, EntryPtr>;
+    using List = std::list<Item>;
+
+    static std::size_t cost(const Item &item);
+
+    void erase(List::iterator it);
+
+    void enforceBudget();
+
+private:
+
+    mutable std::mutex mutex;
+
+    List mru_list; // most recently used items are in the front
+
+    std::unordered_map<std::string, List::iterator> items;
+
+    Stats counters;
+};
+
+} // result_cache namespace
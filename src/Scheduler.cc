@@ -0,0 +1,143 @@
+#include "Scheduler.hh"
+
+#include <algorithm>
+#include <sstream>
+
+namespace scheduler {
+
+//-----------------------------------------------------------------------------
+// Rejected Impl.
+//-----------------------------------------------------------------------------
+
+Rejected::Rejected(Reason reason, const std::string &message):
+    std::runtime_error(message),
+    reason(reason)
+{}
+
+//-----------------------------------------------------------------------------
+// Ticket Impl.
+//-----------------------------------------------------------------------------
+
+Ticket::Ticket(Scheduler &scheduler, Lane lane):
+    scheduler(&scheduler),
+    lane(lane)
+{}
+
+Ticket::Ticket(Ticket &&other):
+    scheduler(other.scheduler),
+    lane(other.lane)
+{
+    other.scheduler = nullptr;
+}
+
+Ticket& Ticket::operator=(Ticket&& other)
+{
+    if (this != &other) {
+        if (scheduler)
+            scheduler->release(lane);
+        scheduler = other.scheduler;
+        lane      = other.lane;
+        other.scheduler = nullptr;
+    }
+    return *this;
+}
+
+Ticket::~Ticket()
+{
+    if (scheduler)
+        scheduler->release(lane);
+}
+
+//-----------------------------------------------------------------------------
+// Scheduler Impl.
+//-----------------------------------------------------------------------------
+
+void Scheduler::configure(double heavy_cost, int heavy_slots, int max_queued)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->heavy_cost  = heavy_cost;
+    this->heavy_slots = heavy_slots;
+    this->queue_limit = std::max(-1, max_queued);
+    slot_freed.notify_all();
+}
+
+Ticket Scheduler::admit(double cost, const std::atomic<bool> *cancelled)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (heavy_slots <= 0 || cost < heavy_cost) {
+        ++counters.cheap_admitted;
+        ++counters.cheap_running;
+        return Ticket(*this, CHEAP);
+    }
+
+    if (queue.empty() && counters.heavy_running < (std::size_t) heavy_slots) {
+        ++counters.heavy_admitted;
+        ++counters.heavy_running;
+        return Ticket(*this, HEAVY);
+    }
+
+    if (queue_limit >= 0 && queue.size() >= (std::size_t) queue_limit) {
+        ++counters.shed;
+        std::stringstream ss;
+        ss << "server busy: " << counters.heavy_running << " heavy queries running and "
+           << queue.size() << " waiting";
+        throw Rejected(Rejected::OVERLOADED, ss.str());
+    }
+
+    auto id = next_id++;
+    auto it = queue.insert(queue.end(), id);
+    counters.queued     = queue.size();
+    counters.max_queued = std::max(counters.max_queued, counters.queued);
+
+    auto start = Clock::now();
+    while (queue.front() != id || counters.heavy_running >= (std::size_t) heavy_slots) {
+        if (cancelled && cancelled->load()) {
+            queue.erase(it);
+            counters.queued = queue.size();
+            ++counters.cancelled;
+            slot_freed.notify_all(); // the front of the queue may have changed
+            throw Rejected(Rejected::CANCELLED, "query cancelled");
+        }
+        // the cancel flag is not signalled: poll it
+        slot_freed.wait_for(lock, std::chrono::milliseconds(50));
+    }
+
+    queue.pop_front();
+    counters.queued = queue.size();
+    ++counters.heavy_admitted;
+    ++counters.heavy_running;
+
+    auto wait_us = (std::uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+    ++counters.waited;
+    counters.wait_us    += wait_us;
+    counters.max_wait_us = std::max(counters.max_wait_us, wait_us);
+
+    // the next one in line may fit in another free slot
+    slot_freed.notify_all();
+    return Ticket(*this, HEAVY);
+}
+
+void Scheduler::release(Lane lane)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (lane == CHEAP) {
+        --counters.cheap_running;
+    }
+    else {
+        --counters.heavy_running;
+        slot_freed.notify_all();
+    }
+}
+
+Stats Scheduler::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats result = counters;
+    result.heavy_cost  = heavy_cost;
+    result.heavy_slots = heavy_slots;
+    result.queue_limit = queue_limit;
+    return result;
+}
+
+} // scheduler namespace
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+//
+// Admission control of the queries that reach the cube.
+//
+// Every query is admitted with an estimate of its cost. Cheap queries
+// run right away. Heavy ones (cost at least "heavy_cost") run at most
+// "heavy_slots" at a time; the ones beyond that wait in arrival order
+// and, when "max_queued" of them are already waiting, a new one is shed
+// (Rejected::OVERLOADED) instead of waiting. With a limit on the queue,
+// heavy queries never take more than heavy_slots + max_queued of the
+// server threads and the remaining ones are left to cheap queries and to
+// the other services.
+//
+// A waiting query whose client is gone leaves the queue
+// (Rejected::CANCELLED).
+//
+
+namespace scheduler {
+
+using Clock = std::chrono::steady_clock;
+
+enum Lane { CHEAP, HEAVY };
+
+//-----------------------------------------------------------------------------
+// Rejected
+//-----------------------------------------------------------------------------
+
+struct Rejected: public std::runtime_error {
+public:
+    enum Reason { OVERLOADED, CANCELLED };
+    Rejected(Reason reason, const std::string &message);
+public:
+    Reason reason;
+};
+
+//-----------------------------------------------------------------------------
+// Stats
+//-----------------------------------------------------------------------------
+
+struct Stats {
+    std::uint64_t cheap_admitted { 0 };
+    std::uint64_t heavy_admitted { 0 };
+    std::uint64_t shed           { 0 }; // heavy queries rejected on a full queue
+    std::uint64_t cancelled      { 0 }; // heavy queries that left the queue
+    std::size_t   cheap_running  { 0 };
+    std::size_t   heavy_running  { 0 };
+    std::size_t   queued         { 0 }; // heavy queries waiting now
+    std::size_t   max_queued     { 0 }; // most heavy queries ever waiting
+    std::uint64_t waited         { 0 }; // heavy queries that had to wait
+    std::uint64_t wait_us        { 0 }; // total time they waited
+    std::uint64_t max_wait_us    { 0 };
+    double        heavy_cost     { 0 };
+    int           heavy_slots    { 0 };
+    int           queue_limit    { 0 };
+};
+
+struct Scheduler;
+
+//-----------------------------------------------------------------------------
+// Ticket: a query admitted to run; releases its slot when destroyed
+//-----------------------------------------------------------------------------
+
+struct Ticket {
+public:
+
+    Ticket() = default;
+
+    Ticket(Scheduler &scheduler, Lane lane);
+
+    Ticket(Ticket &&other);
+
+    Ticket& operator=(Ticket&& other);
+
+    ~Ticket();
+
+    Ticket(const Ticket& other) = delete;
+    Ticket& operator=(const Ticket& other) = delete;
+
+public:
+
+    Scheduler *scheduler { nullptr };
+    Lane       lane      { CHEAP };
+};
+
+//-----------------------------------------------------------------------------
+// Scheduler
+//-----------------------------------------------------------------------------
+
+struct Scheduler {
+public:
+
+    Scheduler() = default;
+
+    Scheduler(const Scheduler& other) = delete;
+    Scheduler& operator=(const Scheduler& other) = delete;
+
+    // heavy_slots <= 0: no limit (every query is cheap)
+    // max_queued < 0: no limit (heavy queries are never shed)
+    void configure(double heavy_cost, int heavy_slots, int max_queued);
+
+    // blocks a heavy query until a slot is free; throws Rejected when the
+    // queue is full or when *cancelled is set while waiting
+    Ticket admit(double cost, const std::atomic<bool> *cancelled=nullptr);
+
+    Stats stats() const;
+
+private:
+
+    friend struct Ticket;
+
+    void release(Lane lane);
+
+private:
+
+    mutable std::mutex      mutex;
+    std::condition_variable slot_freed;
+
+    double heavy_cost  { 0 };
+    int    heavy_slots { 0 };
+    int    queue_limit { -1 };
+
+    // waiting heavy queries in arrival order: the front one runs next
+    std::list<std::uint64_t> queue;
+    std::uint64_t            next_id { 0 };
+
+    Stats counters;
+};
+
+} // scheduler namespace
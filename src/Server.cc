@@ -1,4 +1,5 @@
 #include <chrono>
+#include <cstdio>
 
 #include <thread>
 #include <iostream>
@@ -21,8 +22,10 @@
 // Request Impl.
 //-------------------------------------------------------------------------
 
-Request::Request(mg_connection *conn, const std::string &request_string):
-    conn(conn), request_string(request_string), response_size(0)
+Request::Request(ResponseChannel &channel, const std::string &request_string, const std::string &content, const ResponseCompression &compression):
+    channel(channel), compression(compression), request_string(request_string),
+    content(content),
+    response_size(0)
 {}
 
 
@@ -32,61 +35,165 @@ static std::string _content_type[] {
     std::string("text/plain")         /* 2 */
 };
 
-void Request::respondText(std::string msg_content)
+::compression::Encoding Request::responseEncoding(std::size_t size) const
+{
+    if (compression.level == 0 || size < compression.min_size)
+        return ::compression::IDENTITY;
+    return ::compression::negotiate(channel.header("Accept-Encoding"));
+}
+
+std::string Request::connectionHeader() const
+{
+    // HTTP/1.1 connections persist and HTTP/1.0 ones close unless stated
+    if (channel.http_1_0())
+        return channel.keepAlive() ? "Connection: keep-alive\r\n" : "";
+    return channel.keepAlive() ? "" : "Connection: close\r\n";
+}
+
+static const char* statusLine(int status)
+{
+    switch (status) {
+    case 200: return "HTTP/1.1 200 OK";
+    case 503: return "HTTP/1.1 503 Service Unavailable";
+    case 504: return "HTTP/1.1 504 Gateway Timeout";
+    default:  return "HTTP/1.1 500 Internal Server Error";
+    }
+}
+
+void Request::respond(const std::string &content_type, const char *data, std::size_t size, int status)
 {
     const std::string sep = "\r\n";
 
+    std::string compressed;
+    auto encoding = responseEncoding(size);
+    if (encoding != ::compression::IDENTITY) {
+        compressed = ::compression::compress(encoding, compression.level, data, size);
+        data = compressed.data();
+        size = compressed.size();
+    }
+
     std::stringstream ss;
-    ss << "HTTP/1.1 200 OK"                << sep
-       << "Content-Type: text/plain"       << sep
-       << "Access-Control-Allow-Origin: *" << sep
-       << "Content-Length: %d"             << sep << sep
-       << "%s";
+    ss << statusLine(status)                << sep
+       << "Content-Type: " << content_type  << sep
+       << "Access-Control-Allow-Origin: *"  << sep;
+    if (encoding != ::compression::IDENTITY) {
+        ss << "Content-Encoding: " << ::compression::name(encoding) << sep
+           << "Vary: Accept-Encoding"                               << sep;
+    }
+    ss << connectionHeader()
+       << "Content-Length: " << size        << sep << sep;
+
+    const std::string &header = ss.str();
+    channel.write(header.c_str(), header.size());
+    channel.write(data, size);
+
+    // response_size = 106 + (int) size; // banchmark data transfer
+    response_size = (int) size;
+}
 
-    // response_size = 106 + (int) msg_content.size(); // banchmark data transfer
-    response_size = (int) msg_content.size();
-    // check how a binary stream would work here
-    mg_printf(conn, ss.str().c_str(), (int) msg_content.size(), msg_content.c_str());
+void Request::respondText(std::string msg_content)
+{
+    respond(_content_type[2], msg_content.c_str(), msg_content.size());
 }
 
 void Request::respondJson(std::string msg_content)
 {
-    const std::string sep = "\r\n";
-    
-    std::stringstream ss;
-    ss << "HTTP/1.1 200 OK"             << sep
-    << "Content-Type: application/json" << sep
-    << "Access-Control-Allow-Origin: *" << sep
-    << "Content-Length: %d"             << sep << sep
-    << "%s";
-    
-    // response_size = 106 + (int) msg_content.size(); // banchmark data transfer
-    response_size = (int) msg_content.size();
-    // check how a binary stream would work here
-    mg_printf(conn, ss.str().c_str(), (int) msg_content.size(), msg_content.c_str());
+    respond(_content_type[0], msg_content.c_str(), msg_content.size());
+}
+
+void Request::respondError(int status, std::string msg_content)
+{
+    respond(_content_type[2], msg_content.c_str(), msg_content.size(), status);
+}
+
+const std::atomic<bool>* Request::cancelled() const
+{
+    return channel.cancelled();
 }
 
 void Request::respondOctetStream(const void *ptr, std::size_t size)
 {
+    if (ptr) {
+        respond(_content_type[1], reinterpret_cast<const char*>(ptr), size);
+        return;
+    }
+
+    // unsage access to nullptr: only the header
     const std::string sep = "\r\n";
 
     std::stringstream ss;
     ss << "HTTP/1.1 200 OK"                        << sep
        << "Content-Type: application/octet-stream" << sep
        << "Access-Control-Allow-Origin: *"         << sep
-       << "Content-Length: %d"                     << sep << sep;
+       << "Content-Length: " << size               << sep << sep;
 
     response_size = 0; // 114;
-    // check how a binary stream would work here
-    mg_printf(conn, ss.str().c_str(), size);
+    const std::string &header = ss.str();
+    channel.write(header.c_str(), header.size());
+}
 
-    if (ptr) { // unsage access to nullptr
-        mg_write(conn, ptr, (int) size);
-        response_size += size;
-    }
-    
+void Request::writeChunk(const char *data, std::size_t size)
+{
+    if (size == 0)
+        return; // an empty chunk ends the body
+
+    char frame[24];
+    int n = snprintf(frame, sizeof(frame), "%zx\r\n", size);
+    channel.write(frame, (std::size_t) n);
+    channel.write(data, size);
+    channel.write("\r\n", 2);
+    response_size += (int) size;
 }
 
+void Request::respondJsonChunk(const char *data, std::size_t size, bool last)
+{
+    if (!chunked && !last && !channel.http_1_0()) {
+        const std::string sep = "\r\n";
+
+        std::stringstream ss;
+        ss << "HTTP/1.1 200 OK"                 << sep
+           << "Transfer-Encoding: chunked"      << sep
+           << "Content-Type: application/json"  << sep
+           << "Access-Control-Allow-Origin: *"  << sep;
+        auto encoding = responseEncoding(size);
+        if (encoding != ::compression::IDENTITY) {
+            ss << "Content-Encoding: " << ::compression::name(encoding) << sep
+               << "Vary: Accept-Encoding"                               << sep;
+            deflater.reset(new ::compression::Deflater(encoding, compression.level));
+        }
+        ss << connectionHeader() << sep;
+
+        const std::string &header = ss.str();
+        channel.write(header.c_str(), header.size());
+        chunked = true;
+        response_size = 0;
+    }
+
+    if (chunked) {
+        if (deflater) {
+            deflater->write(data, size, last, [this](const char *p, std::size_t n) {
+                writeChunk(p, n);
+            });
+        }
+        else {
+            writeChunk(data, size);
+        }
+        if (last) {
+            channel.write("0\r\n\r\n", 5);
+        }
+        return;
+    }
+
+    // plain response once the whole body is known
+    if (!last || pending.size()) {
+        pending.append(data, size);
+        if (!last)
+            return;
+        data = pending.data();
+        size = pending.size();
+    }
+    respond(_content_type[0], data, size);
+}
 
 //-------------------------------------------------------------------------
 // ServerException
@@ -105,16 +212,78 @@ void Server::setHandler(const RequestHandler& rh)
     handler = rh;
 }
 
+//
+// https goes through mongoose (its own poll loop); plain http through the
+// epoll front end
+//
+
 static Server    *__server { nullptr };
 static mg_server *__mongoose_server { nullptr };
 
+struct MongooseChannel: public ResponseChannel {
+
+    MongooseChannel(mg_connection *conn):
+        conn(conn)
+    {}
+
+    const char* header(const char *name) const {
+        return mg_get_header(conn, name);
+    }
+
+    bool http_1_0() const {
+        return conn->http_version && std::string(conn->http_version) == "1.0";
+    }
+
+    bool keepAlive() const {
+        return !http_1_0(); // mongoose decides, nothing to announce
+    }
+
+    void write(const char *data, std::size_t size) {
+        mg_write(conn, data, (int) size);
+    }
+
+    mg_connection *conn;
+};
+
+struct ExchangeChannel: public ResponseChannel {
+
+    ExchangeChannel(http::Exchange &exchange):
+        exchange(exchange)
+    {}
+
+    const char* header(const char *name) const {
+        return exchange.message().header(name);
+    }
+
+    bool http_1_0() const {
+        return exchange.message().version == "1.0";
+    }
+
+    bool keepAlive() const {
+        return exchange.keepAlive();
+    }
+
+    void write(const char *data, std::size_t size) {
+        exchange.write(data, size);
+    }
+
+    const std::atomic<bool>* cancelled() const {
+        return &exchange.cancelled();
+    }
+
+    http::Exchange &exchange;
+};
+
 int __mg_callback(struct mg_connection* c, enum mg_event e)
 {
     if (e == MG_AUTH) {
         return MG_TRUE;   // Authorize all requests
     } else if (e == MG_REQUEST) {
         std::string uri(c->uri + 1);
-        Request request(c, uri);
+        MongooseChannel channel(c);
+        Request request(channel, uri,
+                        c->content ? std::string(c->content, c->content_len) : std::string(),
+                        __server->compression);
         __server->handle_request(request);
         return MG_TRUE;   // Mark as processed
         
@@ -149,16 +318,33 @@ void Server::handle_request(Request &request) {
     }
 }
 
-void Server::init(int mongoose_threads, std::string pemfile) // blocks current thread
+void Server::init(int threads, std::string pemfile)
 {
     __server = this;
+
+    if (pemfile == "") {
+        http_options.workers = threads;
+        http_server.reset(new http::Server(http_options, [this](http::Exchange &exchange) {
+                    auto &message = exchange.message();
+                    ExchangeChannel channel(exchange);
+                    Request request(channel, message.uri.size() ? message.uri.substr(1) : message.uri,
+                                    message.body, compression);
+                    handle_request(request);
+                }));
+        try {
+            http_server->listen(port);
+        }
+        catch (std::runtime_error &e) {
+            http_server.reset();
+            throw ServerException(std::string("Problem starting http server: ") + e.what());
+        }
+        return;
+    }
     
     mg_server *srv = mg_create_server(NULL, __mg_callback);
-    mg_set_option(srv, "num_threads", std::to_string(mongoose_threads).c_str());
+    mg_set_option(srv, "num_threads", std::to_string(threads).c_str());
 
-    if (pemfile  != ""){
-      mg_set_option(srv, "ssl_certificate", pemfile.c_str());
-    }
+    mg_set_option(srv, "ssl_certificate", pemfile.c_str());
     
     // Serve current directory
     mg_set_option(srv, "listening_port", (std::to_string(port)).c_str());
@@ -176,6 +362,11 @@ void Server::init(int mongoose_threads, std::string pemfile) // blocks current t
 }
 
 void Server::run() {
+
+    if (http_server) {
+        http_server->run(); // until stop() and the drain are done
+        return;
+    }
     
     if (!__mongoose_server)
         throw ServerException("No mongoose server initialized");
@@ -188,9 +379,11 @@ void Server::run() {
     mg_destroy_server(&__mongoose_server);
 }
 
-void Server::stop() // blocks current thread
+void Server::stop()
 {
     keep_running = false;
+    if (http_server)
+        http_server->stop();
 }
 
 bool Server::toggleTiming(bool b)
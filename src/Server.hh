@@ -12,10 +12,49 @@
 #include <exception>
 #include <stdexcept>
 #include <functional>
+#include <atomic>
+#include <memory>
 #include <mutex>
 
 #include "mongoose.h"
 
+#include "Compression.hh"
+#include "HttpServer.hh"
+
+//-------------------------------------------------------------------------
+// ResponseCompression
+//-------------------------------------------------------------------------
+
+// responses are compressed (gzip or deflate) when the client accepts it
+struct ResponseCompression {
+    int         level    { 1 };    // zlib level (0: never compress)
+    std::size_t min_size { 1024 }; // smaller bodies are sent as they are
+};
+
+//-------------------------------------------------------------------------
+// ResponseChannel
+//-------------------------------------------------------------------------
+
+// the connection a request arrived on: responses are written to it as
+// raw HTTP (status line, headers and body)
+struct ResponseChannel {
+    virtual ~ResponseChannel() {}
+
+    // nullptr if the request has no such header
+    virtual const char* header(const char *name) const = 0;
+
+    virtual bool http_1_0() const = 0;
+
+    // the connection stays open after the response
+    virtual bool keepAlive() const = 0;
+
+    virtual void write(const char *data, std::size_t size) = 0;
+
+    // set when nobody waits for the response anymore (nullptr if the
+    // channel cannot tell)
+    virtual const std::atomic<bool>* cancelled() const { return nullptr; }
+};
+
 //-------------------------------------------------------------------------
 // Request
 //-------------------------------------------------------------------------
@@ -24,7 +63,7 @@ struct Request {
 
     enum Type { JSON_OBJECT=0, OCTET_STREAM=1};
 
-    Request(mg_connection *conn, const std::string& request_string);
+    Request(ResponseChannel &channel, const std::string& request_string, const std::string &content, const ResponseCompression &compression=ResponseCompression());
 
     void respondJson(std::string msg_content);
 
@@ -32,14 +71,46 @@ struct Request {
 
     void respondOctetStream(const void *ptr, std::size_t size);
 
+    // json response written in pieces as they are produced: sent with
+    // chunked transfer encoding unless the first piece is also the
+    // last one (or the client speaks HTTP/1.0)
+    void respondJsonChunk(const char *data, std::size_t size, bool last);
+
+    // text/plain message with an error status (e.g. 504)
+    void respondError(int status, std::string msg_content);
+
+    // see ResponseChannel::cancelled
+    const std::atomic<bool>* cancelled() const;
+
 private:
 
-    mg_connection *conn;
+    ::compression::Encoding responseEncoding(std::size_t size) const;
+
+    void respond(const std::string &content_type, const char *data, std::size_t size, int status=200);
+
+    // Connection header a response needs (if any)
+    std::string connectionHeader() const;
+
+    void writeChunk(const char *data, std::size_t size);
+
+private:
+
+    ResponseChannel &channel;
+
+    ResponseCompression compression;
+
+    bool           chunked { false }; // headers of a chunked response were sent
+
+    std::string    pending;           // body of an HTTP/1.0 response
+
+    std::unique_ptr<::compression::Deflater> deflater; // of a chunked response
 
 public:
 
     const std::string request_string;
 
+    const std::string content; // body of a POST request
+
     int response_size;
 
 };
@@ -68,7 +139,9 @@ struct Server {
 
     Server() = default;
 
-    void init(int mongoose_threads, std::string pemfile);
+    // queries are served by an epoll front end with a pool of "threads"
+    // workers; https (a pem file) still goes through mongoose
+    void init(int threads, std::string pemfile);
     void run();
     
     void stop();
@@ -88,10 +161,12 @@ public:
     
     int port { 29512 };
 
-    int mongoose_threads { 10 };
-
     RequestHandler handler;
 
+    ResponseCompression compression;
+
+    http::Options http_options;
+
 public:
 
     bool is_timing { false };
@@ -102,4 +177,8 @@ public:
     
     std::mutex mutex; // mutual exclusion for writing into the timing file
 
+private:
+
+    std::unique_ptr<http::Server> http_server;
+
 };
@@ -0,0 +1,593 @@
+#include "SlabAllocator.hh"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+namespace slab {
+
+char* slab_table[MAX_SLABS];
+
+void throwNoHandle()
+{
+    throw std::runtime_error("object has no slab handle (out of slab ids or not allocated on a slab)");
+}
+
+#ifndef NO_SLAB_ALLOCATOR
+
+namespace {
+
+static const std::size_t NUM_SIZE_CLASSES = MAX_OBJECT_SIZE / ALIGNMENT;
+
+struct Pool;
+
+//
+// Slab header: lives at the beginning of the SLAB_SIZE aligned block
+// and the objects follow it
+//
+struct Slab {
+    uint32_t    id;          // needs to be the first field (see slab::slabId)
+    Pool       *pool;
+    Slab       *prev;        // list of slabs with free objects
+    Slab       *next;
+    Slab       *all_prev;    // list of every slab of the pool
+    Slab       *all_next;
+    void       *free_list;   // objects that were freed
+    uint32_t    num_objects; // live objects
+    uint32_t    num_carved;  // objects carved from the block so far
+};
+
+static const std::size_t HEADER_SIZE = (sizeof(Slab) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+
+//
+// Header of the allocations larger than MAX_OBJECT_SIZE (keeps the
+// alignment of ::operator new)
+//
+struct Large {
+    Arena::Impl *arena;      // nullptr if not allocated in an arena
+    Large       *prev;
+    Large       *next;
+    std::size_t  size;
+};
+
+static_assert(sizeof(Large) % 16 == 0, "Large header breaks the alignment of operator new");
+
+inline void pause()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+//
+// critical sections are a few pointer updates: spin a little, then let
+// the holder run (e.g. when it was preempted)
+//
+struct SpinLock {
+    void lock() {
+        for (int spins=0; flag.test_and_set(std::memory_order_acquire); ++spins) {
+            if (spins < 64) {
+                pause();
+            }
+            else {
+                std::this_thread::yield();
+            }
+        }
+    }
+    void unlock() { flag.clear(std::memory_order_release); }
+    std::atomic_flag flag = ATOMIC_FLAG_INIT;
+};
+
+struct Pool {
+
+    void* allocate();
+
+    void  deallocate(Slab *slab, void *p);
+
+    void  link(Slab *slab);
+
+    void  unlink(Slab *slab);
+
+    // frees every slab of the pool
+    void  releaseAll();
+
+    std::size_t object_size { 0 };
+    uint32_t    capacity    { 0 }; // objects per slab
+    Slab       *partial     { nullptr };
+    Slab       *spare       { nullptr }; // one empty slab kept around
+    Slab       *all         { nullptr };
+    std::size_t num_slabs   { 0 };
+    std::size_t num_objects { 0 };
+    SpinLock    spin_lock;
+};
+
+void initPools(Pool *p)
+{
+    for (std::size_t i=0;i<NUM_SIZE_CLASSES;++i) {
+        p[i].object_size = (i + 1) * ALIGNMENT;
+        p[i].capacity    = (uint32_t) ((SLAB_SIZE - HEADER_SIZE) / p[i].object_size);
+    }
+}
+
+//
+// slab ids
+//
+struct SlabIds {
+
+    uint32_t acquire(Slab *slab) {
+        spin_lock.lock();
+        uint32_t id = 0;
+        if (free_ids.size()) {
+            id = free_ids.back();
+            free_ids.pop_back();
+        }
+        else if (next_id < MAX_SLABS) {
+            id = next_id++;
+        }
+        if (id) {
+            slab_table[id] = reinterpret_cast<char*>(slab);
+        }
+        spin_lock.unlock();
+        return id;
+    }
+
+    void release(uint32_t id) {
+        if (!id) {
+            return;
+        }
+        spin_lock.lock();
+        slab_table[id] = nullptr;
+        free_ids.push_back(id);
+        spin_lock.unlock();
+    }
+
+    uint32_t              next_id { 1 };
+    std::vector<uint32_t> free_ids;
+    SpinLock              spin_lock;
+};
+
+SlabIds& slabIds()
+{
+    static SlabIds *result = new SlabIds();
+    return *result;
+}
+
+Pool* pools()
+{
+    // never destroyed: objects may be deleted during static destruction
+    static Pool *result = []() {
+        Pool *p = new Pool[NUM_SIZE_CLASSES];
+        initPools(p);
+        return p;
+    }();
+    return result;
+}
+
+inline Slab* slabOf(void *p)
+{
+    return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(p) & ~(uintptr_t) (SLAB_SIZE - 1));
+}
+
+void Pool::link(Slab *slab)
+{
+    slab->prev = nullptr;
+    slab->next = partial;
+    if (partial) {
+        partial->prev = slab;
+    }
+    partial = slab;
+}
+
+void Pool::unlink(Slab *slab)
+{
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    }
+    else {
+        partial = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = slab->next = nullptr;
+}
+
+void* Pool::allocate()
+{
+    spin_lock.lock();
+
+    Slab *slab = partial;
+    if (!slab) {
+        if (spare) {
+            slab  = spare;
+            spare = nullptr;
+        }
+        else {
+            void *block = nullptr;
+            if (posix_memalign(&block, SLAB_SIZE, SLAB_SIZE) != 0) {
+                spin_lock.unlock();
+                throw std::bad_alloc();
+            }
+            slab = reinterpret_cast<Slab*>(block);
+            slab->id          = slabIds().acquire(slab);
+            slab->pool        = this;
+            slab->free_list   = nullptr;
+            slab->num_objects = 0;
+            slab->num_carved  = 0;
+            slab->all_prev    = nullptr;
+            slab->all_next    = all;
+            if (all) {
+                all->all_prev = slab;
+            }
+            all = slab;
+            ++num_slabs;
+        }
+        link(slab);
+    }
+
+    void *p = nullptr;
+    if (slab->free_list) {
+        p = slab->free_list;
+        slab->free_list = *reinterpret_cast<void**>(p);
+    }
+    else {
+        p = reinterpret_cast<char*>(slab) + HEADER_SIZE + (std::size_t) slab->num_carved * object_size;
+        ++slab->num_carved;
+    }
+
+    ++slab->num_objects;
+    ++num_objects;
+    if (slab->num_objects == capacity) {
+        unlink(slab); // full
+    }
+
+    spin_lock.unlock();
+    return p;
+}
+
+void Pool::deallocate(Slab *slab, void *p)
+{
+    spin_lock.lock();
+
+    if (slab->num_objects == capacity) {
+        link(slab); // was full
+    }
+
+    *reinterpret_cast<void**>(p) = slab->free_list;
+    slab->free_list = p;
+    --slab->num_objects;
+    --num_objects;
+
+    if (slab->num_objects == 0) {
+        unlink(slab);
+        slab->free_list  = nullptr;
+        slab->num_carved = 0;
+        if (!spare) {
+            spare = slab;
+        }
+        else {
+            if (slab->all_prev) {
+                slab->all_prev->all_next = slab->all_next;
+            }
+            else {
+                all = slab->all_next;
+            }
+            if (slab->all_next) {
+                slab->all_next->all_prev = slab->all_prev;
+            }
+            --num_slabs;
+            slabIds().release(slab->id);
+            free(slab);
+        }
+    }
+
+    spin_lock.unlock();
+}
+
+void Pool::releaseAll()
+{
+    spin_lock.lock();
+    Slab *slab = all;
+    while (slab) {
+        Slab *next = slab->all_next;
+        slabIds().release(slab->id);
+        free(slab);
+        slab = next;
+    }
+    partial     = nullptr;
+    spare       = nullptr;
+    all         = nullptr;
+    num_slabs   = 0;
+    num_objects = 0;
+    spin_lock.unlock();
+}
+
+} // anonymous namespace
+
+//-----------------------------------------------------------------------------
+// Arena::Impl
+//-----------------------------------------------------------------------------
+
+struct Arena::Impl {
+    Impl() { initPools(pools); }
+
+    void link(Large *large);
+    void unlink(Large *large);
+    void releaseAll();
+
+    Pool        pools[NUM_SIZE_CLASSES];
+    Large      *large { nullptr };
+    SpinLock    spin_lock; // large list
+    Impl       *prev  { nullptr }; // live arenas
+    Impl       *next  { nullptr };
+};
+
+void Arena::Impl::link(Large *block)
+{
+    spin_lock.lock();
+    block->prev = nullptr;
+    block->next = large;
+    if (large) {
+        large->prev = block;
+    }
+    large = block;
+    spin_lock.unlock();
+}
+
+void Arena::Impl::unlink(Large *block)
+{
+    spin_lock.lock();
+    if (block->prev) {
+        block->prev->next = block->next;
+    }
+    else {
+        large = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    spin_lock.unlock();
+}
+
+void Arena::Impl::releaseAll()
+{
+    for (auto &p: pools) {
+        p.releaseAll();
+    }
+    spin_lock.lock();
+    Large *block = large;
+    while (block) {
+        Large *next = block->next;
+        ::operator delete(block);
+        block = next;
+    }
+    large = nullptr;
+    spin_lock.unlock();
+}
+
+namespace {
+
+thread_local Arena::Impl *current_arena = nullptr;
+
+//
+// live arenas (for the stats)
+//
+struct Arenas {
+    void add(Arena::Impl *arena) {
+        spin_lock.lock();
+        arena->prev = nullptr;
+        arena->next = first;
+        if (first) {
+            first->prev = arena;
+        }
+        first = arena;
+        spin_lock.unlock();
+    }
+    void remove(Arena::Impl *arena) {
+        spin_lock.lock();
+        if (arena->prev) {
+            arena->prev->next = arena->next;
+        }
+        else {
+            first = arena->next;
+        }
+        if (arena->next) {
+            arena->next->prev = arena->prev;
+        }
+        spin_lock.unlock();
+    }
+    Arena::Impl *first { nullptr };
+    SpinLock     spin_lock;
+};
+
+Arenas& arenas()
+{
+    static Arenas *result = new Arenas();
+    return *result;
+}
+
+void collect(const Pool *p, SizeClassStats *result)
+{
+    for (std::size_t i=0;i<NUM_SIZE_CLASSES;++i) {
+        auto &pool = const_cast<Pool&>(p[i]);
+        pool.spin_lock.lock();
+        result[i].object_size  = pool.object_size;
+        result[i].num_slabs   += pool.num_slabs;
+        result[i].num_objects += pool.num_objects;
+        pool.spin_lock.unlock();
+    }
+}
+
+Stats toStats(const SizeClassStats *size_classes)
+{
+    Stats result;
+    for (std::size_t i=0;i<NUM_SIZE_CLASSES;++i) {
+        if (size_classes[i].num_slabs) {
+            result.size_classes.push_back(size_classes[i]);
+        }
+    }
+    return result;
+}
+
+} // anonymous namespace
+
+void* allocate(std::size_t size)
+{
+    Arena::Impl *arena = current_arena;
+    if (size == 0 || size > MAX_OBJECT_SIZE) {
+        Large *block  = static_cast<Large*>(::operator new(sizeof(Large) + size));
+        block->arena  = arena;
+        block->size   = size;
+        if (arena) {
+            arena->link(block);
+        }
+        return block + 1;
+    }
+    Pool *p = arena ? arena->pools : pools();
+    return p[(size - 1) / ALIGNMENT].allocate();
+}
+
+void deallocate(void *p, std::size_t size)
+{
+    if (!p) {
+        return;
+    }
+    else if (size == 0 || size > MAX_OBJECT_SIZE) {
+        Large *block = static_cast<Large*>(p) - 1;
+        if (block->arena) {
+            block->arena->unlink(block);
+        }
+        ::operator delete(block);
+        return;
+    }
+    Slab *slab = slabOf(p);
+    slab->pool->deallocate(slab, p);
+}
+
+Stats stats()
+{
+    SizeClassStats size_classes[NUM_SIZE_CLASSES];
+    collect(pools(), size_classes);
+    auto &a = arenas();
+    a.spin_lock.lock();
+    for (auto arena=a.first; arena; arena=arena->next) {
+        collect(arena->pools, size_classes);
+    }
+    a.spin_lock.unlock();
+    return toStats(size_classes);
+}
+
+//-----------------------------------------------------------------------------
+// Arena Impl.
+//-----------------------------------------------------------------------------
+
+Arena::Arena():
+    impl(new Impl())
+{
+    arenas().add(impl);
+}
+
+Arena::~Arena()
+{
+    arenas().remove(impl);
+    impl->releaseAll();
+    delete impl;
+}
+
+bool Arena::release()
+{
+    impl->releaseAll();
+    return true;
+}
+
+Stats Arena::stats() const
+{
+    SizeClassStats size_classes[NUM_SIZE_CLASSES];
+    collect(impl->pools, size_classes);
+    return toStats(size_classes);
+}
+
+ArenaScope::ArenaScope(Arena &arena):
+    previous(current_arena)
+{
+    current_arena = arena.impl;
+}
+
+ArenaScope::~ArenaScope()
+{
+    current_arena = previous;
+}
+
+#else
+
+void* allocate(std::size_t size)
+{
+    return ::operator new(size);
+}
+
+void deallocate(void *p, std::size_t size)
+{
+    ::operator delete(p);
+}
+
+Stats stats()
+{
+    return Stats();
+}
+
+Arena::Arena():
+    impl(nullptr)
+{}
+
+Arena::~Arena()
+{}
+
+bool Arena::release()
+{
+    return false;
+}
+
+Stats Arena::stats() const
+{
+    return Stats();
+}
+
+ArenaScope::ArenaScope(Arena &arena):
+    previous(nullptr)
+{}
+
+ArenaScope::~ArenaScope()
+{}
+
+#endif
+
+//-----------------------------------------------------------------------------
+// Stats Impl.
+//-----------------------------------------------------------------------------
+
+std::size_t Stats::reservedBytes() const
+{
+    std::size_t result = 0;
+    for (auto &s: size_classes) {
+        result += s.num_slabs * SLAB_SIZE;
+    }
+    return result;
+}
+
+std::size_t Stats::usedBytes() const
+{
+    std::size_t result = 0;
+    for (auto &s: size_classes) {
+        result += s.num_objects * s.object_size;
+    }
+    return result;
+}
+
+std::size_t Stats::overheadBytes() const
+{
+    return reservedBytes() - usedBytes();
+}
+
+} // slab namespace
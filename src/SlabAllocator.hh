@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//
+// Size-class slab allocator for the small objects of a nanocube
+// (quadtree nodes of the 16 shapes, flattrees, time series and the
+// small_vector buffers of links and time series entries).
+//
+// Objects of the same size class are carved out of 64KB slabs aligned
+// to their size, so there are no per-object malloc headers and the
+// slab (and its size class) of an object is found from its address.
+// A slab that becomes empty is given back to the system as a whole,
+// except for one spare slab per size class.
+//
+// Requests larger than MAX_OBJECT_SIZE go to ::operator new (behind a
+// small header that links them to their arena).
+//
+// An Arena has size classes of its own: while an ArenaScope of it is
+// alive, the allocations of that thread come from the arena. All of it
+// is given back at once by Arena::release(), without visiting objects
+// (e.g. the nanocube of a sliding window that expired).
+//
+// Every slab also gets an id, so that an object on a slab can be
+// referred to by a 32-bit handle: slab id and offset (in ALIGNMENT
+// units) inside the slab. These handles are used by the compact link
+// policy (see TaggedPointer.hh).
+//
+// Define NO_SLAB_ALLOCATOR to route everything to ::operator new.
+//
+
+namespace slab {
+
+static const std::size_t SLAB_SIZE       = 1 << 16;
+static const std::size_t MAX_OBJECT_SIZE = 256;
+static const std::size_t ALIGNMENT       = 8;
+
+static const int         OFFSET_BITS     = 13;      // SLAB_SIZE / ALIGNMENT
+static const std::size_t MAX_SLABS       = 1 << 19; // 32 - OFFSET_BITS
+
+void* allocate(std::size_t size);
+
+// size is the size used on allocation (or any size up to
+// MAX_OBJECT_SIZE if the object came from a slab)
+void deallocate(void *p, std::size_t size);
+
+//-----------------------------------------------------------------------------
+// Allocator: std containers owned by nanocube objects (so they go to
+// the same arena)
+//-----------------------------------------------------------------------------
+
+template <typename T>
+struct Allocator {
+    using value_type = T;
+
+    Allocator() = default;
+
+    template <typename U>
+    Allocator(const Allocator<U>&) {}
+
+    T* allocate(std::size_t n) { return static_cast<T*>(slab::allocate(n * sizeof(T))); }
+
+    void deallocate(T* p, std::size_t n) { slab::deallocate(p, n * sizeof(T)); }
+};
+
+template <typename T, typename U>
+inline bool operator==(const Allocator<T>&, const Allocator<U>&) { return true; }
+
+template <typename T, typename U>
+inline bool operator!=(const Allocator<T>&, const Allocator<U>&) { return false; }
+
+//-----------------------------------------------------------------------------
+// Handles
+//-----------------------------------------------------------------------------
+
+// base address of every slab indexed by its id (id 0 is not used)
+extern char* slab_table[MAX_SLABS];
+
+// the first field of a slab header is its id (0 if the slab has no id)
+inline uint32_t slabId(const void *p)
+{
+    auto base = reinterpret_cast<uintptr_t>(p) & ~(uintptr_t) (SLAB_SIZE - 1);
+    return *reinterpret_cast<const uint32_t*>(base);
+}
+
+void throwNoHandle();
+
+// handle of an object allocated on a slab (0 for nullptr). Only objects
+// of up to MAX_OBJECT_SIZE bytes that came from slab::allocate have a
+// slab header to read (the handle types of TaggedPointer.hh check the
+// size at compile time). The id read is checked against slab_table.
+inline uint32_t handle(const void *p)
+{
+    if (!p) {
+        return 0;
+    }
+    auto base   = reinterpret_cast<uintptr_t>(p) & ~(uintptr_t) (SLAB_SIZE - 1);
+    auto offset = reinterpret_cast<uintptr_t>(p) & (SLAB_SIZE - 1);
+    auto id     = slabId(p);
+    if (!id || id >= MAX_SLABS || reinterpret_cast<uintptr_t>(slab_table[id]) != base) {
+        throwNoHandle();
+    }
+    return (id << OFFSET_BITS) | (uint32_t) (offset / ALIGNMENT);
+}
+
+inline void* pointer(uint32_t handle)
+{
+    if (!handle) {
+        return nullptr;
+    }
+    return slab_table[handle >> OFFSET_BITS] + (std::size_t) (handle & ((1U << OFFSET_BITS) - 1)) * ALIGNMENT;
+}
+
+//-----------------------------------------------------------------------------
+// Stats
+//-----------------------------------------------------------------------------
+
+struct SizeClassStats {
+    std::size_t object_size { 0 };
+    std::size_t num_slabs   { 0 };
+    std::size_t num_objects { 0 }; // live objects
+};
+
+struct Stats {
+    std::size_t reservedBytes() const; // bytes on slabs
+    std::size_t usedBytes() const;     // bytes on live objects
+    std::size_t overheadBytes() const; // reserved - used
+    std::vector<SizeClassStats> size_classes;
+};
+
+// every size class, including the ones of live arenas
+Stats stats();
+
+//-----------------------------------------------------------------------------
+// Arena
+//-----------------------------------------------------------------------------
+
+struct Arena {
+public:
+
+    Arena();
+    ~Arena(); // release()
+
+    Arena(const Arena& other) = delete;
+    Arena& operator=(const Arena& other) = delete;
+
+    // frees every object allocated in the arena in bulk: none of them may
+    // be used (or deallocated) afterwards, and no thread may be in a scope
+    // of the arena. false if there is nothing to release in bulk (under
+    // NO_SLAB_ALLOCATOR): objects need to be deleted one by one.
+    bool release();
+
+    Stats stats() const;
+
+public:
+
+    struct Impl;
+
+private:
+
+    Impl *impl;
+
+    friend struct ArenaScope;
+};
+
+//
+// Allocations of the current thread go to arena while the scope lives.
+// Scopes nest.
+//
+struct ArenaScope {
+public:
+    explicit ArenaScope(Arena &arena);
+    ~ArenaScope();
+
+    ArenaScope(const ArenaScope& other) = delete;
+    ArenaScope& operator=(const ArenaScope& other) = delete;
+
+private:
+    Arena::Impl *previous;
+};
+
+} // slab namespace
@@ -2,6 +2,12 @@
 
 #include <cstdint>
 
+#include "SlabAllocator.hh"
+
+#if defined(NANOCUBE_COMPACT_HANDLES) && defined(NO_SLAB_ALLOCATOR)
+#error "NANOCUBE_COMPACT_HANDLES needs the slab allocator (don't define NO_SLAB_ALLOCATOR)"
+#endif
+
 namespace tagged_pointer {
 
 template <typename T>
@@ -70,4 +76,162 @@ struct TaggedPointer
 
 };
 
+//-----------------------------------------------------------------------------
+// TaggedHandle
+//-----------------------------------------------------------------------------
+
+//
+// Same interface as TaggedPointer, but the pointer is stored as a 32-bit
+// slab handle (see SlabAllocator.hh): 6 bytes of data, so a struct
+// holding a TaggedHandle can place a few more bytes in what would
+// otherwise be padding. T needs an operator new that goes to
+// slab::allocate and has to fit in a slab size class.
+//
+template <typename T>
+struct TaggedHandle
+{
+    typedef uint16_t Tag;
+
+    TaggedHandle():
+        handle(0),
+        tag(0)
+    {}
+
+    TaggedHandle(T *ptr, Tag tag):
+        handle(encode(ptr)),
+        tag(tag)
+    {}
+
+    inline T* operator()()
+    {
+        return getPointer();
+    }
+
+    inline T* getPointer() const
+    {
+        return static_cast<T*>(slab::pointer(handle));
+    }
+
+    inline void setPointer(T* ptr)
+    {
+        handle = encode(ptr);
+    }
+
+    inline void setTag(Tag tag)
+    {
+        this->tag = tag;
+    }
+
+    inline Tag getTag() const
+    {
+        return tag;
+    }
+
+    static inline uint32_t encode(T *ptr)
+    {
+        static_assert(sizeof(T) <= slab::MAX_OBJECT_SIZE, "a handle needs an object on a slab");
+        return slab::handle(ptr);
+    }
+
+    uint32_t handle;
+    Tag      tag;
+} __attribute__((packed, aligned(2)));
+
+//-----------------------------------------------------------------------------
+// FlaggedHandle
+//-----------------------------------------------------------------------------
+
+//
+// A 31-bit slab handle and a one bit tag (0 or 1) in 4 bytes (same
+// requirements on T as TaggedHandle).
+//
+template <typename T>
+struct FlaggedHandle
+{
+    typedef uint16_t Tag;
+
+    static const uint32_t FLAG = 1U << 31;
+
+    FlaggedHandle():
+        data(0)
+    {}
+
+    FlaggedHandle(T *ptr, Tag tag):
+        data(encode(ptr) | (tag ? FLAG : 0))
+    {}
+
+    inline T* operator()()
+    {
+        return getPointer();
+    }
+
+    inline T* getPointer() const
+    {
+        return static_cast<T*>(slab::pointer(data & ~FLAG));
+    }
+
+    inline void setPointer(T* ptr)
+    {
+        data = encode(ptr) | (data & FLAG);
+    }
+
+    inline void setTag(Tag tag)
+    {
+        data = (data & ~FLAG) | (tag ? FLAG : 0);
+    }
+
+    inline Tag getTag() const
+    {
+        return (data & FLAG) ? 1 : 0;
+    }
+
+    static inline uint32_t encode(T *ptr)
+    {
+        static_assert(sizeof(T) <= slab::MAX_OBJECT_SIZE, "a handle needs an object on a slab");
+        uint32_t h = slab::handle(ptr);
+        if (h & FLAG) {
+            slab::throwNoHandle(); // slab id doesn't fit in 31 bits
+        }
+        return h;
+    }
+
+    uint32_t data;
+};
+
+//-----------------------------------------------------------------------------
+// Link policies
+//-----------------------------------------------------------------------------
+
+//
+// How tree structures refer to their children and contents:
+// Flagged<T> needs a one bit tag (e.g. quadtree child links) and
+// Tagged<T> a 16-bit tag (e.g. content holders).
+//
+// WidePointers stores 64-bit pointers with the tag in the unused high
+// bits; CompactHandles stores 32-bit slab handles, which costs one
+// table lookup per dereference and limits the objects reachable through
+// a Flagged link to the first 2^18 slabs (16GB).
+//
+// The policy is the last template parameter of the quadtree (QuadTree,
+// Node, ScopedNode, NodePointer), of both flattrees and of ContentHolder,
+// so one cube can mix them. It defaults to CompactHandles if
+// NANOCUBE_COMPACT_HANDLES is defined.
+//
+
+struct WidePointers {
+    template <typename T> using Flagged = TaggedPointer<T>;
+    template <typename T> using Tagged  = TaggedPointer<T>;
+};
+
+struct CompactHandles {
+    template <typename T> using Flagged = FlaggedHandle<T>;
+    template <typename T> using Tagged  = TaggedHandle<T>;
+};
+
+#ifdef NANOCUBE_COMPACT_HANDLES
+typedef CompactHandles DefaultPolicy;
+#else
+typedef WidePointers   DefaultPolicy;
+#endif
+
 }
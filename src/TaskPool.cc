@@ -0,0 +1,101 @@
+#include "TaskPool.hh"
+
+namespace task_pool {
+
+//-----------------------------------------------------------------------------
+// TaskPool Impl.
+//-----------------------------------------------------------------------------
+
+TaskPool::TaskPool(int num_threads)
+{
+    try {
+        for (int i=0;i<num_threads;++i)
+            threads.push_back(std::thread(&TaskPool::loop, this));
+    }
+    catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        for (auto &t: threads)
+            t.join();
+        throw;
+    }
+}
+
+TaskPool::~TaskPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    for (auto &t: threads)
+        t.join();
+}
+
+void TaskPool::run(int num_helpers, const Task &task)
+{
+    auto job  = std::make_shared<Job>();
+    job->task = &task;
+    if (!threads.empty()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i=1;i<=num_helpers;++i)
+            queue.push_back(std::make_pair(job, i));
+    }
+    wakeup.notify_all();
+
+    std::exception_ptr error;
+    try {
+        task(0);
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+
+    // helpers still queued never see task (it dies with this call)
+    std::unique_lock<std::mutex> lock(mutex);
+    job->closed = true;
+    finished.wait(lock, [&job]() { return job->active == 0; });
+    if (!error)
+        error = job->error;
+    lock.unlock();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void TaskPool::loop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wakeup.wait(lock, [this]() { return stopping || !queue.empty(); });
+        if (queue.empty())
+            return;
+        auto item = queue.front();
+        queue.pop_front();
+        if (item.first->closed)
+            continue;
+        ++item.first->active;
+        lock.unlock();
+        help(item.first, item.second);
+        lock.lock();
+        if (--item.first->active == 0)
+            finished.notify_all();
+    }
+}
+
+void TaskPool::help(const JobPtr &job, int index)
+{
+    try {
+        (*job->task)(index);
+    }
+    catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!job->error)
+            job->error = std::current_exception();
+    }
+}
+
+} // task_pool namespace
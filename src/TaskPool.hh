@@ -0,0 +1,73 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// Threads started once and shared by the parallel parts of the queries
+// (e.g. the cubes of a sliding window), so a query doesn't start and
+// join threads of its own.
+//
+// run(n, task) calls task(0) on the calling thread and task(1..n) on
+// the pool. The helpers are meant to share the work with the caller
+// (e.g. pick the next item from a common counter): once task(0)
+// returns, the helpers that didn't start yet are skipped, so a busy
+// pool never makes a query wait for work that is already done.
+//
+
+namespace task_pool {
+
+//-----------------------------------------------------------------------------
+// TaskPool
+//-----------------------------------------------------------------------------
+
+struct TaskPool {
+public:
+
+    using Task = std::function<void(int)>; // helper index (0: caller)
+
+    TaskPool(int num_threads);
+    ~TaskPool(); // waits for the running tasks
+
+    TaskPool(const TaskPool& other) = delete;
+    TaskPool& operator=(const TaskPool& other) = delete;
+
+    // the first exception of a task is rethrown once every started
+    // task returned
+    void run(int num_helpers, const Task &task);
+
+    int size() const { return (int) threads.size(); }
+
+private:
+
+    // one call of run(): lives until its last queued helper is popped
+    struct Job {
+        const Task        *task    { nullptr };
+        bool               closed  { false }; // no more helpers start
+        int                active  { 0 };
+        std::exception_ptr error;
+    };
+
+    using JobPtr = std::shared_ptr<Job>;
+
+    void loop();
+
+    void help(const JobPtr &job, int index);
+
+private:
+
+    std::mutex                 mutex;
+    std::condition_variable    wakeup;   // helpers were queued
+    std::condition_variable    finished; // a helper returned
+    std::deque<std::pair<JobPtr, int>> queue;
+    bool                       stopping { false };
+    std::vector<std::thread>   threads;
+};
+
+} // task_pool namespace
@@ -1,11 +1,13 @@
 #pragma once
 
 #include <cstdint>
+#include <atomic>
 #include <vector>
 #include <map>
 #include <unordered_map>
 #include <sstream>
 #include <iomanip>
+#include <iterator>
 #include <stdexcept>
 
 #include <algorithm>
@@ -18,6 +20,7 @@
 
 #ifndef TIMESERIES_VECTOR
 #include "small_vector.hh"
+#include "SlabAllocator.hh"
 #endif
 
 namespace timeseries {
@@ -34,6 +37,89 @@ typedef uint8_t  BitIndex; // this goes up 25 (17 zooms + 8 resolution)
 typedef uint64_t Timestamp;
 typedef uint32_t NumBins;
 
+//-----------------------------------------------------------------------------
+// visitWindowBins
+//-----------------------------------------------------------------------------
+
+//
+// Calls f(i, before, last) for every bin i in [0, count) that has
+// entries among the cumulative entries [first, last), where bin i is
+// the interval [base + i * width, base + (i+1) * width): "last" is the
+// last entry on the bin and "before" the entry preceding the first
+// entry on the bin (all zeros if there is none), so the bin total of
+// any variable is the difference of the two.
+//
+// Entries and bins are merged in a single pass: the bin of the next
+// entry is computed directly (empty bins cost nothing) and the end of a
+// bin is found by galloping from the current entry, so a dense series
+// is walked almost linearly and a sparse one costs a few probes per
+// non-empty bin.
+//
+template <typename Iterator, typename Function>
+void visitWindowBins(Iterator first, Iterator last, Timestamp base, Timestamp width, NumBins count, Function f)
+{
+    using entry_type = typename std::iterator_traits<Iterator>::value_type;
+
+    if (width == 0 || count == 0 || first == last) {
+        return;
+    }
+
+    auto cmp = [](const entry_type &e, Timestamp t) -> bool {
+        return e.template get<0>() < t;
+    };
+
+    const Timestamp end = base + width * count;
+
+    const entry_type zero = entry_type();
+
+    auto it = std::lower_bound(first, last, base, cmp);
+
+    while (it != last) {
+        Timestamp t = it->template get<0>();
+        if (t >= end) {
+            break;
+        }
+        NumBins   i       = (NumBins) ((t - base) / width);
+        Timestamp bin_end = base + (i + 1) * width;
+
+        const entry_type &before = (it == first) ? zero : *(it-1);
+
+        // gallop: the first entry at or after bin_end is in (it, hi]
+        auto hi = it + 1;
+        typename std::iterator_traits<Iterator>::difference_type step = 1;
+        while (hi != last && cmp(*hi, bin_end)) {
+            it   = hi;
+            hi   = (last - hi > step) ? hi + step : last;
+            step *= 2;
+        }
+        auto next = std::lower_bound(it + 1, hi, bin_end, cmp);
+
+        f(i, before, *(next-1));
+        it = next;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// visitWindowTotals
+//-----------------------------------------------------------------------------
+
+//
+// Calls f(i, total) for every bin i of base:width:count with a non-zero
+// total of variable VariableIndex (see visitWindowBins).
+//
+template <int VariableIndex, typename Iterator, typename Function>
+void visitWindowTotals(Iterator first, Iterator last, Timestamp base, Timestamp width, NumBins count, Function f)
+{
+    using entry_type = typename std::iterator_traits<Iterator>::value_type;
+    visitWindowBins(first, last, base, width, count, [&f](NumBins i, const entry_type &before, const entry_type &last) {
+        uint64_t value    = last.template get<VariableIndex>();
+        uint64_t previous = before.template get<VariableIndex>();
+        if (value != previous) {
+            f(i, value - previous);
+        }
+    });
+}
+
 //-----------------------------------------------------------------------------
 // TimeSeries
 //-----------------------------------------------------------------------------
@@ -45,7 +131,7 @@ struct VectorType {
 
 template <typename Entry>
 struct VectorType<Entry,false> {
-    using type = std::vector<Entry>;
+    using type = std::vector<Entry, slab::Allocator<Entry>>;
 };
 
 template<typename Entry>
@@ -72,8 +158,35 @@ public:
     template <int VariableIndex>
     uint64_t getWindowTotal(Timestamp a, Timestamp b) const;
 
+    // f(i, total) for the non-zero bins of base:width:count
+    // (same totals as getWindowTotal on every bin)
+    template <int VariableIndex, typename Function>
+    void visitWindowTotals(Timestamp base, Timestamp width, NumBins count, Function f) const {
+        timeseries::visitWindowTotals<VariableIndex>(entries.begin(), entries.end(), base, width, count, f);
+    }
+
+    // f(i, before, last) for the bins of base:width:count with entries
+    // (see timeseries::visitWindowBins)
+    template <typename Function>
+    void visitWindowBins(Timestamp base, Timestamp width, NumBins count, Function f) const {
+        timeseries::visitWindowBins(entries.begin(), entries.end(), base, width, count, f);
+    }
+
     void dump(std::ostream &os) const;
 
+    inline uint32_t size() const { return entries.size(); }
+
+    inline const Entry& front() const { return *entries.begin(); }
+
+    inline const Entry& back() const { return *(entries.end() - 1); }
+
+    template <typename Function>
+    void forEachEntry(Function f) const {
+        for (auto &e: entries) {
+            f(e);
+        }
+    }
+
 public: // change back to public because of the ObjectFactory deseralization need
 
     TimeSeries();
@@ -83,10 +196,10 @@ public: // change back to public because of the ObjectFactory deseralization nee
     static void* operator new(size_t size);
     static void  operator delete(void *p);
 
-    static uint64_t count_new;
-    static uint64_t count_delete;
-    static uint64_t count_used_bins;
-    static uint64_t count_num_adds;
+    static std::atomic<uint64_t> count_new;
+    static std::atomic<uint64_t> count_delete;
+    static std::atomic<uint64_t> count_used_bins;
+    static std::atomic<uint64_t> count_num_adds;
 
 public: // attributes
 
@@ -154,27 +267,27 @@ std::vector<TimeSeries<Entry>*> TimeSeries<Entry>::tslist;
 //-----------------------------------------------------------------------------
 
 template<typename Entry>
-uint64_t TimeSeries<Entry>::count_new = 0;
+std::atomic<uint64_t> TimeSeries<Entry>::count_new { 0 };
 
 template<typename Entry>
-uint64_t TimeSeries<Entry>::count_delete = 0;
+std::atomic<uint64_t> TimeSeries<Entry>::count_delete { 0 };
 
 template<typename Entry>
-uint64_t TimeSeries<Entry>::count_used_bins = 0;
+std::atomic<uint64_t> TimeSeries<Entry>::count_used_bins { 0 };
 
 template<typename Entry>
-uint64_t TimeSeries<Entry>::count_num_adds = 0;
+std::atomic<uint64_t> TimeSeries<Entry>::count_num_adds { 0 };
 
 template<typename Entry>
 void* TimeSeries<Entry>::operator new(size_t size) {
     count_new++;
-    return ::operator new(size);
+    return slab::allocate(size);
 }
 
 template<typename Entry>
 void TimeSeries<Entry>::operator delete(void *p) {
     count_delete++;
-    ::operator delete(p);
+    slab::deallocate(p, sizeof(TimeSeries<Entry>));
 }
 
 // we can keep the key here if we like
@@ -193,14 +306,14 @@ TimeSeries<Entry>::add(Entry entry)
 
     // std::cout << "TimeSeries<Entry>::add( " << time << " ) " << std::endl;
 #ifdef COLLECT_MEMUSAGE
-    count_num_adds++; // not thread safe (use atomic later)
+    count_num_adds++;
 #endif
 
     // assuming we are adding in order for now
     if (entries.size() == 0)
     {
 #ifdef COLLECT_MEMUSAGE
-        count_used_bins++; // not thread safe (use atomic later)
+        count_used_bins++;
 #endif
         entries.push_back(entry);
         return sizeof(Entry);
@@ -214,7 +327,7 @@ TimeSeries<Entry>::add(Entry entry)
         if (current_entry_time < entry_time) {
 
 #ifdef COLLECT_MEMUSAGE
-            count_used_bins++; // not thread safe (use atomic later)
+            count_used_bins++;
 #endif
 
             entry.accum(entries.back());
@@ -252,7 +365,7 @@ TimeSeries<Entry>::add(Entry entry)
                 used_size_inc += sizeof(Entry);
 
 #ifdef COLLECT_MEMUSAGE
-                count_used_bins++; // not thread safe (use atomic later)
+                count_used_bins++;
 #endif
 
                 if (it != entries.begin()) {
@@ -288,7 +401,7 @@ TimeSeries<Entry>::makeLazyCopy() const
 
     TimeSeries<Entry> *copy = new TimeSeries<Entry>();
 
-    count_used_bins += entries.size(); // not thread safe (use atomic later)
+    count_used_bins += entries.size();
 
     copy->entries.resize(entries.size());
     std::copy(entries.begin(), entries.end(), copy->entries.begin());
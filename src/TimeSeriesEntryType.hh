@@ -166,6 +166,8 @@ public: // methods
     template <int index>
     uint64_t get() const;
 
+    uint64_t get(int index) const; // index known only at runtime
+
     template <int index>
     void set(uint64_t value);
 
@@ -215,6 +217,24 @@ struct Add<tsentry,0> {
 //    return result;
 //}
 
+template <typename tsentry, int n>
+struct Get {
+    static uint64_t get(const tsentry &a, int index) {
+        static const int current = tsentry::dimension - n;
+        if (index == current) {
+            return a.template get<current>();
+        }
+        return Get<tsentry,n-1>::get(a, index);
+    }
+};
+
+template <typename tsentry>
+struct Get<tsentry,0> {
+    static uint64_t get(const tsentry &a, int index) {
+        return 0;
+    }
+};
+
 template<typename var_types>
 void TimeSeriesEntryType<var_types>::accum(const TimeSeriesEntryType &b)
 {
@@ -236,6 +256,12 @@ uint64_t TimeSeriesEntryType<var_types>::get() const {
     return result;
 }
 
+template<typename var_types>
+uint64_t TimeSeriesEntryType<var_types>::get(int index) const {
+    typedef TimeSeriesEntryType<var_types> tsentry;
+    return Get<tsentry, tsentry::dimension>::get(*this, index);
+}
+
 template<typename var_types>
 template <int index>
 void TimeSeriesEntryType<var_types>::set(uint64_t value) {
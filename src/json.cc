@@ -1,5 +1,9 @@
 #include "json.hh"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
 namespace json {
 
 //-----------------------------------------------------------------------------
@@ -138,4 +142,71 @@ ContextGuard::~ContextGuard()
         writer->context_stack.pop();
 }
 
+//-----------------------------------------------------------------------------
+// ChunkBuffer
+//-----------------------------------------------------------------------------
+
+ChunkBuffer::ChunkBuffer(sink_func sink, std::size_t capacity):
+    sink(sink),
+    data(new char[capacity]),
+    capacity(capacity)
+{}
+
+void ChunkBuffer::flush(bool last) {
+    sink(data.get(), size, last);
+    flushed += size;
+    size = 0;
+}
+
+void ChunkBuffer::finish() {
+    flush(true);
+}
+
+std::size_t ChunkBuffer::bytesWritten() const {
+    return flushed + size;
+}
+
+void ChunkBuffer::write(const char *st, std::size_t n) {
+    while (n > 0) {
+        if (size == capacity)
+            flush(false);
+        std::size_t m = std::min(n, capacity - size);
+        std::memcpy(data.get() + size, st, m);
+        size += m;
+        st   += m;
+        n    -= m;
+    }
+}
+
+void ChunkBuffer::writeInt(int64_t value) {
+    if (value < 0) {
+        write("-", 1);
+        writeUInt(-(uint64_t) value);
+        return;
+    }
+    writeUInt((uint64_t) value);
+}
+
+void ChunkBuffer::writeUInt(uint64_t value) {
+    char buf[24];
+    char *end = buf + sizeof(buf);
+    char *p   = end;
+    do {
+        *--p = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value);
+    write(p, (std::size_t) (end - p));
+}
+
+void ChunkBuffer::writeDouble(double value) {
+    // %g prints integers below 10^6 (precision 6) without exponent
+    if (std::fabs(value) < 1e6 && value == (double) (int64_t) value && !(value == 0 && std::signbit(value))) {
+        writeInt((int64_t) value);
+        return;
+    }
+    char buf[32];
+    int n = std::snprintf(buf, sizeof(buf), "%g", value);
+    write(buf, (std::size_t) n);
+}
+
 }
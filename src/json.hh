@@ -3,6 +3,10 @@
 #include <string>
 #include <stack>
 #include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
 
 namespace json {
 
@@ -84,4 +88,67 @@ struct ContextGuard {
 
 };
 
+//-----------------------------------------------------------------------------
+// ChunkBuffer
+//-----------------------------------------------------------------------------
+
+//
+// Fixed size output buffer handed to a sink every time it fills up
+// (e.g. one chunk of an HTTP response), so that large outputs are
+// never held as a whole. Numbers are formatted in place: integers by
+// hand and doubles as std::ostream would print them (%g).
+//
+struct ChunkBuffer {
+
+    using sink_func = std::function<void(const char *data, std::size_t size, bool last)>;
+
+    static const std::size_t DEFAULT_CAPACITY = 1 << 16;
+
+    ChunkBuffer(sink_func sink, std::size_t capacity=DEFAULT_CAPACITY);
+    ChunkBuffer(const ChunkBuffer& other) = delete;
+    ChunkBuffer& operator=(const ChunkBuffer& other) = delete;
+
+    void write(const char *data, std::size_t size);
+    void writeInt(int64_t value);
+    void writeUInt(uint64_t value);
+    void writeDouble(double value);
+
+    ChunkBuffer& operator<<(char c);
+    ChunkBuffer& operator<<(const char *st);
+    ChunkBuffer& operator<<(const std::string &st);
+
+    // hands the rest of the buffer to the sink as the last chunk
+    void finish();
+
+    std::size_t bytesWritten() const;
+
+private:
+
+    void flush(bool last);
+
+private:
+    sink_func               sink;
+    std::unique_ptr<char[]> data;
+    std::size_t             capacity;
+    std::size_t             size    { 0 };
+    std::size_t             flushed { 0 };
+};
+
+inline ChunkBuffer& ChunkBuffer::operator<<(char c) {
+    if (size == capacity)
+        flush(false);
+    data[size++] = c;
+    return *this;
+}
+
+inline ChunkBuffer& ChunkBuffer::operator<<(const char *st) {
+    write(st, std::strlen(st));
+    return *this;
+}
+
+inline ChunkBuffer& ChunkBuffer::operator<<(const std::string &st) {
+    write(st.data(), st.size());
+    return *this;
+}
+
 }
@@ -157,6 +157,7 @@ auto List<I,A>::insert(item_type* item, item_type *insertion_point) -> list_type
         adapter_type a_last(last);
         a_item.setNext(nullptr).setPrev(last);
         a_last.setNext(item);
+        last = item;
     }
     ++size;
     return *this;
@@ -167,24 +168,22 @@ auto List<I,A>::remove(item_type* item) -> list_type& {
     if (!first)
         throw std::runtime_error("cannot remove from empty list");
 
-    if (first == item) {
-        adapter_type a_first(item);
-        first = a_first.next();
-        a_first.setNext(nullptr);
-    }
-    else if (last == item) {
-        adapter_type a_last(item);
-        last = a_last.prev();
-        a_last.setPrev(nullptr);
-    }
-    else {
-        adapter_type a_item(item);
-        adapter_type a_prev(a_item.prev());
-        adapter_type a_next(a_item.next());
-        a_prev.setNext(a_next());
-        a_next.setPrev(a_prev());
-        a_item.setPrev(nullptr).setNext(nullptr);
-    }
+    adapter_type a_item(item);
+    auto prev = a_item.prev();
+    auto next = a_item.next();
+
+    // unlink from both neighbors (or from the list ends)
+    if (prev)
+        adapter_type(prev).setNext(next);
+    else
+        first = next;
+
+    if (next)
+        adapter_type(next).setPrev(prev);
+    else
+        last = prev;
+
+    a_item.setPrev(nullptr).setNext(nullptr);
     --size;
     return *this;
 }
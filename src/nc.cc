@@ -1,9 +1,13 @@
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
 #include <thread>
 #include <functional>
 #include <fstream>
 #include <mutex>
+#include <atomic>
+#include <future>
+#include <map>
 
 #include <zlib.h>
 
@@ -14,11 +18,20 @@
 #include <curl/curl.h>
 
 #include "DumpFile.hh"
+#include "ExternalSort.hh"
 #include "MemoryUtil.hh"
 #include "NanoCube.hh"
 #include "Query.hh"
 #include "QueryParser.hh"
 #include "NanoCubeQueryResult.hh"
+#include "CollectorHeap.hh"
+#include "ColumnarResult.hh"
+#include "FlatResult.hh"
+#include "ResultCache.hh"
+#include "Scheduler.hh"
+#include "MaskStore.hh"
+#include "MaskCache.hh"
+#include "TaskPool.hh"
 #include "NanoCubeSummary.hh"
 #include "json.hh"
 
@@ -255,7 +268,7 @@ struct Options {
     TCLAP::ValueArg<int> no_mongoose_threads {  
             "t",              // flag
             "threads",        // name
-            "Number of threads for querying (mongoose)",     // description
+            "Number of threads serving queries",     // description
             false,                                 // required
             10,                                   // value
             "threads"                         // type description
@@ -303,24 +316,59 @@ struct Options {
             };
 
 
-    // -d or --data
     TCLAP::ValueArg<int> mask_cache_budget {
-        "M",              // flag
-        "mask-cache-budget",         // name
-        "Number of masks that are kept in the cache. Every time we have 20% more masks in the cache we reduce it to the budget. Default 1000.", // description
-        false,            // required
-        1000,             // value
-        "data-filename"   // type description
+        "M",                      // flag
+        "mask-cache-budget",      // name
+        "MB of masks (mask, degrees_mask, mercator_mask, region) kept in memory. When it is full the masks that were cheapest to compute per byte and least recently used are dropped first. 0 disables the cache (default: 256)", // description
+        false,                    // required
+        256,                      // value
+        "memory-MB"               // type description
+    };
+
+    TCLAP::ValueArg<int> mask_threads {
+        "",                       // flag
+        "mask-threads",           // name
+        "Threads computing the cover of a degrees_mask or mercator_mask polygon. 0: the number of cores (default: 0)", // description
+        false,                    // required
+        0,                        // value
+        "threads"                 // type description
+    };
+
+    TCLAP::ValueArg<std::string> mask_store {
+        "",                       // flag
+        "mask-store",             // name
+        "Precompiled region masks (see nanocube-mask-store) memory mapped at startup: region queries found there skip the .ttt files of NANOCUBE_REGIONS", // description
+        false,                    // required
+        "",                       // value
+        "filename"                // type description
     };
 
     TCLAP::ValueArg<int> sliding {
         "w",                      // flag
         "sliding-window",                // name
-        "Sliding Window",         // description
+        "Time units of each window of a sliding window: records go to the cube of their window and only the cubes of the latest --sliding-cubes windows are kept. 0: no sliding window (default: 0)", // description
         false,                    // required
         0,                        // value
         "sliding window units"    // type description
     };
+
+    TCLAP::ValueArg<int> sliding_cubes {
+        "",                       // flag
+        "sliding-cubes",          // name
+        "Windows (one cube each) kept by a sliding window, e.g. 24 windows of an hour for the last day (default: 2)", // description
+        false,                    // required
+        2,                        // value
+        "cubes"                   // type description
+    };
+
+    TCLAP::ValueArg<int> sliding_threads {
+        "",                       // flag
+        "sliding-threads",        // name
+        "Threads a query runs on, one cube of the sliding window at a time: the query thread and helpers from a pool of this many minus one threads shared by all queries. 0: the number of cores (default: 0)", // description
+        false,                    // required
+        0,                        // value
+        "threads"                 // type description
+    };
     
 
   TCLAP::ValueArg<std::string> pem_file {
@@ -332,7 +380,112 @@ struct Options {
       "pem-file"                         // type description
       };
     
+    TCLAP::ValueArg<int> insert_threads {
+        "j",                      // flag
+        "insert-threads",         // name
+        "Number of threads used to build the nanocube from the first batch read from stdin (default: 1). Use a large batch size so that most of the data goes in this first batch.", // description
+        false,                    // required
+        1,                        // value
+        "insert-threads"          // type description
+    };
+
+    TCLAP::ValueArg<int> bulk_load {
+        "B",                      // flag
+        "bulk-load",              // name
+        "Read all of stdin (a finite .dmp) and sort the records by time (then by address) before inserting them. At most this many MB of records are kept in memory while sorting: the rest is spilled to temporary files in $TMPDIR (default: 0, insert records in arrival order)", // description
+        false,                    // required
+        0,                        // value
+        "memory-MB"               // type description
+    };
+
     TCLAP::SwitchArg  nolog { "0", "nolog", "Don't append to nanocube.log file" };
+
+    TCLAP::ValueArg<int> compression_level {
+        "z",                      // flag
+        "compression-level",      // name
+        "zlib level (1 fastest, 9 smallest) of the responses compressed for clients that send Accept-Encoding: gzip or deflate. 0 disables compression (default: 1)", // description
+        false,                    // required
+        1,                        // value
+        "level"                   // type description
+    };
+
+    TCLAP::ValueArg<int> compression_min_size {
+        "Z",                      // flag
+        "compression-min-size",   // name
+        "Responses smaller than this many bytes are never compressed (default: 1024)", // description
+        false,                    // required
+        1024,                     // value
+        "bytes"                   // type description
+    };
+
+    TCLAP::ValueArg<int> plan_cache_size {
+        "P",                      // flag
+        "plan-cache-size",        // name
+        "Number of compiled queries kept in the cache: a query string seen before is neither parsed nor compiled again. Every time we have 20% more plans in the cache we reduce it to this size. 0 disables the cache (default: 1000)", // description
+        false,                    // required
+        1000,                     // value
+        "plans"                   // type description
+    };
+
+    TCLAP::ValueArg<int> result_cache_budget {
+        "C",                      // flag
+        "result-cache-budget",    // name
+        "MB of query responses kept in memory: a query repeated while no records were inserted is answered from this cache without touching the cube. 0 disables the cache (default: 64)", // description
+        false,                    // required
+        64,                       // value
+        "memory-MB"               // type description
+    };
+
+    TCLAP::ValueArg<int> query_timeout {
+        "T",                      // flag
+        "query-timeout",          // name
+        "Milliseconds a query may run before it is aborted with a 504 response (it releases the cube right away). A query can ask for less with .timeout(<ms>). 0: no limit (default: 0)", // description
+        false,                    // required
+        0,                        // value
+        "ms"                      // type description
+    };
+
+    TCLAP::ValueArg<int> query_max_nodes {
+        "N",                      // flag
+        "query-max-nodes",        // name
+        "Nodes (and time bins) a query may visit before it is aborted with a 504 response. 0: no limit (default: 0)", // description
+        false,                    // required
+        0,                        // value
+        "nodes"                   // type description
+    };
+
+    TCLAP::ValueArg<int> heavy_queries {
+        "H",                      // flag
+        "heavy-queries",          // name
+        "Heavy queries (see --heavy-query-cost) running at the same time; the others wait for a slot. 0: half of the threads, -1: no admission control (default: 0)", // description
+        false,                    // required
+        0,                        // value
+        "queries"                 // type description
+    };
+
+    TCLAP::ValueArg<int> heavy_queue {
+        "Q",                      // flag
+        "heavy-queue",            // name
+        "Heavy queries that may wait for a slot: beyond this a heavy query gets a 503 response. -2: the threads left by the heavy slots and one cheap query, -1: no limit, heavy queries wait and are never shed (default: -2)", // description
+        false,                    // required
+        -2,                       // value
+        "queries"                 // type description
+    };
+
+    TCLAP::ValueArg<double> heavy_query_cost {
+        "",                       // flag
+        "heavy-query-cost",       // name
+        "Estimated cost from which a query is heavy: the product of the addresses or bins asked on each dimension, dive(d) counting as 4^d (default: 1000000)", // description
+        false,                    // required
+        1000000.0,                // value
+        "cost"                    // type description
+    };
+
+    TCLAP::SwitchArg half_close {
+        "",                       // flag
+        "half-close",             // name
+        "Answer a client that shuts down its sending side while its query runs (by default a client that closes its connection cancels its query)"
+    };
 };
 
 
@@ -349,10 +502,26 @@ Options::Options(std::vector<std::string>& args)
     cmd_line.add(batch_size);
     cmd_line.add(sleep_for_ns);
     cmd_line.add(mask_cache_budget);
+    cmd_line.add(mask_threads);
+    cmd_line.add(mask_store);
     cmd_line.add(sliding);
+    cmd_line.add(sliding_cubes);
+    cmd_line.add(sliding_threads);
+    cmd_line.add(insert_threads);
+    cmd_line.add(bulk_load);
     cmd_line.add(nanocube_alias);
     cmd_line.add(nanocube_registry);
     cmd_line.add(nolog);
+    cmd_line.add(compression_level);
+    cmd_line.add(compression_min_size);
+    cmd_line.add(plan_cache_size);
+    cmd_line.add(result_cache_budget);
+    cmd_line.add(query_timeout);
+    cmd_line.add(query_max_nodes);
+    cmd_line.add(heavy_queries);
+    cmd_line.add(heavy_queue);
+    cmd_line.add(heavy_query_cost);
+    cmd_line.add(half_close);
     cmd_line.parse(args);
 }
 
@@ -443,7 +612,9 @@ typedef nanocube::NanoCubeTemplate<
 using Entry   = typename NanoCube::entry_type;
 using Address = typename NanoCube::address_type;
 
-using MaskCache = cache2::Cache<std::string, ::query::Mask>;
+// cached masks are shared: a query pins the masks it uses so that
+// an eviction triggered by a concurrent query doesn't release them
+using MaskPtr = ::mask_cache::MaskPtr;
 
 
 //-----------------------------------------------------------------
@@ -569,7 +740,7 @@ std::size_t AnnotatedSchema::convertPathAddress(int dimension_index, DimAddress
 // API_3
 //
 
-enum OutputEncoding { JSON, BINARY, TEXT };
+enum OutputEncoding { JSON, BINARY, TEXT, BINARY_COLUMNS };
 
 struct BranchTargetOnTime {
 public:
@@ -593,6 +764,85 @@ struct FormatOption {
     DimAddress base_address;
 };
 
+//------------------------------------------------------------------------------
+// QueryPlan
+//------------------------------------------------------------------------------
+
+//
+// A request compiled once: the program name routes the request and the
+// rest is what the query handlers need to run it. Plans are cached by
+// request string and shared read-only by the threads serving the same
+// query, so a repeated query is neither parsed nor compiled again.
+//
+struct QueryPlan {
+public:
+    std::string               name; // program name
+    ::query::QueryDescription query_description;
+    OutputEncoding            output_encoding { JSON };
+    BranchTargetOnTime        branch_target_on_time;
+    std::vector<FormatOption> format_options { ::query::QueryDescription::MAX_DIMENSIONS };
+    std::vector<MaskPtr>      masks; // targets point to these masks
+    int                       k { 10 }; // topk.k(<k>)
+    int                       timeout { 0 }; // timeout(<ms>); 0: the server's
+    double                    cost { 1 }; // query_description.estimatedCost()
+    std::string               key; // result cache key (see resultKey)
+};
+
+using QueryPlanPtr   = std::shared_ptr<const QueryPlan>;
+using QueryPlanCache = cache2::Cache<std::string, QueryPlanPtr>;
+
+//------------------------------------------------------------------------------
+// QueryOutput
+//------------------------------------------------------------------------------
+
+// where the encoded result of a query goes: json in pieces as it is
+// written, the other encodings as a whole
+struct QueryOutput {
+    ::json::ChunkBuffer::sink_func                                  json;
+    std::function<void(::result_cache::ContentType, std::string&&)> body;
+};
+
+//------------------------------------------------------------------------------
+// QueryCells
+//------------------------------------------------------------------------------
+
+// what the traversal of a query leaves for its encoding, which runs
+// once the cube is released: the cells of a count query on a flat
+// result, the ones of topk and unique on a tree
+struct QueryCells {
+    // cells on a builder (push, store, pop) in depth first order
+    template <typename Builder>
+    void emit(Builder &builder);
+
+    bool                           flat { false }; // cells are on flat_result
+    ::query::result::FlatResult    flat_result;
+    ::nanocube::TreeValue          tree_value { 0 };
+    std::vector<std::string>       level_names;
+};
+
+template <typename Builder>
+void QueryCells::emit(Builder &builder)
+{
+    if (flat)
+        flat_result.emit(builder);
+    else
+        ::tree_store::replay(tree_value, builder);
+}
+
+//------------------------------------------------------------------------------
+// BatchQuery
+//------------------------------------------------------------------------------
+
+// a query of a batch: answered with its json (an error or a cached
+// result) before the cube is read, or by the encoding of its cells
+struct BatchQuery {
+    QueryPlanPtr                plan;
+    ::collector_heap::Mode      mode { ::collector_heap::NO_COLLECTOR };
+    bool                        answered { false };
+    std::string                 json;
+    std::unique_ptr<QueryCells> cells;
+};
+
 
 //------------------------------------------------------------------------------
 // SlidingWindow
@@ -604,9 +854,16 @@ using SlidingWindowID = std::int64_t;
 using NanocubeID      = int;
 
 /*!
- * Given a timestamp, indicate which action should be taken.
- * insert point nanocube with active ID
+ * Ring of the cubes of the latest num_cubes windows of window_size time
+ * units. A record goes to the cube of its window; when a record of a
+ * new window arrives, the cubes of the windows that fall out of the
+ * ring are dropped and records older than the ring are discarded. The
+ * queryable history grows from num_cubes-1 to num_cubes windows and
+ * every rollover drops a single window.
  *
+ * Every window has a slab::Arena that holds all the objects of its
+ * cube (see arena()), so dropping a cube gives its slabs back in bulk
+ * instead of deleting its nodes one by one.
  */
 template <typename nanocube_type>
 struct SlidingCubeManager {
@@ -614,39 +871,37 @@ public:
     
     using nanocube_type_ptr   = std::unique_ptr<nanocube_type>;
     using f_new_nanocube_type = std::function<nanocube_type*()>;
-    using f_visit_type        = std::function<void(nanocube_type& n)>;
     
 public:
     /*!
      * Sliding window case
      */
-    SlidingCubeManager(Timestamp base, Duration window_size, f_new_nanocube_type f_new);
+    SlidingCubeManager(Timestamp base, Duration window_size, int num_cubes, f_new_nanocube_type f_new);
+    
+    ~SlidingCubeManager();
+    
+    SlidingCubeManager(const SlidingCubeManager&) = delete;
+    SlidingCubeManager& operator=(const SlidingCubeManager&) = delete;
 
+    // cube of the window of timestamp (nullptr if it is out of reach)
     inline nanocube_type* at(Timestamp timestamp);
 
-    inline void apply(f_visit_type f);
+    // cubes of the live windows (oldest first)
+    inline std::vector<nanocube_type*> cubes() const;
 
     inline Timestamp latest() const { return _latest_at; }
 
+    // arena of the cube at(timestamp) returned: inserts into that cube
+    // need to be in a slab::ArenaScope of it
+    inline slab::Arena& arena(Timestamp timestamp) { return *_arenas[slot(id(timestamp))]; }
+
 private:
     
-    inline int current() const { return _parity; }
-    inline int previous() const { return 1 - _parity; }
-    
-    inline SlidingWindowID current_id() const { return _window_ids[current()]; }
-    inline SlidingWindowID previous_id() const { return _window_ids[previous()]; }
+    inline SlidingWindowID id(Timestamp timestamp) const { return (timestamp - _base) / _window_size; }
     
-    inline void current_id(SlidingWindowID id) { _window_ids[current()] = id; }
-    inline void previous_id(SlidingWindowID id) { _window_ids[previous()] = id; }
+    inline int slot(SlidingWindowID id) const { return (int) (id % (SlidingWindowID) _cubes.size()); }
     
-    inline nanocube_type& current_cube() { return *_cubes[current()].get(); }
-    inline nanocube_type& previous_cube() { return *_cubes[previous()].get();; }
-
-    inline void current_cube(nanocube_type_ptr&& p) { _cubes[current()].swap(p); }
-    inline void previous_cube(nanocube_type_ptr&& p) { _cubes[previous()].swap(p); }
-    
-    inline SlidingWindowID id(Timestamp timestamp) const { return (timestamp - _base) / _window_size; }
-
+    void drop(int slot);
 
 public:
     // sliding window case
@@ -656,11 +911,12 @@ public:
     f_new_nanocube_type       _f_new_nanocube;
 
     Timestamp                 _latest_at { -1 };
+    SlidingWindowID           _latest_id { -1 };
     
-    //
-    nanocube_type_ptr         _cubes[2]; // active vs. previous.
-    SlidingWindowID           _window_ids[2] { -1, -1 };
-    int                       _parity { 0 };
+    // window w lives on slot w % num_cubes
+    std::vector<nanocube_type_ptr> _cubes;
+    std::vector<SlidingWindowID>    _window_ids; // -1: empty slot
+    std::vector<std::unique_ptr<slab::Arena>> _arenas;
 };
 
 
@@ -671,52 +927,68 @@ public:
 template <typename nanocube_type>
 SlidingCubeManager<nanocube_type>::SlidingCubeManager(Timestamp base,
                                                       Duration window_size,
+                                                      int num_cubes,
                                                       f_new_nanocube_type f_new):
-_base{base}, _window_size{window_size}, _f_new_nanocube(f_new)
-{}
+_base{base}, _window_size{window_size}, _f_new_nanocube(f_new),
+_cubes(std::max(1, num_cubes)), _window_ids(std::max(1, num_cubes), -1)
+{
+    for (int s=0;s<(int)_cubes.size();++s)
+        _arenas.emplace_back(new slab::Arena());
+}
 
 template <typename nanocube_type>
-void SlidingCubeManager<nanocube_type>::apply(f_visit_type f) {
-    if (current_id() >= 0)
-        f(current_cube());
-    if (previous_id() >= 0)
-        f(previous_cube());
+SlidingCubeManager<nanocube_type>::~SlidingCubeManager() {
+    for (int s=0;s<(int)_cubes.size();++s)
+        drop(s);
+}
+
+template <typename nanocube_type>
+std::vector<nanocube_type*> SlidingCubeManager<nanocube_type>::cubes() const {
+    std::vector<nanocube_type*> result;
+    auto num_cubes = (SlidingWindowID) _cubes.size();
+    for (auto window_id = std::max((SlidingWindowID) 0, _latest_id - num_cubes + 1); window_id <= _latest_id; ++window_id) {
+        auto s = slot(window_id);
+        if (_window_ids[s] == window_id)
+            result.push_back(_cubes[s].get());
+    }
+    return result;
 }
 
 template <typename nanocube_type>
 nanocube_type* SlidingCubeManager<nanocube_type>::at(Timestamp timestamp) {
     _latest_at = std::max(_latest_at, timestamp);
     auto window_id = id(timestamp);
-    auto curr_id   = current_id();
-    if (window_id == curr_id) {
-        return &current_cube();
-    }
-    else if (window_id == previous_id()) {
-        return &previous_cube();
-    }
-    else if (window_id == curr_id-1) {
-        // set previous cube
-        previous_cube(nanocube_type_ptr{ _f_new_nanocube() }); // reset previous cube
-        previous_id(curr_id - 1);
-        return &previous_cube();
-    }
-    else if (window_id == curr_id+1) {
-        _parity = 1 - _parity;
-        current_cube(nanocube_type_ptr{ _f_new_nanocube() }); // reset previous cube
-        current_id(window_id);
-        return &current_cube();
-    }
-    else if (window_id > curr_id+1) {
-        current_cube(nanocube_type_ptr{ _f_new_nanocube() });
-        current_id(window_id);
-        previous_cube(nanocube_type_ptr{});
-        previous_id(-1);
-        return &current_cube();
+    auto num_cubes = (SlidingWindowID) _cubes.size();
+    if (window_id < 0) {
+        return nullptr;
     }
-    else {
+    else if (window_id > _latest_id) {
+        // the ring moves forward: windows that fall out of it are dropped
+        for (int s=0;s<(int)_cubes.size();++s) {
+            if (_window_ids[s] >= 0 && _window_ids[s] <= window_id - num_cubes)
+                drop(s);
+        }
+        _latest_id = window_id;
+    }
+    else if (window_id <= _latest_id - num_cubes) {
         // out of reach (point is too old)
         return nullptr;
     }
+    auto s = slot(window_id);
+    if (_window_ids[s] != window_id) {
+        slab::ArenaScope scope(*_arenas[s]);
+        _cubes[s].reset(_f_new_nanocube());
+        _window_ids[s] = window_id;
+    }
+    return _cubes[s].get();
+}
+
+template <typename nanocube_type>
+void SlidingCubeManager<nanocube_type>::drop(int slot) {
+    if (_cubes[slot] && _arenas[slot]->release())
+        _cubes[slot]->abandon(); // its nodes went with the arena
+    _cubes[slot].reset();
+    _window_ids[slot] = -1;
 }
 
 //------------------------------------------------------------------------------
@@ -775,7 +1047,8 @@ private: // Private Methods
 
 public: // Public Methods
     
-    void serveQuery(Request &request, ::nanocube::lang::Program &program);
+    void serveQuery(Request &request, const QueryPlan &plan,
+                    ::collector_heap::Mode mode=::collector_heap::NO_COLLECTOR);
     // void serveQuery     (Request &request, bool json, bool compression);
 
     void serveTimeQuery (Request &request, bool json, bool compression);
@@ -785,6 +1058,10 @@ public: // Public Methods
     void serveTiming    (Request &request);
     void serveVersion   (Request &request);
     void serveShutdown  (Request &request);
+    void serveCacheStats(Request &request);
+    
+    void serveQueueStats(Request &request);
+    void serveBatch     (Request &request);
     //    void serveRegister  (Request &request);
 
 public:
@@ -797,16 +1074,42 @@ public:
     
     void logMessage(std::string s);
     
-    void cacheMask(const std::string& key, ::query::Mask* mask);
+    // plans are cached by request string
+    QueryPlanPtr getCachedQueryPlan(const std::string& request_string);
+    QueryPlanPtr compileQueryPlan(const std::string& request_string, const ::nanocube::lang::Program &program);
 
 private:
     
     void parse_program_into_query(const ::nanocube::lang::Program &program,
                                   AnnotatedSchema           &annotated_schema,
-                                  ::query::QueryDescription &query_description,
-                                  OutputEncoding &output_encoding,
-                                  BranchTargetOnTime &branch_target_on_time,
-                                  std::vector<FormatOption> &format_options);
+                                  QueryPlan                 &plan);
+    
+    // run the query on the served cube(s)
+    template <typename Result>
+    void runQuery(const ::query::QueryDescription &query_description, Result &result, ::nanocube::query::Budget &budget);
+    
+    // budget of a query: the server limits, the plan's timeout if it is
+    // shorter, and cancellation once nobody waits for the response
+    ::nanocube::query::Budget queryBudget(const QueryPlan &plan, const std::atomic<bool> *cancelled);
+    
+    // run a plan on the cube (throws ::nanocube::query::QueryAborted
+    // when the budget runs out)
+    void traverseQuery(const QueryPlan &plan, ::collector_heap::Mode mode, ::nanocube::query::Budget &budget, QueryCells &cells);
+    
+    // names of the result layers of a plan (throws if it anchors on
+    // time without a multi-target)
+    void levelNames(const QueryPlan &plan, ::collector_heap::Mode mode, std::vector<std::string> &level_names);
+    
+    // run count plans that only differ on the dive target of dimension
+    // on one traversal (see ::query::result::FanOutResult)
+    void traverseFanOut(const std::vector<const QueryPlan*> &plans, int dimension, ::nanocube::query::Budget &budget, const std::vector<QueryCells*> &cells);
+    
+    // write the result of traverseQuery to output (the cube is not read)
+    void encodeQuery(const QueryPlan &plan, ::collector_heap::Mode mode, QueryCells &cells, QueryOutput &output);
+    
+    // answer the queries of a batch from the result cache at version or
+    // traverse them (with the cube locked by the caller)
+    void traverseBatch(std::vector<BatchQuery> &batch, std::uint64_t version, const std::atomic<bool> *cancelled);
 
 public: // Data Members
     
@@ -823,6 +1126,8 @@ public: // Data Members
         std::unique_ptr<sliding_mgr_type> mgr_p;
         ReadTimestamp                     read_ts;
         bool                              active;
+        int                               query_threads { 1 }; // cubes queried at once
+        std::unique_ptr<::task_pool::TaskPool> pool;        // query_threads - 1 helpers
     } sliding;
     
     Schema       &schema;
@@ -837,7 +1142,21 @@ public: // Data Members
 
     boost::shared_mutex       shared_mutex; // one writer multiple readers
     
-    MaskCache mask_cache;
+    ::mask_cache::MaskCache mask_cache;
+    int                     mask_threads { 1 }; // of a polygon cover
+    
+    ::mask_store::MaskStore mask_store; // precompiled regions
+    
+    std::mutex     plan_cache_mutex;
+    QueryPlanCache plan_cache;
+    
+    // bumped after every inserted batch: results cached on an older
+    // version are stale
+    std::atomic<std::uint64_t>  cube_version { 0 };
+    ::result_cache::ResultCache result_cache;
+    
+    // admission of the queries that reach the cube
+    ::scheduler::Scheduler scheduler;
 
 
 private:
@@ -888,16 +1207,51 @@ NanocubeServer::NanocubeServer(Schema &schema, Options &options, std::istream &i
     // initialize accordingly...
     //
     
+    plan_cache.setBudget((std::size_t) std::max(0, options.plan_cache_size.getValue()));
+    
+    mask_threads = options.mask_threads.getValue();
+    if (mask_threads <= 0)
+        mask_threads = std::max(1, (int) std::thread::hardware_concurrency());
+    if (options.mask_store.isSet()) {
+        mask_store.open(options.mask_store.getValue());
+        addMessage("mask store: " + std::to_string(mask_store.size()) + " regions\n");
+    }
+    result_cache.setBudget((std::size_t) std::max(0, options.result_cache_budget.getValue()) << 20);
+    mask_cache.setBudget((std::size_t) std::max(0, options.mask_cache_budget.getValue()) << 20);
+    
+    {
+        auto threads     = std::max(1, options.no_mongoose_threads.getValue());
+        auto heavy_slots = options.heavy_queries.getValue();
+        auto heavy_queue = options.heavy_queue.getValue();
+        if (heavy_slots == 0)
+            heavy_slots = std::max(1, threads / 2);
+        // waiting heavy queries hold a thread each: keep one for cheap queries
+        if (heavy_queue == -2)
+            heavy_queue = std::max(0, threads - heavy_slots - 1);
+        scheduler.configure(options.heavy_query_cost.getValue(), heavy_slots, heavy_queue);
+    }
+    
     auto sliding_window_size = (Duration) options.sliding.getValue();
     sliding.active = sliding_window_size > 0;
     
+    if (options.insert_threads.getValue() > 1 && sliding.active) {
+        throw std::runtime_error("--insert-threads cannot be combined with --sliding-window");
+    }
+    
     if (!sliding.active) {
         plain_nanocube.reset(new NanoCube(schema));
     }
     else {
         // set mgr
         f_new_nanocube_type f_new = [&schema]() { return new nanocube_type(schema); };
-        sliding.mgr_p.reset(new sliding_mgr_type { 0, sliding_window_size, f_new } );
+        if (options.sliding_cubes.getValue() < 1)
+            throw std::runtime_error("--sliding-cubes must be at least 1");
+        sliding.mgr_p.reset(new sliding_mgr_type { 0, sliding_window_size, options.sliding_cubes.getValue(), f_new } );
+        sliding.query_threads = options.sliding_threads.getValue();
+        if (sliding.query_threads <= 0)
+            sliding.query_threads = std::max(1, (int) std::thread::hardware_concurrency());
+        if (sliding.query_threads > 1)
+            sliding.pool.reset(new ::task_pool::TaskPool(sliding.query_threads - 1));
         
         // set read_ts
         for (auto field: schema.dump_file_description.fields) {
@@ -940,7 +1294,7 @@ NanocubeServer::NanocubeServer(Schema &schema, Options &options, std::istream &i
 
     if (!finish) {
         
-        // start threads for serving queries (uses mongoose)
+        // start threads for serving queries
         std::thread http_server(&NanocubeServer::runQueryServer, this);
         
         // start thread to insert records coming from stdin
@@ -1005,88 +1359,130 @@ void NanocubeServer::stopQueryServer()
     server.stop();
 }
 
+// program of a query string: the grammar is built once per thread and
+// the program is valid until the next parse on the same thread
+static const ::nanocube::lang::Program& parseProgram(const std::string &query_string)
+{
+    static thread_local ::nanocube::lang::Parser<std::string::const_iterator> parser;
+    parser.parse(query_string.begin(), query_string.end());
+    return *parser.program;
+}
+
 void NanocubeServer::initializeQueryServer()
 {
     
     // initialize query server
     server.port = options.query_port.getValue();
     
+    server.compression.level    = std::min(9, std::max(0, options.compression_level.getValue()));
+    server.compression.min_size = (std::size_t) std::max(0, options.compression_min_size.getValue());
+    server.http_options.half_close = options.half_close.getValue();
+    
     auto &nc_server = *this;
     
-    using Handler = std::function<void(Request& request, ::nanocube::lang::Program &program)>;
+    using Handler = std::function<void(Request& request, const QueryPlan &plan)>;
     
     std::map<std::string, Handler> handlers;
     
     // schema handler
-    handlers["schema"] = [&nc_server](Request& request, ::nanocube::lang::Program &program) {
-        bool json = true;
-        if (program.findCallByName("text"))
-            json = false;
-        nc_server.serveSchema(request, json);
+    handlers["schema"] = [&nc_server](Request& request, const QueryPlan &plan) {
+        nc_server.serveSchema(request, plan.output_encoding != TEXT);
     };
     
     // topk handler
-    handlers["topk"] = [&nc_server](Request& request, ::nanocube::lang::Program &program) {
-        // nc_server.serveQuery(request, program, ::collector_heap::TOPK);
+    handlers["topk"] = [&nc_server](Request& request, const QueryPlan &plan) {
+        nc_server.serveQuery(request, plan, ::collector_heap::TOPK);
     };
     
     // topk handler
-    handlers["unique"] = [&nc_server](Request& request, ::nanocube::lang::Program &program) {
-        // nc_server.serveQuery(request, program, ::collector_heap::UNIQUE_COUNT);
+    handlers["unique"] = [&nc_server](Request& request, const QueryPlan &plan) {
+        nc_server.serveQuery(request, plan, ::collector_heap::UNIQUE_COUNT);
     };
     
     // topk handler
-    handlers["count"] = [&nc_server](Request& request, ::nanocube::lang::Program &program) {
-        nc_server.serveQuery(request, program);
+    handlers["count"] = [&nc_server](Request& request, const QueryPlan &plan) {
+        nc_server.serveQuery(request, plan);
     };
 
     // timing handler
-    handlers["timing"] = [&nc_server](Request& request, ::nanocube::lang::Program &program) {
+    handlers["timing"] = [&nc_server](Request& request, const QueryPlan &plan) {
         nc_server.serveTiming(request);
     };
 
     // version handler
-    handlers["version"] = [&nc_server](Request& request, ::nanocube::lang::Program &program) {
+    handlers["version"] = [&nc_server](Request& request, const QueryPlan &plan) {
         nc_server.serveVersion(request);
     };
 
     // shutdown handler
-    handlers["shutdown"] = [&nc_server](Request& request, ::nanocube::lang::Program &program) {
+    handlers["shutdown"] = [&nc_server](Request& request, const QueryPlan &plan) {
         nc_server.serveShutdown(request);
     };
 
+    // cache handler
+    handlers["cache"] = [&nc_server](Request& request, const QueryPlan &plan) {
+        nc_server.serveCacheStats(request);
+    };
+
+    // queue handler
+    handlers["queue"] = [&nc_server](Request& request, const QueryPlan &plan) {
+        nc_server.serveQueueStats(request);
+    };
+
+    // batch handler
+    handlers["batch"] = [&nc_server](Request& request, const QueryPlan &plan) {
+        nc_server.serveBatch(request);
+    };
+
     // register handler
-    // handlers["register"] = [&nc_server](Request& request, ::nanocube::lang::Program &program) {
+    // handlers["register"] = [&nc_server](Request& request, const QueryPlan &plan) {
     //     nc_server.serveRegister(request);
     // };
     
     // topk handler
-    handlers["words"] = [&nc_server](Request& request, ::nanocube::lang::Program &program) {
-        // nc_server.serveWords(request, program);
+    handlers["words"] = [&nc_server](Request& request, const QueryPlan &plan) {
+        // nc_server.serveWords(request, plan);
     };
     
     // topk handler
-    handlers["ids"] = [&nc_server](Request& request, ::nanocube::lang::Program &program) {
-        // nc_server.serveIds(request, program);
+    handlers["ids"] = [&nc_server](Request& request, const QueryPlan &plan) {
+        // nc_server.serveIds(request, plan);
     };
     
     
     // std::string command("query.a(0,find([],2)).a(1,find([],1)).a(2,find([],1))");
     auto handler = [&nc_server, handlers](Request &request) {
+        auto plan = nc_server.getCachedQueryPlan(request.request_string);
+        if (!plan) {
+            const ::nanocube::lang::Program *program = nullptr;
+            try {
+                program = &parseProgram(request.request_string);
+            }
+            catch (...) {
+                // request.respond
+                return;
+            }
+            try {
+                plan = nc_server.compileQueryPlan(request.request_string, *program);
+            }
+            catch (std::runtime_error &e) {
+                request.respondText(e.what());
+                return;
+            }
+            catch (...) {
+                request.respondText("ooops");
+                return;
+            }
+        }
+        
         try {
-            //
-            ::nanocube::lang::Parser<std::string::const_iterator> parser;
-            parser.parse(request.request_string.begin(), request.request_string.end());
-            
             // route program to right handler based on the program name
-            ::nanocube::lang::Program &program = *parser.program;
-            
-            auto it = handlers.find(program.name);
+            auto it = handlers.find(plan->name);
             if (it == handlers.end()) {
                 request.respondText("error");
             }
             else {
-                it->second(request, program);
+                it->second(request, *plan);
             }
         }
         catch (...) {
@@ -1179,19 +1575,86 @@ void NanocubeServer::insert_from_stdin()
     auto plain_nc    = plain_nanocube.get(); // if sliding.active this is null
     auto sliding_mgr = sliding.mgr_p.get();
     
+    //
+    // bulk load: sort the whole input by time first so that every
+    // time series is appended in order (no out of order inserts) and
+    // records close in space and time are inserted together
+    //
+    std::unique_ptr<external_sort::ExternalSorter> sorter;
+    if (options.bulk_load.getValue() > 0) {
+        std::vector<external_sort::KeyField> key;
+        for (auto field: schema.dump_file_description.fields) {
+            if (field->field_type.name.find("nc_dim_time_") == 0) {
+                key.insert(key.begin(), external_sort::KeyField(field->offset_inside_record, field->getNumBytes()));
+            }
+            else if (field->field_type.name.find("nc_dim_quadtree_") == 0) {
+                // x and y coordinates
+                auto half = field->getNumBytes() / 2;
+                key.push_back(external_sort::KeyField(field->offset_inside_record, half));
+                key.push_back(external_sort::KeyField(field->offset_inside_record + half, half));
+            }
+            else if (field->field_type.name.find("nc_dim_") == 0) {
+                key.push_back(external_sort::KeyField(field->offset_inside_record, field->getNumBytes()));
+            }
+        }
+        
+        const char *tmp_dir = std::getenv("TMPDIR");
+        sorter.reset(new external_sort::ExternalSorter(record_size, key,
+                                                       (std::size_t) options.bulk_load.getValue() << 20,
+                                                       tmp_dir ? tmp_dir : "/tmp"));
+        auto num_records = sorter->sort(input_stream, maximum);
+        
+        std::stringstream ss;
+        ss << "(sort      ) count: " << std::setw(10) << num_records
+        << " runs: " << std::setw(6) << sorter->numRuns()
+        << " mem. res: " << std::setw(10) << memory_util::MemInfo::get().res_MB() << "MB."
+        << " time(s): " <<  std::setw(10) << sw.timeInSeconds() << std::endl;
+        addMessage(ss.str());
+    }
+    
     std::uint64_t current_record { 0 };
     
     while (!done) {
 
         //std::cerr << "reading " << num_bytes_per_batch << "...";
-        input_stream.read(&buffer[0],num_bytes_per_batch);
-        
-        //std::cerr << " gcout..." << std::endl;
-        auto read_bytes = input_stream.gcount();
+        std::streamsize read_bytes = 0;
+        if (sorter) {
+            read_bytes = sorter->read(&buffer[0], batch_size) * record_size;
+        }
+        else {
+            input_stream.read(&buffer[0],num_bytes_per_batch);
+            
+            //std::cerr << " gcout..." << std::endl;
+            read_bytes = input_stream.gcount();
+        }
         //std::cerr << " " << read_bytes << " were read" << std::endl;
         
         // write a batch of points
-        if (read_bytes > 0)
+        if (read_bytes > 0 && current_record == 0 && options.insert_threads.getValue() > 1)
+        {
+            // first batch on an empty nanocube: build it in parallel
+            std::vector<nanocube_type::record_type> records;
+            records.reserve(batch_size);
+            imemstream ss(&buffer[0], read_bytes);
+            for (int i=0;i<batch_size && !done;++i)
+            {
+                ++current_record;
+                records.push_back(nanocube_type::record_type());
+                if (!nanocube_type::mountRecordFromStream(records.back(), ss)) {
+                    records.pop_back();
+                    done = true;
+                }
+                else {
+                    ++inserted_points;
+                    done = (maximum && inserted_points == (uint64_t) maximum);
+                }
+            }
+
+            auto num_threads = options.insert_threads.getValue();
+            boost::unique_lock<boost::shared_mutex> lock(shared_mutex);
+            plain_nc->bulkAdd(records, num_threads);
+        }
+        else if (read_bytes > 0)
         {
             imemstream ss(&buffer[0], read_bytes);
             boost::unique_lock<boost::shared_mutex> lock(shared_mutex);
@@ -1211,6 +1674,7 @@ void NanocubeServer::insert_from_stdin()
                     auto nc = sliding_mgr->at(timestamp);
                     
                     if (nc) {
+                        slab::ArenaScope scope(sliding_mgr->arena(timestamp));
                         ok = nc->add(ss);
                     }
                     else {
@@ -1234,6 +1698,9 @@ void NanocubeServer::insert_from_stdin()
         else if (read_bytes == 0) {
             break;
         }
+        
+        // the batch is in: results cached before it are stale
+        ++cube_version;
 
         // shared_mutex.
         if (options.sleep_for_ns.getValue() == 0) {
@@ -1256,10 +1723,16 @@ void NanocubeServer::insert_from_stdin()
 
 
     if (inserted_points > 0) {
+        auto mem_info = memory_util::MemInfo::get();
+        auto ms       = std::max(1, sw.time());
         std::stringstream ss;
         ss << "(stdin:done) count: " << std::setw(10) << inserted_points
-        << " mem. res: " << std::setw(10) << memory_util::MemInfo::get().res_MB() << "MB."
-        << " time(s): " <<  std::setw(10) << sw.timeInSeconds() << std::endl;
+        << " mem. res: " << std::setw(10) << mem_info.res_MB() << "MB."
+        << " time(s): " <<  std::setw(10) << sw.timeInSeconds()
+        << " rate(rec/s): " << std::setw(10) << (uint64_t) (inserted_points * 1000.0 / ms)
+        << " peak res: " << std::setw(10) << mem_info.peak_res_MB() << "MB."
+        << " slabs: " << std::setw(10) << mem_info.slab_reserved_MB() << "MB."
+        << " slab overhead: " << std::setw(6) << mem_info.slab_overhead_MB() << "MB." << std::endl;
         addMessage(ss.str());
     }
 }
@@ -1591,21 +2064,72 @@ void NanocubeServer::parse(std::string              query_st,
 // void NanocubeServer::serveQuery(Request &request, bool json, bool compression)
 
 
-void NanocubeServer::cacheMask(const std::string& key, ::query::Mask* mask)
+// what the plan selects and how its response is encoded, so that the
+// spellings of a query (names or indices of dimensions, tile2d(...) or
+// the path of the same address, the order of its calls) share their
+// cached response
+static std::string resultKey(const QueryPlan &plan)
+{
+    std::stringstream ss;
+    ss << plan.name << ';' << (int) plan.output_encoding << ';';
+    if (plan.name == "topk")
+        ss << plan.k << ';';
+    if (plan.branch_target_on_time.active)
+        ss << 't';
+    for (auto &format_option: plan.format_options)
+        ss << (int) format_option.type;
+    ss << ';';
+    plan.query_description.writeKey(ss);
+    return ss.str();
+}
+
+auto NanocubeServer::getCachedQueryPlan(const std::string& request_string) -> QueryPlanPtr
+{
+    std::lock_guard<std::mutex> lock(plan_cache_mutex);
+    auto plan_ptr = plan_cache[request_string];
+    return plan_ptr ? *plan_ptr : QueryPlanPtr();
+}
+
+auto NanocubeServer::compileQueryPlan(const std::string& request_string, const ::nanocube::lang::Program &program) -> QueryPlanPtr
 {
-    this->mask_cache.insert(key,mask);
-    if (mask_cache.size() > (std::size_t)(1.2 * options.mask_cache_budget.getValue())) {
-        mask_cache.enforce_budget();
+    std::shared_ptr<QueryPlan> plan(new QueryPlan());
+    plan->name = program.name;
+    
+    AnnotatedSchema annotated_schema(schema);
+    parse_program_into_query(program, annotated_schema, *plan);
+    plan->cost = plan->query_description.estimatedCost();
+    plan->key  = resultKey(*plan);
+    
+    QueryPlanPtr result(plan);
+    
+    // a cached plan would pin its masks past the budget of the mask
+    // cache, which already makes compiling it again cheap
+    if (plan_cache.budget == 0 || !plan->masks.empty())
+        return result;
+    
+    std::lock_guard<std::mutex> lock(plan_cache_mutex);
+    // another thread might have compiled the same query in the meantime
+    auto plan_ptr = plan_cache[request_string];
+    if (plan_ptr) {
+        return *plan_ptr;
+    }
+    plan_cache.insert(request_string, new QueryPlanPtr(result));
+    if (plan_cache.size() > (std::size_t)(1.2 * plan_cache.budget)) {
+        plan_cache.enforce_budget();
     }
+    return result;
 }
 
 void NanocubeServer::parse_program_into_query(const ::nanocube::lang::Program &program,
                                               AnnotatedSchema           &annotated_schema,
-                                              ::query::QueryDescription &query_description,
-                                              OutputEncoding &output_encoding,
-                                              BranchTargetOnTime &branch_target_on_time,
-                                              std::vector<FormatOption> &format_options)
+                                              QueryPlan                 &plan)
 {
+    auto &query_description     = plan.query_description;
+    auto &output_encoding       = plan.output_encoding;
+    auto &branch_target_on_time = plan.branch_target_on_time;
+    auto &format_options        = plan.format_options;
+    auto &masks                 = plan.masks;
+    
     // default values
     output_encoding       = JSON;
     branch_target_on_time.active = false;
@@ -1773,17 +2297,15 @@ void NanocubeServer::parse_program_into_query(const ::nanocube::lang::Program &p
 
                 std::string key = std::string("mask_level") + std::to_string(level) + std::string("_") + code;
 
-                auto mask = mask_cache[key];
-                if (!mask) {
-                    mask = ::polycover::labeled_tree::load_from_code(code);
+                auto mask = that.mask_cache.get(key, [&]() -> ::query::Mask* {
+                    auto new_mask = ::polycover::labeled_tree::load_from_code(code);
                     if (level > 0)
-                        mask->trim(level);
-
-                    
-                    that.cacheMask(key, mask);
-                }
+                        new_mask->trim(level);
+                    return new_mask;
+                });
                 
-                query_description.setMaskTarget(dimension_index, mask);
+                masks.push_back(mask);
+                query_description.setMaskTarget(dimension_index, mask->mask.get(), &mask->intervals, key);
             }
             else if (call.name.compare("degrees_mask") == 0 || call.name.compare("mercator_mask") == 0) {
                 
@@ -1798,16 +2320,14 @@ void NanocubeServer::parse_program_into_query(const ::nanocube::lang::Program &p
                 std::string prefix = degrees ? std::string("degrees_mask") : std::string("mercator_mask");
                 std::string key = prefix + std::string("_level") + std::to_string(level) + std::string("_") + points_st;
                 
-                auto mask = mask_cache[key];
-                if (!mask) {
-                    
+                auto mask = that.mask_cache.get(key, [&]() -> ::query::Mask* {
                     // split on the commas x0,y0,x1,y1,x2,y2;x0,y0,x1,y1,x2,y2;
                     std::stringstream ss(points_st);
                     std::string contour_st;
-                    
+                
                     // polygons
                     std::vector<polycover::Polygon> polygons;
-                    
+                
                     // sstd::vector<polycover::
                     while (std::getline(ss,contour_st,';')) {
                         std::stringstream ss2(contour_st);
@@ -1824,28 +2344,25 @@ void NanocubeServer::parse_program_into_query(const ::nanocube::lang::Program &p
                             else {
                                 parity = 0;
                                 y = std::stof(coord_st);
-                                
+                            
                                 // convert to mercator
                                 if (degrees) {
                                     x = x / 180.0;
                                     auto lat_rad = (y * M_PI/180.0);
                                     y = std::log(std::tan(lat_rad/2.0 + M_PI/4.0)) / M_PI;
                                 }
-                                
+                            
                                 poly.points.push_back({x,y});
                             }
                         }
                         poly.makeItCW(); // make sure it is clock-wise before running the compute cover
                     }
-                    
-                    // TODO: caching and memory release of masks...
-                    mask = ::polycover::TileCoverEngine(level,8).computeCover(polygons);
-                    
-                    // insert on the cache
-                    that.cacheMask(key, mask);
-                }
+                
+                    return ::polycover::TileCoverEngine(level, 8, that.mask_threads).computeCover(polygons);
+                });
 
-                query_description.setMaskTarget(dimension_index, mask);
+                masks.push_back(mask);
+                query_description.setMaskTarget(dimension_index, mask->mask.get(), &mask->intervals, key);
                 
             }
             else if (call.name.compare("region") == 0) {
@@ -1862,42 +2379,45 @@ void NanocubeServer::parse_program_into_query(const ::nanocube::lang::Program &p
                 
                 std::string key = std::string("region") + std::string("_level") + std::to_string(level) + std::string("_") + region_path;
                 
-                auto mask = mask_cache["key"];
-
-                if (!mask) {
-
-                    // TODO: get environment variable NANOCUBE_REGIONS
-                    std::string nanocube_regions_path(std::getenv("NANOCUBE_REGIONS"));
-                    // std::string nanocube_regions_path("/Users/llins/tests/polycover/data/geofences");
+                // precompiled: traversed right on the mapped store
+                if (auto packed = that.mask_store.find(region_path)) {
+                    query_description.setMaskTarget(dimension_index, packed->root(level), key);
+                }
+                else {
+                    auto mask = that.mask_cache.get(key, [&]() -> ::query::Mask* {
+                        // TODO: get environment variable NANOCUBE_REGIONS
+                        std::string nanocube_regions_path(std::getenv("NANOCUBE_REGIONS"));
+                        // std::string nanocube_regions_path("/Users/llins/tests/polycover/data/geofences");
                     
-                    // append .ttt.gz and check if file exists
-                    std::string path = nanocube_regions_path + region_path + ".ttt";
-                    std::ifstream f(path);
+                        // append .ttt.gz and check if file exists
+                        std::string path = nanocube_regions_path + region_path + ".ttt";
+                        std::ifstream f(path);
                     
-                    if (!f.good()) {
-                        throw std::runtime_error("could not find region " + region_path);
-                    }
+                        if (!f.good()) {
+                            throw std::runtime_error("could not find region " + region_path);
+                        }
 
-                    // TODO: make it more efficient
+                        // TODO: make it more efficient
                     
-                    polycover::labeled_tree::Parser parser;
-                    parser.signal.connect([&mask, &level](const std::string& name, const polycover::labeled_tree::Node &node) {
-                        std::stringstream ss;
-                        ss << node;
-                        mask = polycover::labeled_tree::load_from_code(ss.str());
-                        if (level > 0) {
-                            mask->trim(level);
-                        }
+                        ::query::Mask *new_mask = nullptr;
+                        polycover::labeled_tree::Parser parser;
+                        parser.signal.connect([&new_mask, &level](const std::string& name, const polycover::labeled_tree::Node &node) {
+                            std::stringstream ss;
+                            ss << node;
+                            new_mask = polycover::labeled_tree::load_from_code(ss.str());
+                            if (level > 0) {
+                                new_mask->trim(level);
+                            }
+                        });
+                        parser.run(f,1);
+
+                        return new_mask;
                     });
-                    parser.run(f,1);
-                    
-                    // insert on the cache
-                    that.cacheMask(key, mask);
-                    
+
+                    masks.push_back(mask);
+                    query_description.setMaskTarget(dimension_index, mask->mask.get(), &mask->intervals, key);
                 }
                 
-                query_description.setMaskTarget(dimension_index, mask);
-                
             }
             
             
@@ -1987,6 +2507,37 @@ void NanocubeServer::parse_program_into_query(const ::nanocube::lang::Program &p
             else
                 query_description.setAnchor(dim, no_anchor);
         }
+        else if (call.name.compare("var") == 0) {
+            // measures to aggregate: names (or positions) of nc_var
+            // fields; all of them if no parameter is given
+            std::vector<std::string> names;
+            for (auto field: annotated_schema.schema.dump_file_description.fields) {
+                if (field->field_type.name.find("nc_var") == 0)
+                    names.push_back(field->name);
+            }
+            
+            std::vector<int> variables;
+            if (call.params.size() == 0) {
+                for (int i=0;i<(int)names.size();++i)
+                    variables.push_back(i+1); // entry variable 0 is time
+            }
+            for (auto param: call.params) {
+                int position = -1;
+                if (param->type == NUMBER) {
+                    position = get_number(param);
+                }
+                else {
+                    auto name = get_string(param);
+                    position = (int) (std::find(names.begin(), names.end(), name) - names.begin());
+                }
+                if (position < 0 || position >= (int) names.size())
+                    throw std::runtime_error("Found no variable for var(...) parameter");
+                variables.push_back(position+1);
+            }
+            if (variables.empty())
+                throw std::runtime_error("Schema has no variables");
+            query_description.setVariables(variables);
+        }
         else if (call.name.compare("text") == 0) {
             output_encoding = TEXT;
         }
@@ -1996,6 +2547,21 @@ void NanocubeServer::parse_program_into_query(const ::nanocube::lang::Program &p
         else if (call.name.compare("bin") == 0) {
             output_encoding = BINARY;
         }
+        else if (call.name.compare("bin2") == 0) {
+            output_encoding = BINARY_COLUMNS;
+        }
+        else if (call.name.compare("k") == 0) {
+            // topk.k(<k>): only the k cells with the largest value
+            if (call.params.size() != 1 || call.params[0]->type != NUMBER)
+                throw std::runtime_error("k(...) expects one number");
+            plan.k = get_number(call.params[0]);
+        }
+        else if (call.name.compare("timeout") == 0) {
+            // timeout(<ms>): abort the query after ms milliseconds
+            if (call.params.size() != 1 || call.params[0]->type != NUMBER || get_number(call.params[0]) <= 0)
+                throw std::runtime_error("timeout(...) expects a positive number of milliseconds");
+            plan.timeout = get_number(call.params[0]);
+        }
         call_p = call_p->next_call;
     }
 }
@@ -2006,130 +2572,337 @@ void NanocubeServer::parse_program_into_query(const ::nanocube::lang::Program &p
 // serveQuery
 //
 
-void NanocubeServer::serveQuery(Request &request, ::nanocube::lang::Program &program)
+static void respondWithEntry(Request &request, ::result_cache::ContentType content_type, const std::string &body)
 {
-    boost::unique_lock<boost::shared_mutex> lock(shared_mutex);
+    if (content_type == ::result_cache::JSON)
+        request.respondJson(body);
+    else if (content_type == ::result_cache::TEXT)
+        request.respondText(body);
+    else
+        request.respondOctetStream(body.c_str(), body.size());
+}
 
-    auto process = [&]() {
-        
-        ::query::QueryDescription query_description;
-        
-        AnnotatedSchema annotated_schema(schema);
-        
-        OutputEncoding output_encoding = JSON;
-        
-        BranchTargetOnTime branch_target_on_time_dimension;
-        
-        std::vector<FormatOption> format_options(::query::QueryDescription::MAX_DIMENSIONS);
+template <typename Result>
+void NanocubeServer::runQuery(const ::query::QueryDescription &query_description, Result &result, ::nanocube::query::Budget &budget)
+{
+    if (!sliding.active) {
+        plain_nanocube->query(query_description, result, budget);
+    }
+    else {
+        // the cubes of a sliding window hold disjoint records: each one
+        // can be queried on its own thread and the parts added up
+        auto cubes       = sliding.mgr_p->cubes();
+        auto num_workers = std::min((std::size_t) sliding.query_threads, cubes.size());
+        if (num_workers <= 1 || !sliding.pool) {
+            for (auto nc: cubes)
+                nc->query(query_description, result, budget);
+            return;
+        }
         
-        parse_program_into_query( program,
-                                  annotated_schema,
-                                  query_description,
-                                  output_encoding,
-                                  branch_target_on_time_dimension,
-                                  format_options );
+        // workers pick the next cube until none is left: helpers that
+        // didn't get a pool thread by then are skipped (see TaskPool)
+        std::atomic<std::uint64_t> nodes  { 0 };
+        std::atomic<std::size_t>   next   { 0 };
+        std::atomic<bool>          failed { false };
+        std::vector<Result> parts;
+        for (std::size_t i=1;i<num_workers;++i)
+            parts.push_back(result.part());
+        sliding.pool->run((int) num_workers - 1, [&](int worker) {
+            auto &part       = worker ? parts[worker - 1] : result;
+            auto part_budget = budget.fork(&nodes);
+            try {
+                for (auto i = next++; i < cubes.size() && !failed.load(); i = next++)
+                    cubes[i]->query(query_description, part, part_budget);
+            }
+            catch (...) {
+                failed.store(true);
+                throw;
+            }
+        });
+        for (auto &part: parts)
+            result.merge(part);
+    }
+}
+
+::nanocube::query::Budget NanocubeServer::queryBudget(const QueryPlan &plan, const std::atomic<bool> *cancelled)
+{
+    int timeout = std::max(0, options.query_timeout.getValue());
+    if (plan.timeout > 0 && (timeout == 0 || plan.timeout < timeout))
+        timeout = plan.timeout;
+    return ::nanocube::query::Budget(std::chrono::milliseconds(timeout),
+                                     (std::uint64_t) std::max(0, options.query_max_nodes.getValue()),
+                                     cancelled);
+}
+
+void NanocubeServer::serveQuery(Request &request, const QueryPlan &plan, ::collector_heap::Mode mode)
+{
+    // a query already answered on this version of the cube is served
+    // from the result cache without touching the cube
+    bool cache_result = result_cache.enabled();
+    if (cache_result) {
+        auto entry = result_cache.get(plan.key, cube_version.load());
+        if (entry) {
+            respondWithEntry(request, entry->content_type, entry->body);
+            return;
+        }
+    }
+    
+    // heavy queries wait for a slot, or are shed, before they touch the
+    // cube: cheap ones never queue behind them
+    ::scheduler::Ticket ticket;
+    try {
+        ticket = scheduler.admit(plan.cost, request.cancelled());
+    } catch (::scheduler::Rejected &e) {
+        request.respondError(503, e.what());
+        return;
+    }
+    
+    // cells stay on arrays reused by the next queries of this thread
+    static thread_local QueryCells cells;
+    
+    std::uint64_t version = 0;
+    try {
+        // queries are read-only: many of them can run at the same time
+        boost::shared_lock<boost::shared_mutex> lock(shared_mutex);
         
-        //
-        // it will be tricky to translate the multi_target aspect of the query
-        //
+        // batches bump the version once they are in, so the result is at
+        // least as recent as this version
+        version = cube_version.load();
         
-        // count number of anchored flags
-        int num_anchored_dimensions = 0;
-        std::vector<int> anchored_dimensions;
-        {
-            int i = 0;
-            for (auto flag: query_description.anchors) {
-                if (flag) {
-                    num_anchored_dimensions++;
-                    anchored_dimensions.push_back(i);
-                }
-                ++i;
+        auto budget = queryBudget(plan, request.cancelled());
+        traverseQuery(plan, mode, budget, cells);
+    } catch (::nanocube::query::QueryAborted &e) {
+        ticket = ::scheduler::Ticket();
+        request.respondError(504, e.what());
+        return;
+    } catch (std::runtime_error &e) {
+        ticket = ::scheduler::Ticket();
+        request.respondText(e.what());
+        return;
+    } catch (...) {
+        ticket = ::scheduler::Ticket();
+        request.respondText("ooops");
+        return;
+    }
+    
+    // the result is encoded once the lock and the ticket are given
+    // back: neither the encoding nor a slow client holds them
+    ticket = ::scheduler::Ticket();
+    
+    // json goes to the client as it is encoded (and to the cache if it
+    // is small enough); the other encodings are written as a whole
+    auto content_type = ::result_cache::JSON;
+    std::string body;
+    bool streamed = false;
+    
+    QueryOutput output;
+    output.json = [&](const char *data, std::size_t size, bool last) {
+        streamed = true;
+        if (cache_result && body.size() + size <= result_cache.maxEntrySize())
+            body.append(data, size);
+        else
+            cache_result = false;
+        request.respondJsonChunk(data, size, last);
+    };
+    output.body = [&](::result_cache::ContentType type, std::string &&encoded) {
+        content_type = type;
+        body         = std::move(encoded);
+    };
+    
+    try {
+        encodeQuery(plan, mode, cells, output);
+        if (!streamed)
+            respondWithEntry(request, content_type, body);
+        if (cache_result)
+            result_cache.put(plan.key, content_type, version, std::move(body));
+    } catch (std::runtime_error &e) {
+        // a response already under way cannot become an error
+        if (streamed)
+            throw;
+        request.respondText(e.what());
+    } catch (...) {
+        if (streamed)
+            throw;
+        request.respondText("ooops");
+    }
+}
+
+void NanocubeServer::levelNames(const QueryPlan &plan, ::collector_heap::Mode mode, std::vector<std::string> &level_names)
+{
+    const auto &query_description               = plan.query_description;
+    const auto &branch_target_on_time_dimension = plan.branch_target_on_time;
+    
+    AnnotatedSchema annotated_schema(schema);
+    
+    level_names.clear();
+    int i=0;
+    for (auto flag: query_description.anchors) {
+        if (flag) {
+            if (annotated_schema.dimType(i) == AnnotatedSchema::TIME) {
+                if (!branch_target_on_time_dimension.active)
+                    throw std::runtime_error("Cannot anchor on time dimension");
+                else if (mode != ::collector_heap::UNIQUE_COUNT)
+                    level_names.push_back(std::string("multi-target:") + schema.getDimensionName(i));
+            }
+            else if (mode != ::collector_heap::UNIQUE_COUNT) {
+                level_names.push_back(std::string("anchor:") + schema.getDimensionName(i));
             }
         }
+        i++;
+    }
+}
+
+void NanocubeServer::traverseQuery(const QueryPlan &plan, ::collector_heap::Mode mode, ::nanocube::query::Budget &budget, QueryCells &query_cells)
+{
+    
+    const auto &query_description = plan.query_description;
+    
+    //
+    // it will be tricky to translate the multi_target aspect of the query
+    //
+    
+    // count number of anchored flags
+    int num_anchored_dimensions = 0;
+    for (auto flag: query_description.anchors) {
+        if (flag)
+            num_anchored_dimensions++;
+    }
+    
+    levelNames(plan, mode, query_cells.level_names);
+    
+    // count queries keep their cells on the flat result until they are
+    // encoded; topk and unique ones on a tree
+    query_cells.flat = mode == ::collector_heap::NO_COLLECTOR;
+    query_cells.tree_value = ::nanocube::TreeValue(mode == ::collector_heap::UNIQUE_COUNT ? 0 : num_anchored_dimensions);
+    
+    if (query_cells.flat) {
+        query_cells.flat_result.reset(num_anchored_dimensions);
+        runQuery(query_description, query_cells.flat_result, budget);
+    }
+    else {
+        // topk: only the k cells with the largest value
+        // unique: only the number of cells
+        int k = plan.k;
         
-        // big hack
-        
-        ::nanocube::TreeValue treestore_result(num_anchored_dimensions);
+        // the cubes of a sliding window visit the same cells
+        bool stream_cells = !sliding.active && ::collector_heap::Collector::streamsCells(query_description);
         
-        ::query::result::Result result(treestore_result);
+        ::collector_heap::Collector collector(mode, k, stream_cells);
+        runQuery(query_description, collector, budget);
         
-        if (!sliding.active) {
-            plain_nanocube->query(query_description, result);
+        ::query::result::Result result(query_cells.tree_value);
+        if (mode == ::collector_heap::TOPK) {
+            for (auto &cell: collector.topK()) {
+                auto path = cell.path();
+                for (auto &label: path)
+                    result.push(label);
+                result.store(cell.value, ::tree_store::SET);
+                for (std::size_t j=0;j<path.size();++j)
+                    result.pop();
+            }
         }
         else {
-            sliding.mgr_p->apply([&query_description, &result](nanocube_type& nc) {
-                nc.query(query_description, result);
-            });
+            result.store((uint64_t) collector.uniqueCount(), ::tree_store::SET);
         }
-        
-        
-        // set level names
-        int level=0;
-        int i=0;
-        for (auto flag: query_description.anchors) {
-            if (flag) {
-                if (annotated_schema.dimType(i) == AnnotatedSchema::TIME) {
-                    if (branch_target_on_time_dimension.active)
-                        treestore_result.setLevelName(level, std::string("multi-target:") + schema.getDimensionName(i));
-                    else
-                        throw std::runtime_error("Cannot anchor on time dimension");
-                }
-                else {
-                    treestore_result.setLevelName(level, std::string("anchor:") + schema.getDimensionName(i));
-                }
-                ++level;
-            }
-            i++;
-        }
-        
-        std::stringstream ss;
-        SimpleConfig::parameter_type parameter;
-        using Writer    = ::tree_store::Writer<SimpleConfig, typename SimpleConfig::parameter_type>;
-        using LabelType = typename SimpleConfig::label_type;
-        
-        if (output_encoding == JSON) {
-            Writer writer;
-            
-            int layer = 0;
-            int dim   = 0;
-            for (auto &format_option: format_options)
-            {
-                if (query_description.anchors[dim])
-                    ++layer;
+    }
+}
 
-                if (format_option.type == FormatOption::RELATIVE_IMAGE) {
-                    using fmt_func = typename Writer::format_label_func;
-                    fmt_func f = [&format_option](const LabelType& lbl) {
-                        std::stringstream ss;
-                        auto x = lbl.at(0);
-                        auto y = lbl.at(1);
+void NanocubeServer::traverseFanOut(const std::vector<const QueryPlan*> &plans, int dimension, ::nanocube::query::Budget &budget, const std::vector<QueryCells*> &cells)
+{
+    // the plans only differ on the base of the dive on dimension: the
+    // description of the first one drives the traversal
+    const auto &query_description = plans[0]->query_description;
+    
+    int num_anchored_dimensions = 0;
+    for (auto flag: query_description.anchors) {
+        if (flag)
+            num_anchored_dimensions++;
+    }
+    
+    std::vector<::query::Target*> targets;
+    for (std::size_t i=0;i<plans.size();++i) {
+        levelNames(*plans[i], ::collector_heap::NO_COLLECTOR, cells[i]->level_names);
+        targets.push_back(plans[i]->query_description.targets[dimension]);
+    }
+    
+    ::query::result::FanOutResult result(dimension, targets, num_anchored_dimensions);
+    runQuery(query_description, result, budget);
+    
+    for (std::size_t i=0;i<plans.size();++i) {
+        cells[i]->flat        = true;
+        cells[i]->flat_result = std::move(result.members[i]);
+        cells[i]->tree_value  = ::nanocube::TreeValue(num_anchored_dimensions);
+    }
+}
+
+void NanocubeServer::encodeQuery(const QueryPlan &plan, ::collector_heap::Mode mode, QueryCells &query_cells, QueryOutput &output)
+{
+    const auto &query_description = plan.query_description;
+    const auto &output_encoding   = plan.output_encoding;
+    const auto &format_options    = plan.format_options;
+    const auto &level_names       = query_cells.level_names;
+    
+    AnnotatedSchema annotated_schema(schema);
+    
+    std::stringstream ss;
+    SimpleConfig::parameter_type parameter;
+    using Writer    = ::tree_store::Writer<SimpleConfig, typename SimpleConfig::parameter_type>;
+    using LabelType = typename SimpleConfig::label_type;
+    
+    if (output_encoding == JSON) {
+        Writer writer;
+        
+        int layer = 0;
+        int dim   = 0;
+        for (auto &format_option: format_options)
+        {
+            if (query_description.anchors[dim])
+                ++layer;
+
+            if (format_option.type == FormatOption::RELATIVE_IMAGE) {
+                using fmt_func = typename Writer::format_label_func;
+                fmt_func f = [&format_option](::json::ChunkBuffer &out, const LabelType& lbl) {
+                    auto x = lbl.at(0);
+                    auto y = lbl.at(1);
 //                        auto n = format_option.base_address.size();
 //                        auto suffix = LabelType(lbl.begin()+n,lbl.end());
 //                        ::nanocube::Tile tile(suffix);
 //                        ss << "\"x\":" << tile.x << ", " << "\"y\":" << tile.y;
-                        ss << "\"x\":" << x << ", " << "\"y\":" << y;
-                        return ss.str();
-                    };
-                    writer.setFormatLabelFunction(layer, f);
-                }
-                ++dim;
+                    out << "\"x\":";
+                    out.writeInt(x);
+                    out << ", \"y\":";
+                    out.writeInt(y);
+                };
+                writer.setFormatLabelFunction(layer, f);
             }
-            
-            
-            writer.json(treestore_result, ss, parameter);
-            
-//            ::tree_store::json(treestore_result, ss, parameter);
-            request.respondJson(ss.str());
-        }
-        else if (output_encoding == TEXT) {
-            ::tree_store::text(treestore_result, ss, parameter);
-            request.respondText(ss.str());
+            ++dim;
         }
-        else if (output_encoding == BINARY) {
+        
+        
+        // json goes to the output in chunks as it is written
+        ::json::ChunkBuffer out(output.json);
+        Writer::JsonBuilder builder(writer, out, level_names, parameter);
+        query_cells.emit(builder);
+        builder.finish();
+        out.finish();
+        
+//            ::tree_store::json(treestore_result, ss, parameter);
+    }
+    else if (output_encoding == TEXT) {
+        // the text encoding is written from a tree
+        auto &tree_value = query_cells.tree_value;
+        if (query_cells.flat)
+            query_cells.flat_result.fill(tree_value);
+        for (std::size_t level=0;level<level_names.size();++level)
+            tree_value.setLevelName((int) level, level_names[level]);
+        ::tree_store::text(tree_value, ss, parameter);
+        output.body(::result_cache::TEXT, ss.str());
+    }
+    else if (output_encoding == BINARY) {
 
-            // if the img flag was used, treat long path
-            // as a 2 entry path: local x and local y
-            
+        // if the img flag was used, treat long path
+        // as a 2 entry path: local x and local y
+        
 //            std::vector<bool> dimensions_to_transform_to_img(treestore_result.getNumLevels());
 //            std::vector<int>  base_address_sizes(treestore_result.getNumLevels());
 //            
@@ -2173,22 +2946,268 @@ void NanocubeServer::serveQuery(Request &request, ::nanocube::lang::Program &pro
 //                    }
 //                }
 //            }
-            
-            ::tree_store::serialize(treestore_result, ss);
-            const auto &text = ss.str();
-            request.respondOctetStream(text.c_str(), text.size());
-        }
         
-    };
+        // the header carries the number of measures written per value
+        ::nanocube::SimpleConfig config;
+        config.num_measures = (mode == ::collector_heap::UNIQUE_COUNT) ? 1 : query_description.variables.size();
+        ::tree_store::Serializer<SimpleConfig> serializer(ss, level_names, config);
+        query_cells.emit(serializer);
+        output.body(::result_cache::OCTET_STREAM, ss.str());
+    }
+    else if (output_encoding == BINARY_COLUMNS) {
+        std::vector<::columnar_result::LayerKind> kinds;
+        if (mode != ::collector_heap::UNIQUE_COUNT) {
+            for (std::size_t dim=0;dim<query_description.anchors.size();++dim) {
+                if (!query_description.anchors[dim])
+                    continue;
+                if (annotated_schema.dimType(dim) == AnnotatedSchema::TIME)
+                    kinds.push_back(::columnar_result::TIME_BIN);
+                else if (annotated_schema.dimType(dim) == AnnotatedSchema::CATEGORICAL)
+                    kinds.push_back(::columnar_result::CATEGORY);
+                else if (format_options[dim].type == FormatOption::RELATIVE_IMAGE)
+                    kinds.push_back(::columnar_result::IMAGE);
+                else
+                    kinds.push_back(::columnar_result::QUADTREE);
+            }
+        }
+        ::columnar_result::Encoder encoder(kinds, level_names);
+        query_cells.emit(encoder);
+        output.body(::result_cache::OCTET_STREAM, encoder.finish());
+    }
+
+}
+
+//
+// serveBatch
+//
+
+static bool queryMode(const std::string &program_name, ::collector_heap::Mode &mode)
+{
+    if (program_name == "count")
+        mode = ::collector_heap::NO_COLLECTOR;
+    else if (program_name == "topk")
+        mode = ::collector_heap::TOPK;
+    else if (program_name == "unique")
+        mode = ::collector_heap::UNIQUE_COUNT;
+    else
+        return false;
+    return true;
+}
+
+static std::string jsonString(const std::string &st)
+{
+    std::string result("\"");
+    for (auto c: st) {
+        if (c == '"' || c == '\\')
+            result.push_back('\\');
+        if (c == '\n')
+            result.append("\\n");
+        else if ((unsigned char) c >= 0x20)
+            result.push_back(c);
+    }
+    result.push_back('"');
+    return result;
+}
+
+static std::string errorItem(const std::string &message)
+{
+    return "{ \"error\":" + jsonString(message) + " }";
+}
+
+void NanocubeServer::traverseBatch(std::vector<BatchQuery> &batch, std::uint64_t version, const std::atomic<bool> *cancelled)
+{
+    AnnotatedSchema annotated_schema(schema);
     
-    try {
-        process();
-    } catch (std::runtime_error &e) {
-        request.respondText(e.what());
-    } catch (...) {
-        request.respondText("ooops");
+    std::vector<std::size_t> pending;
+    for (std::size_t i=0;i<batch.size();++i) {
+        auto &query = batch[i];
+        if (query.answered)
+            continue;
+        if (result_cache.enabled()) {
+            auto entry = result_cache.get(query.plan->key, version);
+            if (entry) {
+                query.answered = true;
+                query.json     = entry->body;
+                continue;
+            }
+        }
+        query.cells.reset(new QueryCells());
+        pending.push_back(i);
+    }
+    
+    // count queries that only differ on the base of a dive (e.g. the
+    // dive(tile2d(...)) tiles of a map under the same filters) share
+    // their traversal up to that dimension: they are grouped by the
+    // key of their description without that base
+    std::map<std::pair<int, std::string>, std::vector<std::size_t>> keys;
+    for (auto i: pending) {
+        if (batch[i].mode != ::collector_heap::NO_COLLECTOR)
+            continue;
+        const auto &query_description = batch[i].plan->query_description;
+        for (std::size_t dim=0;dim<query_description.targets.size();++dim) {
+            if (query_description.targets[dim]->type != ::query::Target::FIND_AND_DIVE ||
+                annotated_schema.dimType((int) dim) == AnnotatedSchema::TIME)
+                continue;
+            std::stringstream ss;
+            query_description.writeKey(ss, (int) dim);
+            keys[std::make_pair((int) dim, ss.str())].push_back(i);
+        }
     }
+    
+    // the largest groups first: a query is traversed once
+    std::vector<std::pair<int, std::vector<std::size_t>>> groups;
+    for (auto &it: keys) {
+        if (it.second.size() > 1)
+            groups.push_back(std::make_pair(it.first.first, std::move(it.second)));
+    }
+    std::stable_sort(groups.begin(), groups.end(), [](const std::pair<int, std::vector<std::size_t>> &a,
+                                                      const std::pair<int, std::vector<std::size_t>> &b) {
+        return a.second.size() > b.second.size();
+    });
+    
+    std::vector<bool> traversed(batch.size(), false);
+    for (auto &group: groups) {
+        std::vector<const QueryPlan*> plans;
+        std::vector<QueryCells*>      cells;
+        for (auto i: group.second) {
+            if (traversed[i])
+                continue;
+            plans.push_back(batch[i].plan.get());
+            cells.push_back(batch[i].cells.get());
+        }
+        if (plans.size() < 2)
+            continue;
+        std::string error;
+        try {
+            // the node limit is that of the queries of the group
+            auto budget = queryBudget(*plans[0], cancelled);
+            budget.max_nodes *= plans.size();
+            traverseFanOut(plans, group.first, budget, cells);
+        } catch (std::runtime_error &e) {
+            error = errorItem(e.what());
+        } catch (...) {
+            error = errorItem("ooops");
+        }
+        for (auto i: group.second) {
+            if (traversed[i])
+                continue;
+            traversed[i] = true;
+            if (!error.empty()) {
+                batch[i].answered = true;
+                batch[i].json     = error;
+            }
+        }
+    }
+    
+    for (auto i: pending) {
+        if (traversed[i])
+            continue;
+        auto &query = batch[i];
+        try {
+            auto budget = queryBudget(*query.plan, cancelled);
+            traverseQuery(*query.plan, query.mode, budget, *query.cells);
+        } catch (std::runtime_error &e) {
+            query.answered = true;
+            query.json     = errorItem(e.what());
+        } catch (...) {
+            query.answered = true;
+            query.json     = errorItem("ooops");
+        }
+    }
+}
 
+void NanocubeServer::serveBatch(Request &request)
+{
+    // one query per line of the (POST) body
+    std::vector<std::string> queries;
+    {
+        std::stringstream ss(request.content);
+        std::string line;
+        while (std::getline(ss, line)) {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (!line.empty())
+                queries.push_back(line);
+        }
+    }
+    
+    // the json responses of the queries, in order, are the items of a
+    // list: a query that fails is an { "error":<message> } item
+    std::vector<BatchQuery> batch(queries.size());
+    
+    // a batch is admitted as a whole: its cost is that of its queries
+    double cost = 0;
+    for (std::size_t i=0;i<queries.size();++i) {
+        auto &query = batch[i];
+        try {
+            auto plan = getCachedQueryPlan(queries[i]);
+            if (!plan)
+                plan = compileQueryPlan(queries[i], parseProgram(queries[i]));
+            cost += plan->cost;
+            if (!queryMode(plan->name, query.mode))
+                throw std::runtime_error("batch: only count, topk and unique queries");
+            if (plan->output_encoding != JSON)
+                throw std::runtime_error("batch: only json responses");
+            query.plan = plan;
+        } catch (std::runtime_error &e) {
+            query.answered = true;
+            query.json     = errorItem(e.what());
+        } catch (...) {
+            query.answered = true;
+            query.json     = errorItem("ooops");
+        }
+    }
+    ::scheduler::Ticket ticket;
+    try {
+        ticket = scheduler.admit(cost, request.cancelled());
+    } catch (::scheduler::Rejected &e) {
+        request.respondError(503, e.what());
+        return;
+    }
+    
+    // all the queries of the batch see the same version of the cube:
+    // it is locked once for all of them
+    std::uint64_t version = 0;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(shared_mutex);
+        version = cube_version.load();
+        traverseBatch(batch, version, request.cancelled());
+    }
+    
+    // encoded once the lock and the ticket are given back (see
+    // serveQuery), straight into the response
+    ticket = ::scheduler::Ticket();
+    
+    ::json::ChunkBuffer body([&request](const char *data, std::size_t size, bool last) {
+        request.respondJsonChunk(data, size, last);
+    });
+    body << '[';
+    for (std::size_t i=0;i<batch.size();++i) {
+        if (i > 0)
+            body << ", ";
+        auto &query = batch[i];
+        if (query.answered) {
+            body << query.json;
+            continue;
+        }
+        
+        bool cache_result = result_cache.enabled();
+        std::string json;
+        QueryOutput output;
+        output.json = [&](const char *data, std::size_t size, bool last) {
+            if (cache_result && json.size() + size <= result_cache.maxEntrySize())
+                json.append(data, size);
+            else
+                cache_result = false;
+            body.write(data, size);
+        };
+        encodeQuery(*query.plan, query.mode, *query.cells, output);
+        query.cells.reset();
+        if (cache_result)
+            result_cache.put(query.plan->key, ::result_cache::JSON, version, std::move(json));
+    }
+    body << ']';
+    body.finish();
 }
 
 void NanocubeServer::serveTile(Request &request)
@@ -2446,6 +3465,57 @@ void NanocubeServer::serveVersion(Request &request)
     request.respondJson(NANOCUBE_VERSION);
 }
 
+void NanocubeServer::serveCacheStats(Request &request)
+{
+    auto stats = result_cache.stats();
+    auto masks = mask_cache.stats();
+    std::size_t plans = 0;
+    {
+        std::lock_guard<std::mutex> lock(plan_cache_mutex);
+        plans = plan_cache.size();
+    }
+    std::stringstream ss;
+    ss << "{ \"version\":" << cube_version.load()
+       << ", \"results\":{ \"hits\":" << stats.hits
+       << ", \"misses\":" << stats.misses
+       << ", \"stale\":" << stats.stale
+       << ", \"evictions\":" << stats.evictions
+       << ", \"entries\":" << stats.entries
+       << ", \"bytes\":" << stats.bytes
+       << ", \"budget\":" << stats.budget
+       << " }, \"masks\":{ \"hits\":" << masks.hits
+       << ", \"misses\":" << masks.misses
+       << ", \"shared\":" << masks.shared
+       << ", \"evictions\":" << masks.evictions
+       << ", \"entries\":" << masks.entries
+       << ", \"bytes\":" << masks.bytes
+       << ", \"budget\":" << masks.budget
+       << " }, \"plans\":{ \"entries\":" << plans << " } }";
+    request.respondJson(ss.str());
+}
+
+void NanocubeServer::serveQueueStats(Request &request)
+{
+    auto stats = scheduler.stats();
+    std::stringstream ss;
+    ss << "{ \"cheap\":{ \"admitted\":" << stats.cheap_admitted
+       << ", \"running\":" << stats.cheap_running
+       << " }, \"heavy\":{ \"admitted\":" << stats.heavy_admitted
+       << ", \"running\":" << stats.heavy_running
+       << ", \"queued\":" << stats.queued
+       << ", \"max_queued\":" << stats.max_queued
+       << ", \"shed\":" << stats.shed
+       << ", \"cancelled\":" << stats.cancelled
+       << ", \"slots\":" << stats.heavy_slots
+       << ", \"queue_limit\":" << stats.queue_limit
+       << ", \"cost\":" << stats.heavy_cost
+       << " }, \"wait\":{ \"waited\":" << stats.waited
+       << ", \"mean_ms\":" << (stats.waited ? stats.wait_us / 1000.0 / stats.waited : 0.0)
+       << ", \"max_ms\":" << stats.max_wait_us / 1000.0
+       << " } }";
+    request.respondJson(ss.str());
+}
+
 void NanocubeServer::serveShutdown(Request &request)
 {
     std::string passcode = randomString();
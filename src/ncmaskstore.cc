@@ -0,0 +1,94 @@
+#include <ftw.h>
+
+#include <functional>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "polycover/labeled_tree.hh"
+#include "polycover/packed_tree.hh"
+
+#include "MaskStore.hh"
+
+//
+// Precompiles the .ttt region files of a directory (the one
+// NANOCUBE_REGIONS points to) into a mask store for nanocube servers
+// (--mask-store). Regions are named by their path relative to the
+// directory without the .ttt extension: the same name a region query
+// uses.
+//
+//     nanocube-mask-store <regions-directory> <store-file>
+//
+
+static std::vector<std::string> region_files;
+
+static int collect(const char *path, const struct stat *, int type, struct FTW *) {
+    std::string p(path);
+    if (type == FTW_F && p.size() > 4 && p.compare(p.size() - 4, 4, ".ttt") == 0)
+        region_files.push_back(p);
+    return 0;
+}
+
+void message() {
+    std::cout << "Usage: nanocube-mask-store <regions-directory> <store-file>" << std::endl;
+}
+
+int main(int argc, char **argv) {
+
+    if (argc != 3) {
+        message();
+        return 1;
+    }
+
+    std::string directory(argv[1]);
+    std::string store_path(argv[2]);
+    while (directory.size() > 1 && directory.back() == '/')
+        directory.pop_back();
+
+    if (nftw(directory.c_str(), collect, 32, FTW_PHYS) != 0) {
+        std::cerr << "could not read " << directory << std::endl;
+        return 1;
+    }
+
+    std::vector<mask_store::Mask> masks;
+    std::uint64_t total_nodes = 0;
+    for (auto &file: region_files) {
+        std::ifstream f(file);
+
+        // same mask a region query builds from the first area of the file
+        std::unique_ptr<polycover::labeled_tree::Node> root;
+        polycover::labeled_tree::Parser parser;
+        parser.signal.connect([&root](const std::string& name, const polycover::labeled_tree::Node &node) {
+            std::stringstream ss;
+            ss << node;
+            root.reset(polycover::labeled_tree::load_from_code(ss.str()));
+        });
+        parser.run(f,1);
+
+        if (!root) {
+            std::cerr << "skipping " << file << ": no region" << std::endl;
+            continue;
+        }
+
+        mask_store::Mask mask;
+        mask.name   = file.substr(directory.size() + 1, file.size() - directory.size() - 5);
+        mask.packed = polycover::labeled_tree::PackedTree::pack(*root, mask.num_nodes);
+        total_nodes += mask.num_nodes;
+        masks.push_back(std::move(mask));
+    }
+
+    auto num_masks = masks.size();
+    try {
+        mask_store::MaskStore::write(store_path, std::move(masks));
+    }
+    catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "regions: " << num_masks << " nodes: " << total_nodes << std::endl;
+    return 0;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "labeled_tree.hh"
+
+namespace polycover {
+
+namespace labeled_tree {
+
+//
+// The leaves of a quadtree mask as a sorted list of Morton code
+// intervals: a leaf at level l with child labels c1...cl is the interval
+// of level MAX_LEVEL codes that start with c1...cl. The intervals are
+// disjoint and never merged, so every leaf is still an interval of its
+// own.
+//
+// Intersecting the mask with a quadtree needs no lockstep descent of
+// the mask: a traversal that visits cells in Morton order keeps a
+// position in the interval list that only moves one way and skips, with
+// a galloping search, the intervals no cell reaches. A cell that
+// overlaps no interval is dropped with its whole subtree and a cell
+// that is one of the intervals is a leaf of the mask.
+//
+
+//-----------------------------------------------------------------------
+// IntervalMask
+//-----------------------------------------------------------------------
+
+struct IntervalMask {
+public:
+
+    static const int MAX_LEVEL = 31;
+
+    // Morton interval [begin, end) of a cell
+    static std::uint64_t cellBegin(std::uint64_t code, int level);
+    static std::uint64_t cellEnd(std::uint64_t code, int level);
+
+public:
+
+    IntervalMask() = default;
+
+    // Cursor: NodeCursor or PackedCursor (see packed_tree.hh)
+    template <typename Cursor>
+    explicit IntervalMask(Cursor root);
+
+    std::size_t size() const;
+    bool        empty() const;
+
+    // number of intervals that start before end, given that it is at
+    // most count (a search backwards from count)
+    std::size_t startingBefore(std::uint64_t end, std::size_t count) const;
+
+public:
+
+    std::vector<std::uint64_t> begins;
+    std::vector<std::uint64_t> ends;
+
+private:
+
+    template <typename Cursor>
+    void collect(Cursor cursor, std::uint64_t code, int level);
+};
+
+//-----------------------------------------------------------------------
+// IntervalMask Impl.
+//-----------------------------------------------------------------------
+
+inline std::uint64_t IntervalMask::cellBegin(std::uint64_t code, int level) {
+    return code << (2 * (MAX_LEVEL - level));
+}
+
+inline std::uint64_t IntervalMask::cellEnd(std::uint64_t code, int level) {
+    return (code + 1) << (2 * (MAX_LEVEL - level));
+}
+
+template <typename Cursor>
+IntervalMask::IntervalMask(Cursor root) {
+    collect(root, 0, 0);
+}
+
+template <typename Cursor>
+void IntervalMask::collect(Cursor cursor, std::uint64_t code, int level) {
+    if (cursor.isLeaf()) {
+        begins.push_back(cellBegin(code, level));
+        ends.push_back(cellEnd(code, level));
+        return;
+    }
+    if (level == MAX_LEVEL) {
+        throw std::runtime_error("mask deeper than " + std::to_string(MAX_LEVEL) + " levels");
+    }
+    for (int label=0;label<4;++label) {
+        auto child = cursor.child((ChildLabel) label);
+        if (child.valid()) {
+            collect(child, code * 4 + label, level + 1);
+        }
+    }
+}
+
+inline std::size_t IntervalMask::size() const {
+    return begins.size();
+}
+
+inline bool IntervalMask::empty() const {
+    return begins.empty();
+}
+
+inline std::size_t IntervalMask::startingBefore(std::uint64_t end, std::size_t count) const {
+    // gallop backwards: begins[hi..count) all start at or after end
+    std::size_t hi   = count;
+    std::size_t step = 1;
+    while (hi > 0 && begins[hi - 1] >= end) {
+        auto lo = hi > step ? hi - step : 0;
+        if (begins[lo] < end) {
+            return std::lower_bound(begins.begin() + lo, begins.begin() + hi, end) - begins.begin();
+        }
+        hi    = lo;
+        step *= 2;
+    }
+    return hi;
+}
+
+} // labeled_tree namespace
+
+} // polycover namespace
@@ -1,6 +1,8 @@
 #include "mipmap.hh"
 
 #include <iomanip>
+#include <iterator>
+#include <mutex>
 #include <stdexcept>
 
 namespace polycover {
@@ -136,4 +138,40 @@ MipMap::State MipMap::state(int resolution_exp, std::size_t x, std::size_t y) co
     }
 }
 
+//-----------------------------------------------------------------------------
+// MipMapPool Impl.
+//-----------------------------------------------------------------------------
+
+namespace {
+
+std::mutex                           pool_mutex;
+std::vector<std::unique_ptr<MipMap>> pool_idle;
+
+}
+
+MipMapPool::Ptr MipMapPool::acquire(int min_resolution_exp, int max_resolution_exp)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        for (auto it=pool_idle.rbegin();it!=pool_idle.rend();++it) {
+            auto &mipmap = *it;
+            if (mipmap->min_resolution_exp == min_resolution_exp &&
+                mipmap->max_resolution_exp == max_resolution_exp) {
+                Ptr result(mipmap.release());
+                pool_idle.erase(std::next(it).base());
+                return result;
+            }
+        }
+    }
+    return Ptr(new MipMap(min_resolution_exp, max_resolution_exp));
+}
+
+void MipMapPool::Release::operator()(MipMap *mipmap) const
+{
+    std::unique_ptr<MipMap> owned(mipmap);
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (pool_idle.size() < MAX_IDLE)
+        pool_idle.push_back(std::move(owned));
+}
+
 } // polycover
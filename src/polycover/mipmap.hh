@@ -3,6 +3,7 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <memory>
 
 namespace polycover {
 
@@ -37,5 +38,28 @@ struct MipMap {
     std::vector<size_t> pixels;
     std::vector<size_t> pixels_per_cell;
 };
+
+//-----------------------------------------------------------------------------
+// MipMapPool
+//-----------------------------------------------------------------------------
+
+//
+// Mipmaps are recycled across cover computations (and across the threads
+// of one) instead of being allocated for every polygon. A recycled
+// mipmap keeps the active resolution of its last user, so the clear()
+// that starts every rasterization wipes exactly what that user wrote.
+//
+struct MipMapPool {
+public:
+    struct Release {
+        void operator()(MipMap *mipmap) const;
+    };
+
+    using Ptr = std::unique_ptr<MipMap, Release>;
+
+    static Ptr acquire(int min_resolution_exp, int max_resolution_exp);
+
+    static const std::size_t MAX_IDLE = 32; // idle mipmaps kept for reuse
+};
     
 } // polycover namespace
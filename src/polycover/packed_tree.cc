@@ -0,0 +1,151 @@
+#include "packed_tree.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "packed trees are little-endian"
+#endif
+
+namespace polycover {
+
+namespace labeled_tree {
+
+static const std::uint64_t BLOCK = 16; // nodes per rank directory entry
+
+//-----------------------------------------------------------------------
+// PackedTree Impl.
+//-----------------------------------------------------------------------
+
+std::size_t PackedTree::bytes(std::uint64_t num_nodes) {
+    return (std::size_t) ((num_nodes + BLOCK - 1) / BLOCK * BLOCK + (num_nodes / BLOCK + 1) * sizeof(std::uint32_t));
+}
+
+std::string PackedTree::pack(const Node& root, std::uint64_t &num_nodes) {
+    std::vector<std::uint8_t> masks;
+    std::deque<const Node*> queue { &root };
+    while (!queue.empty()) {
+        auto node = queue.front();
+        queue.pop_front();
+        std::uint8_t mask = 0;
+        for (int i=0;i<4;++i) {
+            if (node->children[i]) {
+                mask |= (std::uint8_t) (1 << i);
+                queue.push_back(node->children[i].get());
+            }
+        }
+        masks.push_back(mask);
+    }
+
+    num_nodes = masks.size();
+    auto blocks = num_nodes / BLOCK + 1;
+
+    std::string result(bytes(num_nodes), '\0');
+    std::memcpy(&result[0], masks.data(), masks.size());
+
+    // children before each block
+    auto ranks_offset = (num_nodes + BLOCK - 1) / BLOCK * BLOCK;
+    std::uint32_t rank = 0;
+    for (std::uint64_t b=0;b<blocks;++b) {
+        std::memcpy(&result[ranks_offset + b * sizeof(std::uint32_t)], &rank, sizeof(rank));
+        for (auto i=b*BLOCK;i<std::min(num_nodes, (b+1)*BLOCK);++i) {
+            rank += __builtin_popcount(masks[i]);
+        }
+    }
+    return result;
+}
+
+PackedTree::PackedTree(std::uint64_t num_nodes, const char *data):
+    num_nodes(num_nodes),
+    child_masks(reinterpret_cast<const std::uint8_t*>(data)),
+    ranks(reinterpret_cast<const std::uint32_t*>(data + (num_nodes + BLOCK - 1) / BLOCK * BLOCK))
+{
+    if (num_nodes == 0) {
+        throw std::runtime_error("packed tree without nodes");
+    }
+}
+
+std::uint64_t PackedTree::numNodes() const {
+    return num_nodes;
+}
+
+std::uint8_t PackedTree::childMask(std::uint64_t index) const {
+    return child_masks[index];
+}
+
+std::uint64_t PackedTree::child(std::uint64_t index, ChildLabel label) const {
+    auto mask = child_masks[index];
+    if ((mask & (1 << label)) == 0) {
+        return NO_NODE;
+    }
+
+    // children of the nodes before index in its block: a block is 16
+    // bytes and every mask fits in a nibble, so a popcount of the bytes
+    // before index in each half of the block counts them
+    std::uint64_t words[2];
+    std::memcpy(words, child_masks + (index & ~(BLOCK - 1)), sizeof(words));
+    auto k = index % BLOCK;
+    std::uint64_t before;
+    if (k < 8) {
+        before = __builtin_popcountll(words[0] & ((1ULL << (8 * k)) - 1));
+    }
+    else {
+        before = __builtin_popcountll(words[0]) + (k == 8 ? 0 : __builtin_popcountll(words[1] & ((1ULL << (8 * (k - 8))) - 1)));
+    }
+
+    return 1 + ranks[index / BLOCK] + before + __builtin_popcount(mask & ((1 << label) - 1));
+}
+
+PackedCursor PackedTree::root(int levels) const {
+    return PackedCursor(this, 0, 0, levels);
+}
+
+//-----------------------------------------------------------------------
+// PackedCursor Impl.
+//-----------------------------------------------------------------------
+
+PackedCursor::PackedCursor(const PackedTree *tree, std::uint64_t index, int depth, int levels):
+    tree(tree),
+    index(index),
+    depth(depth),
+    levels(levels)
+{}
+
+bool PackedCursor::valid() const {
+    return index != PackedTree::NO_NODE;
+}
+
+bool PackedCursor::isLeaf() const {
+    return tree->childMask(index) == 0 || (levels > 0 && depth + 1 >= levels);
+}
+
+PackedCursor PackedCursor::child(ChildLabel label) const {
+    return PackedCursor(tree, tree->child(index, label), depth + 1, levels);
+}
+
+//-----------------------------------------------------------------------
+// NodeCursor Impl.
+//-----------------------------------------------------------------------
+
+NodeCursor::NodeCursor(const Node *node):
+    node(node)
+{}
+
+bool NodeCursor::valid() const {
+    return node != nullptr;
+}
+
+bool NodeCursor::isLeaf() const {
+    return node->getNumChildren() == 0;
+}
+
+NodeCursor NodeCursor::child(ChildLabel label) const {
+    return NodeCursor(node->children[label].get());
+}
+
+} // labeled_tree namespace
+
+} // polycover namespace
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "labeled_tree.hh"
+
+namespace polycover {
+
+namespace labeled_tree {
+
+//
+// Pointer free form of a quadtree labeled_tree::Node that can be used
+// right where it lies (e.g. in a memory mapped file).
+//
+// Nodes are numbered in breadth first order and each one is a byte with
+// the bitmask of its children labels (0 is a leaf). Since the children
+// of consecutive nodes are consecutive, the children of node i start at
+// 1 + (number of children of the nodes before i): a directory with that
+// count before every block of 16 nodes makes it a popcount away.
+//
+// Layout (little-endian, num_nodes is kept by whoever stores the tree):
+//
+//     uint8_t  child_masks[num_nodes rounded up to 16]
+//     uint32_t ranks[num_nodes/16 + 1]
+//
+
+struct PackedCursor;
+
+//-----------------------------------------------------------------------
+// PackedTree
+//-----------------------------------------------------------------------
+
+struct PackedTree {
+public:
+
+    static const std::uint64_t NO_NODE = ~0ULL;
+
+    // bytes of the packed form of a tree with num_nodes nodes
+    static std::size_t bytes(std::uint64_t num_nodes);
+
+    // packed form of a tree; bytes(num_nodes) long
+    static std::string pack(const Node& root, std::uint64_t &num_nodes);
+
+public:
+
+    PackedTree() = default;
+
+    // view of a packed tree at data (4-byte aligned); the bytes must
+    // outlive the view
+    PackedTree(std::uint64_t num_nodes, const char *data);
+
+    std::uint64_t numNodes() const;
+
+    // child labels bitmask of a node (0 on a leaf)
+    std::uint8_t childMask(std::uint64_t index) const;
+
+    // NO_NODE if there is no such child
+    std::uint64_t child(std::uint64_t index, ChildLabel label) const;
+
+    // traversal from the root; levels > 0 stops it as if the tree was
+    // trim(levels)
+    PackedCursor root(int levels=0) const;
+
+public:
+
+    std::uint64_t        num_nodes   { 0 };
+    const std::uint8_t  *child_masks { nullptr };
+    const std::uint32_t *ranks       { nullptr };
+};
+
+//-----------------------------------------------------------------------
+// PackedCursor: a node of a PackedTree
+//-----------------------------------------------------------------------
+
+struct PackedCursor {
+public:
+    PackedCursor() = default;
+    PackedCursor(const PackedTree *tree, std::uint64_t index, int depth, int levels);
+
+    bool valid() const;
+    bool isLeaf() const;
+
+    // invalid cursor if there is no such child
+    PackedCursor child(ChildLabel label) const;
+
+public:
+    const PackedTree *tree   { nullptr };
+    std::uint64_t     index  { PackedTree::NO_NODE };
+    int               depth  { 0 };
+    int               levels { 0 };
+};
+
+//-----------------------------------------------------------------------
+// NodeCursor: the same interface over a labeled_tree::Node
+//-----------------------------------------------------------------------
+
+struct NodeCursor {
+public:
+    NodeCursor() = default;
+    NodeCursor(const Node *node);
+
+    bool valid() const;
+    bool isLeaf() const;
+    NodeCursor child(ChildLabel label) const;
+
+public:
+    const Node *node { nullptr };
+};
+
+} // labeled_tree namespace
+
+} // polycover namespace
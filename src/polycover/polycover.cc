@@ -6,7 +6,11 @@
 #include "area.hh"
 
 #include <algorithm>
+#include <atomic>
 #include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -1470,12 +1474,12 @@ Polygon random_simple_grid_polygon(int width, int height, int num_sides, uint32_
 // TileCoverEngine Impl.
 //-------------------------------------------------------------------------------
 
-TileCoverEngine::TileCoverEngine(int max_level, int max_texture_level):
+TileCoverEngine::TileCoverEngine(int max_level, int max_texture_level, int threads):
+    mipmap_p(MipMapPool::acquire(1,std::min(max_level,max_texture_level))),
     max_level(max_level),
-    max_texture_level(max_texture_level)
-{
-    mipmap_p.reset(new MipMap(1,std::min(max_level,max_texture_level)));
-}
+    max_texture_level(max_texture_level),
+    threads(std::max(1,threads))
+{}
 
 #define xLOG_COMPUTE_TREE_DECOMPOSITION
 #define LOG_COMPUTE_TREE_DECOMPOSITION_VERBOSITY 0
@@ -1597,7 +1601,7 @@ labeled_tree::Node* TileCoverEngine::computeCover(const std::vector<Polygon> &me
 
     Reporter reporter;
     
-    using ProcessPolyType = std::function<void(const std::vector<Polygon>&, const RealBox&, int)>;
+    using ProcessPolyType = std::function<void(labeled_tree::CoverTreeEngine&, MipMap&, const std::vector<Polygon>&, const RealBox&, int)>;
     
 #ifdef LOG_COMPUTE_TREE_DECOMPOSITION
     int COUNT = -1;
@@ -1615,8 +1619,11 @@ labeled_tree::Node* TileCoverEngine::computeCover(const std::vector<Polygon> &me
         labeled_tree::CoverTreeEngine &engine;
     };
     
+    // engine of the cover: the threads of a parallel refinement have their own
+    auto shared_engine = &engine;
+    
     // routine to process polygons recursively
-    ProcessPolyType process = [&](const std::vector<Polygon> &polygons, const RealBox& bbox, int recursion_level) {
+    ProcessPolyType process = [&](labeled_tree::CoverTreeEngine &engine, MipMap &mipmap, const std::vector<Polygon> &polygons, const RealBox& bbox, int recursion_level) {
         CountIteration count_iteration(engine);
         
 
@@ -1986,13 +1993,16 @@ labeled_tree::Node* TileCoverEngine::computeCover(const std::vector<Polygon> &me
             std::cout << prefix <<  "cellmap size: " << cellmap.map.size() << std::endl;
 #endif
             
+            // the cells to refine are tiles of the next level: their
+            // polygons are the polygons clipped to the cell
+            struct Refinement {
+                Refinement(const maps::Tile &tile): tile(tile) {}
+                maps::Tile           tile;
+                std::vector<Polygon> polygons;
+                RealBox              bbox;
+            };
+            std::vector<Refinement> refinements;
             for (auto it: cellmap.map) {
-
-                //---- BEGIN -----
-                // TODO: clean this segment to split parent if necessary
-                //
-                // tiles that we are going to refine, need to be
-                // separated from their parent tiles
                 auto cell_id = it.first;
                 auto d = current_depth;
                 if (x_blocks > 1 || y_blocks > 1)
@@ -2003,90 +2013,100 @@ labeled_tree::Node* TileCoverEngine::computeCover(const std::vector<Polygon> &me
                 tile_id.x.quantity += cell_id.x;
                 tile_id.y.quantity += cell_id.y;
 
-                
 #ifdef LOG_COMPUTE_TREE_DECOMPOSITION
-#if LOG_COMPUTE_TREE_DECOMPOSITION_VERBOSITY>0
-                static int count_refinements = 0;
-
-                std::cerr << prefix << "Refining tile " << tile_id << "    refinement index: " << count_refinements++ << std::endl;
-                {
-//                    std::cerr << *engine.root.get() << std::endl;
-                    std::cerr << "-------------------------------------------" << std::endl;
-                    std::cerr << "BEFORE SPLIT" << std::endl;
-                    std::stringstream ss;
-                    ::labeled_tree::text(ss, *engine.root.get());
-                    std::cerr << ss.str() << std::endl;
-                    std::cerr << "-------------------------------------------" << std::endl;
-                }
-#endif
+                std::cerr << prefix << "cell: " << it.first << " tile: " << tile_id << std::endl;
 #endif
-                
-                // make sure tile_id is an individual tile
-                engine.goTo(tile_id);
-                engine.current_node->split(); // split is an operation that returns true if parent node is
-                                              // fixed and has no children. if it is not fixed, nothing is done
-
-#ifdef LOG_COMPUTE_TREE_DECOMPOSITION
-#if LOG_COMPUTE_TREE_DECOMPOSITION_VERBOSITY>0
-                {
-                    std::cerr << "-------------------------------------------" << std::endl;
-                    std::cerr << "AFTER SPLIT" << std::endl;
-                    std::stringstream ss;
-                    ::labeled_tree::text(ss, *engine.root.get());
-                    std::cerr << ss.str() << std::endl;
-                    std::cerr << "-------------------------------------------" << std::endl;
+                refinements.push_back(Refinement(tile_id));
+                auto &refinement = refinements.back();
+                for (auto &p: it.second->polygons()) {
+                    refinement.polygons.push_back(Polygon(p,inverse_transform));
+                    refinement.bbox.add(refinement.polygons.back().getBoundingBox());
                 }
-#endif
-#endif
-                //---- END -----
-                
-                
-#ifdef LOG_COMPUTE_TREE_DECOMPOSITION
-                std::cerr << prefix << "cell: " << it.first << std::endl;
-#endif
-                // int count = 0;
-                auto cell_intersection_grid_polygons = it.second->polygons();
-                
-                RealBox bbox;
-                std::vector<Polygon> cell_intersection_mercator_polygons;
-                std::for_each(cell_intersection_grid_polygons.begin(),
-                              cell_intersection_grid_polygons.end(),
-                              [&cell_intersection_mercator_polygons, &inverse_transform,&bbox](const Polygon& p) {
-                                  cell_intersection_mercator_polygons.push_back(Polygon(p,inverse_transform));
-                                  bbox.add(cell_intersection_mercator_polygons.back().getBoundingBox());
-                              });
-                
-                
+            }
 
-#ifdef LOG_COMPUTE_TREE_DECOMPOSITION
-                std::cerr << prefix << "recurse on grid polygons:" << std::endl;
-                for (auto &p: cell_intersection_grid_polygons) {
-                    std::cerr << prefix << std::string(4,'.') << p << std::endl;
-                    // std::cerr << prefix << std::string(4,".") << "bounds: " << bbox.pmin << ", " << bbox.pmax << std::endl;
+            // the refinements run in parallel once, on the first level
+            // with enough cells to keep the threads busy (or the last)
+            bool parallel = threads > 1 && &engine == shared_engine && refinements.size() > 1 &&
+                (refinements.size() >= 4 * (std::size_t) threads || recursion_level + 2 >= (int) levels.size());
+            
+            if (!parallel) {
+                for (auto &refinement: refinements) {
+                    // make sure the tile is an individual tile: split
+                    // returns true if the parent node is fixed and has
+                    // no children. if it is not fixed, nothing is done
+                    engine.goTo(refinement.tile);
+                    engine.current_node->split();
+                    process(engine, mipmap, refinement.polygons, refinement.bbox, recursion_level + 1);
+                }
+            }
+            else {
+                // splits only touch the tiles and their ancestors: once
+                // they are done the tiles are disjoint subtrees
+                std::vector<labeled_tree::Tag> tags;
+                for (auto &refinement: refinements) {
+                    engine.goTo(refinement.tile);
+                    engine.current_node->split();
+                    tags.push_back(engine.current_node->tag);
                 }
-#endif
-                process(cell_intersection_mercator_polygons, bbox, recursion_level + 1);
 
-#ifdef LOG_COMPUTE_TREE_DECOMPOSITION
-#if LOG_COMPUTE_TREE_DECOMPOSITION_VERBOSITY>0
-                {
-                    std::cerr << "-------------------------------------------" << std::endl;
-                    std::cerr << "AFTER REFINEMENT" << std::endl;
-                    // std::cerr << *engine.root.get() << std::endl;
-                    std::stringstream ss;
-                    ::labeled_tree::text(ss, *engine.root.get());
-                    std::cerr << ss.str() << std::endl;
-                    std::cerr << "-------------------------------------------" << std::endl;
+                // each subtree is built by its own engine, starting from
+                // the tile as it is on the shared tree
+                std::vector<std::unique_ptr<labeled_tree::Node>> subtrees(refinements.size());
+                std::atomic<std::size_t> next { 0 };
+                std::exception_ptr       error;
+                std::mutex               error_mutex;
+                auto iteration_tag = engine.iteration_tag;
+                auto refine = [&]() {
+                    auto local_mipmap = MipMapPool::acquire(mipmap.min_resolution_exp, mipmap.max_resolution_exp);
+                    for (auto i=next++;i<refinements.size();i=next++) {
+                        try {
+                            auto &refinement = refinements[i];
+                            labeled_tree::Path path(refinement.tile);
+                            labeled_tree::CoverTreeEngine local_engine;
+                            local_engine.iteration_tag = iteration_tag;
+                            local_engine.goTo(path);
+                            local_engine.current_node->tag = tags[i];
+                            process(local_engine, *local_mipmap, refinement.polygons, refinement.bbox, recursion_level + 1);
+                            local_engine.goTo(path);
+                            auto node = local_engine.current_node;
+                            subtrees[i] = std::move(node->parent->children[node->label_to_parent]);
+                        }
+                        catch (...) {
+                            std::lock_guard<std::mutex> lock(error_mutex);
+                            if (!error)
+                                error = std::current_exception();
+                        }
+                    }
+                };
+                std::vector<std::thread> workers;
+                auto num_workers = std::min((std::size_t) threads, refinements.size());
+                for (std::size_t i=1;i<num_workers;++i)
+                    workers.push_back(std::thread(refine));
+                refine();
+                for (auto &worker: workers)
+                    worker.join();
+                if (error)
+                    std::rethrow_exception(error);
+
+                // graft the subtrees in the order of the cells
+                for (std::size_t i=0;i<refinements.size();++i) {
+                    engine.goTo(refinements[i].tile);
+                    auto node    = engine.current_node;
+                    auto subtree = subtrees[i].get();
+                    node->tag = subtree->tag;
+                    for (int c=0;c<4;++c) {
+                        node->children[c] = std::move(subtree->children[c]);
+                        if (node->children[c])
+                            node->children[c]->parent = node;
+                    }
                 }
-#endif
-#endif
             }
             
             // throw std::runtime_error("recursion is not ready yet");
         }
     };
     
-    process(mercator_polygons, bbox, 0); //
+    process(engine, mipmap, mercator_polygons, bbox, 0); //
     
     engine.goTo(labeled_tree::Path());
     auto labeled_tree = engine.root.get();
@@ -1160,14 +1160,25 @@ std::vector<Segment> find_outgoing_vectors(const Polygon& polygon, Reporter* rep
 Polygon random_simple_grid_polygon(int width, int height, int num_sides, uint32_t seed=13);
 
 
+//
+// The cover is computed coarse to fine: a first rasterization fixes the
+// coarse cells inside the polygons and each cell crossed by a boundary
+// is refined by rasterizing the polygons clipped to it. With threads > 1
+// the cells of one refinement level (the first one with enough cells)
+// are spread over that many threads, each building the subtrees of its
+// cells with its own mipmap and cover tree, and the subtrees are grafted
+// into the cover in their original order: the result is the same as on
+// a single thread.
+//
 struct TileCoverEngine {
 public:
-    TileCoverEngine(int max_level, int max_texture_level);
+    TileCoverEngine(int max_level, int max_texture_level, int threads=1);
     labeled_tree::Node* computeCover(const std::vector<Polygon> &polygons);
 public:
-    std::unique_ptr<MipMap> mipmap_p;
+    MipMapPool::Ptr mipmap_p;
     int max_level;
     int max_texture_level;
+    int threads;
 };
 
 // ::labeled_tree::Node* compute_tree_decomposition(const std::vector<Polygon> &polygons, int max_level, int max_texture_level);
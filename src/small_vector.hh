@@ -8,8 +8,10 @@
 #include <vector>
 
 #include <iterator>
+#include <new>
 
 #include "TaggedPointer.hh"
+#include "SlabAllocator.hh"
 
 namespace small_vector {
 
@@ -144,7 +146,23 @@ struct small_vector
     {
       //std::cout << "delete small_vector" << std::endl;
         if (this->size() > 0)
-            delete [] data.getPointer();
+            release(data.getPointer(), capacity());
+    }
+
+    // buffers come from the slab allocator (see SlabAllocator.hh)
+    static T* acquire(size_type c)
+    {
+        T* buffer = static_cast<T*>(slab::allocate(c * sizeof(T)));
+        for (size_type i=0;i<c;i++)
+            new (buffer + i) T();
+        return buffer;
+    }
+
+    static void release(T* buffer, size_type c)
+    {
+        for (size_type i=0;i<c;i++)
+            buffer[i].~T();
+        slab::deallocate(buffer, c * sizeof(T));
     }
 
     void assert_capacity(size_type c)
@@ -156,12 +174,12 @@ struct small_vector
             size_type new_capacity = capacityFor(c);
 
             T* buffer = data.getPointer();
-            T* new_buffer = new T[new_capacity];
+            T* new_buffer = acquire(new_capacity);
 
             std::copy(buffer, buffer + s, new_buffer);
 
             if (buffer)
-                delete [] buffer;
+                release(buffer, capacity());
 
             data.setPointer(new_buffer);
         }
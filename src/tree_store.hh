@@ -284,6 +284,8 @@ public: // Value Members
 enum StoreMode { NORMAL, INVERTED };
 enum StoreOp   { ADD, SUB, MUL, DIV, SET, POW, GEQ, LEQ, LE, GT, NEQ, EQ };
 
+inline double evalOp(double a, double b, StoreOp op, StoreMode store_mode);
+
 template <typename TreeStore>
 struct TreeStoreBuilder {
 public:
@@ -489,9 +491,42 @@ std::ostream& operator<<(std::ostream &os, const TreeStore<Config> &v);
 template <typename Config>
 void serialize(const TreeStore<Config> &tree_store, std::ostream &os);
 
+// the config writes the header of the values (e.g. their size)
+template <typename Config>
+void serialize(const TreeStore<Config> &tree_store, std::ostream &os, Config &config);
+
+// writes what it is pushed, stored and popped (in depth first order) as
+// serialize writes a tree store with these level names, e.g. the cells
+// of a query::result::FlatResult without building the tree
+template <typename Config>
+struct Serializer {
+public:
+    using label_type = typename Config::label_type;
+    using value_type = typename Config::value_type;
+
+    Serializer(std::ostream &os, const std::vector<std::string> &level_names, Config &config);
+
+    void push(const label_type &label);
+    void store(const value_type &value);
+    void pop();
+
+private:
+    std::ostream &os;
+    Config       &config;
+};
+
+// pushes, stores and pops the nodes of a tree store on a builder (e.g. a
+// Serializer) in depth first order
+template <typename Config, typename Builder>
+void replay(const TreeStore<Config> &tree_store, Builder &builder);
+
 template <typename Config>
 auto deserialize(std::istream &is) -> TreeStore<Config>;
 
+// the config reads the header written by serialize with the same config
+template <typename Config>
+auto deserialize(std::istream &is, Config &config) -> TreeStore<Config>;
+
 //template <typename Config, typename Parameter>
 //void json(const TreeStore<Config> &tree_store, std::ostream &os, const Parameter& parameter);
 //
@@ -974,49 +1009,55 @@ int TreeStoreBuilder<T>::getNumLevels() const
         }
     }
     
+//-----------------------------------------------------------------------------
+// evalOp Impl.
+//-----------------------------------------------------------------------------
+
+inline double evalOp(double a, double b, StoreOp op, StoreMode store_mode)
+{
+    if (store_mode == INVERTED)
+        std::swap(a,b);
+
+    switch (op) {
+    case SET:
+        return b;
+    case ADD:
+        return a + b;
+    case SUB:
+        return a - b;
+    case MUL:
+        return a * b;
+    case DIV:
+        return (b != 0 ? a/b : 0.0);
+    case POW:
+        return std::pow(a,b);
+    case GEQ:
+        return (a >= b ? 1.0 : 0.0);
+    case LEQ:
+        return (a <= b ? 1.0 : 0.0);
+    case LE:
+        return (a <  b ? 1.0 : 0.0);
+    case GT:
+        return (a >  b ? 1.0 : 0.0);
+    case NEQ:
+        return (a != b ? 1.0 : 0.0);
+    case EQ:
+        return (a == b ? 1.0 : 0.0);
+    default:
+        throw TreeStoreException("Operation not implemented");
+    }
+}
+
 template <typename T>
 void TreeStoreBuilder<T>::store(value_type value, StoreOp op, StoreMode store_mode)
 {
-
-    auto eval_op = [] (value_type a, value_type b, StoreOp op, StoreMode store_mode) -> value_type{
-        if (store_mode == INVERTED)
-            std::swap(a,b);
-
-        switch (op) {
-        case SET:
-            return b;
-        case ADD:
-            return a + b;
-        case SUB:
-            return a - b;
-        case MUL:
-            return a * b;
-        case DIV:
-            return (b != 0 ? a/b : 0.0);
-        case POW:
-            return std::pow(a,b);
-        case GEQ:
-            return (a >= b ? 1.0 : 0.0);
-        case LEQ:
-            return (a <= b ? 1.0 : 0.0);
-        case LE:
-            return (a <  b ? 1.0 : 0.0);
-        case GT:
-            return (a >  b ? 1.0 : 0.0);
-        case NEQ:
-            return (a != b ? 1.0 : 0.0);
-        case EQ:
-            return (a == b ? 1.0 : 0.0);
-        default:
-            throw TreeStoreException("Operation not implemented");
-        }
-    };
-
     auto leaf_node = this->getCurrentNode()->asLeafNode();
     if (!leaf_node) {
         throw TreeStoreException("TreeStoreBuilder::store() ... can only store on last level");
     }
-    leaf_node->setValue(eval_op(leaf_node->value, value, op, store_mode));
+    // unqualified: values that are not numbers provide their own
+    // evalOp (found by argument dependent lookup)
+    leaf_node->setValue(evalOp(leaf_node->value, value, op, store_mode));
 
     // std::cout << std::string(3*current_level, ' ') << "store: " << value << std::endl;
 
@@ -1414,117 +1455,96 @@ auto TreeStore<C>::operator =(TreeStore &&other) -> TreeStore&// move assign
     template <typename C>
     void serialize(const TreeStore<C> &tree_store, std::ostream &os)
     {
-        
-        using treestore_type    = TreeStore<C>;
-        using config_type       = typename treestore_type::config_type;
-        using label_type        = typename treestore_type::label_type;
-        //using value_type        = typename treestore_type::value_type;
-        //using leafnode_type     = typename treestore_type::leafnode_type;
-        //using internalnode_type = typename treestore_type::internalnode_type;
-        using node_type         = typename treestore_type::node_type;
-        //using edge_type         = typename treestore_type::edge_type;
-        //using labelhash_type    = typename treestore_type::labelhash_type;
-
-        
-        config_type config;
-        
-        enum Instruction { PUSH, POP, ROOT };
-        // using Item = std::tuple<node_type*, label_type, Instruction>;
-        
-        struct Item {
-            Item() = default;
-            
-            Item(const Item& other) = default;
-            Item& operator=(const Item& other) = default;
-
-            Item(Item&& other) = default;
-            Item& operator=(Item&& other) = default;
-
-            Item(node_type *n, const label_type *l, Instruction i):
-                node(n),
-                label(l),
-                instruction(i)
-            {
-//                std::cout << "---- construct ----" << std::endl;
-//                std::cout << "node:        " << (void*) this->node << std::endl;
-//                std::cout << "label:       " << (void*) this->label << std::endl;
-//                std::cout << "label size:  " << this->label->size() << std::endl;
-//                std::cout << "instruction: " << (int) this->instruction << std::endl;
-            }
+        C config;
+        serialize(tree_store, os, config);
+    }
 
-            void print(std::ostream &os) {
-                os << "---- print ----" << (void*) this->node << std::endl;
-                os << "node:        " << (void*) this->node << std::endl;
-                os << "label:       " << (void*) &this->label << std::endl;
-                os << "label size:  " << this->label->size() << std::endl;
-                os << "instruction: " << (int) this->instruction << std::endl;
-            }
-            
-            Item(node_type *node):
-                node(node),
-                instruction(ROOT)
-            {}
-            const node_type  *node   { nullptr };
-            const label_type *label  { nullptr };
-            Instruction instruction;
-        };
-        
-        
+    template <typename C>
+    void serialize(const TreeStore<C> &tree_store, std::ostream &os, C &config)
+    {
+        // serialization of an empty tree_store is only the header
+        Serializer<C> serializer(os, tree_store.level_names, config);
+        replay(tree_store, serializer);
+    }
+    
+    template <typename C>
+    Serializer<C>::Serializer(std::ostream &os, const std::vector<std::string> &level_names, C &config):
+        os(os),
+        config(config)
+    {
         // four bytes for number of levels
-        uint16_t no_levels = static_cast<uint16_t>(tree_store.level_names.size());
+        uint16_t no_levels = static_cast<uint16_t>(level_names.size());
         os.write(reinterpret_cast<char*>(&no_levels), sizeof(uint16_t));
-        for (auto name: tree_store.level_names) {
+        for (auto &name: level_names) {
             os.write(&name[0],name.size());
             // end of name marker:
             char zero = 0;
             os.write(&zero,sizeof(char));
         }
+        config.serialize_header(os);
+    }
+    
+    template <typename C>
+    void Serializer<C>::push(const label_type &label)
+    {
+        os.write(&PUSH_COMMAND, sizeof(PUSH_COMMAND));
+        config.serialize_label(os, label);
+    }
+    
+    template <typename C>
+    void Serializer<C>::store(const value_type &value)
+    {
+        os.write(&STORE_COMMAND, sizeof(STORE_COMMAND));
+        config.serialize_value(os, value);
+    }
+    
+    template <typename C>
+    void Serializer<C>::pop()
+    {
+        os.write(&POP_COMMAND, sizeof(POP_COMMAND));
+    }
+    
+    template <typename C, typename Builder>
+    void replay(const TreeStore<C> &tree_store, Builder &builder)
+    {
+        using node_type         = typename TreeStore<C>::node_type;
+        using internalnode_type = typename TreeStore<C>::internalnode_type;
         
-        // serialization of an empty tree_store is empty
         if (tree_store.root == nullptr)
             return;
         
-        // push, pop and store instructions
-        std::stack<Item> stack;
-        // , label_type *label
-        auto process = [&os, &stack, &config](const node_type* node) {
+        // children still to be replayed of every open internal node
+        struct Frame {
+            internalnode_type *node;
+            typename internalnode_type::children_repository_type::const_iterator it;
+        };
+        std::vector<Frame> stack;
+        
+        // a leaf is stored, an internal node opens a frame
+        auto enter = [&builder, &stack](node_type *node) {
             if (node->isLeafNode()) {
-                const auto leaf_node = node->asLeafNode();
-                os.write(&STORE_COMMAND, sizeof(STORE_COMMAND));
-                config.serialize_value(os, leaf_node->value);
-            }
-            else {
-                const auto inode = node->asInternalNode();
-                for (const auto &it: inode->children) {
-                    const auto &e = it.second;
-                    stack.push(Item(e.node, &e.label, POP));
-                    stack.push(Item(e.node, &e.label, PUSH));
-                }
+                builder.store(node->asLeafNode()->value);
+                return true; // done
             }
+            internalnode_type *internal = node->asInternalNode();
+            stack.push_back(Frame { internal, internal->children.cbegin() });
+            return false;
         };
         
-        stack.push(Item(tree_store.root.get()));
+        enter(tree_store.root.get());
         while (!stack.empty()) {
-            
-            Item item = stack.top(); // this is a copy
-            
-            // item.print(std::cout);
-            
-            stack.pop();
-            
-            switch (item.instruction) {
-                case ROOT:
-                    process(item.node);
-                    break;
-                case PUSH:
-                    os.write(&PUSH_COMMAND, sizeof(PUSH_COMMAND));
-                    config.serialize_label(os, *item.label);
-                    process(item.node);
-                    break;
-                case POP:
-                    os.write(&POP_COMMAND, sizeof(POP_COMMAND));
-                    break;
+            Frame &frame = stack.back();
+            if (frame.it == frame.node->children.cend()) {
+                stack.pop_back();
+                if (!stack.empty())
+                    builder.pop(); // the root was never pushed
+                continue;
             }
+            const auto &e = frame.it->second;
+            ++frame.it; // frame might be moved by enter(...)
+            builder.push(e.label);
+            if (enter(e.node))
+                builder.pop();
         }
     }
     
@@ -1534,9 +1554,16 @@ auto TreeStore<C>::operator =(TreeStore &&other) -> TreeStore&// move assign
     
     template <typename C>
     auto deserialize(std::istream &is) -> TreeStore<C>
+    {
+        C config;
+        return deserialize(is, config);
+    }
+
+    template <typename C>
+    auto deserialize(std::istream &is, C &config) -> TreeStore<C>
     {
         using treestore_type    = TreeStore<C>;
-        using config_type       = typename treestore_type::config_type;
+        //using config_type       = typename treestore_type::config_type;
         using label_type        = typename treestore_type::label_type;
         using value_type        = typename treestore_type::value_type;
         //using leafnode_type     = typename treestore_type::leafnode_type;
@@ -1547,8 +1574,6 @@ auto TreeStore<C>::operator =(TreeStore &&other) -> TreeStore&// move assign
 
         using builder_type      = TreeStoreBuilder<treestore_type>;
 
-        config_type config;
-        
         uint16_t no_levels;
         is.read(reinterpret_cast<char*>(&no_levels), sizeof(uint16_t));
         
@@ -1558,6 +1583,7 @@ auto TreeStore<C>::operator =(TreeStore &&other) -> TreeStore&// move assign
             is.getline(buffer,256,'\0');
             v.setLevelName(i, std::string(buffer));
         }
+        config.deserialize_header(is);
         
         builder_type vb(v);
         char ch;
@@ -1610,8 +1636,36 @@ auto TreeStore<C>::operator =(TreeStore &&other) -> TreeStore&// move assign
         using internalnode_type = typename treestore_type::internalnode_type;
         using node_type         = typename treestore_type::node_type;
         using edge_type         = typename treestore_type::edge_type;
+        using value_type        = typename treestore_type::value_type;
         using parameter_type    = P;
-        using format_label_func = std::function<std::string(const label_type&)>;
+
+        // writes the whole label entry of a node (e.g. "path":[0,1])
+        using format_label_func = std::function<void(::json::ChunkBuffer&, const label_type&)>;
+        
+        // writes what it is pushed, stored and popped (in depth first
+        // order) as json(...) writes a tree store with these level
+        // names, e.g. the cells of a query::result::FlatResult without
+        // building the tree
+        struct JsonBuilder {
+        public:
+            JsonBuilder(Writer &writer, ::json::ChunkBuffer &out, const std::vector<std::string> &level_names, const parameter_type &parameter);
+
+            void push(const label_type &label);
+            void store(const value_type &value);
+            void pop();
+
+            // closes what is still open (the caller finishes the buffer)
+            void finish();
+
+        private:
+            Writer                         &writer;
+            ::json::ChunkBuffer            &out;
+            const parameter_type           &parameter;
+            config_type                     config;
+            std::vector<format_label_func>  label_functions; // of every layer
+            int                             depth      { 0 };
+            int                             open_lists { 0 }; // nodes of the path with a children list
+        };
         
     public:
 
@@ -1623,6 +1677,10 @@ auto TreeStore<C>::operator =(TreeStore &&other) -> TreeStore&// move assign
         
         void json(const TreeStore<C> &tree_store, std::ostream &os, const parameter_type& parameter);
 
+        // output goes to the buffer as it is produced (the caller
+        // finishes the buffer)
+        void json(const TreeStore<C> &tree_store, ::json::ChunkBuffer &out, const parameter_type& parameter);
+
     public:
         std::vector<format_label_func> fmt_label_functions;
     };
@@ -1638,12 +1696,10 @@ auto TreeStore<C>::operator =(TreeStore &&other) -> TreeStore&// move assign
     
     template <typename C, typename P>
     auto Writer<C,P>::getLabelFormatFunction(int result_layer) -> format_label_func {
-        format_label_func default_func = [](const label_type& label) {
+        format_label_func default_func = [](::json::ChunkBuffer &out, const label_type& label) {
             config_type config; // we need to send some parameters to this guy
-            std::stringstream ss;
-            ss << "\"path\":";
-            config.print_label(ss, label);
-            return ss.str();
+            out << "\"path\":";
+            config.write_label(out, label);
         };
         
         format_label_func result;
@@ -1658,146 +1714,85 @@ auto TreeStore<C>::operator =(TreeStore &&other) -> TreeStore&// move assign
     
     template <typename C, typename P>
     void Writer<C,P>::json(const TreeStore<C> &tree_store, std::ostream &os, const parameter_type& parameter) {
-        
-        using namespace json;
+        ::json::ChunkBuffer out([&os](const char *data, std::size_t size, bool last) {
+            os.write(data, size);
+        });
+        json(tree_store, out, parameter);
+        out.finish();
+    }
 
-        using Guard     = ContextGuard;
-        
-        // empty result
-        if (!tree_store.root) {
-            
-            JsonWriter writer(os);
-            Guard g = writer.dict();
-            {
-                {
-                    Guard g2 = writer.list("layers");
-                    for (std::string level_name: tree_store.level_names) {
-                        writer << std::string("\"" + level_name + "\"");
-                    }
-                }
-                {
-                    Guard g2 = writer.dict("root");
-                }
-            }
+    template <typename C, typename P>
+    void Writer<C,P>::json(const TreeStore<C> &tree_store, ::json::ChunkBuffer &out, const parameter_type& parameter) {
+        JsonBuilder builder(*this, out, tree_store.level_names, parameter);
+        replay(tree_store, builder);
+        builder.finish();
+    }
 
-            return;
+    template <typename C, typename P>
+    Writer<C,P>::JsonBuilder::JsonBuilder(Writer &writer, ::json::ChunkBuffer &out, const std::vector<std::string> &level_names, const parameter_type &parameter):
+        writer(writer),
+        out(out),
+        parameter(parameter)
+    {
+        // same text as a ::json::JsonWriter would write, e.g.
+        // { "layers":[ "anchor:a" ], "root":{ "children":[ { "path":[1], "val":3 } ] } }
+
+        out << "{ \"layers\":[ ";
+        bool first = true;
+        for (auto &level_name: level_names) {
+            if (!first)
+                out << ", ";
+            out << '"' << level_name << '"';
+            first = false;
         }
-        
-        // int indent = 0;
-        
-        // auto S = [&indent]() -> std::string { return std::string(" ",3*indent); };
-        // auto process_node = [&os, &]
-        
-        
-        enum Op {BEGIN, END};
-        
-        using treestore_type    = TreeStore<C>;
-        using config_type       = typename treestore_type::config_type;
-        using label_type        = typename treestore_type::label_type;
-        // using value_type        = typename treestore_type::value_type;
-        using leafnode_type     = typename treestore_type::leafnode_type;
-        using internalnode_type = typename treestore_type::internalnode_type;
-        using node_type         = typename treestore_type::node_type;
-        using edge_type         = typename treestore_type::edge_type;
-        // using labelhash_type    = typename treestore_type::labelhash_type;
-        
-//        using Item      = std::tuple<node_type*, label_type, Op>;
-        
-        struct Item {
-            Item() = default;
-            
-            Item(node_type *node, label_type label, Op op, int layer):
-                node(node), label(label), op(op), layer(layer)
-            {}
-            
-            node_type  *node { nullptr };
-            label_type  label;
-            Op          op;
-            int         layer { 0 };
-        };
-        
-        
-        JsonWriter writer(os);
-        
-        std::stack<Item> stack;
-        
-        config_type config; // we need to send some parameters to this guy
-        
-        auto process = [&writer, &stack, &config, &parameter] (node_type *node, int layer) {
-            if (!node)
-                return;
-            
-            else if (node->isLeafNode()) {
-                leafnode_type *leaf = node->asLeafNode();
-                std::stringstream ss;
-                ss << "\"val\":";
-                config.print_value(ss, leaf->value, parameter);
-                writer << ss.str();
-            }
-            else if (node->isInternalNode()) {
-                internalnode_type *internal = node->asInternalNode();
-                writer.list("children");
-                for (auto &it: internal->children) {
-                    edge_type &e = it.second;
-                    stack.push(Item(e.node, e.label, END, layer+1));
-                    stack.push(Item(e.node, e.label, BEGIN, layer+1));
-                }
-            }
-        };
-        
-        
-        Guard g = writer.dict();
-        {
-            Guard g2 = writer.list("layers");
-            for (std::string level_name: tree_store.level_names) {
-                writer << std::string("\"" + level_name + "\"");
-            }
+        out << " ], \"root\":{ ";
+
+        // label functions of every layer
+        for (int layer=0;layer<=(int) level_names.size();++layer) {
+            label_functions.push_back(writer.getLabelFormatFunction(layer));
         }
-        
-        bool first = true;
-        
-        {
-            stack.push(Item(tree_store.root.get(), label_type(), END, 0));
-            stack.push(Item(tree_store.root.get(), label_type(), BEGIN, 0));
-            
-            while (!stack.empty()) {
-                
-                Item item = std::move(stack.top());
-                stack.pop();
-                
-                node_type* node  = item.node;
-                label_type label = item.label;
-                Op         op    = item.op;
-                
-                if (op == BEGIN) {
-                    if (first) {
-                        writer.dict("root"); // pushes dict context
-                    }
-                    else {
-                        writer.dict();
-                    }
-
-                    if (!first) {
-                        auto f = getLabelFormatFunction(item.layer);
-                        writer << f(label);
-                        
-//                        std::stringstream ss;
-//                        ss << "\"path\":";
-//                        config.print_label(ss, label);
-//                        writer << ss.str();
-                    }
-                    first = false;
-                    process(node, item.layer);
-                }
-                else if (op == END) {
-                    if (node->isInternalNode())
-                        writer.pop(); // pop list of children
-                    writer.pop(); // pop node dictionary
-                }
-            }
-            
+    }
+
+    template <typename C, typename P>
+    void Writer<C,P>::JsonBuilder::push(const label_type &label) {
+        // first child of the node opens its list
+        if (open_lists == depth) {
+            out << "\"children\":[ ";
+            ++open_lists;
+        }
+        else {
+            out << ", ";
         }
+        ++depth;
+        out << "{ ";
+        if ((std::size_t) depth < label_functions.size())
+            label_functions[depth](out, label);
+        else
+            writer.getLabelFormatFunction(depth)(out, label);
+        out << ", ";
+    }
+
+    template <typename C, typename P>
+    void Writer<C,P>::JsonBuilder::store(const value_type &value) {
+        out << "\"val\":";
+        config.write_value(out, value, parameter);
+    }
 
+    template <typename C, typename P>
+    void Writer<C,P>::JsonBuilder::pop() {
+        if (open_lists > depth) {
+            out << " ]";
+            open_lists = depth;
+        }
+        out << " }"; // dictionary of the child
+        --depth;
+    }
+
+    template <typename C, typename P>
+    void Writer<C,P>::JsonBuilder::finish() {
+        if (open_lists > 0)
+            out << " ]";
+        out << " } }";
     }
 
 } // tree_store namespace
@@ -1,14 +1,117 @@
 #include "tree_store_nanocube.hh"
 
 #include <algorithm>
+#include <cmath>
 
 namespace nanocube {
 
+//-----------------------------------------------------------------
+// Measure Impl.
+//-----------------------------------------------------------------
+
+Measure::Measure(uint64_t count):
+    integral(true),
+    count(count)
+{}
+
+Measure::Measure(double value):
+    integral(false),
+    value(value)
+{}
+
+double Measure::asDouble() const {
+    return integral ? (double) count : value;
+}
+
+bool operator==(const Measure &a, const Measure &b) {
+    if (a.integral && b.integral)
+        return a.count == b.count;
+    return a.asDouble() == b.asDouble();
+}
+
+bool operator!=(const Measure &a, const Measure &b) {
+    return !(a == b);
+}
+
+bool operator<(const Measure &a, const Measure &b) {
+    if (a.integral && b.integral)
+        return a.count < b.count;
+    return a.asDouble() < b.asDouble();
+}
+
+bool operator>(const Measure &a, const Measure &b) {
+    return b < a;
+}
+
+Measure evalOp(const Measure &a, const Measure &b, ::tree_store::StoreOp op, ::tree_store::StoreMode store_mode) {
+    if (a.integral && b.integral) {
+        const Measure &x = store_mode == ::tree_store::INVERTED ? b : a;
+        const Measure &y = store_mode == ::tree_store::INVERTED ? a : b;
+        switch (op) {
+        case ::tree_store::SET:
+            return y;
+        case ::tree_store::ADD:
+            return Measure(x.count + y.count);
+        case ::tree_store::SUB:
+            if (x.count >= y.count)
+                return Measure(x.count - y.count);
+            break;
+        default:
+            break;
+        }
+    }
+    return Measure(::tree_store::evalOp(a.asDouble(), b.asDouble(), op, store_mode));
+}
+
+//-----------------------------------------------------------------
+// Measures Impl.
+//-----------------------------------------------------------------
+
+Measures::Measures(uint64_t count):
+    first(count)
+{}
+
+Measures::Measures(double value):
+    first(value)
+{}
+
+std::size_t Measures::size() const {
+    return 1 + rest.size();
+}
+
+void Measures::resize(std::size_t n) {
+    rest.resize(n > 1 ? n - 1 : 0);
+}
+
+const Measure& Measures::operator[](std::size_t i) const {
+    return i == 0 ? first : rest[i-1];
+}
+
+Measure& Measures::operator[](std::size_t i) {
+    return i == 0 ? first : rest[i-1];
+}
+
+Measures evalOp(const Measures &a, const Measures &b, ::tree_store::StoreOp op, ::tree_store::StoreMode store_mode) {
+    Measures result;
+    if (a.rest.empty() && b.rest.empty()) {
+        result.first = evalOp(a.first, b.first, op, store_mode);
+        return result;
+    }
+    auto n = std::max(a.size(), b.size());
+    result.resize(n);
+    for (std::size_t i=0;i<n;++i) {
+        Measure va = i < a.size() ? a[i] : Measure();
+        Measure vb = i < b.size() ? b[i] : Measure();
+        result[i] = evalOp(va, vb, op, store_mode);
+    }
+    return result;
+}
+
 //-----------------------------------------------------------------
 // SimpleConfig Impl.
 //-----------------------------------------------------------------
 
-const double SimpleConfig::default_value = 0.0f;
+const SimpleConfig::value_type SimpleConfig::default_value = Measures();
 
 std::size_t SimpleConfig::operator()(const label_type &label) const {
     std::size_t hash_value = 0;
@@ -32,11 +135,61 @@ std::ostream& SimpleConfig::print_label(std::ostream& os, const label_type &labe
     return os;
 }
 
+static void printMeasure(std::ostream& os, const Measure &m) {
+    if (m.integral)
+        os << m.count;
+    else
+        os << m.value;
+}
+
 std::ostream& SimpleConfig::print_value(std::ostream& os, const value_type &value, const parameter_type& parameter) const {
-    os << value;
+    if (value.size() == 1) {
+        printMeasure(os, value.first);
+        return os;
+    }
+    os << "[";
+    for (std::size_t i=0;i<value.size();++i) {
+        if (i > 0)
+            os << ",";
+        printMeasure(os, value[i]);
+    }
+    os << "]";
     return os;
 }
 
+void SimpleConfig::write_label(::json::ChunkBuffer& out, const label_type &label) const {
+    out << '[';
+    bool first = true;
+    for (auto l: label) {
+        if (!first)
+            out << ',';
+        out.writeInt(l);
+        first = false;
+    }
+    out << ']';
+}
+
+static void writeMeasure(::json::ChunkBuffer& out, const Measure &m) {
+    if (m.integral)
+        out.writeUInt(m.count);
+    else
+        out.writeDouble(m.value);
+}
+
+void SimpleConfig::write_value(::json::ChunkBuffer& out, const value_type &value, const parameter_type& parameter) const {
+    if (value.size() == 1) {
+        writeMeasure(out, value.first);
+        return;
+    }
+    out << '[';
+    for (std::size_t i=0;i<value.size();++i) {
+        if (i > 0)
+            out << ',';
+        writeMeasure(out, value[i]);
+    }
+    out << ']';
+}
+
 std::ostream& SimpleConfig::serialize_label(std::ostream& os, const label_type &label) {
     uint16_t n = static_cast<uint16_t>(label.size());
     os.write(reinterpret_cast<char*>(&n), sizeof(uint16_t));
@@ -59,13 +212,47 @@ std::istream& SimpleConfig::deserialize_label(std::istream& is, label_type &labe
     return is;
 }
 
+// a single measure per value keeps the original layout (no header)
+std::ostream& SimpleConfig::serialize_header(std::ostream& os) {
+    if (num_measures > 1) {
+        uint16_t n = static_cast<uint16_t>(num_measures);
+        os.write(reinterpret_cast<char*>(&n), sizeof(uint16_t));
+    }
+    return os;
+}
+
+// num_measures is the number of variables of the query that produced
+// the stream: the header is only there if there was more than one
+std::istream& SimpleConfig::deserialize_header(std::istream& is) {
+    if (num_measures > 1) {
+        uint16_t n = 1;
+        is.read(reinterpret_cast<char*>(&n), sizeof(uint16_t));
+        num_measures = n;
+    }
+    return is;
+}
+
+// one double per measure (every cell of a result has the same
+// number of measures: the number of queried variables)
 std::ostream& SimpleConfig::serialize_value(std::ostream& os, const value_type &value) {
-    os.write(reinterpret_cast<const char*>(&value), sizeof(double));
+    for (std::size_t i=0;i<num_measures;++i) {
+        double v = i < value.size() ? value[i].asDouble() : 0.0;
+        os.write(reinterpret_cast<const char*>(&v), sizeof(double));
+    }
     return os;
 }
 
+// doubles holding a count below 2^53 become exact counts again
 std::istream& SimpleConfig::deserialize_value(std::istream& is, value_type &value) {
-    is.read(reinterpret_cast<char*>(&value), sizeof(double));
+    value.resize(num_measures);
+    for (std::size_t i=0;i<value.size();++i) {
+        double v = 0.0;
+        is.read(reinterpret_cast<char*>(&v), sizeof(double));
+        if (v >= 0.0 && v < 9007199254740992.0 && v == std::floor(v))
+            value[i] = Measure((uint64_t) v);
+        else
+            value[i] = Measure(v);
+    }
     return is;
 }
 
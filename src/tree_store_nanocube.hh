@@ -3,10 +3,74 @@
 #include "address.hh"
 #include "tree_store.hh"
 
+#include <cstdint>
 #include <iostream>
+#include <vector>
 
 namespace nanocube {
 
+//-----------------------------------------------------------------
+// Measure
+//-----------------------------------------------------------------
+
+//
+// One total of a result cell. The variables of a cube are unsigned
+// integers, so a total stays an exact 64-bit count while it is only
+// added, set or subtracted (without going below zero); any other
+// operation, or a value that is not a count, turns it into a double.
+//
+struct Measure {
+public:
+    Measure() = default;
+    Measure(uint64_t count);
+    Measure(double value);
+
+    double asDouble() const;
+
+public:
+    bool integral { true };
+    union {
+        uint64_t count { 0 }; // integral
+        double   value;       // otherwise
+    };
+};
+
+bool operator==(const Measure &a, const Measure &b);
+bool operator!=(const Measure &a, const Measure &b);
+bool operator<(const Measure &a, const Measure &b);
+bool operator>(const Measure &a, const Measure &b);
+
+Measure evalOp(const Measure &a, const Measure &b, ::tree_store::StoreOp op, ::tree_store::StoreMode store_mode);
+
+//-----------------------------------------------------------------
+// Measures
+//-----------------------------------------------------------------
+
+//
+// Value of a query result cell: one total per queried variable (in
+// the order they were requested). The first one is kept inline so
+// that single variable queries (the common case) don't allocate.
+//
+struct Measures {
+public:
+    Measures() = default;
+    Measures(uint64_t count); // a single measure
+    Measures(double value);   // a single measure
+
+    std::size_t size() const;
+    void resize(std::size_t n);
+
+    const Measure& operator[](std::size_t i) const;
+    Measure&       operator[](std::size_t i);
+
+public:
+    Measure              first;
+    std::vector<Measure> rest;
+};
+
+// element-wise (missing measures count as zero)
+Measures evalOp(const Measures &a, const Measures &b, ::tree_store::StoreOp op, ::tree_store::StoreMode store_mode);
+
 //-----------------------------------------------------------------
 // SimpleConfig
 //-----------------------------------------------------------------
@@ -15,10 +79,10 @@ struct SimpleConfig {
     
     using label_type       = ::nanocube::DimAddress;
     using label_item_type  = typename label_type::value_type;
-    using value_type       = double;
+    using value_type       = Measures;
     using parameter_type   = int; // dummy parameter
     
-    static const double default_value;
+    static const value_type default_value;
     
     std::size_t operator()(const label_type &label) const;
     
@@ -26,14 +90,27 @@ struct SimpleConfig {
     
     std::ostream& print_value(std::ostream& os, const value_type &value, const parameter_type& parameter) const;
     
+    // same text as print_label/print_value (used by the json encoder)
+    void write_label(::json::ChunkBuffer& out, const label_type &label) const;
+    
+    void write_value(::json::ChunkBuffer& out, const value_type &value, const parameter_type& parameter) const;
+    
     std::ostream& serialize_label(std::ostream& os, const label_type &label);
     
     std::istream& deserialize_label(std::istream& is, label_type &label);
     
+    // written after the level names: the number of measures per value
+    // (only when there is more than one)
+    std::ostream& serialize_header(std::ostream& os);
+    
+    std::istream& deserialize_header(std::istream& is);
+    
     std::ostream& serialize_value(std::ostream& os, const value_type &value);
     
     std::istream& deserialize_value(std::istream& is, value_type &value);
     
+    std::size_t num_measures { 1 }; // measures per value
+    
 };
 
 using TreeValue = tree_store::TreeStore<SimpleConfig>;
@@ -0,0 +1,149 @@
+//
+// Parse cost against query cost (the numbers behind the plan cache).
+//
+// Every query is parsed n times with a new parser per parse (what a
+// request used to pay for the grammar) and with one reused parser (what
+// a server thread pays now). With -p, the same query is then sent n
+// times to a nanocube server on that port of localhost, each request on
+// a new connection, and the whole request is timed: the difference
+// between a server started with and without --plan-cache-size 0 is the
+// cost of compiling the plan.
+//
+//     bench_parse [-n <count>] [-p <port>] [<query> ...]
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "nanocube_language.hh"
+
+namespace {
+
+using Clock  = std::chrono::steady_clock;
+using Parser = ::nanocube::lang::Parser<std::string::const_iterator>;
+
+// queries of the crime50k example (see API.md)
+const char *default_queries[] = {
+    "count.a(\"location\",dive([2,1,2],8))",
+    "count.r(\"time\",mt_interval_sequence(480,24,10)).a(\"location\",dive([2,1,2],8)).a(\"crime\",dive([],1))",
+    "count.r(\"location\",degrees_mask(\"-87.65,41.88,-87.62,41.88,-87.62,41.90,-87.65,41.90\",25))",
+};
+
+double micros(Clock::duration d)
+{
+    return std::chrono::duration<double, std::micro>(d).count();
+}
+
+// median and mean of the samples (microseconds)
+void report(const std::string &what, std::vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for (auto s: samples)
+        sum += s;
+    std::cout << "  " << std::left << std::setw(20) << what << std::right << std::fixed << std::setprecision(1)
+              << " median " << std::setw(9) << samples[samples.size() / 2] << "us"
+              << "   mean " << std::setw(9) << sum / samples.size() << "us" << std::endl;
+}
+
+// whole response of GET /<query> on a new connection
+std::size_t request(int port, const std::string &query)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw std::runtime_error("socket() failed");
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family      = AF_INET;
+    address.sin_port        = htons((uint16_t) port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        throw std::runtime_error("could not connect to port " + std::to_string(port));
+    }
+    std::string message = "GET /" + query + " HTTP/1.0\r\n\r\n";
+    std::size_t sent = 0;
+    while (sent < message.size()) {
+        auto n = send(fd, message.data() + sent, message.size() - sent, 0);
+        if (n <= 0)
+            break;
+        sent += (std::size_t) n;
+    }
+    std::size_t received = 0;
+    char buffer[1 << 16];
+    for (;;) {
+        auto n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0)
+            break;
+        received += (std::size_t) n;
+    }
+    close(fd);
+    return received;
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    int count = 1000;
+    int port  = 0;
+    std::vector<std::string> queries;
+    for (int i=1;i<argc;++i) {
+        std::string arg(argv[i]);
+        if (arg == "-n" && i + 1 < argc)
+            count = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "-p" && i + 1 < argc)
+            port = std::atoi(argv[++i]);
+        else
+            queries.push_back(arg);
+    }
+    if (queries.empty())
+        queries.assign(std::begin(default_queries), std::end(default_queries));
+
+    Parser reused;
+    for (auto &query: queries) {
+        std::cout << query << std::endl;
+
+        std::vector<double> samples;
+        for (int i=0;i<count;++i) {
+            auto start = Clock::now();
+            std::unique_ptr<Parser> parser(new Parser());
+            parser->parse(query.begin(), query.end());
+            samples.push_back(micros(Clock::now() - start));
+        }
+        report("parse (new parser)", samples);
+
+        samples.clear();
+        for (int i=0;i<count;++i) {
+            auto start = Clock::now();
+            reused.parse(query.begin(), query.end());
+            samples.push_back(micros(Clock::now() - start));
+        }
+        report("parse (reused)", samples);
+
+        if (port) {
+            samples.clear();
+            std::size_t bytes = 0;
+            for (int i=0;i<count;++i) {
+                auto start = Clock::now();
+                bytes = request(port, query);
+                samples.push_back(micros(Clock::now() - start));
+            }
+            report("request", samples);
+            std::cout << "  " << bytes << " bytes per response" << std::endl;
+        }
+    }
+    return 0;
+}
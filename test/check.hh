@@ -0,0 +1,27 @@
+//
+// Checks shared by the test programs: CHECK counts a failed condition
+// and keeps going, checkSummary() reports the count as the exit status
+// of main.
+//
+
+#pragma once
+
+#include <iostream>
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond) \
+    do { if (!(cond)) { ++failures; std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; } } while (0)
+
+int checkSummary()
+{
+    if (failures) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+} // anonymous namespace
@@ -10,6 +10,16 @@ if [ "$?" = "1" ]; then
 	exit
 fi
 
+# Test for gzip (exit on error)
+which gzip >> /dev/null
+if [ "$?" = "1" ]; then
+	echo "********************"
+	echo "The nctest script requires gzip, but it was not found on your system."
+	echo "Please install it or update your PATH environment variable to include gzip."
+	echo "********************"
+	exit
+fi
+
 # Test for sed (exit on error)
 which sed >> /dev/null
 if [ "$?" = "1" ]; then
@@ -91,6 +101,25 @@ sort out.txt > out_sorted.txt
 
 diff out_sorted.txt nctest_output_expected_sorted.txt
 tmp=$?
+
+
+# Compressed responses: a large response requested with gzip must
+# decode to the plain one and a small one is not compressed.
+url='http://localhost:29512/count.a("location",dive([2,1,2],8)).r("time",mt_interval_sequence(480,24,10))'
+wget -q -O plain.txt "$url"
+wget -q -O - --header='Accept-Encoding: gzip' "$url" | gzip -dc > gunzipped.txt 2>/dev/null
+cmp -s plain.txt gunzipped.txt
+if [ $? -ne 0 ]; then
+	echo "gzip response of $url does not match the plain one"
+	tmp=1
+fi
+wget -q -S -O /dev/null --header='Accept-Encoding: gzip' 'http://localhost:29512/count' 2>&1 | grep -qi "Content-Encoding"
+if [ $? -eq 0 ]; then
+	echo "small response was compressed"
+	tmp=1
+fi
+/bin/rm -f plain.txt gunzipped.txt
+
 if [ $tmp -ne 0 ]; then
 echo "********************"
 echo "FAILURE: Test output does not match expected results.  Please do a manual comparison to see what might be going wrong."
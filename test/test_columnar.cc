@@ -0,0 +1,353 @@
+//
+// .bin2() round trip: results are encoded with columnar_result::encode
+// and decoded following the layout documented in API.md; every cell
+// must come back with its key columns (in sorted order) and measures.
+// The same cells emitted by a query::result::FlatResult must encode to
+// the same bytes as their tree.
+//
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ColumnarResult.hh"
+#include "FlatResult.hh"
+#include "tree_store_nanocube.hh"
+
+#include "check.hh"
+
+namespace {
+
+using columnar_result::LayerKind;
+
+using Key    = std::vector<int64_t>;
+using Values = std::vector<double>;
+using Cells  = std::map<Key, Values>; // sorted as the rows of .bin2()
+
+//-----------------------------------------------------------------------------
+// Decoder (API.md)
+//-----------------------------------------------------------------------------
+
+struct Decoded {
+    uint16_t                 version      { 0 };
+    std::vector<uint8_t>     kinds;
+    std::vector<std::string> names;
+    uint32_t                 num_measures { 0 };
+    std::vector<Key>         keys;
+    std::vector<Values>      values;
+    int                      encodings[2] { 0, 0 }; // key columns per encoding
+};
+
+struct Reader {
+    Reader(const std::string &data): data(data) {}
+
+    template <typename T>
+    T read() {
+        if (offset + sizeof(T) > data.size())
+            throw std::runtime_error("bin2: truncated");
+        T value;
+        std::memcpy(&value, data.data() + offset, sizeof(T));
+        offset += sizeof(T);
+        return value;
+    }
+
+    const std::string &data;
+    std::size_t        offset { 0 };
+};
+
+Decoded decode(const std::string &data)
+{
+    Decoded result;
+    Reader in(data);
+
+    CHECK(data.compare(0, 4, "NCB2") == 0);
+    in.offset = 4;
+    result.version = in.read<uint16_t>();
+    uint16_t num_layers = in.read<uint16_t>();
+    result.num_measures = in.read<uint32_t>();
+    CHECK(in.read<uint32_t>() == 0);
+    uint64_t n = in.read<uint64_t>();
+
+    std::size_t num_columns = 0;
+    for (int i=0;i<num_layers;++i) {
+        result.kinds.push_back(in.read<uint8_t>());
+        num_columns += in.read<uint8_t>();
+        uint16_t size = in.read<uint16_t>();
+        result.names.push_back(data.substr(in.offset, size));
+        in.offset += size;
+    }
+    in.offset = (in.offset + 7) / 8 * 8;
+
+    result.keys.assign(n, Key(num_columns));
+    for (std::size_t j=0;j<num_columns;++j) {
+        CHECK(in.offset % 8 == 0);
+        uint8_t  encoding = in.read<uint8_t>();
+        uint8_t  bits     = in.read<uint8_t>();
+        CHECK(in.read<uint16_t>() == 0);
+        uint32_t size     = in.read<uint32_t>();
+        uint64_t base     = in.read<uint64_t>();
+        CHECK(size % 8 == 0);
+        CHECK(size == ((uint64_t) bits * n + 63) / 64 * 8);
+        CHECK(encoding <= 1);
+        result.encodings[encoding & 1]++;
+
+        std::vector<uint64_t> words(size / 8);
+        if (size)
+            std::memcpy(words.data(), data.data() + in.offset, size);
+        in.offset += size;
+
+        int64_t previous = 0;
+        for (uint64_t i=0;i<n;++i) {
+            uint64_t offset = 0;
+            if (bits) {
+                uint64_t position = i * bits;
+                uint64_t w = position / 64;
+                int      b = (int) (position % 64);
+                offset = words[w] >> b;
+                if (b + bits > 64)
+                    offset |= words[w + 1] << (64 - b);
+                if (bits < 64)
+                    offset &= (1ULL << bits) - 1;
+            }
+            uint64_t z = base + offset;
+            if (encoding == 0) {
+                result.keys[i][j] = (int64_t) z;
+            }
+            else {
+                previous += (int64_t) (z >> 1) ^ -(int64_t) (z & 1);
+                result.keys[i][j] = previous;
+            }
+        }
+    }
+
+    result.values.assign(n, Values(result.num_measures));
+    for (uint32_t m=0;m<result.num_measures;++m) {
+        CHECK(in.offset % 8 == 0);
+        for (uint64_t i=0;i<n;++i)
+            result.values[i][m] = in.read<double>();
+    }
+    CHECK(in.offset == data.size());
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+// Results
+//-----------------------------------------------------------------------------
+
+// a layer of a cell: its label and its key columns
+struct Layer {
+    ::nanocube::DimAddress label;
+    Key                    key;
+};
+
+// labels of any size packed as a FlatResult packs the address of a
+// quadtree or of a flattree: the number of items on the high bits and
+// the items on bits_per_item bits each
+template <int bits_per_item>
+struct PackedAddress {
+    PackedAddress(uint64_t raw): value(raw) {}
+
+    PackedAddress(const ::nanocube::DimAddress &label) {
+        for (auto item: label)
+            value = (value << bits_per_item) | (uint64_t) item;
+        value |= (uint64_t) label.size() << 56;
+    }
+
+    uint64_t raw() const { return value; }
+
+    ::nanocube::DimAddress getDimensionPath() const {
+        ::nanocube::DimAddress label(value >> 56);
+        uint64_t items = value & ((1ULL << 56) - 1);
+        for (auto i=label.size();i>0;--i) {
+            label[i - 1] = (int) (items & ((1ULL << bits_per_item) - 1));
+            items >>= bits_per_item;
+        }
+        return label;
+    }
+
+    uint64_t value { 0 };
+};
+
+Layer quadtreeLayer(std::mt19937_64 &rng, int max_level)
+{
+    Layer layer;
+    int level = std::uniform_int_distribution<int>(0, max_level)(rng);
+    int64_t x = 0, y = 0;
+    for (int i=0;i<level;++i) {
+        int d = (int) (rng() % 4);
+        layer.label.push_back(d);
+        x = (x << 1) | (d & 1);
+        y = (y << 1) | ((d >> 1) & 1);
+    }
+    layer.key = { level, x, y };
+    return layer;
+}
+
+Layer categoryLayer(std::mt19937_64 &rng)
+{
+    Layer layer;
+    if (rng() % 8 == 0) {
+        layer.key = { 0, 0 };
+    }
+    else {
+        int id = (int) (rng() % 300);
+        layer.label = { id };
+        layer.key   = { 1, id };
+    }
+    return layer;
+}
+
+Layer timeLayer(std::mt19937_64 &rng, int base, int spread)
+{
+    int bin = base + (int) (rng() % spread);
+    return Layer { { bin }, { bin } };
+}
+
+Layer imageLayer(std::mt19937_64 &rng)
+{
+    int x = (int) (rng() % 256);
+    int y = (int) (rng() % 256);
+    return Layer { { x, y }, { x, y } };
+}
+
+struct Result {
+    Result(const std::vector<LayerKind> &kinds, std::size_t num_measures):
+        kinds(kinds),
+        num_measures(num_measures),
+        tree_value((int) kinds.size())
+    {
+        for (std::size_t i=0;i<kinds.size();++i)
+            tree_value.setLevelName((int) i, "layer" + std::to_string(i));
+        flat_result.reset((int) kinds.size());
+    }
+
+    void add(const std::vector<Layer> &layers, const std::vector<uint64_t> &counts) {
+        Key key;
+        for (auto &layer: layers)
+            key.insert(key.end(), layer.key.begin(), layer.key.end());
+        if (cells.count(key))
+            return;
+
+        ::nanocube::Measures value;
+        value.resize(counts.size());
+        Values expected;
+        for (std::size_t m=0;m<counts.size();++m) {
+            value[m] = ::nanocube::Measure(counts[m]);
+            expected.push_back((double) counts[m]);
+        }
+        cells[key] = expected;
+
+        ::nanocube::TreeValueBuilder builder(tree_value);
+        for (auto &layer: layers)
+            builder.push(layer.label);
+        builder.store(value, ::tree_store::SET);
+        for (std::size_t i=0;i<layers.size();++i)
+            builder.pop();
+
+        for (std::size_t i=0;i<layers.size();++i) {
+            if (kinds[i] == columnar_result::QUADTREE)
+                flat_result.pushAddress(PackedAddress<2>(layers[i].label));
+            else if (kinds[i] == columnar_result::CATEGORY)
+                flat_result.pushAddress(PackedAddress<16>(layers[i].label));
+            else
+                flat_result.push(layers[i].label);
+        }
+        flat_result.store(value, ::tree_store::SET);
+        for (std::size_t i=0;i<layers.size();++i)
+            flat_result.pop();
+    }
+
+    void check() {
+        std::string encoded = ::columnar_result::encode(tree_value, kinds);
+        Decoded decoded = decode(encoded);
+
+        ::columnar_result::Encoder encoder(kinds, tree_value.level_names);
+        flat_result.emit(encoder);
+        CHECK(encoder.finish() == encoded);
+
+        CHECK(decoded.version == ::columnar_result::FORMAT_VERSION);
+        CHECK(decoded.kinds.size() == kinds.size());
+        for (std::size_t i=0;i<kinds.size() && i<decoded.kinds.size();++i) {
+            CHECK(decoded.kinds[i] == (uint8_t) kinds[i]);
+            CHECK(decoded.names[i] == tree_value.level_names[i]);
+        }
+        CHECK(decoded.num_measures == (cells.empty() ? 1 : num_measures));
+        CHECK(decoded.keys.size() == cells.size());
+
+        std::size_t i = 0;
+        for (auto &cell: cells) {
+            if (i >= decoded.keys.size())
+                break;
+            CHECK(decoded.keys[i] == cell.first);
+            CHECK(decoded.values[i] == cell.second);
+            ++i;
+        }
+        encodings[0] += decoded.encodings[0];
+        encodings[1] += decoded.encodings[1];
+    }
+
+    std::vector<LayerKind>      kinds;
+    std::size_t                 num_measures;
+    ::nanocube::TreeValue       tree_value;
+    ::query::result::FlatResult flat_result;
+    Cells                       cells;
+
+    static int encodings[2];
+};
+
+int Result::encodings[2] = { 0, 0 };
+
+} // anonymous namespace
+
+int main()
+{
+    std::mt19937_64 rng(7);
+
+    {
+        // wide and sparse keys, two measures with large counts
+        Result result({ columnar_result::QUADTREE, columnar_result::CATEGORY, columnar_result::TIME_BIN }, 2);
+        for (int i=0;i<3000;++i) {
+            result.add({ quadtreeLayer(rng, 25), categoryLayer(rng), timeLayer(rng, 0, 1 << 20) },
+                       { 1 + rng() % 1000, rng() >> 12 });
+        }
+        result.check();
+    }
+
+    {
+        // a dense run of time bins far from zero (delta encoded)
+        Result result({ columnar_result::TIME_BIN }, 1);
+        for (int i=0;i<500;++i)
+            result.add({ Layer { { 1000000 + i }, { 1000000 + i } } }, { (uint64_t) i + 1 });
+        result.check();
+    }
+
+    {
+        // a single cell: every key column has bit width 0
+        Result result({ columnar_result::IMAGE }, 1);
+        result.add({ imageLayer(rng) }, { 42 });
+        result.check();
+    }
+
+    {
+        // image tiles and shallow quadtree cells
+        Result result({ columnar_result::IMAGE, columnar_result::QUADTREE }, 3);
+        for (int i=0;i<1000;++i)
+            result.add({ imageLayer(rng), quadtreeLayer(rng, 3) }, { rng() % 10, rng() % 100, rng() % 1000 });
+        result.check();
+    }
+
+    {
+        // no cells
+        Result result({ columnar_result::CATEGORY }, 1);
+        result.check();
+    }
+
+    CHECK(Result::encodings[0] > 0);
+    CHECK(Result::encodings[1] > 0);
+
+    return checkSummary();
+}
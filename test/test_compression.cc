@@ -0,0 +1,159 @@
+//
+// Accept-Encoding negotiation and the gzip/deflate streams of
+// compression::Deflater: a body written in pieces of any size must
+// inflate back to itself and carry the header of its encoding.
+//
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "Compression.hh"
+
+#include "check.hh"
+
+namespace {
+
+using compression::Encoding;
+
+void testNegotiate()
+{
+    struct Case {
+        const char *header;
+        Encoding    expected;
+    };
+    std::vector<Case> cases {
+        { nullptr,                     compression::IDENTITY },
+        { "",                          compression::IDENTITY },
+        { "identity",                  compression::IDENTITY },
+        { "br",                        compression::IDENTITY },
+        { "gzipx, xdeflate",           compression::IDENTITY },
+        { "gzip",                      compression::GZIP     },
+        { "GZip",                      compression::GZIP     },
+        { "deflate",                   compression::DEFLATE  },
+        { "deflate, gzip",             compression::GZIP     }, // gzip is preferred
+        { "gzip;q=0.2, deflate",       compression::GZIP     },
+        { "gzip;q=0, deflate",         compression::DEFLATE  },
+        { "gzip; q=0.0, deflate;q=0",  compression::IDENTITY },
+        { " br , deflate ;q=0.5 ",     compression::DEFLATE  },
+        { "*",                         compression::GZIP     },
+        { "*;q=0",                     compression::IDENTITY },
+        { "*;q=0, deflate",            compression::DEFLATE  },
+        { "gzip;q=0, *",               compression::DEFLATE  },
+        { "identity, *;q=0",           compression::IDENTITY },
+    };
+    for (auto &c: cases) {
+        Encoding encoding = compression::negotiate(c.header);
+        if (encoding != c.expected) {
+            ++failures;
+            std::cerr << "negotiate(\"" << (c.header ? c.header : "(null)") << "\") is "
+                      << compression::name(encoding) << ", expected "
+                      << compression::name(c.expected) << std::endl;
+        }
+    }
+    CHECK(std::string(compression::name(compression::GZIP))    == "gzip");
+    CHECK(std::string(compression::name(compression::DEFLATE)) == "deflate");
+}
+
+// inflate with the window bits of one format only, so that a stream of
+// the other format is an error
+bool inflateAs(Encoding encoding, const std::string &data, std::string &result)
+{
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, encoding == compression::GZIP ? 15 + 16 : 15) != Z_OK)
+        return false;
+
+    result.clear();
+    std::vector<char> buffer(1 << 14);
+    stream.next_in  = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = (uInt) data.size();
+    int status = Z_OK;
+    while (status == Z_OK) {
+        stream.next_out  = reinterpret_cast<Bytef*>(buffer.data());
+        stream.avail_out = (uInt) buffer.size();
+        status = inflate(&stream, Z_NO_FLUSH);
+        result.append(buffer.data(), buffer.size() - stream.avail_out);
+        if (status == Z_BUF_ERROR && stream.avail_in == 0)
+            break;
+    }
+    bool ok = status == Z_STREAM_END && stream.avail_in == 0;
+    inflateEnd(&stream);
+    return ok;
+}
+
+std::string body(std::mt19937_64 &rng, std::size_t size, bool random_bytes)
+{
+    std::string result;
+    result.reserve(size);
+    while (result.size() < size) {
+        if (random_bytes)
+            result.push_back((char) (rng() & 0xFF));
+        else
+            result += "{ \"path\":[" + std::to_string(rng() % 4) + "], \"val\":" + std::to_string(rng() % 1000) + " }, ";
+    }
+    result.resize(size);
+    return result;
+}
+
+void testRoundTrip(std::mt19937_64 &rng, Encoding encoding, int level, std::size_t size, bool random_bytes)
+{
+    std::string original = body(rng, size, random_bytes);
+
+    // whole body
+    std::string compressed = compression::compress(encoding, level, original.data(), original.size());
+    std::string inflated;
+    CHECK(inflateAs(encoding, compressed, inflated));
+    CHECK(inflated == original);
+    CHECK(!inflateAs(encoding == compression::GZIP ? compression::DEFLATE : compression::GZIP, compressed, inflated));
+    if (encoding == compression::GZIP)
+        CHECK(compressed.size() >= 2 && (uint8_t) compressed[0] == 0x1f && (uint8_t) compressed[1] == 0x8b);
+    if (!random_bytes && size >= 1024)
+        CHECK(compressed.size() < original.size() / 2);
+
+    // the same body as chunks of any size (and an empty last write)
+    std::string streamed;
+    std::size_t sink_calls = 0;
+    compression::Deflater deflater(encoding, level);
+    auto sink = [&streamed, &sink_calls](const char *data, std::size_t n) {
+        streamed.append(data, n);
+        ++sink_calls;
+    };
+    std::size_t position = 0;
+    while (position < original.size()) {
+        std::size_t n = std::min<std::size_t>(original.size() - position, rng() % 3 == 0 ? 0 : rng() % 100000);
+        deflater.write(original.data() + position, n, false, sink);
+        position += n;
+    }
+    deflater.write(nullptr, 0, true, sink);
+    CHECK(inflateAs(encoding, streamed, inflated));
+    CHECK(inflated == original);
+    if (random_bytes && size > (1 << 17))
+        CHECK(sink_calls > 1); // output buffer filled more than once
+}
+
+} // anonymous namespace
+
+int main()
+{
+    testNegotiate();
+
+    std::mt19937_64 rng(14);
+    for (auto encoding: { compression::GZIP, compression::DEFLATE }) {
+        for (int level: { 1, 6, 9 }) {
+            testRoundTrip(rng, encoding, level, 0, false);
+            testRoundTrip(rng, encoding, level, 1, false);
+            testRoundTrip(rng, encoding, level, 1024, false);
+            testRoundTrip(rng, encoding, level, 300000, false);
+            testRoundTrip(rng, encoding, level, 300000, true);
+        }
+    }
+
+    return checkSummary();
+}
@@ -0,0 +1,233 @@
+//
+// Mask traversals of a QuadTree: the walk of a packed mask (as handed
+// out by a mask store) and the walk of the Morton intervals of a mask
+// must visit the same nodes as the lockstep walk of the
+// labeled_tree::Node they come from, with and without trimming.
+//
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "QuadTree.hh"
+#include "MaskStore.hh"
+#include "polycover/interval_mask.hh"
+#include "polycover/labeled_tree.hh"
+#include "polycover/packed_tree.hh"
+
+#include "check.hh"
+
+namespace {
+
+using polycover::labeled_tree::IntervalMask;
+using polycover::labeled_tree::Node;
+using polycover::labeled_tree::NodeCursor;
+using polycover::labeled_tree::PackedCursor;
+using polycover::labeled_tree::PackedTree;
+
+struct Content {}; // the walks never touch the content
+
+static const quadtree::BitSize LEVELS = 10;
+
+using Tree        = quadtree::QuadTree<LEVELS, Content>;
+using NodeType    = Tree::NodeType;
+using AddressType = Tree::AddressType;
+
+using Visits = std::vector<std::pair<uint64_t, const NodeType*>>;
+
+struct Recorder {
+    void visit(NodeType *node, const AddressType &address) {
+        visits.push_back({ address.raw(), node });
+    }
+    Visits visits;
+};
+
+// the lockstep walk of the tree and a labeled_tree::Node mask
+void nodeWalk(NodeType *node, const AddressType &address, NodeCursor mask, Visits &visits)
+{
+    if (mask.isLeaf()) {
+        visits.push_back({ address.raw(), node });
+        return;
+    }
+    auto num_children = node->getNumChildren();
+    const quadtree::ChildName *names = quadtree::childEntryIndexToName[node->key()];
+    auto children = node->getChildrenArray();
+    for (int i=0;i<num_children;++i) {
+        auto child_mask = mask.child((polycover::labeled_tree::ChildLabel) names[i]);
+        if (child_mask.valid())
+            nodeWalk(children[i].getNode(), address.childAddress(names[i]), child_mask, visits);
+    }
+}
+
+Visits sorted(Visits visits)
+{
+    std::sort(visits.begin(), visits.end());
+    return visits;
+}
+
+// tree with random points, dense around a corner
+void fill(Tree &tree, std::mt19937_64 &rng, int num_points)
+{
+    for (int i=0;i<num_points;++i) {
+        int level = (int) (rng() % (LEVELS + 1));
+        uint32_t side = 1u << level;
+        uint32_t range = (i % 2) ? side : std::max<uint32_t>(1, side / 8);
+        AddressType address((quadtree::Coordinate) (rng() % range), (quadtree::Coordinate) (rng() % range), level,
+                            quadtree::FLAG_HIGH_LEVEL_COORDS);
+        Tree::NodeStackType stack;
+        std::vector<void*>  replaced_nodes;
+        tree.prepareProperOutdatedPath(nullptr, address, replaced_nodes, stack);
+    }
+}
+
+// random mask down to max_depth levels (deeper than the tree too)
+void grow(Node &node, std::mt19937_64 &rng, int depth, int max_depth)
+{
+    if (depth == max_depth)
+        return;
+    int split = (int) (rng() % 10);
+    if (depth > 0 && split < 1)
+        return; // leaf
+    for (int label=0;label<4;++label) {
+        if (rng() % 4 != 0)
+            grow(*node.advance((polycover::labeled_tree::ChildLabel) label), rng, depth + 1, max_depth);
+    }
+}
+
+std::unique_ptr<Node> randomMask(std::mt19937_64 &rng, int max_depth)
+{
+    std::unique_ptr<Node> root(new Node());
+    grow(*root, rng, 0, max_depth);
+    return root;
+}
+
+// the packed tree has the same child masks as the tree it came from
+void checkPacked(NodeCursor node, PackedCursor packed)
+{
+    CHECK(node.valid() == packed.valid());
+    if (!node.valid() || !packed.valid())
+        return;
+    CHECK(node.isLeaf() == packed.isLeaf());
+    for (int label=0;label<4;++label) {
+        auto l = (polycover::labeled_tree::ChildLabel) label;
+        CHECK(node.child(l).valid() == packed.child(l).valid());
+        if (node.child(l).valid())
+            checkPacked(node.child(l), packed.child(l));
+    }
+}
+
+// sorted, disjoint and the same from a Node or from its packed form
+void checkIntervals(const IntervalMask &intervals, const IntervalMask &from_packed)
+{
+    CHECK(intervals.begins == from_packed.begins);
+    CHECK(intervals.ends == from_packed.ends);
+    CHECK(intervals.begins.size() == intervals.ends.size());
+    for (std::size_t i=0;i<intervals.size();++i) {
+        CHECK(intervals.begins[i] < intervals.ends[i]);
+        if (i > 0)
+            CHECK(intervals.ends[i-1] <= intervals.begins[i]);
+    }
+}
+
+void checkWalks(Tree &tree, const Node &mask, const PackedTree &packed, int levels)
+{
+    Visits expected;
+    nodeWalk(tree.getRoot(), AddressType(), NodeCursor(&mask), expected);
+    expected = sorted(expected);
+
+    Recorder packed_recorder;
+    tree.visitExistingTreeLeaves(packed.root(levels), packed_recorder);
+    CHECK(sorted(packed_recorder.visits) == expected);
+
+    IntervalMask intervals { NodeCursor(&mask) };
+    checkIntervals(intervals, IntervalMask(packed.root(levels)));
+
+    Recorder interval_recorder;
+    tree.visitExistingTreeLeaves(intervals, interval_recorder);
+    CHECK(sorted(interval_recorder.visits) == expected);
+}
+
+void testWalks(std::mt19937_64 &rng, int num_points, int max_depth)
+{
+    Tree tree;
+    fill(tree, rng, num_points);
+
+    auto mask = randomMask(rng, max_depth);
+
+    uint64_t num_nodes = 0;
+    std::string data = PackedTree::pack(*mask, num_nodes);
+    CHECK(data.size() == PackedTree::bytes(num_nodes));
+    PackedTree packed(num_nodes, data.data());
+    checkPacked(NodeCursor(mask.get()), packed.root());
+
+    checkWalks(tree, *mask, packed, 0);
+
+    // trimmed as a region query at a given level would
+    for (int levels: { 1, 2, 4 }) {
+        std::unique_ptr<Node> trimmed(new Node());
+        // copy of the mask through its packed form
+        std::vector<std::pair<Node*, PackedCursor>> stack { { trimmed.get(), packed.root() } };
+        while (!stack.empty()) {
+            auto item = stack.back();
+            stack.pop_back();
+            for (int label=0;label<4;++label) {
+                auto child = item.second.child((polycover::labeled_tree::ChildLabel) label);
+                if (child.valid())
+                    stack.push_back({ item.first->advance((polycover::labeled_tree::ChildLabel) label), child });
+            }
+        }
+        trimmed->trim(levels);
+        checkWalks(tree, *trimmed, packed, levels);
+    }
+}
+
+// masks written to a store come back as the same packed trees
+void testStore(std::mt19937_64 &rng)
+{
+    std::vector<std::unique_ptr<Node>> masks;
+    std::vector<mask_store::Mask> input;
+    for (int i=0;i<20;++i) {
+        masks.push_back(randomMask(rng, 1 + i % 8));
+        mask_store::Mask m;
+        m.name   = "region/" + std::to_string(19 - i);
+        m.packed = PackedTree::pack(*masks.back(), m.num_nodes);
+        input.push_back(m);
+    }
+
+    std::string path = "test_masks.store";
+    mask_store::MaskStore::write(path, input);
+
+    mask_store::MaskStore store;
+    store.open(path);
+    CHECK(store.size() == input.size());
+    for (std::size_t i=0;i<input.size();++i) {
+        auto packed = store.find(input[i].name);
+        CHECK(packed != nullptr);
+        if (packed) {
+            CHECK(packed->numNodes() == input[i].num_nodes);
+            checkPacked(NodeCursor(masks[i].get()), packed->root());
+        }
+    }
+    CHECK(store.find("region/20") == nullptr);
+    std::remove(path.c_str());
+}
+
+} // anonymous namespace
+
+int main()
+{
+    std::mt19937_64 rng(22);
+
+    for (int i=0;i<40;++i)
+        testWalks(rng, 50 + 100 * i, 1 + i % (LEVELS + 3));
+
+    testStore(rng);
+
+    return checkSummary();
+}
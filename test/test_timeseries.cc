@@ -0,0 +1,212 @@
+//
+// CompressedTimeSeries against TimeSeries: the same additions (in and
+// out of order) must give the same entries and the same window totals,
+// on both the plain and the compressed representations, and a series
+// that reached MAX_NUM_ENTRIES must refuse new time bins untouched.
+//
+
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+#include <boost/mpl/vector.hpp>
+
+#include "TimeSeries.hh"
+#include "CompressedTimeSeries.hh"
+#include "TimeSeriesEntryType.hh"
+
+#include "check.hh"
+
+namespace {
+
+struct u2 { static const int size = 2; };
+struct u4 { static const int size = 4; };
+struct u8 { static const int size = 8; };
+
+using Entry      = nanocube::TimeSeriesEntryType<boost::mpl::vector<u2, u4, u8>>;
+using Plain      = timeseries::TimeSeries<Entry>;
+using Compressed = timeseries::CompressedTimeSeries<Entry>;
+
+using WideEntry  = nanocube::TimeSeriesEntryType<boost::mpl::vector<u4, u4>>;
+using WideSeries = timeseries::CompressedTimeSeries<WideEntry>;
+
+Entry makeEntry(uint64_t t, uint64_t a, uint64_t b)
+{
+    Entry e = Entry();
+    e.set<0>(t);
+    e.set<1>(a);
+    e.set<2>(b);
+    return e;
+}
+
+using Row = std::tuple<uint64_t, uint64_t, uint64_t>;
+
+Row row(const Entry &e)
+{
+    return Row(e.get<0>(), e.get<1>(), e.get<2>());
+}
+
+template <typename Series>
+std::vector<Row> entries(const Series &series)
+{
+    std::vector<Row> result;
+    series.forEachEntry([&result](const Entry &e) { result.push_back(row(e)); });
+    return result;
+}
+
+template <int Index, typename Series>
+std::vector<std::pair<uint32_t, uint64_t>> totals(const Series &series, uint64_t base, uint64_t width, uint32_t count)
+{
+    std::vector<std::pair<uint32_t, uint64_t>> result;
+    series.template visitWindowTotals<Index>(base, width, count, [&result](uint32_t i, uint64_t value) {
+        result.push_back({ i, value });
+    });
+    return result;
+}
+
+template <typename Series>
+std::vector<std::tuple<uint32_t, Row, Row>> bins(const Series &series, uint64_t base, uint64_t width, uint32_t count)
+{
+    std::vector<std::tuple<uint32_t, Row, Row>> result;
+    series.visitWindowBins(base, width, count, [&result](uint32_t i, const Entry &before, const Entry &last) {
+        result.push_back(std::make_tuple(i, row(before), row(last)));
+    });
+    return result;
+}
+
+void compare(const Plain &plain, const Compressed &compressed, std::mt19937_64 &rng)
+{
+    CHECK(plain.size() == compressed.size());
+    CHECK(entries(plain) == entries(compressed));
+    CHECK(row(plain.front()) == row(compressed.front()));
+    CHECK(row(plain.back()) == row(compressed.back()));
+
+    std::uniform_int_distribution<uint64_t> time(0, 0x10000);
+    for (int k=0;k<50;++k) {
+        uint64_t a = time(rng);
+        uint64_t b = time(rng);
+        if (a > b)
+            std::swap(a, b);
+        CHECK(plain.getWindowTotal<1>(a, b) == compressed.getWindowTotal<1>(a, b));
+        CHECK(plain.getWindowTotal<2>(a, b) == compressed.getWindowTotal<2>(a, b));
+    }
+
+    std::uniform_int_distribution<uint64_t> width(1, 4000);
+    std::uniform_int_distribution<uint32_t> count(1, 64);
+    for (int k=0;k<20;++k) {
+        uint64_t base = time(rng);
+        uint64_t w    = width(rng);
+        uint32_t c    = count(rng);
+        CHECK((totals<1>(plain, base, w, c) == totals<1>(compressed, base, w, c)));
+        CHECK((totals<2>(plain, base, w, c) == totals<2>(compressed, base, w, c)));
+        CHECK(bins(plain, base, w, c) == bins(compressed, base, w, c));
+    }
+}
+
+// increasing, repeated and out of order time bins with values of every
+// size, so that deltas take from one to ten bytes
+void testRoundTrip(uint32_t num_adds, uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<int>      kind(0, 9);
+    std::uniform_int_distribution<uint64_t> gap(1, 12);
+    std::uniform_int_distribution<uint64_t> long_gap(1, 3000);
+    std::uniform_int_distribution<int>      bits(0, 64);
+
+    Plain      plain;
+    Compressed compressed;
+
+    uint64_t t = 0;
+    for (uint32_t i=0;i<num_adds;++i) {
+        uint64_t entry_time;
+        int k = kind(rng);
+        if (k < 6 || plain.size() == 0) {
+            t = std::min<uint64_t>(t + (k == 0 ? long_gap(rng) : gap(rng)), 0xFFFF);
+            entry_time = t;
+        }
+        else if (k < 8) {
+            entry_time = t; // same bin as the last entry
+        }
+        else {
+            entry_time = std::uniform_int_distribution<uint64_t>(0, t)(rng); // out of order
+        }
+        int b = bits(rng);
+        uint64_t value = rng() & (b == 64 ? ~0ULL : ((1ULL << b) - 1));
+        Entry e = makeEntry(entry_time, value, value);
+        plain.add(e);
+        compressed.add(e);
+        if (i % 97 == 0 || i + 1 == num_adds || plain.size() == Compressed::THRESHOLD + 1)
+            compare(plain, compressed, rng);
+    }
+}
+
+// a full series keeps its entries when a new time bin is refused
+void testMaxEntries()
+{
+    const uint32_t n = WideSeries::MAX_NUM_ENTRIES;
+
+    WideSeries series;
+    for (uint32_t i=0;i<n;++i) {
+        WideEntry e = WideEntry();
+        e.set<0>(2 * i);
+        e.set<1>(1);
+        series.add(e);
+    }
+    CHECK(series.size() == n);
+    CHECK(series.back().get<1>() == n);
+
+    auto add = [&series](uint64_t t) {
+        WideEntry e = WideEntry();
+        e.set<0>(t);
+        e.set<1>(1);
+        try {
+            series.add(e);
+        }
+        catch (const std::runtime_error &) {
+            return false;
+        }
+        return true;
+    };
+
+    CHECK(!add(2 * n));     // after the last entry
+    CHECK(!add(1));         // out of order
+    CHECK(series.size() == n);
+    CHECK(series.back().get<0>() == 2 * (n - 1));
+    CHECK(series.back().get<1>() == n);
+    CHECK(series.getWindowTotal<1>(0, 2 * n) == n);
+
+    CHECK(add(2 * (n - 1))); // existing bins still accumulate
+    CHECK(add(0));
+    CHECK(series.size() == n);
+    CHECK(series.getWindowTotal<1>(0, 2 * n) == n + 2);
+    CHECK(series.getWindowTotal<1>(0, 1) == 2);
+
+    std::vector<WideEntry> too_many(n + 1);
+    for (uint32_t i=0;i<=n;++i)
+        too_many[i].set<0>(i);
+    bool thrown = false;
+    try {
+        series.assign(too_many);
+    }
+    catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(series.size() == n);
+}
+
+} // anonymous namespace
+
+int main()
+{
+    testRoundTrip(Compressed::THRESHOLD, 1);        // plain only
+    testRoundTrip(4 * Compressed::THRESHOLD, 2);    // converted
+    testRoundTrip(5000, 3);
+    testRoundTrip(5000, 4);
+    testMaxEntries();
+
+    return checkSummary();
+}